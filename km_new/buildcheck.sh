@@ -0,0 +1,68 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+# buildcheck.sh – build the module against other kernel trees
+#
+# Usage :  ./buildcheck.sh <kernel build dir>...   (or make buildcheck KDIRS="...")
+#
+# Several features are compiled in only from some kernel version on, so a
+# build on one kernel says little about the others. Each tree gets a clean
+# build in a scratch copy of the sources, and then the module's imports
+# must show that every feature the tree supports was compiled in. The
+# BPF region kfunc needs 6.0 with CONFIG_BPF_SYSCALL and
+# CONFIG_DEBUG_INFO_BTF_MODULES, the fprobe hook 6.3 with CONFIG_FPROBE.
+
+set -u
+
+src=$(cd "$(dirname "$0")" && pwd)
+failed=0
+
+# major * 100 + minor of a configured tree
+tree_version() {
+    sed -n 's/^\([0-9]*\)\.\([0-9]*\).*/\1 \2/p' "$1/include/config/kernel.release" 2>/dev/null |
+        { read -r major minor && echo $((major * 100 + minor)); }
+}
+
+has_config() {
+    grep -q "^$2=y" "$1/.config"
+}
+
+# check <what> <symbol the module must import>
+check() {
+    if nm -u "$work/drm_fb_pixel_extractor.ko" | grep -qw "$2"; then
+        echo "  ok    $1"
+    else
+        echo "  FAIL  $1: $2 is not imported, so it was not built"
+        failed=1
+    fi
+}
+
+for kdir in "$@"; do
+    ver=$(tree_version "$kdir")
+    if [ -z "$ver" ] || [ ! -f "$kdir/.config" ]; then
+        echo "$kdir: not a configured kernel tree"
+        failed=1
+        continue
+    fi
+    echo "=== $kdir ($(cat "$kdir/include/config/kernel.release"))"
+
+    work=$(mktemp -d)
+    cp "$src"/*.c "$src"/*.h "$src/Makefile" "$work"/
+    if ! make -s -C "$kdir" M="$work" modules; then
+        echo "  FAIL  build"
+        failed=1
+        rm -rf "$work"
+        continue
+    fi
+    echo "  ok    build"
+
+    if [ "$ver" -ge 600 ] && has_config "$kdir" CONFIG_BPF_SYSCALL &&
+       has_config "$kdir" CONFIG_DEBUG_INFO_BTF_MODULES; then
+        check "BPF region kfunc" register_btf_kfunc_id_set
+    fi
+    if [ "$ver" -ge 603 ] && has_config "$kdir" CONFIG_FPROBE; then
+        check "fprobe hook" register_fprobe
+    fi
+    rm -rf "$work"
+done
+
+exit $failed
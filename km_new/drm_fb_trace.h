@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0
+// Trace events of the DRM framebuffer pixel extractor
+//
+//   echo 1 > /sys/kernel/tracing/events/drm_fb/enable
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM drm_fb
+
+#if !defined(_DRM_FB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DRM_FB_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// What the overhead guard did, see "Overhead guard" in kernel.c
+#define FB_GUARD_HOOK       1   // probe handler over guard_hook_us, hook silenced
+#define FB_GUARD_METADATA   2   // copy over guard_call_us, shape captured metadata-only
+#define FB_GUARD_SKIP       3   // over guard_sec_us, captures skipped for the second
+
+TRACE_EVENT(drm_fb_guard,
+    TP_PROTO(int action, u32 width, u32 height, u32 format, u64 modifier,
+             u64 cost_ns, u64 budget_ns),
+    TP_ARGS(action, width, height, format, modifier, cost_ns, budget_ns),
+
+    TP_STRUCT__entry(
+        __field(int, action)
+        __field(u32, width)
+        __field(u32, height)
+        __field(u32, format)
+        __field(u64, modifier)
+        __field(u64, cost_ns)
+        __field(u64, budget_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->action = action;
+        __entry->width = width;
+        __entry->height = height;
+        __entry->format = format;
+        __entry->modifier = modifier;
+        __entry->cost_ns = cost_ns;
+        __entry->budget_ns = budget_ns;
+    ),
+
+    TP_printk("%s %ux%u format=0x%08x modifier=0x%llx cost=%llu ns budget=%llu ns",
+              __print_symbolic(__entry->action,
+                               { FB_GUARD_HOOK, "hook-silenced" },
+                               { FB_GUARD_METADATA, "metadata-only" },
+                               { FB_GUARD_SKIP, "skipped" }),
+              __entry->width, __entry->height, __entry->format, __entry->modifier,
+              __entry->cost_ns, __entry->budget_ns)
+);
+
+// A display turned harmful or cleared, see "Flash screening" in kernel.c
+TRACE_EVENT(drm_fb_flash,
+    TP_PROTO(u32 dev_minor, u32 width, u32 height, bool harmful, u32 window_flashes,
+             u32 flashed, u64 latency_ns),
+    TP_ARGS(dev_minor, width, height, harmful, window_flashes, flashed, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(u32, dev_minor)
+        __field(u32, width)
+        __field(u32, height)
+        __field(bool, harmful)
+        __field(u32, window_flashes)
+        __field(u32, flashed)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_minor = dev_minor;
+        __entry->width = width;
+        __entry->height = height;
+        __entry->harmful = harmful;
+        __entry->window_flashes = window_flashes;
+        __entry->flashed = flashed;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("minor=%u %ux%u %s flashes=%u flashed=%u px latency=%llu ns",
+              __entry->dev_minor, __entry->width, __entry->height,
+              __entry->harmful ? "harmful" : "clear", __entry->window_flashes,
+              __entry->flashed, __entry->latency_ns)
+);
+
+#endif /* _DRM_FB_TRACE_H */
+
+// Outside the guard: define_trace.h reads this file again
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE drm_fb_trace
+#include <trace/define_trace.h>
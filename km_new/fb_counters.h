@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+/* fb_counters.h – layout of /proc/drm_fb_counters
+ *
+ * One fixed-size record of the module's running totals, read whole by
+ * fb_exporter: captures taken, skipped and lost, bytes copied, hook and
+ * render-wait counts, captures per quality level, flash screening totals,
+ * a latency histogram per capture stage, and how long the ring's writer
+ * and raw readers waited for and held the ring lock. Everything counts up
+ * from module load, so rates are differences between two reads.
+ *
+ * Histograms have power-of-two buckets in microseconds: bucket i counts
+ * values below 2^i us, the last one everything above. The same buckets
+ * serve the analyzer's counters (flash_counters.h).
+ */
+#ifndef FB_COUNTERS_H
+#define FB_COUNTERS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#else
+#include <stdint.h>
+#endif
+
+#define FB_COUNTERS_MAGIC       0x43424644u     /* 'DFBC' */
+#define FB_COUNTERS_VERSION     2
+#define FB_COUNTERS_BUCKETS     22              /* < 1 us ... < 2^20 us (~1 s), then the rest */
+#define FB_COUNTERS_LEVELS      5               /* enum fb_quality */
+
+enum fb_stage {
+    FB_STAGE_RENDER,        /* drm_framebuffer_init() returned -> rendering complete */
+    FB_STAGE_QUEUE,         /* rendering complete -> worker started the capture */
+    FB_STAGE_CAPTURE,       /* copy and detile, as charged to the CPU budget */
+    FB_STAGE_DETILE,        /* of which detiling (staged captures only) */
+    FB_STAGE_COUNT
+};
+
+enum fb_ring_side {
+    FB_RING_WRITER,         /* captures, real or injected */
+    FB_RING_READER,         /* read() calls on /proc/drm_fb_raw */
+    FB_RING_SIDES
+};
+
+struct fb_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t bucket[FB_COUNTERS_BUCKETS];
+};
+
+/* The published record: 1752 bytes, little-endian, no pointers. */
+struct fb_counters {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t stages;                /* FB_STAGE_COUNT */
+    uint32_t buckets;               /* FB_COUNTERS_BUCKETS */
+    uint32_t levels;                /* FB_COUNTERS_LEVELS */
+    uint64_t loaded_ns;             /* CLOCK_MONOTONIC at module load */
+    uint64_t captured;              /* captures recorded in the ring, pixels or not */
+    uint64_t with_pixels;           /* ... that hold pixels */
+    uint64_t failed;                /* ... whose copy failed, metadata kept */
+    uint64_t skipped;               /* not captured: policy, quality level or guard */
+    uint64_t metadata_only;         /* left without pixels by the overhead guard */
+    uint64_t unread;                /* replaced in the ring before /proc/drm_fb_raw read them */
+    uint64_t bytes_copied;          /* into capture buffers */
+    uint64_t hook_calls;
+    uint64_t hook_silenced;         /* probe calls over guard_hook_us */
+    uint64_t render_waits;          /* captures that waited for a render fence */
+    uint64_t render_errors;
+    uint64_t quality_captures[FB_COUNTERS_LEVELS];
+    uint64_t quality_steps_down, quality_steps_up;
+    uint64_t screen_frames;         /* flash screening, all displays */
+    uint64_t screen_flashes;
+    uint64_t screen_alarms;
+    uint64_t injected;              /* synthetic captures, see inject_hz */
+    uint64_t exported;              /* captures handed out as dma-bufs (fb_export.h) */
+    uint64_t reserved[1];
+    struct fb_hist stage[FB_STAGE_COUNT];
+    struct fb_hist lock_wait[FB_RING_SIDES];
+    struct fb_hist lock_hold[FB_RING_SIDES];
+};
+
+/* Histogram bucket of a value in nanoseconds. */
+static inline unsigned int fb_hist_bucket(uint64_t ns)
+{
+#ifdef __KERNEL__
+    unsigned int b = fls64(div_u64(ns, 1000));
+#else
+    uint64_t us = ns / 1000;
+    unsigned int b = us ? 64 - __builtin_clzll(us) : 0;
+#endif
+
+    return b < FB_COUNTERS_BUCKETS ? b : FB_COUNTERS_BUCKETS - 1;
+}
+
+static inline void fb_hist_add(struct fb_hist *h, uint64_t ns)
+{
+    h->count++;
+    h->sum_ns += ns;
+    h->bucket[fb_hist_bucket(ns)]++;
+}
+
+#endif /* FB_COUNTERS_H */
@@ -0,0 +1,797 @@
+// SPDX-License-Identifier: MIT
+/* fb_delta.c – delta-compressed frame history with scroll detection
+ *
+ * Build :  gcc -O2 -c fb_delta.c
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fb_delta.h"
+
+#define FOURCC_XRGB8888 0x34325258u     /* 'XR24' */
+#define MIN_VOTES       8               /* segments that must agree on an offset */
+#define MAX_VERTICAL    8               /* vectors taken from each direction */
+#define MAX_HORIZONTAL  4
+#define SLOT_POSITIONS  4               /* segments seen more often than this do not vote */
+#define HASH_MUL        0x9e3779b97f4a7c15ull
+#define COLUMN_SALT     0xff51afd7ed558ccdull
+#define BLOCK_PIXELS    (FBD_BLOCK * FBD_BLOCK)
+#define PATCH_COLUMNS   8               /* columns per horizontal-motion patch */
+
+struct fbd_slot {
+    uint64_t key;                       /* 0 = empty */
+    uint32_t count;
+    uint32_t pos[SLOT_POSITIONS];
+};
+
+static inline uint64_t mix(uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * HASH_MUL;
+    return h ^ (h >> 29);
+}
+
+static inline unsigned min_u(unsigned a, unsigned b)
+{
+    return a < b ? a : b;
+}
+
+static inline uint32_t px_at(const uint8_t *f, unsigned w, unsigned x, unsigned y)
+{
+    uint32_t v;
+
+    memcpy(&v, f + ((size_t)y * w + x) * 4, 4);
+    return v;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Segment hashes */
+
+/* out[bx * h + y]: the 16-pixel segment of row y in block column bx; 0 if flat. */
+static void hash_rows(const uint8_t *px, unsigned w, unsigned h, uint64_t *out)
+{
+    const unsigned nbx = (w + FBD_BLOCK - 1) / FBD_BLOCK;
+
+    for (unsigned y = 0; y < h; y++) {
+        const uint32_t *row = (const uint32_t *)(px + (size_t)y * w * 4);
+
+        for (unsigned bx = 0; bx < nbx; bx++) {
+            const unsigned x0 = bx * FBD_BLOCK, x1 = min_u(x0 + FBD_BLOCK, w);
+            uint32_t diff = 0;
+            uint64_t hs = bx;
+
+            for (unsigned x = x0; x < x1; x++) {
+                diff |= row[x] ^ row[x0];
+                hs = mix(hs, row[x]);
+            }
+            out[(size_t)bx * h + y] = diff ? hs | 1 : 0;
+        }
+    }
+}
+
+/*
+ * out[by * w + x]: the PATCH_COLUMNS x 16 patch at column x of block row by;
+ * 0 if flat. A single column of text repeats too often to place a match.
+ */
+static void hash_cols(const uint8_t *px, unsigned w, unsigned h, uint64_t *out,
+                      uint32_t *diff)
+{
+    for (unsigned by = 0; by * FBD_BLOCK < h; by++) {
+        const unsigned y0 = by * FBD_BLOCK, y1 = min_u(y0 + FBD_BLOCK, h);
+        const uint32_t *first = (const uint32_t *)(px + (size_t)y0 * w * 4);
+        uint64_t *hs = out + (size_t)by * w;
+
+        for (unsigned x = 0; x < w; x++) {
+            hs[x] = by ^ COLUMN_SALT;
+            diff[x] = 0;
+        }
+        /* Row by row, so the frame is read in order. */
+        for (unsigned y = y0; y < y1; y++) {
+            const uint32_t *row = (const uint32_t *)(px + (size_t)y * w * 4);
+
+            for (unsigned x = 0; x < w; x++) {
+                diff[x] |= row[x] ^ first[x];
+                hs[x] = mix(hs[x], row[x]);
+            }
+        }
+        for (unsigned x = 0; x < w; x++)
+            hs[x] = diff[x] ? hs[x] : 0;
+        /* In place: patch x only needs columns x and up. */
+        for (unsigned x = 0; x < w; x++) {
+            uint64_t patch = 0, any = 0;
+
+            for (unsigned c = x; c < x + PATCH_COLUMNS && x + PATCH_COLUMNS <= w; c++) {
+                patch = mix(patch, hs[c]);
+                any |= hs[c];
+            }
+            hs[x] = any ? patch | 1 : 0;
+        }
+    }
+}
+
+/* Motion search */
+
+static void table_insert(struct fbd_writer *w, uint64_t key, uint32_t pos)
+{
+    size_t i = (key * HASH_MUL >> 32) & w->table_mask;
+    struct fbd_slot *slot;
+
+    while (w->table[i].key && w->table[i].key != key)
+        i = (i + 1) & w->table_mask;
+    slot = &w->table[i];
+    slot->key = key;
+    if (slot->count < SLOT_POSITIONS)
+        slot->pos[slot->count] = pos;
+    slot->count++;
+}
+
+static const struct fbd_slot *table_find(const struct fbd_writer *w, uint64_t key)
+{
+    size_t i = (key * HASH_MUL >> 32) & w->table_mask;
+
+    while (w->table[i].key) {
+        if (w->table[i].key == key)
+            return &w->table[i];
+        i = (i + 1) & w->table_mask;
+    }
+    return NULL;
+}
+
+/*
+ * Segments of one kind, in lines of len positions: prev[l * len + p]. Every
+ * changed segment of cur votes for the offsets to the places on its line
+ * where prev has it, unless that is more than SLOT_POSITIONS places.
+ * votes[off + len - 1] counts offset off.
+ */
+static void vote(struct fbd_writer *w, const uint64_t *prev, const uint64_t *cur,
+                 unsigned lines, unsigned len, uint32_t *votes)
+{
+    const size_t n = (size_t)lines * len;
+
+    memset(w->table, 0, (w->table_mask + 1) * sizeof(*w->table));
+    memset(votes, 0, (2 * (size_t)len - 1) * sizeof(*votes));
+    for (size_t i = 0; i < n; i++) {
+        if (prev[i])
+            table_insert(w, prev[i], i % len);
+    }
+    for (size_t i = 0; i < n; i++) {
+        const struct fbd_slot *slot;
+
+        if (!cur[i] || cur[i] == prev[i])
+            continue;
+        slot = table_find(w, cur[i]);
+        if (!slot || slot->count > SLOT_POSITIONS)
+            continue;
+        for (uint32_t k = 0; k < slot->count; k++)
+            votes[i % len - slot->pos[k] + len - 1]++;
+    }
+}
+
+/* Up to max best-supported nonzero offsets, most votes first. */
+static unsigned pick(uint32_t *votes, unsigned len, int *off, unsigned max)
+{
+    unsigned n = 0;
+
+    votes[len - 1] = 0;
+    while (n < max) {
+        unsigned best = 0;
+
+        for (unsigned i = 1; i < 2 * len - 1; i++) {
+            if (votes[i] > votes[best])
+                best = i;
+        }
+        if (votes[best] < MIN_VOTES)
+            break;
+        off[n++] = (int)best - (int)(len - 1);
+        votes[best] = 0;
+    }
+    return n;
+}
+
+static unsigned find_motions(struct fbd_writer *w, const uint64_t *rows, const uint64_t *cols,
+                             struct fbd_motion *mv)
+{
+    const unsigned width = w->width, height = w->height;
+    const unsigned nbx = (width + FBD_BLOCK - 1) / FBD_BLOCK;
+    const unsigned nby = (height + FBD_BLOCK - 1) / FBD_BLOCK;
+    int dy[MAX_VERTICAL], dx[MAX_HORIZONTAL];
+    unsigned n = 1, nv, nh;
+
+    mv[0] = (struct fbd_motion){ 0, 0 };
+    vote(w, w->row_hash[!w->cur], rows, nbx, height, w->votes);
+    nv = pick(w->votes, height, dy, MAX_VERTICAL);
+    vote(w, w->col_hash[!w->cur], cols, nby, width, w->votes);
+    nh = pick(w->votes, width, dx, MAX_HORIZONTAL);
+
+    for (unsigned i = 0; i < nv; i++)
+        mv[n++] = (struct fbd_motion){ 0, (int16_t)dy[i] };
+    for (unsigned i = 0; i < nh; i++)
+        mv[n++] = (struct fbd_motion){ (int16_t)dx[i], 0 };
+    return n;
+}
+
+/* Block coding */
+
+struct block {
+    unsigned x, y, w, h;
+};
+
+static int source_inside(const struct block *b, const struct fbd_motion *m, unsigned width,
+                         unsigned height)
+{
+    long sx = (long)b->x - m->dx, sy = (long)b->y - m->dy;
+
+    return sx >= 0 && sy >= 0 && sx + b->w <= width && sy + b->h <= height;
+}
+
+static int block_equal(const uint8_t *cur, const uint8_t *prev, unsigned width,
+                       const struct block *b, const struct fbd_motion *m)
+{
+    for (unsigned r = 0; r < b->h; r++) {
+        if (memcmp(cur + ((size_t)(b->y + r) * width + b->x) * 4,
+                   prev + ((size_t)(b->y + r - m->dy) * width + b->x - m->dx) * 4, b->w * 4))
+            return 0;
+    }
+    return 1;
+}
+
+/* Prediction of the block: from prev through m, or intra when m is NULL. */
+static void predict(uint32_t *pred, const uint8_t *cur, const uint8_t *prev, unsigned width,
+                    const struct block *b, const struct fbd_motion *m)
+{
+    for (unsigned r = 0; r < b->h; r++) {
+        const unsigned y = b->y + r;
+
+        if (m) {
+            memcpy(pred + r * b->w, prev + ((size_t)(y - m->dy) * width + b->x - m->dx) * 4,
+                   b->w * 4);
+            continue;
+        }
+        for (unsigned c = 0; c < b->w; c++) {
+            const unsigned x = b->x + c;
+
+            pred[r * b->w + c] = x ? px_at(cur, width, x - 1, y) :
+                                 y ? px_at(cur, width, x, y - 1) : 0;
+        }
+    }
+}
+
+/* Pixels of the block that differ from pred, giving up past limit. */
+static unsigned residual_pixels(const uint32_t *pred, const uint8_t *cur, unsigned width,
+                                const struct block *b, unsigned limit)
+{
+    unsigned n = 0;
+
+    for (unsigned r = 0; r < b->h && n <= limit; r++) {
+        for (unsigned c = 0; c < b->w; c++)
+            n += px_at(cur, width, b->x + c, b->y + r) != pred[r * b->w + c];
+    }
+    return n;
+}
+
+static uint8_t *put_residual(uint8_t *out, const uint32_t *pred, const uint8_t *cur,
+                             unsigned width, const struct block *b)
+{
+    uint32_t v[BLOCK_PIXELS];
+    const unsigned n = b->w * b->h;
+
+    for (unsigned r = 0; r < b->h; r++) {
+        for (unsigned c = 0; c < b->w; c++)
+            v[r * b->w + c] = px_at(cur, width, b->x + c, b->y + r) ^ pred[r * b->w + c];
+    }
+    for (unsigned i = 0; i < n; ) {
+        uint16_t zeros = 0, lits = 0;
+
+        while (i < n && !v[i])
+            i++, zeros++;
+        while (i + lits < n && v[i + lits])
+            lits++;
+        memcpy(out, &zeros, 2);
+        memcpy(out + 2, &lits, 2);
+        memcpy(out + 4, v + i, lits * 4);
+        out += 4 + lits * 4;
+        i += lits;
+    }
+    return out;
+}
+
+/* Writer */
+
+int fbd_create(struct fbd_writer *w, const char *path, unsigned width, unsigned height,
+               unsigned keyint, int motion)
+{
+    const size_t pixels = (size_t)width * height;
+    const size_t blocks = (size_t)((width + FBD_BLOCK - 1) / FBD_BLOCK) *
+                          ((height + FBD_BLOCK - 1) / FBD_BLOCK);
+    size_t segments = blocks * FBD_BLOCK, table = 1;
+    struct fbd_header hdr;
+    int ret;
+
+    if (!width || !height || width > INT16_MAX || height > INT16_MAX)
+        return -EINVAL;
+
+    memset(w, 0, sizeof(*w));
+    w->width = width;
+    w->height = height;
+    w->keyint = keyint ? keyint : FBD_DEFAULT_KEYINT;
+    w->motion = motion;
+    w->offset = sizeof(hdr);
+    while (table < 2 * segments)
+        table <<= 1;
+    w->table_mask = table - 1;
+    /* Worst case per block: every other pixel a literal, 4 bytes per run. */
+    w->out_cap = sizeof(struct fbd_frame_header) +
+                 FBD_MAX_MOTIONS * sizeof(struct fbd_motion) + blocks + pixels * 6 + blocks * 8;
+
+    w->prev = malloc(pixels * 4);
+    w->out = malloc(w->out_cap);
+    w->table = malloc(table * sizeof(*w->table));
+    w->votes = malloc((2 * (size_t)(width > height ? width : height)) * sizeof(*w->votes));
+    w->scratch = malloc((size_t)width * sizeof(*w->scratch));
+    for (int i = 0; i < 2; i++) {
+        w->row_hash[i] = malloc(segments * sizeof(uint64_t));
+        w->col_hash[i] = malloc(segments * sizeof(uint64_t));
+    }
+    if (!w->prev || !w->out || !w->table || !w->votes || !w->scratch || !w->row_hash[0] ||
+        !w->row_hash[1] || !w->col_hash[0] || !w->col_hash[1]) {
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        ret = -errno;
+        goto err;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FBD_MAGIC, sizeof(hdr.magic));
+    hdr.version = FBD_VERSION;
+    hdr.block = FBD_BLOCK;
+    hdr.width = width;
+    hdr.height = height;
+    hdr.format = FOURCC_XRGB8888;
+    hdr.keyint = w->keyint;
+    ret = pwrite_all(w->fd, &hdr, sizeof(hdr), 0);
+    if (ret) {
+        close(w->fd);
+        goto err;
+    }
+    return 0;
+
+err:
+    w->fd = -1;
+    fbd_finish(w);
+    return ret;
+}
+
+int fbd_append(struct fbd_writer *w, const uint8_t *px, uint64_t timestamp_ns,
+               uint64_t sequence)
+{
+    const unsigned width = w->width, height = w->height;
+    const int key = w->count % w->keyint == 0;
+    uint64_t *rows = w->row_hash[w->cur], *cols = w->col_hash[w->cur];
+    struct fbd_motion mv[FBD_MAX_MOTIONS];
+    struct fbd_frame_header fh = {
+        .magic = FBD_FRAME_MAGIC,
+        .flags = key ? FBD_FRAME_KEY : 0,
+        .sequence = sequence,
+        .timestamp_ns = timestamp_ns,
+    };
+    uint8_t *map, *res;
+    unsigned n = 0, i = 0;
+    int ret;
+
+    if (w->count == w->index_cap) {
+        size_t cap = w->index_cap ? w->index_cap * 2 : 1024;
+        uint64_t *index = realloc(w->index, cap * sizeof(*index));
+
+        if (!index)
+            return -ENOMEM;
+        w->index = index;
+        w->index_cap = cap;
+    }
+
+    if (w->motion) {
+        hash_rows(px, width, height, rows);
+        hash_cols(px, width, height, cols, w->scratch);
+    }
+    if (!key)
+        n = w->motion ? find_motions(w, rows, cols, mv) : 1;
+    if (!key && !w->motion)
+        mv[0] = (struct fbd_motion){ 0, 0 };
+
+    fh.motions = n;
+    memcpy(w->out + sizeof(fh), mv, n * sizeof(*mv));
+    map = w->out + sizeof(fh) + n * sizeof(*mv);
+    res = map + ((width + FBD_BLOCK - 1) / FBD_BLOCK) * ((height + FBD_BLOCK - 1) / FBD_BLOCK);
+
+    for (unsigned y = 0; y < height; y += FBD_BLOCK) {
+        for (unsigned x = 0; x < width; x += FBD_BLOCK, i++) {
+            const struct block b = { x, y, min_u(FBD_BLOCK, width - x),
+                                     min_u(FBD_BLOCK, height - y) };
+            uint32_t pred[BLOCK_PIXELS];
+            unsigned m, best = FBD_INTRA, cost;
+
+            for (m = 0; m < n; m++) {
+                if (source_inside(&b, &mv[m], width, height) &&
+                    block_equal(px, w->prev, width, &b, &mv[m]))
+                    break;
+            }
+            if (m < n) {
+                map[i] = m;
+                if (m)
+                    w->stats.blocks_moved++;
+                else
+                    w->stats.blocks_same++;
+                continue;
+            }
+
+            /* No exact copy: the prediction that leaves the fewest pixels to fix. */
+            predict(pred, px, w->prev, width, &b, NULL);
+            cost = residual_pixels(pred, px, width, &b, BLOCK_PIXELS);
+            for (m = 0; m < n && cost; m++) {
+                unsigned c;
+
+                if (!source_inside(&b, &mv[m], width, height))
+                    continue;
+                predict(pred, px, w->prev, width, &b, &mv[m]);
+                c = residual_pixels(pred, px, width, &b, cost);
+                if (c < cost) {
+                    cost = c;
+                    best = m;
+                }
+            }
+            predict(pred, px, w->prev, width, &b, best == FBD_INTRA ? NULL : &mv[best]);
+            map[i] = FBD_RESIDUAL | best;
+            res = put_residual(res, pred, px, width, &b);
+            fh.residual_blocks++;
+            if (best == FBD_INTRA)
+                w->stats.blocks_intra++;
+            else
+                w->stats.blocks_residual++;
+        }
+    }
+
+    fh.payload_size = res - w->out - sizeof(fh);
+    memcpy(w->out, &fh, sizeof(fh));
+    ret = pwrite_all(w->fd, w->out, res - w->out, w->offset);
+    if (ret)
+        return ret;
+
+    w->index[w->count++] = w->offset;
+    w->offset += res - w->out;
+    w->stats.frames++;
+    w->stats.keyframes += key;
+    w->stats.bytes += res - w->out;
+    memcpy(w->prev, px, (size_t)width * height * 4);
+    w->cur = !w->cur;
+    return 0;
+}
+
+int fbd_finish(struct fbd_writer *w)
+{
+    int ret = 0;
+
+    if (w->fd >= 0) {
+        const uint64_t index_offset = w->offset;
+
+        ret = pwrite_all(w->fd, w->index, w->count * sizeof(*w->index), index_offset);
+        if (!ret)
+            ret = pwrite_all(w->fd, &w->count, sizeof(w->count),
+                             offsetof(struct fbd_header, count));
+        if (!ret)
+            ret = pwrite_all(w->fd, &index_offset, sizeof(index_offset),
+                             offsetof(struct fbd_header, index_offset));
+        if (!ret && fsync(w->fd))
+            ret = -errno;
+        close(w->fd);
+        w->fd = -1;
+    }
+    free(w->index);
+    free(w->prev);
+    free(w->out);
+    free(w->table);
+    free(w->votes);
+    free(w->scratch);
+    for (int i = 0; i < 2; i++) {
+        free(w->row_hash[i]);
+        free(w->col_hash[i]);
+    }
+    w->index = NULL;
+    w->prev = w->out = NULL;
+    w->table = NULL;
+    w->votes = w->scratch = NULL;
+    memset(w->row_hash, 0, sizeof(w->row_hash));
+    memset(w->col_hash, 0, sizeof(w->col_hash));
+    return ret;
+}
+
+/* Reader */
+
+/* Unfinished file: walk the frames until one doesn't parse. */
+static int rebuild_index(struct fbd_reader *r)
+{
+    uint64_t off = sizeof(*r->hdr), cap = 1024, n = 0;
+
+    r->rebuilt = malloc(cap * sizeof(*r->rebuilt));
+    if (!r->rebuilt)
+        return -ENOMEM;
+    while (off + sizeof(struct fbd_frame_header) <= r->map_size) {
+        const struct fbd_frame_header *fh = (const void *)(r->map + off);
+
+        if (fh->magic != FBD_FRAME_MAGIC ||
+            fh->payload_size > r->map_size - off - sizeof(*fh))
+            break;
+        if (n == cap) {
+            uint64_t *idx = realloc(r->rebuilt, 2 * cap * sizeof(*idx));
+
+            if (!idx)
+                return -ENOMEM;
+            r->rebuilt = idx;
+            cap *= 2;
+        }
+        r->rebuilt[n++] = off;
+        off += sizeof(*fh) + fh->payload_size;
+    }
+    r->index = r->rebuilt;
+    r->count = n;
+    return 0;
+}
+
+int fbd_open(struct fbd_reader *r, const char *path)
+{
+    const size_t min_size = sizeof(struct fbd_header);
+    struct stat st;
+    size_t frame;
+    int ret;
+
+    memset(r, 0, sizeof(*r));
+    r->decoded = -1;
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0)
+        return -errno;
+    if (fstat(r->fd, &st)) {
+        ret = -errno;
+        goto err_close;
+    }
+    if ((size_t)st.st_size < min_size) {
+        ret = -EINVAL;
+        goto err_close;
+    }
+    r->map_size = st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        ret = -errno;
+        goto err_close;
+    }
+    r->hdr = (const void *)r->map;
+    if (memcmp(r->hdr->magic, FBD_MAGIC, sizeof(r->hdr->magic)) ||
+        r->hdr->version != FBD_VERSION || r->hdr->block != FBD_BLOCK ||
+        !r->hdr->width || !r->hdr->height || r->hdr->width > INT16_MAX ||
+        r->hdr->height > INT16_MAX) {
+        ret = -EINVAL;
+        goto err_unmap;
+    }
+
+    if (r->hdr->index_offset) {
+        if (r->hdr->index_offset > r->map_size ||
+            r->hdr->count > (r->map_size - r->hdr->index_offset) / sizeof(*r->index)) {
+            ret = -EINVAL;
+            goto err_unmap;
+        }
+        r->index = (const void *)(r->map + r->hdr->index_offset);
+        r->count = r->hdr->count;
+    } else {
+        ret = rebuild_index(r);
+        if (ret)
+            goto err_unmap;
+    }
+
+    frame = (size_t)r->hdr->width * r->hdr->height * 4;
+    r->frame[0] = calloc(1, frame);
+    r->frame[1] = calloc(1, frame);
+    if (!r->frame[0] || !r->frame[1]) {
+        ret = -ENOMEM;
+        goto err_unmap;
+    }
+    return 0;
+
+err_unmap:
+    free(r->frame[0]);
+    free(r->frame[1]);
+    free(r->rebuilt);
+    munmap((void *)r->map, r->map_size);
+err_close:
+    close(r->fd);
+    memset(r, 0, sizeof(*r));
+    return ret;
+}
+
+void fbd_close(struct fbd_reader *r)
+{
+    if (r->map) {
+        munmap((void *)r->map, r->map_size);
+        close(r->fd);
+    }
+    free(r->rebuilt);
+    free(r->frame[0]);
+    free(r->frame[1]);
+    memset(r, 0, sizeof(*r));
+}
+
+static const struct fbd_frame_header *frame_header(const struct fbd_reader *r, uint64_t i)
+{
+    const uint64_t off = r->index[i];
+    const struct fbd_frame_header *fh;
+
+    if (off > r->map_size || r->map_size - off < sizeof(*fh))
+        return NULL;
+    fh = (const void *)(r->map + off);
+    if (fh->magic != FBD_FRAME_MAGIC || fh->payload_size > r->map_size - off - sizeof(*fh) ||
+        fh->motions > FBD_MAX_MOTIONS)
+        return NULL;
+    return fh;
+}
+
+/* Apply one block's residual runs to out, which already holds the inter prediction. */
+static const uint8_t *get_residual(const uint8_t *p, const uint8_t *end, uint8_t *out,
+                                   unsigned width, const struct block *b, int intra)
+{
+    const unsigned n = b->w * b->h;
+    unsigned i = 0;
+
+    while (i < n) {
+        uint16_t zeros, lits;
+
+        if (end - p < 4)
+            return NULL;
+        memcpy(&zeros, p, 2);
+        memcpy(&lits, p + 2, 2);
+        p += 4;
+        if (!(zeros + lits) || zeros + lits > n - i || (size_t)(end - p) < lits * 4u)
+            return NULL;
+        for (unsigned k = 0; k < zeros + lits; k++, i++) {
+            const unsigned x = b->x + i % b->w, y = b->y + i / b->w;
+            uint8_t *dst = out + ((size_t)y * width + x) * 4;
+            uint32_t v = 0, pred;
+
+            if (k >= zeros) {
+                memcpy(&v, p, 4);
+                p += 4;
+            }
+            if (intra)
+                pred = x ? px_at(out, width, x - 1, y) : y ? px_at(out, width, x, y - 1) : 0;
+            else
+                memcpy(&pred, dst, 4);
+            v ^= pred;
+            memcpy(dst, &v, 4);
+        }
+    }
+    return p;
+}
+
+static int decode(struct fbd_reader *r, uint64_t i)
+{
+    const unsigned width = r->hdr->width, height = r->hdr->height;
+    const size_t blocks = (size_t)((width + FBD_BLOCK - 1) / FBD_BLOCK) *
+                          ((height + FBD_BLOCK - 1) / FBD_BLOCK);
+    const struct fbd_frame_header *fh = frame_header(r, i);
+    const uint8_t *ref = r->frame[0], *map, *p, *end;
+    uint8_t *out = r->frame[1];
+    struct fbd_motion mv[FBD_MAX_MOTIONS];
+    size_t bi = 0;
+
+    if (!fh)
+        return -EINVAL;
+    if (!(fh->flags & FBD_FRAME_KEY) && r->decoded != (int64_t)i - 1)
+        return -EINVAL;
+
+    p = (const uint8_t *)(fh + 1);
+    end = p + fh->payload_size;
+    if ((size_t)(end - p) < fh->motions * sizeof(*mv) + blocks)
+        return -EINVAL;
+    memcpy(mv, p, fh->motions * sizeof(*mv));
+    map = p + fh->motions * sizeof(*mv);
+    p = map + blocks;
+
+    for (unsigned y = 0; y < height; y += FBD_BLOCK) {
+        for (unsigned x = 0; x < width; x += FBD_BLOCK, bi++) {
+            const struct block b = { x, y, min_u(FBD_BLOCK, width - x),
+                                     min_u(FBD_BLOCK, height - y) };
+            const unsigned m = map[bi] & FBD_INTRA;
+
+            if (m != FBD_INTRA) {
+                if (m >= fh->motions || !source_inside(&b, &mv[m], width, height))
+                    return -EINVAL;
+                for (unsigned row = 0; row < b.h; row++)
+                    memcpy(out + ((size_t)(y + row) * width + x) * 4,
+                           ref + ((size_t)(y + row - mv[m].dy) * width + x - mv[m].dx) * 4,
+                           b.w * 4);
+            } else if (!(map[bi] & FBD_RESIDUAL)) {
+                return -EINVAL;
+            }
+            if (map[bi] & FBD_RESIDUAL) {
+                p = get_residual(p, end, out, width, &b, m == FBD_INTRA);
+                if (!p)
+                    return -EINVAL;
+            }
+
+            if (!(map[bi] & FBD_RESIDUAL) && m)
+                r->stats.blocks_moved++;
+            else if (!(map[bi] & FBD_RESIDUAL))
+                r->stats.blocks_same++;
+            else if (m == FBD_INTRA)
+                r->stats.blocks_intra++;
+            else
+                r->stats.blocks_residual++;
+        }
+    }
+
+    r->frame[1] = r->frame[0];
+    r->frame[0] = out;
+    r->decoded = i;
+    r->stats.frames++;
+    r->stats.keyframes += !!(fh->flags & FBD_FRAME_KEY);
+    r->stats.bytes += sizeof(*fh) + fh->payload_size;
+    return 0;
+}
+
+int fbd_frame(struct fbd_reader *r, uint64_t i, const uint8_t **px,
+              const struct fbd_frame_header **hdr)
+{
+    uint64_t key = i, from;
+    int ret;
+
+    if (i >= r->count)
+        return -ERANGE;
+
+    if (r->decoded != (int64_t)i) {
+        /* Start at the keyframe, or carry on if it is already behind us. */
+        for (;;) {
+            const struct fbd_frame_header *fh = frame_header(r, key);
+
+            if (!fh)
+                return -EINVAL;
+            if ((fh->flags & FBD_FRAME_KEY) || !key)
+                break;
+            key--;
+        }
+        from = key;
+        if (r->decoded >= (int64_t)key && r->decoded < (int64_t)i)
+            from = r->decoded + 1;
+        for (uint64_t j = from; j <= i; j++) {
+            ret = decode(r, j);
+            if (ret) {
+                r->decoded = -1;
+                return ret;
+            }
+        }
+    }
+    *px = r->frame[0];
+    if (hdr)
+        *hdr = frame_header(r, i);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: MIT
+/* fb_delta.h – delta-compressed frame history with scroll detection
+ *
+ * Each frame is coded against the previous one in 16x16 pixel blocks. A
+ * block is either copied from the previous frame, at its own position or
+ * shifted by one of the frame's motion vectors, or predicted that way (or
+ * from its left neighbour) and corrected with a run-length coded XOR
+ * residual. Scrolling moves most pixels, so plain XOR deltas code nearly
+ * the whole frame. Here a scrolled block becomes a one-byte copy.
+ *
+ * Motion vectors are found by matching 16-pixel row segments of the new
+ * frame against the previous one in the same block column (vertical
+ * shifts), and 8-column by 16-row patches in the same block row
+ * (horizontal shifts). Each match votes for its offset, and the
+ * best-supported offsets become the frame's vectors. Flat segments match
+ * everywhere and do not vote.
+ *
+ * Layout:
+ *
+ *   fbd_header
+ *   frames: fbd_frame_header | fbd_motion[motions] | block map | residuals
+ *   index:  uint64_t offset[count]          (file offset of every frame)
+ *
+ * The block map has one byte per block, in row-major order: the low four
+ * bits select the motion vector (FBD_INTRA for the left neighbour) and
+ * FBD_RESIDUAL says a residual follows. Residuals are stored in block
+ * order. Each one is a list of (uint16 zero pixels, uint16 literal
+ * pixels, uint32 literal[]) runs covering the block in raster order.
+ * Keyframes, every keyint frames, are intra coded throughout so decoding
+ * can start there.
+ */
+#ifndef FB_DELTA_H
+#define FB_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FBD_MAGIC           "FBDELTA"
+#define FBD_VERSION         1
+#define FBD_FRAME_MAGIC     0x544c4446u     /* "FDLT" */
+#define FBD_BLOCK           16              /* pixels per block side */
+#define FBD_MAX_MOTIONS     15              /* vector 0 is always (0, 0) */
+#define FBD_INTRA           0x0f
+#define FBD_RESIDUAL        0x80
+#define FBD_DEFAULT_KEYINT  300
+
+/* Frame flags */
+#define FBD_FRAME_KEY       (1u << 0)
+
+struct fbd_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block;
+    uint32_t width, height;         /* linear XRGB8888, width * 4 bytes per row */
+    uint32_t format;
+    uint32_t keyint;
+    uint64_t count;                 /* 0 until finished */
+    uint64_t index_offset;          /* 0 until finished */
+};
+
+struct fbd_frame_header {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    uint16_t motions;
+    uint16_t reserved;
+    uint32_t residual_blocks;
+    uint64_t payload_size;          /* bytes after this header */
+};
+
+/* cur(x, y) = prev(x - dx, y - dy) */
+struct fbd_motion {
+    int16_t dx, dy;
+};
+
+struct fbd_stats {
+    uint64_t frames, keyframes;
+    uint64_t blocks_same;           /* copied in place */
+    uint64_t blocks_moved;          /* copied through a motion vector */
+    uint64_t blocks_residual;       /* predicted from the previous frame, then corrected */
+    uint64_t blocks_intra;
+    uint64_t bytes;                 /* encoded, headers included */
+};
+
+/* Writer */
+
+struct fbd_writer {
+    int fd;
+    uint64_t offset;
+    unsigned width, height, keyint;
+    int motion;                     /* search for motion vectors */
+    uint64_t count;
+    uint64_t *index;
+    size_t index_cap;
+
+    /* encoder state: the previous frame and its segment hashes */
+    uint8_t *prev;
+    uint64_t *row_hash[2], *col_hash[2];
+    int cur;
+    struct fbd_slot *table;         /* segment hash -> position */
+    size_t table_mask;
+    uint32_t *votes;                /* per vertical, then horizontal offset */
+    uint32_t *scratch;
+    uint8_t *out;
+    size_t out_cap;
+    struct fbd_stats stats;
+};
+
+/* keyint 0 uses FBD_DEFAULT_KEYINT; motion 0 codes plain deltas only. */
+int  fbd_create(struct fbd_writer *w, const char *path, unsigned width, unsigned height,
+                unsigned keyint, int motion);
+/* px is a linear XRGB8888 frame of the writer's size, width * 4 bytes per row. */
+int  fbd_append(struct fbd_writer *w, const uint8_t *px, uint64_t timestamp_ns,
+                uint64_t sequence);
+/* Write the index, finalise the header and close. */
+int  fbd_finish(struct fbd_writer *w);
+
+/* Reader (mmap) */
+
+struct fbd_reader {
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    const struct fbd_header *hdr;
+    const uint64_t *index;
+    uint64_t *rebuilt;              /* owned when the file had no index */
+    uint64_t count;
+    uint8_t *frame[2];              /* last decoded frame, and the one being decoded */
+    int64_t decoded;                /* index of the frame in frame[0], or -1 */
+    struct fbd_stats stats;         /* block kinds of the frames decoded so far */
+};
+
+int  fbd_open(struct fbd_reader *r, const char *path);
+void fbd_close(struct fbd_reader *r);
+
+/*
+ * Decode frame i into an internal buffer valid until the next call. The
+ * next frame costs one delta; any other one is decoded from the
+ * keyframe before it.
+ */
+int  fbd_frame(struct fbd_reader *r, uint64_t i, const uint8_t **px,
+               const struct fbd_frame_header **hdr);
+
+#endif /* FB_DELTA_H */
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: MIT
+/* fb_detile.c – Intel X/Y/Yf/Tile4 tiled <-> linear conversion
+ *
+ * Build :  kbuild (part of drm_fb_pixel_extractor.ko), or
+ *          gcc -O2 -c fb_detile.c && ar rcs libfb_detile.a fb_detile.o
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/string.h>
+#else
+#include <errno.h>
+#include <string.h>
+#endif
+
+#include "fb_detile.h"
+
+int fb_tile_dims(enum fb_tiling tiling, unsigned *tile_w, unsigned *tile_h)
+{
+    switch (tiling) {
+    case FB_TILING_NONE:
+        *tile_w = 0;
+        *tile_h = 1;
+        return 0;
+    case FB_TILING_X:
+        *tile_w = FB_TILE_X_WIDTH;
+        *tile_h = FB_TILE_X_HEIGHT;
+        return 0;
+    case FB_TILING_Y:
+    case FB_TILING_YF:
+    case FB_TILING_4:
+        *tile_w = FB_TILE_Y_WIDTH;
+        *tile_h = FB_TILE_Y_HEIGHT;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+enum fb_tiling fb_tiling_from_modifier(uint64_t modifier)
+{
+    /* fourcc_mod_code(INTEL, n): vendor 0x01 in the top byte */
+    switch (modifier) {
+    case (1ull << 56) | 1: return FB_TILING_X;
+    case (1ull << 56) | 2: return FB_TILING_Y;
+    case (1ull << 56) | 3: return FB_TILING_YF;
+    case (1ull << 56) | 9: return FB_TILING_4;
+    default:               return FB_TILING_NONE;
+    }
+}
+
+uint64_t fb_tiling_modifier(enum fb_tiling tiling)
+{
+    switch (tiling) {
+    case FB_TILING_X:  return (1ull << 56) | 1;
+    case FB_TILING_Y:  return (1ull << 56) | 2;
+    case FB_TILING_YF: return (1ull << 56) | 3;
+    case FB_TILING_4:  return (1ull << 56) | 9;
+    default:           return 0;
+    }
+}
+
+/* Offset of byte x of row y within one tile. */
+static inline size_t in_tile_offset(enum fb_tiling tiling, unsigned tile_w,
+                                    unsigned x, unsigned y)
+{
+    if (tiling != FB_TILING_4)
+        return (size_t)y * tile_w + x;
+    return ((y >> 3) << 10) | ((x >> 6) << 9) | (((y >> 2) & 1) << 8) |
+           (((x >> 4) & 3) << 6) | ((y & 3) << 4) | (x & 15);
+}
+
+/* Copy n bytes at off, zero-filling whatever lies beyond the source. */
+static inline void copy_span(uint8_t *dst, const uint8_t *src, size_t src_size,
+                             size_t off, unsigned n)
+{
+    if (off + n <= src_size) {
+        memcpy(dst, src + off, n);
+    } else if (off < src_size) {
+        memcpy(dst, src + off, src_size - off);
+        memset(dst + (src_size - off), 0, n - (src_size - off));
+    } else {
+        memset(dst, 0, n);
+    }
+}
+
+void fb_detile_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_size,
+                    unsigned pitch, enum fb_tiling tiling, unsigned xb0, unsigned row_bytes,
+                    unsigned y0, unsigned y1)
+{
+    const unsigned xb1 = xb0 + row_bytes;
+    unsigned tile_w, tile_h, tiles_per_row, span;
+    unsigned x, y;
+    size_t tile_size;
+
+    if (fb_tile_dims(tiling, &tile_w, &tile_h))
+        return;
+
+    if (!tile_w) {
+        for (y = y0; y < y1; y++)
+            copy_span(dst + (size_t)(y - y0) * dst_stride, src, src_size,
+                      (size_t)y * pitch + xb0, row_bytes);
+        return;
+    }
+
+    span = tiling == FB_TILING_4 ? FB_TILE_4_SPAN : tile_w;
+    tile_size = (size_t)tile_w * tile_h;
+    tiles_per_row = pitch / tile_w;
+
+    for (y = y0; y < y1; y++) {
+        size_t row_off = (size_t)(y / tile_h) * tiles_per_row * tile_size;
+        unsigned ty = y & (tile_h - 1);
+        uint8_t *out = dst + (size_t)(y - y0) * dst_stride;
+
+        for (x = xb0; x < xb1; ) {
+            unsigned in_tile = x & (tile_w - 1);
+            unsigned n = span - (x & (span - 1));
+
+            if (n > xb1 - x)
+                n = xb1 - x;
+            copy_span(out + (x - xb0), src, src_size,
+                      row_off + (size_t)(x / tile_w) * tile_size +
+                      in_tile_offset(tiling, tile_w, in_tile, ty), n);
+            x += n;
+        }
+    }
+}
+
+void fb_tile_rows(uint8_t *dst, size_t dst_size, unsigned pitch, enum fb_tiling tiling,
+                  const uint8_t *src, size_t src_stride, unsigned xb0, unsigned row_bytes,
+                  unsigned y0, unsigned y1)
+{
+    const unsigned xb1 = xb0 + row_bytes;
+    unsigned tile_w, tile_h, tiles_per_row, span;
+    unsigned x, y;
+    size_t tile_size;
+
+    if (fb_tile_dims(tiling, &tile_w, &tile_h))
+        return;
+
+    span = tile_w;
+    tile_size = 0;
+    tiles_per_row = 0;
+    if (tile_w) {
+        span = tiling == FB_TILING_4 ? FB_TILE_4_SPAN : tile_w;
+        tile_size = (size_t)tile_w * tile_h;
+        tiles_per_row = pitch / tile_w;
+    }
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t *in = src + (size_t)(y - y0) * src_stride;
+        size_t row_off, off;
+        unsigned ty;
+
+        if (!tile_w) {
+            off = (size_t)y * pitch + xb0;
+            if (off < dst_size)
+                memcpy(dst + off, in, off + row_bytes <= dst_size ? row_bytes : dst_size - off);
+            continue;
+        }
+
+        row_off = (size_t)(y / tile_h) * tiles_per_row * tile_size;
+        ty = y & (tile_h - 1);
+        for (x = xb0; x < xb1; ) {
+            unsigned in_tile = x & (tile_w - 1);
+            unsigned n = span - (x & (span - 1));
+
+            if (n > xb1 - x)
+                n = xb1 - x;
+            off = row_off + (size_t)(x / tile_w) * tile_size +
+                  in_tile_offset(tiling, tile_w, in_tile, ty);
+            if (off < dst_size)
+                memcpy(dst + off, in + (x - xb0), off + n <= dst_size ? n : dst_size - off);
+            x += n;
+        }
+    }
+}
+
+int fb_detile_rect(uint8_t *dst, const uint8_t *src, size_t src_size, unsigned pitch,
+                   enum fb_tiling tiling, unsigned x, unsigned y,
+                   unsigned width, unsigned height)
+{
+    unsigned tile_w, tile_h;
+
+    if (!dst || !src || fb_tile_dims(tiling, &tile_w, &tile_h))
+        return -EINVAL;
+    if ((x + width) * 4 > pitch)
+        return -EINVAL;
+
+    fb_detile_rows(dst, (size_t)width * 4, src, src_size, pitch, tiling,
+                   x * 4, width * 4, y, y + height);
+    return 0;
+}
+
+int fb_tile_rect(uint8_t *dst, size_t dst_size, unsigned pitch, enum fb_tiling tiling,
+                 const uint8_t *src, unsigned x, unsigned y,
+                 unsigned width, unsigned height)
+{
+    unsigned tile_w, tile_h;
+
+    if (!dst || !src || fb_tile_dims(tiling, &tile_w, &tile_h))
+        return -EINVAL;
+    if ((x + width) * 4 > pitch)
+        return -EINVAL;
+
+    fb_tile_rows(dst, dst_size, pitch, tiling, src, (size_t)width * 4,
+                 x * 4, width * 4, y, y + height);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+/* fb_detile.h – Intel X/Y/Yf/Tile4 tiled <-> linear conversion
+ *
+ * One implementation for the kernel module (kbuild, __KERNEL__) and the
+ * userspace tools (libfb_detile.a). Tile addressing is the module's
+ * original one:
+ *
+ *   tile_index = (y / tile_h) * (pitch / tile_w) + byte_x / tile_w
+ *   offset     = tile_index * tile_size + (y % tile_h) * tile_w + byte_x % tile_w
+ *
+ * X tiles are 512 bytes x 8 rows, Y and Yf tiles 128 bytes x 32 rows.
+ * Tile4 tiles are also 128 bytes x 32 rows, but inside a tile 16-byte x
+ * 4-row cells are grouped into 512-byte blocks of 4 x 2 cells:
+ *
+ *   offset = (y / 8) * 1024 + (byte_x / 64) * 512 + (y / 4 % 2) * 256 +
+ *            (byte_x / 16 % 4) * 64 + (y % 4) * 16 + byte_x % 16
+ *
+ * Rows are copied one span at a time: tile-wide for X/Y/Yf, 16 bytes for
+ * Tile4.
+ */
+#ifndef FB_DETILE_H
+#define FB_DETILE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define FB_TILE_X_WIDTH     512     /* bytes */
+#define FB_TILE_X_HEIGHT    8       /* rows */
+#define FB_TILE_Y_WIDTH     128
+#define FB_TILE_Y_HEIGHT    32
+#define FB_TILE_4_SPAN      16      /* contiguous bytes per Tile4 cell row */
+
+enum fb_tiling {
+    FB_TILING_NONE = 0,
+    FB_TILING_X,
+    FB_TILING_Y,
+    FB_TILING_YF,
+    FB_TILING_4
+};
+
+/* Tile size in bytes x rows; linear is reported as 0 x 1. */
+int fb_tile_dims(enum fb_tiling tiling, unsigned *tile_w, unsigned *tile_h);
+
+/* Intel fourcc_mod_code(INTEL, 1..3 and 9); anything else is linear. */
+enum fb_tiling fb_tiling_from_modifier(uint64_t modifier);
+uint64_t fb_tiling_modifier(enum fb_tiling tiling);
+
+/*
+ * Copy bytes [xb0, xb0 + row_bytes) of rows [y0, y1) into dst, one row per
+ * dst_stride. Rows are counted from the start of src, which must begin on
+ * a tile row. Anything that would read past src_size is zero-filled.
+ */
+void fb_detile_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_size,
+                    unsigned pitch, enum fb_tiling tiling, unsigned xb0, unsigned row_bytes,
+                    unsigned y0, unsigned y1);
+
+/* The width x height pixel (4 bytes) rectangle at (x, y), packed into dst. */
+int fb_detile_rect(uint8_t *dst, const uint8_t *src, size_t src_size, unsigned pitch,
+                   enum fb_tiling tiling, unsigned x, unsigned y,
+                   unsigned width, unsigned height);
+
+/*
+ * The reverse: rows [y0, y1) of linear src, dst_stride apart, are written to
+ * bytes [xb0, xb0 + row_bytes) of the tiled surface dst. Anything that would
+ * land past dst_size is dropped.
+ */
+void fb_tile_rows(uint8_t *dst, size_t dst_size, unsigned pitch, enum fb_tiling tiling,
+                  const uint8_t *src, size_t src_stride, unsigned xb0, unsigned row_bytes,
+                  unsigned y0, unsigned y1);
+
+/* Write the packed width x height pixel rectangle src to (x, y) of dst. */
+int fb_tile_rect(uint8_t *dst, size_t dst_size, unsigned pitch, enum fb_tiling tiling,
+                 const uint8_t *src, unsigned x, unsigned y,
+                 unsigned width, unsigned height);
+
+#endif /* FB_DETILE_H */
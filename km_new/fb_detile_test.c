@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: MIT
+/* fb_detile_test.c – KUnit suite for the detile core
+ *
+ * Build :  kbuild, CONFIG_DRM_FB_DETILE_KUNIT_TEST (fb_detile_test.ko)
+ * Usage :  make kunit && sudo insmod fb_detile_test.ko (CONFIG_KUNIT), or
+ *          kunit.py run under UML with this directory in a tree (README)
+ *
+ * Every tiling is checked byte by byte against ref_offset(), which spells
+ * out the addressing in fb_detile.h one byte at a time instead of one span
+ * at a time. The surface is two X tiles wide and two Y tiles high, so the
+ * sub-rectangles cross tile and Tile4 cell edges in both directions. No
+ * GPU is involved: the tiled surfaces are made up, so the suite runs under
+ * UML.
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+
+/* Built into this module on its own, apart from drm_fb_pixel_extractor.ko */
+#include "fb_detile.c"
+
+#define TEST_PITCH      1024    /* bytes: two X tiles, eight Y tiles */
+#define TEST_WIDTH      (TEST_PITCH / 4)
+#define TEST_HEIGHT     64      /* rows: two Y tiles, eight X tiles */
+#define TEST_SIZE       ((size_t)TEST_PITCH * TEST_HEIGHT)
+
+struct detile_case {
+    enum fb_tiling tiling;
+    const char *name;
+};
+
+static const struct detile_case detile_cases[] = {
+    { FB_TILING_NONE, "linear" },
+    { FB_TILING_X,    "X" },
+    { FB_TILING_Y,    "Y" },
+    { FB_TILING_YF,   "Yf" },
+    { FB_TILING_4,    "Tile4" },
+};
+
+static void detile_case_desc(const struct detile_case *c, char *desc)
+{
+    strscpy(desc, c->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(detile, detile_cases, detile_case_desc);
+
+/* Where byte xb of row y lies in a tiled surface, worked out byte by byte. */
+static size_t ref_offset(enum fb_tiling tiling, unsigned pitch, unsigned xb, unsigned y)
+{
+    unsigned tile_w = 128, tile_h = 32, tx, ty;
+    size_t tile;
+
+    if (tiling == FB_TILING_NONE)
+        return (size_t)y * pitch + xb;
+    if (tiling == FB_TILING_X) {
+        tile_w = 512;
+        tile_h = 8;
+    }
+
+    tile = (size_t)(y / tile_h) * (pitch / tile_w) + xb / tile_w;
+    tx = xb % tile_w;
+    ty = y % tile_h;
+    if (tiling != FB_TILING_4)
+        return tile * tile_w * tile_h + ty * tile_w + tx;
+
+    /* 16 x 4 cells, 4 x 2 of them to a 512-byte block, 2 x 4 blocks to a tile */
+    return tile * tile_w * tile_h +
+           (ty / 8) * 1024 + (tx / 64) * 512 +
+           (ty / 4 % 2) * 256 + (tx / 16 % 4) * 64 +
+           (ty % 4) * 16 + tx % 16;
+}
+
+/* A byte that differs from its neighbours in every direction. */
+static u8 pattern(size_t off)
+{
+    return (u8)((off * 2654435761u) >> 13) ^ (u8)off;
+}
+
+static u8 *tiled_surface(struct kunit *test)
+{
+    u8 *src = kunit_kmalloc(test, TEST_SIZE, GFP_KERNEL);
+    size_t i;
+
+    KUNIT_ASSERT_NOT_NULL(test, src);
+    for (i = 0; i < TEST_SIZE; i++)
+        src[i] = pattern(i);
+    return src;
+}
+
+/*
+ * Compare rows [y0, y1), bytes [xb0, xb0 + row_bytes), of dst (dst_stride
+ * apart) with the reference. Bytes at or beyond src_size must read as zero.
+ */
+static void expect_rows(struct kunit *test, const struct detile_case *c, const u8 *dst,
+                        size_t dst_stride, size_t src_size, unsigned xb0,
+                        unsigned row_bytes, unsigned y0, unsigned y1)
+{
+    unsigned xb, y;
+
+    for (y = y0; y < y1; y++) {
+        for (xb = xb0; xb < xb0 + row_bytes; xb++) {
+            size_t off = ref_offset(c->tiling, TEST_PITCH, xb, y);
+            u8 want = off < src_size ? pattern(off) : 0;
+            u8 got = dst[(size_t)(y - y0) * dst_stride + (xb - xb0)];
+
+            /* One report per surface, not one per byte */
+            KUNIT_ASSERT_EQ_MSG(test, got, want, "%s: byte %u of row %u (offset %zu)",
+                                c->name, xb, y, off);
+        }
+    }
+}
+
+static void detile_rect_full(struct kunit *test)
+{
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *dst = kunit_kzalloc(test, TEST_SIZE, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dst);
+    KUNIT_ASSERT_EQ(test, fb_detile_rect(dst, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                                         0, 0, TEST_WIDTH, TEST_HEIGHT), 0);
+    expect_rows(test, c, dst, TEST_PITCH, TEST_SIZE, 0, TEST_PITCH, 0, TEST_HEIGHT);
+}
+
+static void detile_rect_sub(struct kunit *test)
+{
+    /* Odd edges: pixel 37 and row 13 start inside a tile for every layout */
+    const unsigned x = 37, y = 13, width = 101, height = 43;
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *dst = kunit_kzalloc(test, (size_t)width * height * 4, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dst);
+    KUNIT_ASSERT_EQ(test, fb_detile_rect(dst, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                                         x, y, width, height), 0);
+    expect_rows(test, c, dst, (size_t)width * 4, TEST_SIZE, x * 4, width * 4, y, y + height);
+}
+
+static void detile_rect_bounds(struct kunit *test)
+{
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *dst = kunit_kzalloc(test, TEST_SIZE, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dst);
+    KUNIT_EXPECT_EQ(test, fb_detile_rect(dst, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                                         1, 0, TEST_WIDTH, 1), -EINVAL);
+    KUNIT_EXPECT_EQ(test, fb_detile_rect(NULL, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                                         0, 0, 1, 1), -EINVAL);
+}
+
+static void detile_rows_span(struct kunit *test)
+{
+    /* Byte ranges that start and end mid-pixel, mid-cell and mid-tile */
+    const unsigned xb0 = 3, row_bytes = 777, y0 = 5, y1 = 59;
+    const size_t stride = row_bytes + 9;
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *dst = kunit_kzalloc(test, stride * (y1 - y0), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dst);
+    fb_detile_rows(dst, stride, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                   xb0, row_bytes, y0, y1);
+    expect_rows(test, c, dst, stride, TEST_SIZE, xb0, row_bytes, y0, y1);
+}
+
+static void detile_rows_short_source(struct kunit *test)
+{
+    /* Only the first Y tile row (or first 32 linear rows) was captured */
+    const size_t src_size = TEST_SIZE / 2 + 100;
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *dst = kunit_kmalloc(test, TEST_SIZE, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dst);
+    memset(dst, 0xa5, TEST_SIZE);
+    fb_detile_rows(dst, TEST_PITCH, src, src_size, TEST_PITCH, c->tiling,
+                   0, TEST_PITCH, 0, TEST_HEIGHT);
+    expect_rows(test, c, dst, TEST_PITCH, src_size, 0, TEST_PITCH, 0, TEST_HEIGHT);
+}
+
+static void tile_rect_round_trip(struct kunit *test)
+{
+    const unsigned x = 37, y = 13, width = 101, height = 43;
+    const struct detile_case *c = test->param_value;
+    u8 *src = tiled_surface(test);
+    u8 *tiled = kunit_kzalloc(test, TEST_SIZE, GFP_KERNEL);
+    u8 *inside = kunit_kzalloc(test, TEST_SIZE, GFP_KERNEL);
+    u8 *rect = kunit_kzalloc(test, (size_t)width * height * 4, GFP_KERNEL);
+    unsigned xb, row;
+    size_t i;
+
+    KUNIT_ASSERT_NOT_NULL(test, tiled);
+    KUNIT_ASSERT_NOT_NULL(test, inside);
+    KUNIT_ASSERT_NOT_NULL(test, rect);
+    KUNIT_ASSERT_EQ(test, fb_detile_rect(rect, src, TEST_SIZE, TEST_PITCH, c->tiling,
+                                         x, y, width, height), 0);
+    KUNIT_ASSERT_EQ(test, fb_tile_rect(tiled, TEST_SIZE, TEST_PITCH, c->tiling, rect,
+                                       x, y, width, height), 0);
+
+    /* The rectangle lands back where it came from and nowhere else */
+    for (row = y; row < y + height; row++)
+        for (xb = x * 4; xb < (x + width) * 4; xb++)
+            inside[ref_offset(c->tiling, TEST_PITCH, xb, row)] = 1;
+    for (i = 0; i < TEST_SIZE; i++)
+        KUNIT_ASSERT_EQ_MSG(test, tiled[i], inside[i] ? pattern(i) : 0,
+                            "%s: tiled offset %zu", c->name, i);
+}
+
+static struct kunit_case fb_detile_test_cases[] = {
+    KUNIT_CASE_PARAM(detile_rect_full, detile_gen_params),
+    KUNIT_CASE_PARAM(detile_rect_sub, detile_gen_params),
+    KUNIT_CASE_PARAM(detile_rect_bounds, detile_gen_params),
+    KUNIT_CASE_PARAM(detile_rows_span, detile_gen_params),
+    KUNIT_CASE_PARAM(detile_rows_short_source, detile_gen_params),
+    KUNIT_CASE_PARAM(tile_rect_round_trip, detile_gen_params),
+    {}
+};
+
+static struct kunit_suite fb_detile_test_suite = {
+    .name = "fb_detile",
+    .test_cases = fb_detile_test_cases,
+};
+
+kunit_test_suite(fb_detile_test_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the drm_fb_pixel_extractor detile core");
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: MIT
+/* fb_export.h – ring slots handed out as dma-bufs
+ *
+ * FB_IOC_EXPORT on /proc/drm_fb_raw returns a capture as a read-only
+ * dma-buf instead of copying it out: userspace maps it, and other drivers
+ * (a V4L2 encoder, a writeback test) import it, without another copy. The
+ * dma-buf holds the capture exactly as /proc/drm_fb_raw reads it, padded to
+ * whole pages: packed 32-bit pixels, or the luma plane and then the chroma
+ * plane of an NV12/P010 capture (fb_yuv.h).
+ *
+ * Each dma-buf pins its capture's slot until the last reference to it is
+ * dropped, mappings and importers included: the ring passes pinned slots
+ * over, so the pixels never change underneath. At least one slot always
+ * stays unpinned, so capturing never stalls; an export that would pin the
+ * last free slot fails with EBUSY.
+ */
+#ifndef FB_EXPORT_H
+#define FB_EXPORT_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+struct fb_export {
+    uint32_t age;               /* in: 0 the newest capture with pixels, 1 the one before, ... */
+    int32_t fd;                 /* out: the dma-buf, O_RDONLY | O_CLOEXEC */
+    uint64_t size;              /* bytes of capture in it */
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC, when the capture was taken */
+    uint32_t width, height;     /* of the captured region, after downscaling */
+    uint32_t pitch;             /* bytes per row; of the luma plane for NV12/P010 */
+    uint32_t format;            /* DRM fourcc */
+    uint32_t slot;              /* the ring slot it pins */
+    uint32_t pinned;            /* slots pinned, this one included */
+};
+
+#define FB_IOC_EXPORT   _IOWR(0xfb, 0x01, struct fb_export)
+
+#endif /* FB_EXPORT_H */
@@ -0,0 +1,596 @@
+// SPDX-License-Identifier: MIT
+/* fb_exporter.c – publish the module's and the analyzers' counters for Prometheus
+ *
+ * Build :  gcc -O2 fb_exporter.c flash_counters.c -o fb_exporter
+ * Usage :  fb_exporter [-i interval_ms] [-p procdir] [-a counters]... [-o file.prom | -u socket]
+ *
+ * Every -i milliseconds (default 5000) reads the running totals of
+ * /proc/drm_fb_counters, the per-display flash screening records of
+ * /proc/drm_fb_flash and the counters each flash_analyze -m keeps in the
+ * file given with -a, and renders them in the Prometheus text format:
+ * captures taken, skipped, failed and replaced unread, bytes copied, hook
+ * and render-wait counts, captures per quality level, latency histograms
+ * per capture stage and for the ring lock, and per analyzer region frames,
+ * flashes, alarms and the time each frame took to analyse.
+ *
+ * -o writes the text to a file, replaced whole each time (for
+ * node_exporter's textfile collector); -u serves it on a Unix stream
+ * socket, answering an HTTP GET (curl --unix-socket) or a bare connect
+ * with the latest rendering. Without either, prints it once and exits.
+ *
+ * Only fixed-size records are read, never pixels, so each refresh costs a
+ * few syscalls; fb_exporter_render_seconds reports what it took. -p reads
+ * drm_fb_counters and drm_fb_flash from another directory, e.g. copies
+ * saved for testing.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "fb_counters.h"
+#include "fb_screen.h"
+#include "flash_counters.h"
+
+#define NS_PER_SEC      1000000000ull
+#define MAX_ANALYZERS   8
+#define MAX_DISPLAYS    8               /* more than the module screens */
+#define REQUEST_WAIT_MS 100             /* for an HTTP client to send its request */
+
+static const char *const stage_names[FB_STAGE_COUNT] = {
+    "render", "queue", "capture", "detile",
+};
+
+static const char *const side_names[FB_RING_SIDES] = {
+    "writer", "reader",
+};
+
+static const char *const level_names[FB_COUNTERS_LEVELS] = {
+    "full", "region", "half", "sampled", "skip",
+};
+
+struct analyzer {
+    const char *path;
+    char label[64];             /* file name without directories */
+    const struct fa_counters *map;
+    struct fa_counters snap;
+    int up;                     /* snap is valid */
+    int running;                /* its pid is still alive */
+};
+
+struct text {
+    char *p;
+    size_t len, cap;
+    int oom;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void put(struct text *t, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(t->p + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+        if (t->len + n < t->cap)
+            break;
+
+        size_t cap = t->cap ? t->cap * 2 : 16384;
+        char *p;
+
+        while (cap <= t->len + n)
+            cap *= 2;
+        p = realloc(t->p, cap);
+        if (!p) {
+            t->oom = 1;
+            return;
+        }
+        t->p = p;
+        t->cap = cap;
+    }
+    t->len += n;
+}
+
+static void family(struct text *t, const char *name, const char *type, const char *help)
+{
+    put(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void counter(struct text *t, const char *name, const char *help, uint64_t v)
+{
+    family(t, name, "counter", help);
+    put(t, "%s %llu\n", name, (unsigned long long)v);
+}
+
+/* One histogram's samples; labels is 'key="value"'. Buckets go up by powers of two. */
+static void histogram(struct text *t, const char *name, const char *labels,
+                      const struct fb_hist *h)
+{
+    uint64_t cum = 0;
+
+    for (unsigned i = 0; i + 1 < FB_COUNTERS_BUCKETS; i++) {
+        cum += h->bucket[i];
+        put(t, "%s_bucket{%s,le=\"%.9g\"} %llu\n", name, labels, (double)(1ull << i) / 1e6,
+            (unsigned long long)cum);
+    }
+    put(t, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, (unsigned long long)h->count);
+    put(t, "%s_sum{%s} %.9f\n", name, labels, h->sum_ns / 1e9);
+    put(t, "%s_count{%s} %llu\n", name, labels, (unsigned long long)h->count);
+}
+
+/* The whole of a small proc or regular file; bytes read or negative errno. */
+static ssize_t read_file(const char *path, void *buf, size_t size)
+{
+    size_t got = 0;
+    ssize_t r;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -errno;
+    while (got < size && (r = read(fd, (char *)buf + got, size - got)) > 0)
+        got += r;
+    close(fd);
+    return r < 0 ? -errno : (ssize_t)got;
+}
+
+static int read_counters(const char *procdir, struct fb_counters *c)
+{
+    char path[4096];
+    ssize_t n;
+
+    snprintf(path, sizeof(path), "%s/drm_fb_counters", procdir);
+    n = read_file(path, c, sizeof(*c));
+    if (n < 0)
+        return n;
+    if ((size_t)n < sizeof(*c) || c->magic != FB_COUNTERS_MAGIC ||
+        c->version != FB_COUNTERS_VERSION || c->stages != FB_STAGE_COUNT ||
+        c->buckets != FB_COUNTERS_BUCKETS || c->levels != FB_COUNTERS_LEVELS)
+        return -EPROTO;
+    return 0;
+}
+
+static unsigned read_displays(const char *procdir, struct fb_flash_status *st)
+{
+    char path[4096];
+    unsigned n = 0;
+    ssize_t got;
+
+    snprintf(path, sizeof(path), "%s/drm_fb_flash", procdir);
+    got = read_file(path, st, MAX_DISPLAYS * sizeof(*st));
+    for (ssize_t i = 0; got > 0 && i < got / (ssize_t)sizeof(*st); i++)
+        if (st[i].magic == FB_FLASH_MAGIC && st[i].version == FB_FLASH_VERSION)
+            st[n++] = st[i];
+    return n;
+}
+
+static void read_analyzer(struct analyzer *a)
+{
+    a->up = 0;
+    if (!a->map && fa_counters_map(a->path, &a->map))
+        return;
+    if (fa_counters_read(a->map, &a->snap))
+        return;
+    a->up = 1;
+    a->running = kill(a->snap.pid, 0) == 0 || errno == EPERM;
+    /* A new run replaces the file: map it again on the next refresh. */
+    if (!a->running) {
+        fa_counters_unmap(a->map);
+        a->map = NULL;
+    }
+}
+
+static void render_module(struct text *t, const char *procdir)
+{
+    struct fb_counters c;
+    struct fb_flash_status st[MAX_DISPLAYS];
+    unsigned n;
+    int up = read_counters(procdir, &c) == 0;
+
+    family(t, "drm_fb_up", "gauge", "Whether the module's counters could be read.");
+    put(t, "drm_fb_up %d\n", up);
+    if (!up)
+        return;
+
+    counter(t, "drm_fb_captures_total", "Captures recorded in the ring, with pixels or not.",
+            c.captured);
+    counter(t, "drm_fb_captures_with_pixels_total", "Captures that hold pixels.", c.with_pixels);
+    counter(t, "drm_fb_capture_failures_total", "Captures whose copy failed; metadata kept.",
+            c.failed);
+    counter(t, "drm_fb_captures_skipped_total",
+            "Framebuffers not captured, by policy, quality level or overhead guard.", c.skipped);
+    counter(t, "drm_fb_captures_metadata_only_total",
+            "Captures left without pixels by the overhead guard.", c.metadata_only);
+    counter(t, "drm_fb_captures_dropped_total",
+            "Captures replaced in the ring before /proc/drm_fb_raw read them.", c.unread);
+    counter(t, "drm_fb_copied_bytes_total", "Bytes copied into capture buffers.",
+            c.bytes_copied);
+    counter(t, "drm_fb_captures_injected_total", "Synthetic captures recorded through inject_hz.",
+            c.injected);
+    counter(t, "drm_fb_captures_exported_total", "Captures handed out as dma-bufs.",
+            c.exported);
+    counter(t, "drm_fb_hook_calls_total", "Calls of the drm_framebuffer_init hook.",
+            c.hook_calls);
+    counter(t, "drm_fb_hook_silenced_total",
+            "Hook calls ignored while the overhead guard silenced the hook.", c.hook_silenced);
+    counter(t, "drm_fb_render_waits_total", "Captures that waited for a render fence.",
+            c.render_waits);
+    counter(t, "drm_fb_render_errors_total", "Render fences that signalled an error.",
+            c.render_errors);
+
+    family(t, "drm_fb_quality_captures_total", "counter", "Captures per quality level.");
+    for (unsigned i = 0; i < FB_COUNTERS_LEVELS; i++)
+        put(t, "drm_fb_quality_captures_total{level=\"%s\"} %llu\n", level_names[i],
+            (unsigned long long)c.quality_captures[i]);
+    family(t, "drm_fb_quality_steps_total", "counter", "Changes of the quality level.");
+    put(t, "drm_fb_quality_steps_total{direction=\"down\"} %llu\n",
+        (unsigned long long)c.quality_steps_down);
+    put(t, "drm_fb_quality_steps_total{direction=\"up\"} %llu\n",
+        (unsigned long long)c.quality_steps_up);
+
+    family(t, "drm_fb_stage_duration_seconds", "histogram",
+           "Capture stages: render wait, queueing, copy and detile, detile alone.");
+    for (unsigned i = 0; i < FB_STAGE_COUNT; i++) {
+        char labels[32];
+
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stage_names[i]);
+        histogram(t, "drm_fb_stage_duration_seconds", labels, &c.stage[i]);
+    }
+
+    family(t, "drm_fb_ring_lock_wait_seconds", "histogram",
+           "Time the ring's writer and raw readers waited for the ring lock.");
+    for (unsigned i = 0; i < FB_RING_SIDES; i++) {
+        char labels[32];
+
+        snprintf(labels, sizeof(labels), "side=\"%s\"", side_names[i]);
+        histogram(t, "drm_fb_ring_lock_wait_seconds", labels, &c.lock_wait[i]);
+    }
+    family(t, "drm_fb_ring_lock_hold_seconds", "histogram",
+           "Time the ring's writer and raw readers held the ring lock.");
+    for (unsigned i = 0; i < FB_RING_SIDES; i++) {
+        char labels[32];
+
+        snprintf(labels, sizeof(labels), "side=\"%s\"", side_names[i]);
+        histogram(t, "drm_fb_ring_lock_hold_seconds", labels, &c.lock_hold[i]);
+    }
+
+    counter(t, "drm_fb_screen_frames_total", "Captures screened for flashes.", c.screen_frames);
+    counter(t, "drm_fb_screen_flashes_total", "Screened captures that flashed.",
+            c.screen_flashes);
+    counter(t, "drm_fb_screen_alarms_total", "Displays turning harmful.", c.screen_alarms);
+
+    n = read_displays(procdir, st);
+    if (!n)
+        return;
+    family(t, "drm_fb_screen_harmful", "gauge",
+           "Whether the display had 4 or more flashes within the last second.");
+    for (unsigned i = 0; i < n; i++)
+        put(t, "drm_fb_screen_harmful{minor=\"%u\",mode=\"%ux%u\"} %d\n", st[i].dev_minor,
+            st[i].width, st[i].height, !!(st[i].flags & FB_FLASH_HARMFUL));
+    family(t, "drm_fb_screen_window_flashes", "gauge",
+           "Flashes within the last second, up to the harmful count.");
+    for (unsigned i = 0; i < n; i++)
+        put(t, "drm_fb_screen_window_flashes{minor=\"%u\",mode=\"%ux%u\"} %u\n",
+            st[i].dev_minor, st[i].width, st[i].height, st[i].window_flashes);
+    family(t, "drm_fb_screen_alarm_latency_seconds", "gauge",
+           "From drm_framebuffer_init() returning to the display's last alarm.");
+    for (unsigned i = 0; i < n; i++)
+        put(t, "drm_fb_screen_alarm_latency_seconds{minor=\"%u\",mode=\"%ux%u\"} %.9f\n",
+            st[i].dev_minor, st[i].width, st[i].height, st[i].alarm_latency_ns / 1e9);
+    family(t, "drm_fb_screen_busy_seconds_total", "counter",
+           "Time spent screening the display's captures.");
+    for (unsigned i = 0; i < n; i++)
+        put(t, "drm_fb_screen_busy_seconds_total{minor=\"%u\",mode=\"%ux%u\"} %.9f\n",
+            st[i].dev_minor, st[i].width, st[i].height, st[i].busy_ns / 1e9);
+}
+
+/* Per-region counter of every analyzer that is up; field is an offset into the region. */
+static void region_family(struct text *t, struct analyzer *an, unsigned count,
+                          const char *name, const char *type, const char *help, size_t field,
+                          int is32)
+{
+    family(t, name, type, help);
+    for (unsigned i = 0; i < count; i++) {
+        const struct fa_counters *c = &an[i].snap;
+
+        for (unsigned r = 0; an[i].up && r < c->regions && r < FA_MAX_REGIONS; r++) {
+            const char *p = (const char *)&c->region[r] + field;
+            unsigned long long v = is32 ? *(const uint32_t *)p : *(const uint64_t *)p;
+
+            put(t, "%s{analyzer=\"%s\",region=\"%.32s\"} %llu\n", name, an[i].label,
+                c->region[r].name, v);
+        }
+    }
+}
+
+#define REGION_U64(t, an, n, name, type, help, f) \
+    region_family(t, an, n, name, type, help, offsetof(struct fa_counters_region, f), 0)
+#define REGION_U32(t, an, n, name, type, help, f) \
+    region_family(t, an, n, name, type, help, offsetof(struct fa_counters_region, f), 1)
+
+static void render_analyzers(struct text *t, struct analyzer *an, unsigned count)
+{
+    int any = 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        read_analyzer(&an[i]);
+        any |= an[i].up;
+    }
+
+    family(t, "flash_analyzer_up", "gauge", "Whether the analyzer is running.");
+    for (unsigned i = 0; i < count; i++)
+        put(t, "flash_analyzer_up{analyzer=\"%s\"} %d\n", an[i].label, an[i].up && an[i].running);
+    if (!any)
+        return;
+
+    family(t, "flash_analyzer_frames_total", "counter", "Frames analysed.");
+    for (unsigned i = 0; i < count; i++)
+        if (an[i].up)
+            put(t, "flash_analyzer_frames_total{analyzer=\"%s\"} %llu\n", an[i].label,
+                (unsigned long long)an[i].snap.frames);
+    family(t, "flash_analyzer_late_frames_total", "counter",
+           "Live polls of /proc/drm_fb_raw that came a frame period or more late.");
+    for (unsigned i = 0; i < count; i++)
+        if (an[i].up)
+            put(t, "flash_analyzer_late_frames_total{analyzer=\"%s\"} %llu\n", an[i].label,
+                (unsigned long long)an[i].snap.late);
+    family(t, "flash_analyzer_frame_duration_seconds", "histogram",
+           "Time to analyse one frame over all regions.");
+    for (unsigned i = 0; i < count; i++) {
+        char labels[96];
+
+        if (!an[i].up)
+            continue;
+        snprintf(labels, sizeof(labels), "analyzer=\"%s\"", an[i].label);
+        histogram(t, "flash_analyzer_frame_duration_seconds", labels, &an[i].snap.frame);
+    }
+
+    REGION_U64(t, an, count, "flash_analyzer_region_frames_total", "counter",
+               "Frames analysed for the region.", frames);
+    REGION_U64(t, an, count, "flash_analyzer_flashes_total", "counter",
+               "Frames whose flashed area exceeded the region's threshold.", flashes);
+    REGION_U64(t, an, count, "flash_analyzer_red_flashes_total", "counter",
+               "Frames counted as saturated red flashes.", red_flashes);
+    REGION_U64(t, an, count, "flash_analyzer_alarms_total", "counter",
+               "Turns of the region into the harmful state.", alarms);
+    REGION_U32(t, an, count, "flash_analyzer_harmful", "gauge",
+               "Whether the region had 4 or more flashes within the last second.", harmful);
+    REGION_U32(t, an, count, "flash_analyzer_max_flashed_pixels", "gauge",
+               "Largest flashed area seen.", max_flashed);
+    REGION_U32(t, an, count, "flash_analyzer_area_threshold_pixels", "gauge",
+               "Flashed area above which a frame counts as a flash.", area_threshold);
+    REGION_U64(t, an, count, "flash_analyzer_tiles_total", "counter",
+               "Tiles looked at by incremental analysis.", tiles);
+    REGION_U64(t, an, count, "flash_analyzer_changed_tiles_total", "counter",
+               "Tiles that changed and were analysed.", dirty_tiles);
+}
+
+static void render(struct text *t, const char *procdir, struct analyzer *an, unsigned count,
+                   uint64_t last_render_ns)
+{
+    t->len = 0;
+    t->oom = 0;
+    render_module(t, procdir);
+    if (count)
+        render_analyzers(t, an, count);
+    family(t, "fb_exporter_render_seconds", "gauge", "Time the previous refresh took.");
+    put(t, "fb_exporter_render_seconds %.9f\n", last_render_ns / 1e9);
+}
+
+static int write_all(int fd, const char *p, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Replace path whole, so readers never see a partial file. */
+static int write_atomic(const char *path, const struct text *t)
+{
+    char tmp[4096];
+    int fd, ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -errno;
+    ret = write_all(fd, t->p, t->len);
+    if (close(fd) && !ret)
+        ret = -errno;
+    if (!ret && rename(tmp, path))
+        ret = -errno;
+    if (ret)
+        unlink(tmp);
+    return ret;
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(sa.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(sa.sun_path, path);
+    /* A socket left by an earlier run, but nothing else. */
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+        unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 16)) {
+        int ret = -errno;
+
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+static void serve(int lfd, const struct text *t)
+{
+    struct pollfd pfd;
+    char req[4096];
+    char head[160];
+    ssize_t n = 0;
+    int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return;
+    /* An HTTP client sends its request first; a bare reader sends nothing. */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, REQUEST_WAIT_MS) > 0)
+        n = recv(fd, req, sizeof(req) - 1, MSG_DONTWAIT);
+    if (n >= 4 && !memcmp(req, "GET ", 4)) {
+        snprintf(head, sizeof(head),
+                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", t->len);
+        write_all(fd, head, strlen(head));
+    }
+    write_all(fd, t->p, t->len);
+    close(fd);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-i interval_ms] [-p procdir] [-a counters]... [-o file.prom | -u socket]\n",
+            argv0);
+}
+
+int main(int argc, char **argv)
+{
+    static struct analyzer an[MAX_ANALYZERS];
+    const char *procdir = "/proc", *out = NULL, *sock = NULL;
+    unsigned interval_ms = 5000, count = 0;
+    struct text t = { 0 };
+    uint64_t took = 0, next;
+    int opt, lfd = -1, ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "i:p:a:o:u:")) != -1) {
+        switch (opt) {
+        case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+        case 'p': procdir = optarg; break;
+        case 'o': out = optarg; break;
+        case 'u': sock = optarg; break;
+        case 'a':
+            if (count == MAX_ANALYZERS) {
+                fprintf(stderr, "at most %d analyzers\n", MAX_ANALYZERS);
+                return EXIT_FAILURE;
+            }
+            an[count].path = optarg;
+            snprintf(an[count].label, sizeof(an[count].label), "%s",
+                     strrchr(optarg, '/') ? strrchr(optarg, '/') + 1 : optarg);
+            count++;
+            break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || (out && sock) || !interval_ms) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!out && !sock) {
+        render(&t, procdir, an, count, 0);
+        fwrite(t.p, 1, t.len, stdout);
+        return t.oom ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (sock) {
+        lfd = listen_unix(sock);
+        if (lfd < 0) {
+            fprintf(stderr, "%s: %s\n", sock, strerror(-lfd));
+            return EXIT_FAILURE;
+        }
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    next = now_ns();
+    while (!stop) {
+        uint64_t now = now_ns();
+
+        if (now >= next) {
+            render(&t, procdir, an, count, took);
+            took = now_ns() - now;
+            if (t.oom) {
+                fprintf(stderr, "out of memory\n");
+                ret = EXIT_FAILURE;
+                break;
+            }
+            if (out) {
+                int err = write_atomic(out, &t);
+
+                if (err)
+                    fprintf(stderr, "%s: %s\n", out, strerror(-err));
+            }
+            next += (uint64_t)interval_ms * 1000000;
+            if (next <= now)
+                next = now + (uint64_t)interval_ms * 1000000;
+            continue;
+        }
+        if (lfd >= 0) {
+            struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+
+            if (poll(&pfd, 1, (int)((next - now + 999999) / 1000000)) > 0)
+                serve(lfd, &t);
+        } else {
+            struct timespec ts = { (next - now) / NS_PER_SEC, (next - now) % NS_PER_SEC };
+
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    if (lfd >= 0) {
+        close(lfd);
+        unlink(sock);
+    }
+    for (unsigned i = 0; i < count; i++)
+        if (an[i].map)
+            fa_counters_unmap(an[i].map);
+    free(t.p);
+    return ret;
+}
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: MIT
+/* fb_fence.c – check that captures wait for rendering, using vgem fences
+ *
+ * Build :  gcc -O2 fb_fence.c -o fb_fence
+ * Usage :  fb_fence [-v /dev/dri/cardV] [-c /dev/dri/cardK] [-d delay_ms] [-n rounds] [-s WxH]
+ *
+ * Stands in for a GPU: each round allocates a vgem buffer, fills it with a
+ * "stale" colour and attaches an unsignalled vgem write fence, as a driver
+ * does while rendering is in flight. The buffer is shared with a KMS
+ * device (vkms) through PRIME and registered there as a framebuffer, which
+ * fires the module's hook. The tool then writes the "rendered" colour,
+ * waits -d milliseconds and signals the fence.
+ *
+ * The module should copy only after the signal. For each round the tool
+ * reads the capture back from /proc/drm_fb_pixels and reports whether it
+ * holds the rendered or the stale colour, how long after the signal the
+ * module saw the fence complete, and when the copy started. With
+ * wait_render=0 every capture is expected to be stale.
+ *
+ * vgem signals a forgotten fence itself after 10 s, so -d must stay below
+ * that. Without -v/-c the first vgem and vkms cards are used:
+ *
+ *   sudo modprobe vgem && sudo modprobe vkms && sudo fb_fence -d 20 -n 10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+#include <drm/vgem_drm.h>
+
+#define NS_PER_SEC      1000000000ull
+#define PROC_INFO       "/proc/drm_fb_pixels"
+#define STALE_COLOUR    0x00ff00ffu     /* what the buffer held before "rendering" */
+#define RENDER_COLOUR   0x0000c000u     /* low byte carries the round */
+#define CAPTURE_WAIT_MS 2000
+
+struct capture_info {
+    uint64_t timestamp;                 /* copy started */
+    uint64_t render_ns;                 /* module saw the last render fence signal */
+    uint32_t first_pixel;
+    int has_pixel;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+/* First /dev/dri/card* whose driver is called name, opened read-write. */
+static int open_driver(const char *name, char *path, size_t len)
+{
+    for (int i = 0; i < 64; i++) {
+        char drv[32] = "";
+        struct drm_version ver = { .name = drv, .name_len = sizeof(drv) - 1 };
+        int fd;
+
+        snprintf(path, len, "/dev/dri/card%d", i);
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        if (!ioctl(fd, DRM_IOCTL_VERSION, &ver) && !strcmp(drv, name))
+            return fd;
+        close(fd);
+    }
+    return -ENODEV;
+}
+
+/* Newest capture whose copy started at or after since. */
+static int find_capture(uint64_t since, struct capture_info *out)
+{
+    FILE *f = fopen(PROC_INFO, "r");
+    struct capture_info cur = { 0 };
+    char line[256];
+    int found = 0;
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long v;
+        unsigned px;
+
+        if (!strncmp(line, "Capture ", 8)) {
+            memset(&cur, 0, sizeof(cur));
+        } else if (sscanf(line, "  Timestamp: %llu", &v) == 1) {
+            cur.timestamp = v;
+        } else if (sscanf(line, "  Render: complete at %llu", &v) == 1) {
+            cur.render_ns = v;
+        } else if (sscanf(line, "  First pixel (ARGB): 0x%x", &px) == 1) {
+            cur.first_pixel = px;
+            cur.has_pixel = 1;
+            if (cur.timestamp >= since && (!found || cur.timestamp > out->timestamp)) {
+                *out = cur;
+                found = 1;
+            }
+        }
+    }
+    fclose(f);
+    return found ? 0 : -ENOENT;
+}
+
+struct round_result {
+    int rendered;                       /* capture holds the rendered colour */
+    int64_t fence_ns;                   /* signal -> module saw the fence complete */
+    int64_t copy_ns;                    /* signal -> copy started */
+};
+
+static int run_round(int vgem, int kms, unsigned w, unsigned h, unsigned delay_ms,
+                     unsigned round, struct round_result *res)
+{
+    struct drm_mode_create_dumb create = { .width = w, .height = h, .bpp = 32 };
+    struct drm_mode_map_dumb map = { 0 };
+    struct drm_prime_handle exp = { 0 }, imp = { 0 };
+    struct drm_vgem_fence_attach attach = { 0 };
+    struct drm_vgem_fence_signal sig = { 0 };
+    struct capture_info cap = { 0 };
+    uint32_t *px = MAP_FAILED, fb_id = 0;
+    const uint32_t colour = RENDER_COLOUR | (round & 0xff);
+    uint64_t t_hook = 0, t_signal;
+    int ret;
+
+    if (ioctl(vgem, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+        return -errno;
+    map.handle = create.handle;
+    if (ioctl(vgem, DRM_IOCTL_MODE_MAP_DUMB, &map)) {
+        ret = -errno;
+        goto out;
+    }
+    px = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, vgem, map.offset);
+    if (px == MAP_FAILED) {
+        ret = -errno;
+        goto out;
+    }
+    for (size_t i = 0; i < create.size / 4; i++)
+        px[i] = STALE_COLOUR;
+
+    /* "Rendering" starts: an unsignalled write fence on the buffer */
+    attach.handle = create.handle;
+    attach.flags = VGEM_FENCE_WRITE;
+    if (ioctl(vgem, DRM_IOCTL_VGEM_FENCE_ATTACH, &attach)) {
+        ret = -errno;
+        goto out;
+    }
+
+    exp.handle = create.handle;
+    exp.flags = DRM_CLOEXEC;
+    if (ioctl(vgem, DRM_IOCTL_PRIME_HANDLE_TO_FD, &exp)) {
+        ret = -errno;
+        goto signal;
+    }
+    imp.fd = exp.fd;
+    ret = ioctl(kms, DRM_IOCTL_PRIME_FD_TO_HANDLE, &imp) ? -errno : 0;
+    close(exp.fd);
+    if (ret)
+        goto signal;
+
+    struct drm_mode_fb_cmd2 cmd = {
+        .width = w,
+        .height = h,
+        .pixel_format = DRM_FORMAT_XRGB8888,
+        .handles = { imp.handle },
+        .pitches = { create.pitch },
+    };
+    t_hook = now_ns();
+    if (ioctl(kms, DRM_IOCTL_MODE_ADDFB2, &cmd)) {
+        ret = -errno;
+        goto signal;
+    }
+    fb_id = cmd.fb_id;
+
+    /* The "GPU" finishes the frame, then the fence signals */
+    for (size_t i = 0; i < create.size / 4; i++)
+        px[i] = colour;
+    sleep_ms(delay_ms);
+
+signal:
+    t_signal = now_ns();
+    sig.fence = attach.out_fence;
+    if (ioctl(vgem, DRM_IOCTL_VGEM_FENCE_SIGNAL, &sig) && !ret)
+        ret = -errno;
+    if (ret)
+        goto out;
+
+    ret = -ENOENT;
+    for (unsigned waited = 0; waited < CAPTURE_WAIT_MS && ret; waited += 5) {
+        sleep_ms(5);
+        ret = find_capture(t_hook, &cap);
+    }
+    if (!ret) {
+        res->rendered = (cap.first_pixel & 0xffffff) == colour;
+        res->fence_ns = (int64_t)(cap.render_ns - t_signal);
+        res->copy_ns = (int64_t)(cap.timestamp - t_signal);
+    }
+
+out:
+    if (fb_id)
+        ioctl(kms, DRM_IOCTL_MODE_RMFB, &fb_id);
+    if (imp.handle)
+        ioctl(kms, DRM_IOCTL_GEM_CLOSE, &(struct drm_gem_close){ .handle = imp.handle });
+    if (px != MAP_FAILED)
+        munmap(px, create.size);
+    ioctl(vgem, DRM_IOCTL_MODE_DESTROY_DUMB, &(struct drm_mode_destroy_dumb){ create.handle });
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-v /dev/dri/cardV] [-c /dev/dri/cardK] [-d delay_ms] [-n rounds] [-s WxH]\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *vgem_path = NULL, *kms_path = NULL;
+    char vgem_found[32], kms_found[32];
+    unsigned delay_ms = 20, rounds = 5, w = 640, h = 480;
+    unsigned rendered = 0, done = 0;
+    int64_t fence_sum = 0, copy_sum = 0;
+    int vgem, kms, opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "v:c:d:n:s:")) != -1) {
+        switch (opt) {
+        case 'v': vgem_path = optarg; break;
+        case 'c': kms_path = optarg; break;
+        case 'd': delay_ms = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &w, &h) != 2 || !w || !h) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (argc != optind || delay_ms >= 10000) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    vgem = vgem_path ? open(vgem_path, O_RDWR | O_CLOEXEC) :
+                       open_driver("vgem", vgem_found, sizeof(vgem_found));
+    if (vgem < 0) {
+        fprintf(stderr, "%s: %s\n", vgem_path ? vgem_path : "vgem",
+                strerror(vgem_path ? errno : -vgem));
+        return EXIT_FAILURE;
+    }
+    kms = kms_path ? open(kms_path, O_RDWR | O_CLOEXEC) :
+                     open_driver("vkms", kms_found, sizeof(kms_found));
+    if (kms < 0) {
+        fprintf(stderr, "%s: %s\n", kms_path ? kms_path : "vkms",
+                strerror(kms_path ? errno : -kms));
+        close(vgem);
+        return EXIT_FAILURE;
+    }
+    printf("vgem %s, kms %s, %ux%u, fence signalled %u ms after ADDFB2\n",
+           vgem_path ? vgem_path : vgem_found, kms_path ? kms_path : kms_found, w, h, delay_ms);
+
+    for (unsigned i = 0; i < rounds; i++) {
+        struct round_result res = { 0 };
+
+        ret = run_round(vgem, kms, w, h, delay_ms, i, &res);
+        if (ret == -ENOENT) {
+            printf("round %u: no capture (skipped by policy or quality?)\n", i);
+            ret = 0;
+            continue;
+        }
+        if (ret) {
+            fprintf(stderr, "round %u: %s\n", i, strerror(-ret));
+            break;
+        }
+        printf("round %u: %s, fence seen %+.3f ms, copy %+.3f ms after the signal\n", i,
+               res.rendered ? "rendered" : "STALE", res.fence_ns / 1e6, res.copy_ns / 1e6);
+        rendered += res.rendered;
+        fence_sum += res.fence_ns;
+        copy_sum += res.copy_ns;
+        done++;
+    }
+    if (done)
+        printf("%u/%u captures rendered, fence seen %+.3f ms, copy %+.3f ms after the signal on average\n",
+               rendered, done, fence_sum / 1e6 / done, copy_sum / 1e6 / done);
+
+    close(kms);
+    close(vgem);
+    return ret || rendered < done ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+// SPDX-License-Identifier: MIT
+/* fb_gen.c – generate synthetic tiled framebuffer sequences
+ *
+ * Build :  gcc -O2 fb_gen.c fb_pattern.c fbrec.c fb_detile.c -o fb_gen
+ * Usage :  fb_gen [-p pattern] [-l X|Y|Yf|4|L] [-s WxH] [-n frames] [-f fps] [-F nv12|p010]
+ *                 <out.raw|out.fbrec>
+ *
+ * Renders -n frames of a fb_pattern.h pattern at -f fps, tiles them into
+ * the -l layout with the same fb_detile core the module uses, and writes
+ * them back to back as raw frames, or into a .fbrec recording with the
+ * matching modifier. The pitch is the row size rounded up to the tile
+ * width and every frame is padded to whole tile rows, so the raw output
+ * can be fed straight to flash_analyze, fbrec_record or
+ * intel_y_tile_to_linear with the pitch printed at the end.
+ *
+ * -F converts each frame to BT.709 limited-range NV12 or P010 instead,
+ * chroma averaged over 2 x 2 pixels, and writes the luma plane then the
+ * chroma plane, each tiled on its own (fb_yuv.h). flash_analyze -F reads
+ * them back.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fb_detile.h"
+#include "fb_pattern.h"
+#include "fbrec.h"
+#include "fb_yuv.h"
+
+#define FOURCC_XRGB8888 0x34325258u     /* 'XR24' */
+
+static int parse_layout(const char *s, enum fb_tiling *t)
+{
+    if (!strcmp(s, "L"))       *t = FB_TILING_NONE;
+    else if (!strcmp(s, "X"))  *t = FB_TILING_X;
+    else if (!strcmp(s, "Y"))  *t = FB_TILING_Y;
+    else if (!strcmp(s, "Yf")) *t = FB_TILING_YF;
+    else if (!strcmp(s, "4"))  *t = FB_TILING_4;
+    else return -EINVAL;
+    return 0;
+}
+
+static void yuv_put(uint8_t *p, double v, unsigned depth)
+{
+    unsigned code = v < 0 ? 0 : v > 1023 ? 1023 : (unsigned)(v + 0.5);
+
+    if (depth == 2) {
+        p[0] = (code << 6) & 0xff;
+        p[1] = code >> 2;
+    } else {
+        p[0] = (code + 2) >> 2 > 255 ? 255 : (code + 2) >> 2;
+    }
+}
+
+/*
+ * Packed XRGB8888 to a luma plane of w samples per row and a chroma plane
+ * of (w + 1) / 2 Cb/Cr pairs per row, (h + 1) / 2 rows, in 10-bit BT.709
+ * limited range stored at depth bytes per sample.
+ */
+static void to_yuv(uint8_t *luma, uint8_t *chroma, const uint8_t *px, unsigned w,
+                   unsigned h, unsigned depth)
+{
+    const unsigned pairs = (w + 1) / 2;
+
+    for (unsigned cy = 0; cy < (h + 1) / 2; cy++) {
+        for (unsigned cx = 0; cx < pairs; cx++) {
+            double cb = 0, cr = 0;
+            unsigned n = 0;
+
+            for (unsigned y = 2 * cy; y < 2 * cy + 2 && y < h; y++) {
+                for (unsigned x = 2 * cx; x < 2 * cx + 2 && x < w; x++) {
+                    const uint8_t *p = px + ((size_t)y * w + x) * 4;
+                    double r = p[2] / 255.0, g = p[1] / 255.0, b = p[0] / 255.0;
+                    double l = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+
+                    yuv_put(luma + ((size_t)y * w + x) * depth, 64 + 876 * l, depth);
+                    cb += (b - l) / 1.8556;
+                    cr += (r - l) / 1.5748;
+                    n++;
+                }
+            }
+            yuv_put(chroma + ((size_t)cy * pairs + cx) * 2 * depth, 512 + 896 * cb / n, depth);
+            yuv_put(chroma + ((size_t)cy * pairs + cx) * 2 * depth + depth,
+                    512 + 896 * cr / n, depth);
+        }
+    }
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && !strcmp(s + n - m, suffix);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "usage: %s [-p pattern] [-l X|Y|Yf|4|L] [-s WxH] [-n frames] [-f fps] [-F nv12|p010]\n"
+        "       <out.raw|out.fbrec>\n"
+        "patterns:", argv0);
+    for (int i = 0; i < FB_PATTERN_COUNT; i++)
+        fprintf(stderr, " %s%s", fb_pattern_name(i), fb_pattern_harmful(i) ? "*" : "");
+    fprintf(stderr, "   (* fails the spec.v flash checks)\n");
+}
+
+int main(int argc, char **argv)
+{
+    enum fb_tiling tiling = FB_TILING_NONE;
+    int pattern = FB_PATTERN_FLASH;
+    unsigned w = 1920, h = 1080, frames = 120;
+    unsigned tile_w, tile_h, pitch, h_alloc;
+    uint32_t format = FOURCC_XRGB8888;
+    unsigned depth = 0;
+    double fps = 60.0;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "p:l:s:n:f:F:")) != -1) {
+        switch (opt) {
+        case 'p':
+            pattern = fb_pattern_parse(optarg);
+            if (pattern < 0)
+                goto usage;
+            break;
+        case 'l':
+            if (parse_layout(optarg, &tiling))
+                goto usage;
+            break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &w, &h) != 2 || !w || !h)
+                goto usage;
+            break;
+        case 'n': frames = atoi(optarg); break;
+        case 'f': fps = atof(optarg); break;
+        case 'F':
+            if (!strcmp(optarg, "nv12"))
+                format = FB_YUV_NV12;
+            else if (!strcmp(optarg, "p010"))
+                format = FB_YUV_P010;
+            else
+                goto usage;
+            depth = fb_yuv_depth(format);
+            break;
+        default:  goto usage;
+        }
+    }
+    if (argc - optind != 1 || fps <= 0 || !frames) {
+usage:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fb_tile_dims(tiling, &tile_w, &tile_h);
+    /* A YUV row also has to hold the last Cb/Cr pair of odd widths. */
+    pitch = depth ? (w + 1) / 2 * 2 * depth : w * 4;
+    if (tile_w)
+        pitch = (pitch + tile_w - 1) / tile_w * tile_w;
+    h_alloc = (h + tile_h - 1) / tile_h * tile_h;
+
+    const char *out = argv[optind];
+    const int rec = has_suffix(out, ".fbrec");
+    const size_t frame_size = depth ? fb_yuv_frame_size(pitch, h, tile_h) : (size_t)pitch * h_alloc;
+    const size_t uv_offset = fb_yuv_uv_offset(pitch, h, tile_h);
+    const unsigned chroma_row = (w + 1) / 2 * 2 * depth;
+    uint8_t *linear = malloc((size_t)w * h * 4);
+    uint8_t *tiled = calloc(1, frame_size);
+    uint8_t *luma = depth ? malloc((size_t)w * h * depth) : NULL;
+    uint8_t *chroma = depth ? malloc((size_t)chroma_row * ((h + 1) / 2)) : NULL;
+    struct fbrec_writer wr;
+    FILE *fo = NULL;
+
+    if (!linear || !tiled || (depth && (!luma || !chroma))) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    ret = rec ? fbrec_create(&wr, out, frame_size) : 0;
+    if (!rec && !(fo = fopen(out, "wb")))
+        ret = -errno;
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned f = 0; f < frames; f++) {
+        fb_pattern_fill(linear, w, h, (size_t)w * 4, pattern, f, fps);
+        if (depth) {
+            to_yuv(luma, chroma, linear, w, h, depth);
+            fb_tile_rows(tiled, uv_offset, pitch, tiling, luma, (size_t)w * depth,
+                         0, w * depth, 0, h);
+            fb_tile_rows(tiled + uv_offset, frame_size - uv_offset, pitch, tiling, chroma,
+                         chroma_row, 0, chroma_row, 0, (h + 1) / 2);
+        } else {
+            fb_tile_rect(tiled, frame_size, pitch, tiling, linear, 0, 0, w, h);
+        }
+
+        if (rec) {
+            struct fbrec_frame_header hdr = {
+                .sequence = f,
+                .timestamp_ns = (uint64_t)(f * 1e9 / fps),
+                .width = w,
+                .height = h,
+                .pitch = pitch,
+                .format = format,
+                .modifier = fb_tiling_modifier(tiling),
+                .data_size = frame_size,
+            };
+            ret = fbrec_append(&wr, &hdr, tiled);
+        } else if (fwrite(tiled, 1, frame_size, fo) != frame_size) {
+            ret = -EIO;
+        }
+        if (ret) {
+            fprintf(stderr, "%s: frame %u: %s\n", out, f, strerror(-ret));
+            break;
+        }
+    }
+
+    if (rec) {
+        int fin = fbrec_finish(&wr);
+
+        if (!ret)
+            ret = fin;
+    } else if (fclose(fo)) {
+        ret = ret ? ret : -errno;
+    }
+    if (ret)
+        return EXIT_FAILURE;
+
+    printf("%s: %u frames of '%s', %ux%u at %.2f fps, layout %s, %s, pitch %u, %zu bytes/frame\n",
+           out, frames, fb_pattern_name(pattern), w, h, fps,
+           tiling == FB_TILING_X ? "X" : tiling == FB_TILING_Y ? "Y" :
+           tiling == FB_TILING_YF ? "Yf" : tiling == FB_TILING_4 ? "4" : "L",
+           format == FB_YUV_NV12 ? "NV12" : format == FB_YUV_P010 ? "P010" : "XRGB8888",
+           pitch, frame_size);
+
+    free(luma);
+    free(chroma);
+    free(linear);
+    free(tiled);
+    return EXIT_SUCCESS;
+}
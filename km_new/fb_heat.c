@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: MIT
+/* fb_heat.c – show where the screen changes, and suggest a capture region
+ *
+ * Build :  gcc -O2 fb_heat.c fb_stats.c fbrec.c fb_detile.c -o fb_heat
+ * Usage :  fb_heat [-w windows] [-t percent] [file]
+ *
+ * Reads the module's activity heatmaps (/proc/drm_fb_heatmap by default,
+ * or a copy of it) and draws one character per 32 x 32 block: blank for a
+ * block that never changed, then ".:-=+*#%@" up to one that changed in
+ * every capture. The counts are those since load, or with -w those of the
+ * last N windows of heatmap_window_ms.
+ *
+ * Below each map the tool prints the bounding box of the blocks that
+ * changed in at least -t percent (default 1) of the captures. It is
+ * ready to use as a capture policy region or an analysis ROI.
+ *
+ * Given a .fbrec recording instead, the map of each geometry in it is
+ * built with the module's own comparison (fb_stats_add_frame) and shown
+ * the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fb_detile.h"
+#include "fb_heatmap.h"
+#include "fb_stats.h"
+#include "fbrec.h"
+
+#define PROC_HEATMAP    "/proc/drm_fb_heatmap"
+#define MAX_READ        (64u << 20)
+
+struct heat {
+    unsigned cols, rows, block;
+    unsigned width, height;
+    uint64_t frames;
+    uint32_t *count;            /* rows x cols over the chosen span */
+};
+
+static void show(const struct heat *h, double threshold)
+{
+    static const char ramp[] = ".:-=+*#%@";
+    unsigned x0 = h->cols, y0 = h->rows, x1 = 0, y1 = 0, active = 0;
+
+    for (unsigned y = 0; y < h->rows; y++) {
+        putchar('|');
+        for (unsigned x = 0; x < h->cols; x++) {
+            uint32_t c = h->count[(size_t)y * h->cols + x];
+            double f = h->frames ? (double)c / h->frames : 0;
+
+            putchar(c ? ramp[f >= 1 ? sizeof(ramp) - 2 : (unsigned)(f * (sizeof(ramp) - 1))] : ' ');
+            if (f * 100 >= threshold && c) {
+                active++;
+                x0 = x < x0 ? x : x0;
+                y0 = y < y0 ? y : y0;
+                x1 = x > x1 ? x : x1;
+                y1 = y > y1 ? y : y1;
+            }
+        }
+        printf("|\n");
+    }
+    if (!active) {
+        printf("no block changed in %.1f%% of %llu captures\n", threshold,
+               (unsigned long long)h->frames);
+        return;
+    }
+
+    unsigned rx = x0 * h->block, ry = y0 * h->block;
+    unsigned rw = (x1 + 1) * h->block, rh = (y1 + 1) * h->block;
+
+    rw = (rw > h->width ? h->width : rw) - rx;
+    rh = (rh > h->height ? h->height : rh) - ry;
+    printf("%u of %u blocks changed in %.1f%% of %llu captures or more, region %ux%u+%u+%u (%.1f%% of the screen)\n",
+           active, h->cols * h->rows, threshold, (unsigned long long)h->frames, rw, rh, rx, ry,
+           100.0 * rw * rh / ((double)h->width * h->height));
+}
+
+/* The maps in a copy of /proc/drm_fb_heatmap, summed over the last windows (0 = total). */
+static int show_proc(const uint8_t *buf, size_t size, unsigned windows, double threshold)
+{
+    size_t off = 0;
+
+    while (off + sizeof(struct fb_heatmap_header) <= size) {
+        const struct fb_heatmap_header *hdr = (const void *)(buf + off);
+        size_t blocks, rec;
+        const uint32_t *total;
+        const uint16_t *window;
+        struct heat h;
+
+        if (hdr->magic != FB_HEATMAP_MAGIC || hdr->version != FB_HEATMAP_VERSION ||
+            hdr->windows != FB_HEATMAP_WINDOWS || !hdr->block)
+            return -EPROTO;
+        blocks = (size_t)hdr->cols * hdr->rows;
+        rec = fb_heatmap_size(hdr->cols, hdr->rows);
+        if (rec > size - off)
+            return -EPROTO;
+        total = (const uint32_t *)(hdr + 1);
+        window = (const uint16_t *)(total + blocks);
+
+        h = (struct heat){ .cols = hdr->cols, .rows = hdr->rows, .block = hdr->block,
+                           .width = hdr->width, .height = hdr->height };
+        h.count = calloc(blocks, sizeof(*h.count));
+        if (!h.count)
+            return -ENOMEM;
+        if (!windows) {
+            memcpy(h.count, total, blocks * sizeof(*total));
+            h.frames = hdr->total_frames;
+        }
+        for (unsigned k = FB_HEATMAP_WINDOWS - (windows < FB_HEATMAP_WINDOWS ? windows : FB_HEATMAP_WINDOWS);
+             windows && k < FB_HEATMAP_WINDOWS; k++) {
+            for (size_t b = 0; b < blocks; b++)
+                h.count[b] += window[k * blocks + b];
+            h.frames += hdr->window_frames[k];
+        }
+
+        printf("display minor %u, %ux%u, %ux%u blocks of %u px, ", hdr->dev_minor, hdr->width,
+               hdr->height, hdr->cols, hdr->rows, hdr->block);
+        if (windows)
+            printf("last %u windows of %u ms\n", windows, hdr->window_ms);
+        else
+            printf("since load\n");
+        show(&h, threshold);
+        free(h.count);
+        off += rec;
+    }
+    return 0;
+}
+
+static int show_recording(const char *path, double threshold)
+{
+    struct fbrec rec;
+    uint32_t *cur = NULL, *prev = NULL;
+    uint8_t *dirty = NULL;
+    struct heat h = { 0 };
+    uint32_t format = 0;
+    int have_prev = 0, ret;
+
+    ret = fbrec_open(&rec, path);
+    if (ret)
+        return ret;
+    for (uint64_t i = 0; i <= rec.count; i++) {
+        const struct fbrec_frame_header *fh = NULL;
+        struct fbrec_frame f;
+        struct fb_stats_acc acc;
+        size_t blocks;
+
+        if (i < rec.count) {
+            ret = fbrec_frame(&rec, i, &f);
+            if (ret)
+                break;
+            fh = f.hdr;
+        }
+        /* A new geometry (or the end) closes the current map */
+        if (h.count && (!fh || fh->width != h.width || fh->height != h.height)) {
+            printf("%s, %ux%u, %ux%u blocks of %u px\n", path, h.width, h.height, h.cols,
+                   h.rows, h.block);
+            show(&h, threshold);
+            free(h.count);
+            h.count = NULL;
+            have_prev = 0;
+        }
+        if (!fh)
+            break;
+        if (!fh->width || !fh->height || (fh->format != 0x34325258u && fh->format != 0x34325241u))
+            continue;
+        if (!h.count) {
+            h = (struct heat){ .cols = (fh->width + FB_HEATMAP_BLOCK - 1) / FB_HEATMAP_BLOCK,
+                               .rows = (fh->height + FB_HEATMAP_BLOCK - 1) / FB_HEATMAP_BLOCK,
+                               .block = FB_HEATMAP_BLOCK, .width = fh->width,
+                               .height = fh->height };
+            blocks = (size_t)h.cols * h.rows;
+            h.count = calloc(blocks, sizeof(*h.count));
+            free(dirty);
+            free(cur);
+            free(prev);
+            dirty = malloc(blocks);
+            cur = malloc((size_t)fh->width * fh->height * 4);
+            prev = malloc((size_t)fh->width * fh->height * 4);
+            if (!h.count || !dirty || !cur || !prev) {
+                ret = -ENOMEM;
+                break;
+            }
+        }
+        blocks = (size_t)h.cols * h.rows;
+
+        ret = fb_detile_rect((uint8_t *)cur, f.data, fh->data_size, fh->pitch,
+                             fb_tiling_from_modifier(fh->modifier), 0, 0, fh->width, fh->height);
+        if (ret)
+            break;
+        if (have_prev && fh->format == format) {
+            memset(dirty, 0, blocks);
+            fb_stats_begin(&acc);
+            fb_stats_add_frame(&acc, cur, prev, 0, (size_t)fh->width * fh->height, fh->width,
+                               0, dirty, FB_HEATMAP_BLOCK);
+            for (size_t b = 0; b < blocks; b++)
+                h.count[b] += dirty[b];
+            h.frames++;
+        }
+        uint32_t *t = prev;
+        prev = cur;
+        cur = t;
+        have_prev = 1;
+        format = fh->format;
+    }
+    free(h.count);
+    free(dirty);
+    free(cur);
+    free(prev);
+    fbrec_close(&rec);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-w windows] [-t percent] [/proc/drm_fb_heatmap | copy | recording.fbrec]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = PROC_HEATMAP;
+    unsigned windows = 0;
+    double threshold = 1.0;
+    uint8_t *buf;
+    size_t got = 0;
+    ssize_t r;
+    int fd, opt, ret;
+
+    while ((opt = getopt(argc, argv, "w:t:")) != -1) {
+        switch (opt) {
+        case 'w': windows = atoi(optarg); break;
+        case 't': threshold = atof(optarg); break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind > 1 || windows > FB_HEATMAP_WINDOWS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc - optind == 1)
+        path = argv[optind];
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    buf = malloc(MAX_READ);
+    if (!buf) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    /* One open, read to the end: the module snapshots the maps at open */
+    while (got < sizeof(FBREC_MAGIC) - 1 && (r = read(fd, buf + got, MAX_READ - got)) > 0)
+        got += r;
+    if (got >= sizeof(FBREC_MAGIC) - 1 && !memcmp(buf, FBREC_MAGIC, sizeof(FBREC_MAGIC) - 1)) {
+        close(fd);
+        ret = show_recording(path, threshold);
+    } else {
+        while (got < MAX_READ && (r = read(fd, buf + got, MAX_READ - got)) > 0)
+            got += r;
+        close(fd);
+        ret = show_proc(buf, got, windows, threshold);
+    }
+    free(buf);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+/* fb_heatmap.h – layout of /proc/drm_fb_heatmap
+ *
+ * The module keeps one change-frequency map per display (device minor and
+ * framebuffer size), in blocks of FB_HEATMAP_BLOCK x FB_HEATMAP_BLOCK
+ * framebuffer pixels. A block counts as changed in a capture when any of
+ * its pixels differs from the previous capture of the same region; the
+ * comparison is the one the statistics pass (fb_stats.h) already makes,
+ * so no pixel is read for the map.
+ *
+ * Counts are kept since load (or the last reset) and for each of the last
+ * FB_HEATMAP_WINDOWS windows of heatmap_window_ms. Divided by the frames
+ * of the same span they give the fraction of captures in which a block
+ * changed. With a policy region, blocks outside it are never seen.
+ *
+ * Reading the file returns, per display, a header followed by
+ *
+ *   uint32_t total[rows][cols];
+ *   uint16_t window[FB_HEATMAP_WINDOWS][rows][cols];   oldest window first
+ *
+ * padded to 8 bytes; fb_heatmap_size() is the whole record. Writing
+ * anything to the file clears all maps.
+ */
+#ifndef FB_HEATMAP_H
+#define FB_HEATMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define FB_HEATMAP_MAGIC    0x50414d48u     /* 'HMAP' */
+#define FB_HEATMAP_VERSION  1
+#define FB_HEATMAP_BLOCK    32              /* pixels */
+#define FB_HEATMAP_WINDOWS  8
+
+struct fb_heatmap_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block;                 /* FB_HEATMAP_BLOCK */
+    uint32_t dev_minor;
+    uint32_t width, height;         /* framebuffer */
+    uint32_t cols, rows;            /* blocks */
+    uint32_t windows;               /* FB_HEATMAP_WINDOWS */
+    uint32_t window_ms;             /* heatmap_window_ms when read */
+    uint32_t reserved;
+    uint64_t since_ns;              /* CLOCK_MONOTONIC, start of total */
+    uint64_t total_frames;          /* captures compared since then */
+    uint64_t window_start_ns[FB_HEATMAP_WINDOWS];   /* oldest first, 0 = not used yet */
+    uint32_t window_frames[FB_HEATMAP_WINDOWS];
+};
+
+static inline size_t fb_heatmap_size(uint32_t cols, uint32_t rows)
+{
+    size_t blocks = (size_t)cols * rows;
+
+    return sizeof(struct fb_heatmap_header) +
+           ((blocks * 4 + blocks * 2 * FB_HEATMAP_WINDOWS + 7) & ~(size_t)7);
+}
+
+#endif /* FB_HEATMAP_H */
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: MIT
+/* fb_pattern.c – reproducible XRGB8888 test patterns
+ *
+ * Build :  gcc -O2 -c fb_pattern.c
+ */
+
+#include <string.h>
+
+#include "fb_pattern.h"
+
+#define FLASH_HZ        5       /* pulses per second */
+#define SLOW_HZ         3
+#define TEXT_LINES_HZ   4       /* text scroll, lines per second */
+#define CELL_W          8       /* text cell, pixels */
+#define CELL_H          16
+
+static const struct {
+    const char *name;
+    int harmful;
+} patterns[FB_PATTERN_COUNT] = {
+    [FB_PATTERN_GRADIENT] = { "gradient", 0 },
+    [FB_PATTERN_COUNTER]  = { "counter",  0 },
+    [FB_PATTERN_FLASH]    = { "flash",    1 },
+    [FB_PATTERN_SLOW]     = { "slow",     0 },
+    [FB_PATTERN_FAINT]    = { "faint",    0 },
+    [FB_PATTERN_RED]      = { "red",      1 },
+    [FB_PATTERN_TEXT]     = { "text",     0 },
+};
+
+/* 3x5 digits, one bit per pixel, top row in the high bits. */
+static const uint16_t digits[10] = {
+    0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249, 0x7bef, 0x7bcf,
+};
+
+const char *fb_pattern_name(enum fb_pattern p)
+{
+    return (unsigned)p < FB_PATTERN_COUNT ? patterns[p].name : NULL;
+}
+
+int fb_pattern_parse(const char *name)
+{
+    for (int i = 0; i < FB_PATTERN_COUNT; i++)
+        if (!strcmp(name, patterns[i].name))
+            return i;
+    return -1;
+}
+
+int fb_pattern_harmful(enum fb_pattern p)
+{
+    return (unsigned)p < FB_PATTERN_COUNT && patterns[p].harmful;
+}
+
+static inline void put(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+{
+    p[0] = b;
+    p[1] = g;
+    p[2] = r;
+    p[3] = 0;
+}
+
+static inline uint32_t mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Whether frame starts a new 1/hz period, i.e. carries a pulse. */
+static int pulse(uint64_t frame, double fps, unsigned hz)
+{
+    return frame && (uint64_t)(frame * hz / fps) != (uint64_t)((frame - 1) * hz / fps);
+}
+
+static void fill_gradient(uint8_t *px, unsigned w, unsigned h, size_t stride, uint64_t frame)
+{
+    for (unsigned y = 0; y < h; y++) {
+        uint8_t *row = px + y * stride;
+
+        for (unsigned x = 0; x < w; x++)
+            put(row + x * 4, (uint8_t)(x * 256 / w), (uint8_t)(y * 256 / h),
+                (uint8_t)((x + y) / 4 + frame));
+    }
+}
+
+static void fill_counter(uint8_t *px, unsigned w, unsigned h, size_t stride, uint64_t frame)
+{
+    char text[24];
+    unsigned n = 0, scale, x0, y0;
+    uint64_t v = frame;
+
+    do {
+        text[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v && n < sizeof(text));
+
+    /* Each digit is 3x5 cells plus a one-cell gap. */
+    scale = w / (n * 4 + 2);
+    if (scale > h / 7)
+        scale = h / 7;
+    if (!scale)
+        scale = 1;
+    x0 = (w - (n * 4 - 1) * scale) / 2;
+    y0 = (h - 5 * scale) / 2;
+
+    for (unsigned y = 0; y < h; y++) {
+        uint8_t *row = px + y * stride;
+        unsigned cy = (y - y0) / scale;
+
+        for (unsigned x = 0; x < w; x++) {
+            unsigned cx = (x - x0) / scale, d = cx / 4, on = 0;
+
+            if (y >= y0 && cy < 5 && x >= x0 && d < n && cx % 4 < 3)
+                on = digits[text[n - 1 - d] - '0'] >> (14 - cy * 3 - cx % 4) & 1;
+            /* Luminance 0.08 against 0.01: a digit change is never a harmful step. */
+            if (on)
+                put(row + x * 4, 0x50, 0x50, 0x50);
+            else
+                put(row + x * 4, 0x10, 0x18, 0x40);
+        }
+    }
+}
+
+/* Static gradient background with the block at the centre in colour a or b. */
+static void fill_block(uint8_t *px, unsigned w, unsigned h, size_t stride,
+                       int second, const uint8_t a[3], const uint8_t b[3])
+{
+    const uint8_t *c = second ? b : a;
+
+    for (unsigned y = 0; y < h; y++) {
+        uint8_t *row = px + y * stride;
+
+        for (unsigned x = 0; x < w; x++) {
+            if (x >= w * 3 / 8 && x < w * 5 / 8 && y >= h * 3 / 8 && y < h * 5 / 8)
+                put(row + x * 4, c[0], c[1], c[2]);
+            else
+                put(row + x * 4, (uint8_t)(x * 128 / w), 0x40, (uint8_t)(y * 128 / h));
+        }
+    }
+}
+
+static void fill_text(uint8_t *px, unsigned w, unsigned h, size_t stride,
+                      uint64_t frame, double fps)
+{
+    /* Whole-line steps: a pixel never changes on two consecutive frames. */
+    const uint64_t scroll = (uint64_t)(frame * TEXT_LINES_HZ / fps) * CELL_H;
+    const unsigned cols = w / CELL_W;
+
+    for (unsigned y = 0; y < h; y++) {
+        uint8_t *row = px + y * stride;
+        uint64_t vy = y + scroll;
+        uint32_t line = (uint32_t)(vy / CELL_H);
+        unsigned gy = vy % CELL_H;
+        /* Ragged right margin, and a blank line now and then. */
+        unsigned len = mix(line) % 8 == 0 ? 0 : cols / 2 + mix(line ^ 0x5bd1e995) % (cols / 2 + 1);
+
+        for (unsigned x = 0; x < w; x++) {
+            unsigned col = x / CELL_W, gx = x % CELL_W, on = 0;
+            uint32_t glyph = mix(line * 0x9e3779b1u + col);
+
+            /* 5x6 random glyphs, roughly one space in six. */
+            if (col >= 1 && col < len && glyph % 6 && gx >= 1 && gx < 6 && gy >= 5 && gy < 11)
+                on = glyph >> ((gy - 5) * 5 + gx - 1) & 1;
+            if (on)
+                put(row + x * 4, 0x20, 0x20, 0x28);
+            else
+                put(row + x * 4, 0xf8, 0xf8, 0xf4);
+        }
+    }
+}
+
+void fb_pattern_fill(uint8_t *px, unsigned width, unsigned height, size_t stride,
+                     enum fb_pattern p, uint64_t frame, double fps)
+{
+    static const uint8_t black[3] = { 0x00, 0x00, 0x00 };
+    static const uint8_t white[3] = { 0xff, 0xff, 0xff };
+    static const uint8_t grey_lo[3] = { 0x30, 0x30, 0x30 };
+    static const uint8_t grey_hi[3] = { 0x40, 0x40, 0x40 };
+    /* Mid grey has the luminance of pure red, so only the colour flashes. */
+    static const uint8_t red[3] = { 0xff, 0x00, 0x00 };
+    static const uint8_t grey_red[3] = { 0x80, 0x80, 0x80 };
+
+    switch (p) {
+    case FB_PATTERN_GRADIENT:
+        fill_gradient(px, width, height, stride, frame);
+        break;
+    case FB_PATTERN_COUNTER:
+        fill_counter(px, width, height, stride, frame);
+        break;
+    case FB_PATTERN_FLASH:
+        fill_block(px, width, height, stride, pulse(frame, fps, FLASH_HZ), black, white);
+        break;
+    case FB_PATTERN_SLOW:
+        fill_block(px, width, height, stride, pulse(frame, fps, SLOW_HZ), black, white);
+        break;
+    case FB_PATTERN_FAINT:
+        fill_block(px, width, height, stride, frame & 1, grey_lo, grey_hi);
+        break;
+    case FB_PATTERN_RED:
+        fill_block(px, width, height, stride, pulse(frame, fps, FLASH_HZ), grey_red, red);
+        break;
+    case FB_PATTERN_TEXT:
+    default:
+        fill_text(px, width, height, stride, frame, fps);
+        break;
+    }
+}
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+/* fb_pattern.h – reproducible XRGB8888 test patterns
+ *
+ * Every pattern is a pure function of (frame, fps), so a run can be
+ * regenerated bit for bit. The flashing patterns put a block over the
+ * centre quarter of each dimension (1/16 of the screen) and pulse it for
+ * a single frame, which spec.v counts as one flash (two opposing
+ * transitions on consecutive frames):
+ *
+ *   flash  black -> white -> black, 5 times a second: fails B.1/B.4
+ *   slow   the same 3 times a second: within the B.4 limit
+ *   faint  dark grey pulses every other frame: luminance step < 0.1, never harmful
+ *   red    mid grey -> saturated red, 5 times a second: same luminance, fails B.2
+ *
+ * The rest are content with no flashes: their changes stay below the
+ * 0.1 luminance step or never reverse on the next frame.
+ */
+#ifndef FB_PATTERN_H
+#define FB_PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum fb_pattern {
+    FB_PATTERN_GRADIENT = 0,    /* diagonal gradient drifting one step per frame */
+    FB_PATTERN_COUNTER,         /* frame number in large low-contrast digits */
+    FB_PATTERN_FLASH,
+    FB_PATTERN_SLOW,
+    FB_PATTERN_FAINT,
+    FB_PATTERN_RED,
+    FB_PATTERN_TEXT,            /* lines of glyphs on white, scrolling a line at a time */
+    FB_PATTERN_COUNT
+};
+
+/* Name as accepted on command lines, or NULL. */
+const char *fb_pattern_name(enum fb_pattern p);
+/* Pattern for name, or -1. */
+int fb_pattern_parse(const char *name);
+/* Whether the pattern is meant to fail the spec.v flash checks. */
+int fb_pattern_harmful(enum fb_pattern p);
+
+/* Render frame number frame into px, stride bytes between rows. */
+void fb_pattern_fill(uint8_t *px, unsigned width, unsigned height, size_t stride,
+                     enum fb_pattern p, uint64_t frame, double fps);
+
+#endif /* FB_PATTERN_H */
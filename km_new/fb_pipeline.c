@@ -0,0 +1,801 @@
+// SPDX-License-Identifier: MIT
+/* fb_pipeline.c – place a capture pipeline's stages on CPUs and run it
+ *
+ * Build :  gcc -O2 fb_pipeline.c fb_plan.c fb_source.c fbrec.c fb_detile.c -o fb_pipeline
+ * Usage :  fb_pipeline [-n] [-i seconds] <pipeline.conf>
+ *
+ * Replaces hand-written `parallel ::: 'taskset -c 2 ...' 'taskset -c 3 ...'`
+ * recipes. Each line of the config is one stage:
+ *
+ *   # name    cpus  policy        command
+ *   capture   1     other:-5      @workqueue
+ *   analyze   2     fifo:40       ./flash_analyze -N -f 60 1920 1080 7680 L /proc/drm_fb_raw
+ *   encode    2     other         ffmpeg -f rawvideo -pixel_format bgr0 ... out.mkv
+ *   option    mlock
+ *
+ * cpus is a number of cores for the planner to choose, or =LIST (e.g.
+ * =4-5) to fix them. policy is other[:nice], batch, idle, fifo:PRIO,
+ * rr:PRIO or deadline:RUNTIME/PERIOD in microseconds; deadline falls back
+ * to fifo:50 when the kernel refuses it, which it does for tasks with a
+ * restricted affinity unless the root domain is partitioned. @workqueue
+ * stands for the module's capture workqueue: its cpumask and nice value
+ * are set through sysfs and restored on exit. Any other command is run by
+ * /bin/sh in its own process group.
+ *
+ * Options: mlock (raise RLIMIT_MEMLOCK and have stages lock their memory),
+ * smt (let stages use both hardware threads of a core), node N (prefer
+ * node N over the capture node), noreserve (allow CPU 0's core).
+ *
+ * The planner reads the topology from sysfs. Stages get whole physical
+ * cores, with the sibling threads left idle, so a stage never competes with
+ * another for a core's execution units. Stages are kept within one L3
+ * domain, on the NUMA node the module captures on, where there is room.
+ * The core of CPU 0, which takes most housekeeping interrupts, is left out.
+ * Consecutive stages get neighbouring cores.
+ *
+ * Every -i seconds (default 1) each stage reports its CPU use, the time
+ * its threads spent runnable but waiting for a CPU, per time slice, and
+ * how many threads ran outside their planned CPUs. -n prints the plan
+ * without running anything. SIGINT is forwarded to every stage.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "fb_plan.h"
+#include "fb_source.h"
+
+#define NS_PER_SEC          1000000000ull
+#define MAX_STAGES          16
+#define MAX_CORES           1024
+#define MAX_CMD             1024
+#define SYSFS_CPU           "/sys/devices/system/cpu"
+#define SYSFS_NODE          "/sys/devices/system/node"
+#define SYSFS_WQ            "/sys/devices/virtual/workqueue/drm_fb_capture"
+#define FALLBACK_FIFO_PRIO  50
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE      6
+#endif
+
+/* Not in every libc's headers. */
+struct sched_attr_v0 {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t  sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+struct core {
+    int first;                      /* lowest CPU of the core */
+    cpu_set_t threads;
+    int l3, node;
+};
+
+struct policy {
+    int kind;                       /* SCHED_* */
+    int value;                      /* nice, or RT priority */
+    uint64_t runtime_us, period_us;
+};
+
+struct stage {
+    char name[32];
+    int ncores;                     /* 0 when cpus were given */
+    cpu_set_t cpus;
+    struct policy pol;
+    char cmd[MAX_CMD];
+    int workqueue;
+
+    pid_t pid;
+    int status;
+    uint64_t run_ns, wait_ns, slices;
+};
+
+struct pipeline {
+    struct stage st[MAX_STAGES];
+    int count;
+    int mlock, smt, node, reserve;
+    char wq_saved_mask[256], wq_saved_nice[16];
+};
+
+static struct core cores[MAX_CORES];
+static int ncores;
+static volatile sig_atomic_t interrupted;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -errno;
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -EIO;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int write_line(const char *path, const char *s)
+{
+    FILE *f = fopen(path, "w");
+    int ret = 0;
+
+    if (!f)
+        return -errno;
+    if (fputs(s, f) < 0)
+        ret = -EIO;
+    if (fclose(f) && !ret)
+        ret = -errno;
+    return ret;
+}
+
+/* Topology */
+
+/* CPU -> node, from the node directories; all 0 without them. */
+static void load_nodes(int *node_of)
+{
+    char path[300], list[4096];
+    struct dirent *de;
+    cpu_set_t set;
+    DIR *dir;
+    int n;
+
+    memset(node_of, 0, CPU_SETSIZE * sizeof(*node_of));
+    dir = opendir(SYSFS_NODE);
+    if (!dir)
+        return;
+    while ((de = readdir(dir))) {
+        if (sscanf(de->d_name, "node%d", &n) != 1)
+            continue;
+        snprintf(path, sizeof(path), SYSFS_NODE "/%s/cpulist", de->d_name);
+        if (read_line(path, list, sizeof(list)) || fb_cpulist_parse(list, &set))
+            continue;
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set))
+                node_of[c] = n;
+        }
+    }
+    closedir(dir);
+}
+
+static int load_topology(void)
+{
+    char path[128], list[4096];
+    static int node_of[CPU_SETSIZE];
+    cpu_set_t online, seen;
+    int ret;
+
+    ret = read_line(SYSFS_CPU "/online", list, sizeof(list));
+    if (!ret)
+        ret = fb_cpulist_parse(list, &online);
+    if (ret)
+        return ret;
+    load_nodes(node_of);
+
+    CPU_ZERO(&seen);
+    for (int c = 0; c < CPU_SETSIZE && ncores < MAX_CORES; c++) {
+        struct core *k = &cores[ncores];
+
+        if (!CPU_ISSET(c, &online) || CPU_ISSET(c, &seen))
+            continue;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", c);
+        if (read_line(path, list, sizeof(list)) || fb_cpulist_parse(list, &k->threads)) {
+            CPU_ZERO(&k->threads);
+            CPU_SET(c, &k->threads);
+        }
+        CPU_AND(&k->threads, &k->threads, &online);
+        CPU_OR(&seen, &seen, &k->threads);
+        k->first = c;
+
+        /* index3 is the L3 on x86 and most arm64; without it everything shares one */
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index3/id", c);
+        k->l3 = read_line(path, list, sizeof(list)) ? 0 : atoi(list);
+        k->node = node_of[c];
+        ncores++;
+    }
+    return ncores ? 0 : -ENODEV;
+}
+
+/* Config */
+
+static int parse_policy(const char *s, struct policy *p)
+{
+    memset(p, 0, sizeof(*p));
+    if (!strncmp(s, "other", 5)) {
+        p->kind = SCHED_OTHER;
+        p->value = s[5] == ':' ? atoi(s + 6) : 0;
+        return s[5] && s[5] != ':' ? -EINVAL : 0;
+    }
+    if (!strcmp(s, "batch")) {
+        p->kind = SCHED_BATCH;
+        return 0;
+    }
+    if (!strcmp(s, "idle")) {
+        p->kind = SCHED_IDLE;
+        return 0;
+    }
+    if (!strncmp(s, "fifo:", 5) || !strncmp(s, "rr:", 3)) {
+        p->kind = s[0] == 'f' ? SCHED_FIFO : SCHED_RR;
+        p->value = atoi(strchr(s, ':') + 1);
+        return p->value >= 1 && p->value <= 99 ? 0 : -EINVAL;
+    }
+    if (sscanf(s, "deadline:%" SCNu64 "/%" SCNu64, &p->runtime_us, &p->period_us) == 2) {
+        p->kind = SCHED_DEADLINE;
+        return p->runtime_us && p->runtime_us <= p->period_us ? 0 : -EINVAL;
+    }
+    return -EINVAL;
+}
+
+static void format_policy(const struct policy *p, char *buf, size_t len)
+{
+    switch (p->kind) {
+    case SCHED_FIFO:     snprintf(buf, len, "fifo:%d", p->value); break;
+    case SCHED_RR:       snprintf(buf, len, "rr:%d", p->value); break;
+    case SCHED_BATCH:    snprintf(buf, len, "batch"); break;
+    case SCHED_IDLE:     snprintf(buf, len, "idle"); break;
+    case SCHED_DEADLINE: snprintf(buf, len, "deadline:%llu/%llu",
+                                  (unsigned long long)p->runtime_us,
+                                  (unsigned long long)p->period_us); break;
+    default:             snprintf(buf, len, "other:%d", p->value); break;
+    }
+}
+
+static int load_config(struct pipeline *pl, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[MAX_CMD + 128];
+    int lineno = 0;
+
+    if (!f)
+        return -errno;
+    pl->node = -1;
+    pl->reserve = 1;
+    while (fgets(line, sizeof(line), f)) {
+        char name[32], cpus[64], pol[64];
+        int used = 0;
+
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        if (sscanf(line, "%31s", name) != 1)
+            continue;
+
+        if (!strcmp(name, "option")) {
+            char opt[32];
+            int n;
+
+            if (sscanf(line, "%*s %31s", opt) != 1)
+                goto bad;
+            if (!strcmp(opt, "mlock"))
+                pl->mlock = 1;
+            else if (!strcmp(opt, "smt"))
+                pl->smt = 1;
+            else if (!strcmp(opt, "noreserve"))
+                pl->reserve = 0;
+            else if (!strcmp(opt, "node") && sscanf(line, "%*s %*s %d", &n) == 1)
+                pl->node = n;
+            else
+                goto bad;
+            continue;
+        }
+
+        struct stage *s = &pl->st[pl->count];
+
+        if (pl->count == MAX_STAGES) {
+            fprintf(stderr, "%s:%d: more than %d stages\n", path, lineno, MAX_STAGES);
+            fclose(f);
+            return -E2BIG;
+        }
+        if (sscanf(line, "%31s %63s %63s %n", s->name, cpus, pol, &used) != 3 || !line[used])
+            goto bad;
+        if (cpus[0] == '=') {
+            if (fb_cpulist_parse(cpus + 1, &s->cpus) || !CPU_COUNT(&s->cpus))
+                goto bad;
+        } else if ((s->ncores = atoi(cpus)) <= 0) {
+            goto bad;
+        }
+        if (parse_policy(pol, &s->pol))
+            goto bad;
+        snprintf(s->cmd, sizeof(s->cmd), "%s", line + used);
+        s->cmd[strcspn(s->cmd, "\r")] = '\0';
+        s->workqueue = !strcmp(s->cmd, "@workqueue");
+        s->pid = -1;
+        pl->count++;
+    }
+    fclose(f);
+    return pl->count ? 0 : -ENOENT;
+bad:
+    fprintf(stderr, "%s:%d: cannot parse \"%s\"\n", path, lineno, line);
+    fclose(f);
+    return -EINVAL;
+}
+
+/* Planning */
+
+static int home_l3, home_node;
+
+/* Cores on the home node and L3 first, then by distance from there. */
+static int core_rank(const struct core *k)
+{
+    return (k->node != home_node) * 2 + (k->l3 != home_l3);
+}
+
+static int cmp_core(const void *a, const void *b)
+{
+    const struct core *x = a, *y = b;
+    int rx = core_rank(x), ry = core_rank(y);
+
+    if (rx != ry)
+        return rx - ry;
+    if (x->node != y->node)
+        return x->node - y->node;
+    if (x->l3 != y->l3)
+        return x->l3 - y->l3;
+    return x->first - y->first;
+}
+
+static int plan(struct pipeline *pl)
+{
+    cpu_set_t taken;
+    int want = 0, next = 0, reserved = -1;
+
+    CPU_ZERO(&taken);
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->st[i].ncores)
+            want += pl->st[i].ncores;
+        else
+            CPU_OR(&taken, &taken, &pl->st[i].cpus);
+    }
+
+    home_node = pl->node >= 0 ? pl->node : fb_capture_node();
+    if (home_node < 0)
+        home_node = cores[0].node;
+
+    /* The home L3 is the one on the home node with the most free cores. */
+    int best = -1;
+
+    for (int i = 0; i < ncores; i++) {
+        int free = 0;
+
+        if (cores[i].node != home_node)
+            continue;
+        for (int j = 0; j < ncores; j++)
+            free += cores[j].node == home_node && cores[j].l3 == cores[i].l3 &&
+                    !(pl->reserve && cores[j].first == 0) &&
+                    !CPU_ISSET(cores[j].first, &taken);
+        if (free > best) {
+            best = free;
+            home_l3 = cores[i].l3;
+        }
+    }
+    qsort(cores, ncores, sizeof(cores[0]), cmp_core);
+
+    for (int i = 0; i < ncores; i++) {
+        if (pl->reserve && CPU_ISSET(0, &cores[i].threads) && ncores > 1)
+            reserved = i;
+    }
+
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *s = &pl->st[i];
+        int got = 0;
+
+        if (!s->ncores)
+            continue;
+        CPU_ZERO(&s->cpus);
+        while (got < s->ncores && next < ncores) {
+            struct core *k = &cores[next++];
+            cpu_set_t busy;
+
+            CPU_AND(&busy, &k->threads, &taken);
+            if (next - 1 == reserved || CPU_COUNT(&busy))
+                continue;
+            if (pl->smt)
+                CPU_OR(&s->cpus, &s->cpus, &k->threads);
+            else
+                CPU_SET(k->first, &s->cpus);
+            CPU_OR(&taken, &taken, &k->threads);
+            got++;
+        }
+        if (got < s->ncores) {
+            fprintf(stderr, "%s: wants %d cores, %d left (%d asked for in all)\n",
+                    s->name, s->ncores, got, want);
+            return -ENOSPC;
+        }
+    }
+    return 0;
+}
+
+static const struct core *core_of(int cpu)
+{
+    for (int i = 0; i < ncores; i++) {
+        if (CPU_ISSET(cpu, &cores[i].threads))
+            return &cores[i];
+    }
+    return NULL;
+}
+
+static void print_plan(const struct pipeline *pl)
+{
+    int l3s = 0, nodes = 0, cpus = 0;
+
+    for (int i = 0; i < ncores; i++) {
+        int new_l3 = 1, new_node = 1;
+
+        cpus += CPU_COUNT(&cores[i].threads);
+        for (int j = 0; j < i; j++) {
+            new_l3 &= cores[j].l3 != cores[i].l3 || cores[j].node != cores[i].node;
+            new_node &= cores[j].node != cores[i].node;
+        }
+        l3s += new_l3;
+        nodes += new_node;
+    }
+    printf("topology: %d CPUs, %d cores, %d L3 domains, %d nodes; home node %d, L3 %d\n",
+           cpus, ncores, l3s, nodes, home_node, home_l3);
+
+    for (int i = 0; i < pl->count; i++) {
+        const struct stage *s = &pl->st[i];
+        char list[256], pol[48], where[64] = "";
+        const struct core *k;
+
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &s->cpus) && (k = core_of(c))) {
+                snprintf(where, sizeof(where), "node %d, L3 %d", k->node, k->l3);
+                break;
+            }
+        }
+        format_policy(&s->pol, pol, sizeof(pol));
+        printf("%-10s cpus %-12s %-20s %-16s %s\n", s->name,
+               fb_cpulist_format(&s->cpus, list, sizeof(list)), pol, where, s->cmd);
+    }
+    if (pl->mlock)
+        printf("memory locked\n");
+}
+
+/* Running */
+
+static int set_policy(pid_t pid, const struct policy *p)
+{
+    struct sched_param sp = { .sched_priority = p->value };
+
+    switch (p->kind) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return sched_setscheduler(pid, p->kind, &sp) ? -errno : 0;
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        sp.sched_priority = 0;
+        return sched_setscheduler(pid, p->kind, &sp) ? -errno : 0;
+    case SCHED_DEADLINE: {
+        struct sched_attr_v0 attr = {
+            .size = sizeof(attr),
+            .sched_policy = SCHED_DEADLINE,
+            .sched_runtime = p->runtime_us * 1000,
+            .sched_deadline = p->period_us * 1000,
+            .sched_period = p->period_us * 1000,
+        };
+        struct policy fallback = { .kind = SCHED_FIFO, .value = FALLBACK_FIFO_PRIO };
+
+        if (!syscall(SYS_sched_setattr, pid, &attr, 0))
+            return 0;
+        fprintf(stderr, "SCHED_DEADLINE refused (%s), using fifo:%d\n",
+                strerror(errno), FALLBACK_FIFO_PRIO);
+        return set_policy(pid, &fallback);
+    }
+    default:
+        return setpriority(PRIO_PROCESS, pid, p->value) ? -errno : 0;
+    }
+}
+
+static int cpumask_hex(const cpu_set_t *set, char *buf, size_t len)
+{
+    int top = 0;
+    size_t n = 0;
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, set))
+            top = c;
+    }
+    /* 32-bit words, most significant first, as sysfs prints them */
+    for (int w = top / 32; w >= 0; w--) {
+        uint32_t word = 0;
+
+        for (int b = 0; b < 32; b++)
+            word |= (uint32_t)!!CPU_ISSET(w * 32 + b, set) << b;
+        n += snprintf(buf + (n < len ? n : len), n < len ? len - n : 0,
+                      w ? "%08x," : "%08x", word);
+    }
+    return n < len ? 0 : -ENAMETOOLONG;
+}
+
+static int start_workqueue(struct pipeline *pl, struct stage *s)
+{
+    char mask[256], nice[16];
+    int ret;
+
+    if (s->pol.kind != SCHED_OTHER)
+        fprintf(stderr, "%s: workqueues only take a nice value, policy ignored\n", s->name);
+    read_line(SYSFS_WQ "/cpumask", pl->wq_saved_mask, sizeof(pl->wq_saved_mask));
+    read_line(SYSFS_WQ "/nice", pl->wq_saved_nice, sizeof(pl->wq_saved_nice));
+
+    ret = cpumask_hex(&s->cpus, mask, sizeof(mask));
+    if (!ret)
+        ret = write_line(SYSFS_WQ "/cpumask", mask);
+    if (!ret && s->pol.kind == SCHED_OTHER) {
+        snprintf(nice, sizeof(nice), "%d", s->pol.value);
+        ret = write_line(SYSFS_WQ "/nice", nice);
+    }
+    if (ret)
+        fprintf(stderr, "%s: %s: %s\n", s->name, SYSFS_WQ, strerror(-ret));
+    return ret;
+}
+
+static void restore_workqueue(struct pipeline *pl)
+{
+    if (pl->wq_saved_mask[0])
+        write_line(SYSFS_WQ "/cpumask", pl->wq_saved_mask);
+    if (pl->wq_saved_nice[0])
+        write_line(SYSFS_WQ "/nice", pl->wq_saved_nice);
+}
+
+static int start_stage(const struct pipeline *pl, struct stage *s)
+{
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return -errno;
+    if (pid > 0) {
+        s->pid = pid;
+        return 0;
+    }
+
+    /* Child: its own process group, so the terminal's SIGINT comes from us. */
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (sched_setaffinity(0, sizeof(s->cpus), &s->cpus))
+        fprintf(stderr, "%s: sched_setaffinity: %s\n", s->name, strerror(errno));
+    if (set_policy(0, &s->pol))
+        fprintf(stderr, "%s: cannot set scheduling policy: %s\n", s->name, strerror(errno));
+    if (pl->mlock) {
+        struct rlimit lim = { RLIM_INFINITY, RLIM_INFINITY };
+
+        if (setrlimit(RLIMIT_MEMLOCK, &lim))
+            fprintf(stderr, "%s: RLIMIT_MEMLOCK: %s\n", s->name, strerror(errno));
+        setenv(FB_PLAN_ENV_MLOCK, "1", 1);
+    }
+    setenv(FB_PLAN_ENV_STAGE, s->name, 1);
+
+    char cmd[MAX_CMD + 8];
+
+    snprintf(cmd, sizeof(cmd), "exec %s", s->cmd);
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    fprintf(stderr, "%s: /bin/sh: %s\n", s->name, strerror(errno));
+    _exit(127);
+}
+
+/* Monitoring */
+
+struct thread_sample {
+    uint64_t run_ns, wait_ns, slices;
+    int threads, misplaced;
+};
+
+/* Sum schedstat over the stage's threads and check where each last ran. */
+static void sample_stage(const struct stage *s, struct thread_sample *t)
+{
+    char path[64], line[1024];
+    struct dirent *de;
+    DIR *dir;
+
+    memset(t, 0, sizeof(*t));
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)s->pid);
+    dir = opendir(path);
+    if (!dir)
+        return;
+    while ((de = readdir(dir))) {
+        unsigned long long run, wait, slices;
+        char tpath[96], *p;
+        int cpu = -1;
+
+        if (!isdigit((unsigned char)de->d_name[0]))
+            continue;
+        snprintf(tpath, sizeof(tpath), "%s/%.20s/schedstat", path, de->d_name);
+        if (read_line(tpath, line, sizeof(line)) ||
+            sscanf(line, "%llu %llu %llu", &run, &wait, &slices) != 3)
+            continue;
+        t->run_ns += run;
+        t->wait_ns += wait;
+        t->slices += slices;
+        t->threads++;
+
+        /* stat: "pid (comm) state ..." with processor the 39th field */
+        snprintf(tpath, sizeof(tpath), "%s/%.20s/stat", path, de->d_name);
+        if (read_line(tpath, line, sizeof(line)) || !(p = strrchr(line, ')')))
+            continue;
+        p += 2;
+        for (int field = 3; field < 39 && p; field++) {
+            p = strchr(p, ' ');
+            if (p)
+                p++;
+        }
+        if (p && sscanf(p, "%d", &cpu) == 1 && cpu >= 0 && !CPU_ISSET(cpu, &s->cpus))
+            t->misplaced++;
+    }
+    closedir(dir);
+}
+
+static void report(struct pipeline *pl, uint64_t interval_ns)
+{
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *s = &pl->st[i];
+        struct thread_sample t;
+
+        if (s->workqueue || s->pid <= 0)
+            continue;
+        sample_stage(s, &t);
+        if (!t.threads)
+            continue;
+
+        const uint64_t run = t.run_ns - s->run_ns, wait = t.wait_ns - s->wait_ns;
+        const uint64_t slices = t.slices - s->slices;
+        const double cap = (double)interval_ns * CPU_COUNT(&s->cpus);
+
+        printf("%-10s run %5.1f%%  wait %5.1f%% (%.3f ms/slice)  %d threads, %d off-plan\n",
+               s->name, 100.0 * run / cap, 100.0 * wait / cap,
+               slices ? wait / 1e6 / slices : 0.0, t.threads, t.misplaced);
+        s->run_ns = t.run_ns;
+        s->wait_ns = t.wait_ns;
+        s->slices = t.slices;
+    }
+    fflush(stdout);
+}
+
+/* Reap what has exited; returns how many stages still run. */
+static int reap(struct pipeline *pl)
+{
+    int running = 0;
+
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *s = &pl->st[i];
+
+        if (s->pid <= 0)
+            continue;
+        if (waitpid(s->pid, &s->status, WNOHANG) == s->pid) {
+            if (WIFEXITED(s->status))
+                printf("%s: exited with %d\n", s->name, WEXITSTATUS(s->status));
+            else
+                printf("%s: killed by signal %d\n", s->name, WTERMSIG(s->status));
+            s->pid = 0;
+            continue;
+        }
+        running++;
+    }
+    return running;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n] [-i seconds] <pipeline.conf>\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static struct pipeline pl;
+    double interval = 1.0;
+    int dry_run = 0, failed = 0;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "ni:")) != -1) {
+        switch (opt) {
+        case 'n': dry_run = 1; break;
+        case 'i': interval = atof(optarg); break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1 || interval <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ret = load_config(&pl, argv[optind]);
+    if (ret) {
+        if (ret != -EINVAL)
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    ret = load_topology();
+    if (!ret)
+        ret = plan(&pl);
+    if (ret) {
+        if (ret != -ENOSPC)
+            fprintf(stderr, "topology: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    print_plan(&pl);
+    fflush(stdout);
+    if (dry_run)
+        return EXIT_SUCCESS;
+
+    struct sigaction sa = { .sa_handler = on_signal };
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (int i = 0; i < pl.count && !ret; i++) {
+        struct stage *s = &pl.st[i];
+
+        /* Without the module there is no workqueue to place; run the rest anyway. */
+        if (s->workqueue) {
+            start_workqueue(&pl, s);
+            continue;
+        }
+        ret = start_stage(&pl, s);
+        if (ret)
+            fprintf(stderr, "%s: fork: %s\n", s->name, strerror(-ret));
+    }
+
+    const uint64_t interval_ns = (uint64_t)(interval * NS_PER_SEC);
+    uint64_t next = now_ns() + interval_ns;
+    int forwarded = 0;
+
+    while (reap(&pl)) {
+        struct timespec ts = { 0, 50 * 1000 * 1000 };
+
+        if ((interrupted || ret) && !forwarded) {
+            for (int i = 0; i < pl.count; i++) {
+                if (pl.st[i].pid > 0)
+                    kill(-pl.st[i].pid, SIGINT);
+            }
+            forwarded = 1;
+        }
+        nanosleep(&ts, NULL);
+        if (now_ns() >= next) {
+            report(&pl, interval_ns);
+            next += interval_ns;
+        }
+    }
+
+    for (int i = 0; i < pl.count; i++) {
+        const struct stage *s = &pl.st[i];
+
+        /* Dying of the SIGINT we forwarded is a normal end. */
+        if (WIFSIGNALED(s->status))
+            failed |= !forwarded || WTERMSIG(s->status) != SIGINT;
+        else
+            failed |= !s->workqueue && WEXITSTATUS(s->status);
+    }
+    restore_workqueue(&pl);
+    return ret || failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: MIT
+/* fb_plan.c – the consumer side of fb_pipeline's CPU placement
+ *
+ * Build :  gcc -O2 -c fb_plan.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "fb_plan.h"
+
+int fb_cpulist_parse(const char *p, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+
+        if (end == p || lo < 0)
+            return -EINVAL;
+        if (*end == '-') {
+            const char *q = end + 1;
+
+            hi = strtol(q, &end, 10);
+            if (end == q || hi < lo)
+                return -EINVAL;
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        if (*end && *end != ',' && *end != '\n')
+            return -EINVAL;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+char *fb_cpulist_format(const cpu_set_t *set, char *buf, size_t len)
+{
+    size_t n = 0;
+
+    buf[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        int e = c;
+
+        if (!CPU_ISSET(c, set))
+            continue;
+        while (e + 1 < CPU_SETSIZE && CPU_ISSET(e + 1, set))
+            e++;
+        n += snprintf(buf + (n < len ? n : len), n < len ? len - n : 0,
+                      e > c ? "%s%d-%d" : "%s%d", n ? "," : "", c, e);
+        c = e;
+    }
+    return buf;
+}
+
+int fb_plan_stage_setup(void)
+{
+    if (!getenv(FB_PLAN_ENV_MLOCK))
+        return 0;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        int ret = -errno;
+
+        fprintf(stderr, "mlockall: %s\n", strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
+
+int fb_plan_pin_worker(unsigned index)
+{
+    cpu_set_t stage, one;
+    int count, c;
+
+    if (!getenv(FB_PLAN_ENV_STAGE))
+        return 0;
+    if (sched_getaffinity(0, sizeof(stage), &stage))
+        return -errno;
+    count = CPU_COUNT(&stage);
+    if (!count)
+        return -EINVAL;
+
+    index %= count;
+    for (c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &stage) && !index--)
+            break;
+    }
+    CPU_ZERO(&one);
+    CPU_SET(c, &one);
+    /* On Linux this is the calling thread, not the whole process. */
+    if (sched_setaffinity(0, sizeof(one), &one))
+        return -errno;
+    return 0;
+}
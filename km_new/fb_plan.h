@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: MIT
+/* fb_plan.h – the consumer side of fb_pipeline's CPU placement
+ *
+ * fb_pipeline starts every stage with its affinity and scheduling policy
+ * already set. Two things can only be done from inside the stage, and it
+ * asks for them through the environment:
+ *
+ *   FB_PLAN_STAGE   stage name; worker threads pin one per planned CPU
+ *   FB_PLAN_MLOCK   lock all current and future memory
+ *
+ * Tools call fb_plan_stage_setup() early and fb_plan_pin_worker() from
+ * each worker thread. Both do nothing outside fb_pipeline. Users need
+ * _GNU_SOURCE for cpu_set_t.
+ */
+#ifndef FB_PLAN_H
+#define FB_PLAN_H
+
+#include <stddef.h>
+#include <sched.h>
+
+#define FB_PLAN_ENV_STAGE   "FB_PLAN_STAGE"
+#define FB_PLAN_ENV_MLOCK   "FB_PLAN_MLOCK"
+
+/* "0-3,8,10-11" -> set. Negative errno on a malformed list. */
+int fb_cpulist_parse(const char *list, cpu_set_t *set);
+/* The reverse, into buf; returns buf. */
+char *fb_cpulist_format(const cpu_set_t *set, char *buf, size_t len);
+
+/* Lock memory if the planner asked for it. */
+int fb_plan_stage_setup(void);
+/* Pin the calling thread to the index-th CPU (modulo their number) of the stage. */
+int fb_plan_pin_worker(unsigned index);
+
+#endif /* FB_PLAN_H */
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: MIT
+/* fb_replay.c – replay frames into the flash analyzer at a fixed refresh rate
+ *
+ * Build :  gcc -O2 fb_replay.c fb_source.c flash_regions.c flash_analyzer.c fbrec.c fb_plan.c -lm -lpthread -o fb_replay
+ * Usage :  fb_replay [-r hz,hz,...] [-t seconds] [-R regions.conf] [-g] -s WxH[,WxH...]
+ *          fb_replay [-r hz,hz,...] [-t seconds] [-R regions.conf] [-g] <recording.fbrec>
+ *
+ * Frames are handed to the analysis at each tick of a timerfd running at the
+ * target rate, exactly as a live consumer of /proc/drm_fb_raw would see them
+ * arrive. For every rate the tool reports per-frame analysis time, deadline
+ * misses (analysis not finished before the next tick), ticks that expired
+ * while the analysis was still busy (dropped frames) and lag from tick to
+ * result. A rate is sustainable when fewer than 1% of its ticks miss or
+ * drop; the highest sustainable rate is reported per resolution.
+ *
+ * -s replays synthetic linear frames with a flashing block, one run per
+ * resolution; a recording is looped if it is shorter than -t.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "fb_source.h"
+#include "flash_regions.h"
+#include "fb_plan.h"
+
+#define NS_PER_SEC          1000000000ull
+#define MAX_RATES           16
+#define MAX_SIZES           8
+#define SUSTAIN_PERMILLE    10          /* at most 1% of ticks missed or dropped */
+#define DEFAULT_DIAG_IN     24.0
+#define DEFAULT_VIEW_DIST_IN 24.0
+
+struct replay_result {
+    uint64_t ticks;             /* timer periods covered by the run */
+    uint64_t frames;            /* frames analysed */
+    uint64_t missed;            /* analysis finished after the next tick */
+    uint64_t dropped;           /* ticks that expired while busy */
+    uint64_t *busy_ns;          /* per-frame analysis time */
+    uint64_t max_lag_ns;        /* tick to analysis result */
+    uint64_t sum_lag_ns;
+    uint64_t alarms;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(uint64_t *v, uint64_t n, unsigned pct)
+{
+    if (!n)
+        return 0;
+    return v[(n - 1) * pct / 100];
+}
+
+static int setup_regions(struct fa_region_set *set, const char *conf, unsigned w,
+                         unsigned h, uint32_t format, int red)
+{
+    int ret;
+
+    memset(set, 0, sizeof(*set));
+    if (conf)
+        ret = fa_regions_load(set, conf, DEFAULT_VIEW_DIST_IN);
+    else
+        ret = fa_regions_add(set, "fb", 0, 0, w, h, DEFAULT_DIAG_IN, DEFAULT_VIEW_DIST_IN);
+    if (ret)
+        return ret;
+
+    for (unsigned i = 0; i < set->count; i++) {
+        struct fa_region *r = &set->regions[i];
+        if (r->x > w || r->width > w - r->x || r->y > h || r->height > h - r->y)
+            return -ERANGE;
+    }
+    set->format = format;
+    set->fb_height = h;
+    return fa_regions_start(set, red);
+}
+
+/*
+ * One run at rate hz. Each read() of the timerfd returns the number of
+ * periods that expired since the last one; more than one means the previous
+ * frame overran and the ticks in between were never serviced.
+ */
+static int replay_rate(struct fb_source *src, const char *conf, int red, double hz,
+                       double seconds, struct replay_result *res)
+{
+    static struct fa_region_set set;
+    const uint64_t period = (uint64_t)(NS_PER_SEC / hz);
+    const uint64_t total = (uint64_t)(seconds * hz);
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = period / NS_PER_SEC, .tv_nsec = period % NS_PER_SEC },
+    };
+    uint64_t start, tick = 0;
+    int tfd, ret;
+
+    memset(res, 0, sizeof(*res));
+    res->busy_ns = calloc(total ? total : 1, sizeof(*res->busy_ns));
+    if (!res->busy_ns)
+        return -ENOMEM;
+
+    ret = setup_regions(&set, conf, src->width, src->height, src->format, red);
+    if (ret)
+        return ret;
+    ret = fb_source_rewind(src);
+    if (ret)
+        goto out_stop;
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd < 0) {
+        ret = -errno;
+        goto out_stop;
+    }
+    start = now_ns() + period;
+    its.it_value.tv_sec = start / NS_PER_SEC;
+    its.it_value.tv_nsec = start % NS_PER_SEC;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        ret = -errno;
+        goto out_close;
+    }
+
+    while (tick < total) {
+        struct fb_frame f;
+        uint64_t expirations, due, t0, t1;
+
+        if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            goto out_close;
+        }
+        tick += expirations;
+        res->dropped += expirations - 1;
+        /* The frame belongs to the most recent tick; older ones were dropped. */
+        due = start + (tick - 1) * period;
+
+        ret = fb_source_next(src, &f);
+        if (ret == 0) {
+            ret = fb_source_rewind(src);
+            if (!ret)
+                ret = fb_source_next(src, &f);
+            if (ret == 0)
+                ret = -ENODATA;
+        }
+        if (ret < 0)
+            goto out_close;
+
+        t0 = now_ns();
+        fa_regions_process(&set, f.data, f.pitch, fa_tiling_from_modifier(f.modifier),
+                           (tick - 1) * period);
+        t1 = now_ns();
+
+        res->busy_ns[res->frames++] = t1 - t0;
+        if (t1 > due + period)
+            res->missed++;
+        if (t1 - due > res->max_lag_ns)
+            res->max_lag_ns = t1 - due;
+        res->sum_lag_ns += t1 - due;
+    }
+    ret = 0;
+    res->ticks = tick;
+    for (unsigned i = 0; i < set.count; i++)
+        res->alarms += set.regions[i].stats.alarms;
+
+out_close:
+    close(tfd);
+out_stop:
+    fa_regions_stop(&set);
+    return ret;
+}
+
+static int sustainable(const struct replay_result *res)
+{
+    return (res->missed + res->dropped) * 1000 <= res->ticks * SUSTAIN_PERMILLE;
+}
+
+static int parse_rates(const char *s, double *rates)
+{
+    int n = 0;
+    char *end;
+
+    while (*s && n < MAX_RATES) {
+        rates[n] = strtod(s, &end);
+        if (end == s || rates[n] <= 0)
+            return -EINVAL;
+        n++;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static int parse_sizes(const char *s, unsigned (*sizes)[2])
+{
+    int n = 0;
+
+    while (*s && n < MAX_SIZES) {
+        int used = 0;
+
+        if (sscanf(s, "%ux%u%n", &sizes[n][0], &sizes[n][1], &used) != 2 ||
+            !sizes[n][0] || !sizes[n][1])
+            return -EINVAL;
+        n++;
+        s += used;
+        if (*s == ',')
+            s++;
+    }
+    return n;
+}
+
+static int sweep(struct fb_source *src, const char *conf, int red, const double *rates,
+                 int nrates, double seconds)
+{
+    double best = 0;
+
+    printf("%ux%u %s\n", src->width, src->height,
+           src->kind == FB_SOURCE_SYNTH ? "synthetic" : "recording");
+    printf("  %7s %8s %9s %9s %9s %7s %7s %9s %9s\n", "rate", "frames", "busy p50",
+           "busy p99", "busy max", "missed", "dropped", "lag avg", "lag max");
+
+    for (int i = 0; i < nrates; i++) {
+        struct replay_result res;
+        int ret = replay_rate(src, conf, red, rates[i], seconds, &res);
+
+        if (ret) {
+            fprintf(stderr, "replay at %.0f Hz failed: %s\n", rates[i], strerror(-ret));
+            free(res.busy_ns);
+            return ret;
+        }
+        qsort(res.busy_ns, res.frames, sizeof(*res.busy_ns), cmp_u64);
+        printf("  %5.0fHz %8llu %7.2fms %7.2fms %7.2fms %7llu %7llu %7.2fms %7.2fms%s\n",
+               rates[i], (unsigned long long)res.frames,
+               percentile(res.busy_ns, res.frames, 50) / 1e6,
+               percentile(res.busy_ns, res.frames, 99) / 1e6,
+               percentile(res.busy_ns, res.frames, 100) / 1e6,
+               (unsigned long long)res.missed, (unsigned long long)res.dropped,
+               res.frames ? res.sum_lag_ns / 1e6 / res.frames : 0, res.max_lag_ns / 1e6,
+               sustainable(&res) ? "" : "  overloaded");
+        if (sustainable(&res) && rates[i] > best)
+            best = rates[i];
+        free(res.busy_ns);
+    }
+
+    if (best > 0)
+        printf("  max sustainable rate: %.0f Hz\n", best);
+    else
+        printf("  max sustainable rate: none of the tested rates\n");
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "usage: %s [-r hz,hz,...] [-t seconds] [-R regions.conf] [-g] -s WxH[,WxH...]\n"
+        "   or: %s [-r hz,hz,...] [-t seconds] [-R regions.conf] [-g] <recording.fbrec>\n",
+        argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    double rates[MAX_RATES] = { 60, 120, 144, 240 };
+    unsigned sizes[MAX_SIZES][2];
+    const char *conf = NULL, *synth = NULL;
+    double seconds = 5.0;
+    int nrates = 4, nsizes = 0, red = 1, opt, ret = 0;
+    struct fb_source src;
+
+    while ((opt = getopt(argc, argv, "r:t:R:gs:")) != -1) {
+        switch (opt) {
+        case 'r': nrates = parse_rates(optarg, rates); break;
+        case 't': seconds = atof(optarg); break;
+        case 'R': conf = optarg; break;
+        case 'g': red = 0; break;
+        case 's': synth = optarg; break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (nrates <= 0 || seconds <= 0 || (synth ? argc != optind : argc - optind != 1)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    fb_plan_stage_setup();
+
+    if (!synth) {
+        ret = fb_source_open_fbrec(&src, argv[optind]);
+        if (ret) {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+            return EXIT_FAILURE;
+        }
+        ret = sweep(&src, conf, red, rates, nrates, seconds);
+        fb_source_close(&src);
+        return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    nsizes = parse_sizes(synth, sizes);
+    if (nsizes <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < nsizes && !ret; i++) {
+        ret = fb_source_open_synth(&src, sizes[i][0], sizes[i][1], 0, 60.0);
+        if (ret) {
+            fprintf(stderr, "%ux%u: %s\n", sizes[i][0], sizes[i][1], strerror(-ret));
+            break;
+        }
+        ret = sweep(&src, conf, red, rates, nrates, seconds);
+        fb_source_close(&src);
+    }
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
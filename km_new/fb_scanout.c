@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: MIT
+/* fb_scanout.c – scan test patterns out through a KMS driver (vkms) at a fixed rate
+ *
+ * Build :  gcc -O2 fb_scanout.c fb_pattern.c -o fb_scanout
+ * Usage :  fb_scanout [-c /dev/dri/cardN] [-p pattern] [-f fps] [-t seconds] [-N]
+ *
+ * Drives the first connected connector at its preferred mode with two
+ * linear XRGB8888 dumb buffers. Each tick renders the next fb_pattern.h
+ * frame into the back buffer and page-flips to it, waiting for the flip
+ * event before the next tick, so the display pipe (and anything capturing
+ * it) sees a reproducible sequence at the requested rate. Ticks that pass
+ * while a flip is still outstanding are dropped and counted.
+ *
+ * -N registers a new framebuffer for every frame (ADDFB2, then RMFB of the
+ * one it replaces), so the module's drm_framebuffer_init() hook captures
+ * each frame rather than only the first two.
+ *
+ * Dumb buffers are linear, which is all vkms scans out; tiled layouts are
+ * covered offline by fb_gen. Setting a mode needs DRM master, so run it
+ * on a card no compositor holds:
+ *
+ *   sudo modprobe vkms && sudo fb_scanout -c /dev/dri/card1 -p flash -N
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+
+#include "fb_pattern.h"
+
+#define NS_PER_SEC      1000000000ull
+#define FLIP_TIMEOUT_MS 1000
+
+struct scanout_buf {
+    uint32_t handle;
+    uint32_t pitch;
+    uint32_t fb_id;
+    uint64_t size;
+    uint8_t *map;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int add_fb(int fd, unsigned w, unsigned h, struct scanout_buf *b)
+{
+    struct drm_mode_fb_cmd2 cmd = {
+        .width = w,
+        .height = h,
+        .pixel_format = DRM_FORMAT_XRGB8888,
+        .handles = { b->handle },
+        .pitches = { b->pitch },
+    };
+
+    if (ioctl(fd, DRM_IOCTL_MODE_ADDFB2, &cmd))
+        return -errno;
+    b->fb_id = cmd.fb_id;
+    return 0;
+}
+
+static void rm_fb(int fd, struct scanout_buf *b)
+{
+    if (b->fb_id)
+        ioctl(fd, DRM_IOCTL_MODE_RMFB, &b->fb_id);
+    b->fb_id = 0;
+}
+
+static int create_buf(int fd, unsigned w, unsigned h, struct scanout_buf *b)
+{
+    struct drm_mode_create_dumb create = { .width = w, .height = h, .bpp = 32 };
+    struct drm_mode_map_dumb map = { 0 };
+    int ret;
+
+    memset(b, 0, sizeof(*b));
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+        return -errno;
+    b->handle = create.handle;
+    b->pitch = create.pitch;
+    b->size = create.size;
+
+    map.handle = b->handle;
+    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map)) {
+        ret = -errno;
+        goto err;
+    }
+    b->map = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
+    if (b->map == MAP_FAILED) {
+        b->map = NULL;
+        ret = -errno;
+        goto err;
+    }
+    ret = add_fb(fd, w, h, b);
+    if (ret)
+        goto err;
+    return 0;
+
+err:
+    if (b->map)
+        munmap(b->map, b->size);
+    ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &(struct drm_mode_destroy_dumb){ b->handle });
+    return ret;
+}
+
+static void destroy_buf(int fd, struct scanout_buf *b)
+{
+    rm_fb(fd, b);
+    if (b->map)
+        munmap(b->map, b->size);
+    if (b->handle)
+        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &(struct drm_mode_destroy_dumb){ b->handle });
+    memset(b, 0, sizeof(*b));
+}
+
+/* First connected connector, its preferred mode and a CRTC that can drive it. */
+static int find_output(int fd, uint32_t *conn_id, uint32_t *crtc_id,
+                       struct drm_mode_modeinfo *mode)
+{
+    struct drm_mode_card_res res = { 0 };
+    uint32_t *connectors = NULL, *crtcs = NULL;
+    int ret = -ENOENT;
+
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res))
+        return -errno;
+    connectors = calloc(res.count_connectors, sizeof(*connectors));
+    crtcs = calloc(res.count_crtcs, sizeof(*crtcs));
+    if (!connectors || !crtcs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    res.connector_id_ptr = (uintptr_t)connectors;
+    res.crtc_id_ptr = (uintptr_t)crtcs;
+    res.count_fbs = res.count_encoders = 0;
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res)) {
+        ret = -errno;
+        goto out;
+    }
+
+    for (unsigned i = 0; i < res.count_connectors && ret == -ENOENT; i++) {
+        struct drm_mode_get_connector conn = { .connector_id = connectors[i] };
+        struct drm_mode_modeinfo *modes;
+        uint32_t *encoders;
+
+        /* Counts first; this probes the connector. */
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) || conn.connection != 1 ||
+            !conn.count_modes || !conn.count_encoders)
+            continue;
+
+        modes = calloc(conn.count_modes, sizeof(*modes));
+        encoders = calloc(conn.count_encoders, sizeof(*encoders));
+        if (!modes || !encoders) {
+            free(modes);
+            free(encoders);
+            ret = -ENOMEM;
+            break;
+        }
+        conn.modes_ptr = (uintptr_t)modes;
+        conn.encoders_ptr = (uintptr_t)encoders;
+        conn.count_props = 0;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) || !conn.count_modes)
+            goto next;
+
+        *mode = modes[0];
+        for (unsigned m = 0; m < conn.count_modes; m++) {
+            if (modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+                *mode = modes[m];
+                break;
+            }
+        }
+
+        for (unsigned e = 0; e < conn.count_encoders && ret == -ENOENT; e++) {
+            struct drm_mode_get_encoder enc = { .encoder_id = encoders[e] };
+
+            if (ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc))
+                continue;
+            for (unsigned c = 0; c < res.count_crtcs; c++) {
+                if (enc.possible_crtcs & (1u << c)) {
+                    *conn_id = conn.connector_id;
+                    *crtc_id = crtcs[c];
+                    ret = 0;
+                    break;
+                }
+            }
+        }
+next:
+        free(modes);
+        free(encoders);
+    }
+
+out:
+    free(connectors);
+    free(crtcs);
+    return ret;
+}
+
+/* Block until the outstanding flip completes. */
+static int wait_flip(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char buf[1024];
+
+    for (;;) {
+        ssize_t n;
+        int ret = poll(&pfd, 1, FLIP_TIMEOUT_MS);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return ret ? -errno : -ETIMEDOUT;
+
+        n = read(fd, buf, sizeof(buf));
+        if (n < 0)
+            return -errno;
+        for (ssize_t off = 0; off + (ssize_t)sizeof(struct drm_event) <= n; ) {
+            const struct drm_event *ev = (const void *)(buf + off);
+
+            if (ev->type == DRM_EVENT_FLIP_COMPLETE)
+                return 0;
+            if (!ev->length)
+                break;
+            off += ev->length;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *card = "/dev/dri/card0";
+    int pattern = FB_PATTERN_FLASH;
+    double fps = 60.0, seconds = 10.0;
+    int new_fb = 0, opt, fd, ret;
+
+    while ((opt = getopt(argc, argv, "c:p:f:t:N")) != -1) {
+        switch (opt) {
+        case 'c': card = optarg; break;
+        case 'p':
+            pattern = fb_pattern_parse(optarg);
+            if (pattern < 0)
+                goto usage;
+            break;
+        case 'f': fps = atof(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'N': new_fb = 1; break;
+        default:  goto usage;
+        }
+    }
+    if (optind != argc || fps <= 0 || seconds < 0) {
+usage:
+        fprintf(stderr,
+            "usage: %s [-c /dev/dri/cardN] [-p pattern] [-f fps] [-t seconds] [-N]\n"
+            "patterns:", argv[0]);
+        for (int i = 0; i < FB_PATTERN_COUNT; i++)
+            fprintf(stderr, " %s", fb_pattern_name(i));
+        fprintf(stderr, "\n-t 0 runs until interrupted\n");
+        return EXIT_FAILURE;
+    }
+
+    struct drm_mode_modeinfo mode;
+    struct scanout_buf bufs[2] = { 0 };
+    uint32_t conn_id = 0, crtc_id = 0;
+
+    fd = open(card, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror(card);
+        return EXIT_FAILURE;
+    }
+    ret = find_output(fd, &conn_id, &crtc_id, &mode);
+    if (ret) {
+        fprintf(stderr, "%s: no connected output: %s\n", card, strerror(-ret));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    const unsigned w = mode.hdisplay, h = mode.vdisplay;
+
+    for (int i = 0; i < 2; i++) {
+        ret = create_buf(fd, w, h, &bufs[i]);
+        if (ret) {
+            fprintf(stderr, "dumb buffer %ux%u: %s\n", w, h, strerror(-ret));
+            goto out;
+        }
+    }
+
+    fb_pattern_fill(bufs[0].map, w, h, bufs[0].pitch, pattern, 0, fps);
+    struct drm_mode_crtc set = {
+        .set_connectors_ptr = (uintptr_t)&conn_id,
+        .count_connectors = 1,
+        .crtc_id = crtc_id,
+        .fb_id = bufs[0].fb_id,
+        .mode_valid = 1,
+        .mode = mode,
+    };
+    if (ioctl(fd, DRM_IOCTL_MODE_SETCRTC, &set)) {
+        ret = -errno;
+        fprintf(stderr, "set mode %s on crtc %u: %s (is the device held by a compositor?)\n",
+                mode.name, crtc_id, strerror(-ret));
+        goto out;
+    }
+    printf("%s: connector %u, crtc %u, %s@%u, pattern '%s' at %.2f fps%s\n", card, conn_id,
+           crtc_id, mode.name, mode.vrefresh, fb_pattern_name(pattern), fps,
+           new_fb ? ", new framebuffer per frame" : "");
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    const uint64_t period_ns = (uint64_t)(NS_PER_SEC / fps);
+    const uint64_t ticks = seconds > 0 ? (uint64_t)(seconds * fps) : UINT64_MAX;
+    uint64_t start = now_ns(), next = start;
+    uint64_t presented = 1, dropped = 0, flip_sum_ns = 0, flip_max_ns = 0;
+    unsigned front = 0;
+
+    for (uint64_t tick = 1; tick < ticks && !stop; tick++) {
+        struct scanout_buf *back = &bufs[front ^ 1];
+        struct timespec ts;
+        uint64_t t0, now;
+
+        next += period_ns;
+        ts.tv_sec = next / NS_PER_SEC;
+        ts.tv_nsec = next % NS_PER_SEC;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        fb_pattern_fill(back->map, w, h, back->pitch, pattern, tick, fps);
+        if (new_fb) {
+            rm_fb(fd, back);
+            ret = add_fb(fd, w, h, back);
+            if (ret) {
+                fprintf(stderr, "addfb: %s\n", strerror(-ret));
+                break;
+            }
+        }
+
+        struct drm_mode_crtc_page_flip flip = {
+            .crtc_id = crtc_id,
+            .fb_id = back->fb_id,
+            .flags = DRM_MODE_PAGE_FLIP_EVENT,
+        };
+        t0 = now_ns();
+        if (ioctl(fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip)) {
+            ret = -errno;
+            fprintf(stderr, "page flip: %s\n", strerror(-ret));
+            break;
+        }
+        ret = wait_flip(fd);
+        if (ret) {
+            fprintf(stderr, "flip event: %s\n", strerror(-ret));
+            break;
+        }
+        now = now_ns();
+        flip_sum_ns += now - t0;
+        if (now - t0 > flip_max_ns)
+            flip_max_ns = now - t0;
+        front ^= 1;
+        presented++;
+
+        /* Ticks that expired while this flip was outstanding are lost. */
+        if (now > next + period_ns) {
+            uint64_t late = (now - next) / period_ns;
+
+            dropped += late;
+            tick += late;
+            next += late * period_ns;
+        }
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("presented %llu frames in %.2f s (%.2f fps), dropped %llu ticks, "
+           "flip avg %.2f ms max %.2f ms\n",
+           (unsigned long long)presented, elapsed, elapsed > 0 ? presented / elapsed : 0.0,
+           (unsigned long long)dropped,
+           presented > 1 ? flip_sum_ns / 1e6 / (presented - 1) : 0.0, flip_max_ns / 1e6);
+
+out:
+    destroy_buf(fd, &bufs[0]);
+    destroy_buf(fd, &bufs[1]);
+    close(fd);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
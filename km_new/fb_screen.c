@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: MIT
+/* fb_screen.c – flash screening on block averages, in fixed point
+ *
+ * Build :  kbuild (part of drm_fb_pixel_extractor.ko), or
+ *          gcc -O2 -c fb_screen.c && ar rcs libfb_detile.a fb_screen.o
+ */
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#include <linux/string.h>
+#define fb_div64(n, d)  div64_u64(n, d)
+#else
+#include <string.h>
+#define fb_div64(n, d)  ((n) / (d))
+#endif
+
+#include "fb_screen.h"
+#include "fb_yuv.h"
+
+#define NS_PER_SEC      1000000000ull
+
+/*
+ * Weighted gamma expansion, lround(weight * expand(i / 255) * 2^14), the
+ * same values flash_analyzer.c computes at start-up; the kernel has no
+ * floating point to compute them with.
+ */
+static const uint16_t fb_screen_lut_r[256] = {
+        0,     1,     2,     3,     4,     5,     6,     7,     8,    10,    11,    12,
+       13,    14,    15,    17,    18,    20,    21,    23,    24,    26,    28,    30,
+       32,    34,    36,    38,    40,    43,    45,    48,    50,    53,    56,    59,
+       61,    64,    68,    71,    74,    77,    81,    84,    88,    91,    95,    99,
+      103,   107,   111,   115,   120,   124,   128,   133,   138,   143,   147,   152,
+      157,   163,   168,   173,   179,   184,   190,   196,   201,   207,   213,   219,
+      226,   232,   239,   245,   252,   259,   265,   272,   279,   287,   294,   301,
+      309,   316,   324,   332,   340,   348,   356,   364,   373,   381,   390,   399,
+      407,   416,   425,   435,   444,   453,   463,   472,   482,   492,   502,   512,
+      522,   533,   543,   554,   564,   575,   586,   597,   608,   620,   631,   643,
+      654,   666,   678,   690,   702,   714,   727,   739,   752,   765,   778,   791,
+      804,   817,   830,   844,   858,   871,   885,   899,   913,   928,   942,   957,
+      971,   986,  1001,  1016,  1032,  1047,  1062,  1078,  1094,  1110,  1126,  1142,
+     1158,  1174,  1191,  1208,  1224,  1241,  1259,  1276,  1293,  1311,  1328,  1346,
+     1364,  1382,  1400,  1419,  1437,  1456,  1474,  1493,  1512,  1531,  1551,  1570,
+     1590,  1610,  1629,  1649,  1670,  1690,  1710,  1731,  1752,  1773,  1794,  1815,
+     1836,  1858,  1879,  1901,  1923,  1945,  1967,  1989,  2012,  2034,  2057,  2080,
+     2103,  2127,  2150,  2173,  2197,  2221,  2245,  2269,  2293,  2318,  2342,  2367,
+     2392,  2417,  2442,  2467,  2493,  2519,  2544,  2570,  2596,  2623,  2649,  2676,
+     2702,  2729,  2756,  2783,  2811,  2838,  2866,  2894,  2922,  2950,  2978,  3007,
+     3035,  3064,  3093,  3122,  3151,  3181,  3210,  3240,  3270,  3300,  3330,  3360,
+     3391,  3421,  3452,  3483,
+};
+static const uint16_t fb_screen_lut_g[256] = {
+        0,     4,     7,    11,    14,    18,    21,    25,    28,    32,    36,    39,
+       43,    47,    51,    56,    61,    66,    71,    76,    82,    88,    94,   100,
+      107,   114,   121,   128,   136,   144,   152,   161,   169,   178,   187,   197,
+      207,   217,   227,   238,   249,   260,   271,   283,   295,   307,   320,   333,
+      346,   360,   374,   388,   402,   417,   432,   448,   463,   479,   496,   512,
+      529,   547,   564,   582,   601,   619,   638,   658,   677,   697,   718,   738,
+      759,   781,   802,   824,   847,   870,   893,   916,   940,   964,   989,  1014,
+     1039,  1064,  1090,  1117,  1144,  1171,  1198,  1226,  1254,  1283,  1312,  1341,
+     1371,  1401,  1431,  1462,  1493,  1525,  1557,  1589,  1622,  1655,  1689,  1723,
+     1757,  1792,  1827,  1863,  1899,  1935,  1972,  2009,  2046,  2084,  2123,  2162,
+     2201,  2240,  2280,  2321,  2362,  2403,  2445,  2487,  2529,  2572,  2616,  2660,
+     2704,  2748,  2794,  2839,  2885,  2931,  2978,  3025,  3073,  3121,  3170,  3219,
+     3268,  3318,  3368,  3419,  3470,  3522,  3574,  3626,  3679,  3733,  3787,  3841,
+     3896,  3951,  4006,  4063,  4119,  4176,  4234,  4292,  4350,  4409,  4468,  4528,
+     4588,  4649,  4710,  4772,  4834,  4897,  4960,  5023,  5087,  5152,  5217,  5282,
+     5348,  5415,  5481,  5549,  5617,  5685,  5754,  5823,  5893,  5963,  6034,  6105,
+     6177,  6249,  6322,  6395,  6468,  6543,  6617,  6692,  6768,  6844,  6921,  6998,
+     7076,  7154,  7232,  7311,  7391,  7471,  7552,  7633,  7715,  7797,  7880,  7963,
+     8046,  8131,  8215,  8301,  8386,  8473,  8559,  8647,  8735,  8823,  8912,  9001,
+     9091,  9181,  9272,  9364,  9456,  9548,  9641,  9735,  9829,  9924, 10019, 10114,
+    10211, 10307, 10405, 10502, 10601, 10700, 10799, 10899, 10999, 11100, 11202, 11304,
+    11407, 11510, 11614, 11718,
+};
+static const uint16_t fb_screen_lut_b[256] = {
+        0,     0,     1,     1,     1,     2,     2,     3,     3,     3,     4,     4,
+        4,     5,     5,     6,     6,     7,     7,     8,     8,     9,     9,    10,
+       11,    11,    12,    13,    14,    15,    15,    16,    17,    18,    19,    20,
+       21,    22,    23,    24,    25,    26,    27,    29,    30,    31,    32,    34,
+       35,    36,    38,    39,    41,    42,    44,    45,    47,    48,    50,    52,
+       53,    55,    57,    59,    61,    63,    64,    66,    68,    70,    72,    75,
+       77,    79,    81,    83,    85,    88,    90,    92,    95,    97,   100,   102,
+      105,   107,   110,   113,   115,   118,   121,   124,   127,   129,   132,   135,
+      138,   141,   144,   148,   151,   154,   157,   160,   164,   167,   170,   174,
+      177,   181,   184,   188,   192,   195,   199,   203,   207,   210,   214,   218,
+      222,   226,   230,   234,   238,   243,   247,   251,   255,   260,   264,   268,
+      273,   277,   282,   287,   291,   296,   301,   305,   310,   315,   320,   325,
+      330,   335,   340,   345,   350,   356,   361,   366,   371,   377,   382,   388,
+      393,   399,   404,   410,   416,   422,   427,   433,   439,   445,   451,   457,
+      463,   469,   476,   482,   488,   494,   501,   507,   514,   520,   527,   533,
+      540,   547,   553,   560,   567,   574,   581,   588,   595,   602,   609,   616,
+      624,   631,   638,   646,   653,   660,   668,   676,   683,   691,   699,   706,
+      714,   722,   730,   738,   746,   754,   762,   771,   779,   787,   795,   804,
+      812,   821,   829,   838,   847,   855,   864,   873,   882,   891,   900,   909,
+      918,   927,   936,   945,   955,   964,   973,   983,   992,  1002,  1011,  1021,
+     1031,  1041,  1050,  1060,  1070,  1080,  1090,  1100,  1110,  1121,  1131,  1141,
+     1152,  1162,  1172,  1183,
+};
+
+static inline unsigned lum_of(uint32_t p, unsigned rs, unsigned bs)
+{
+    return fb_screen_lut_r[(p >> rs) & 0xff] + fb_screen_lut_g[(p >> 8) & 0xff] +
+           fb_screen_lut_b[(p >> bs) & 0xff];
+}
+
+/* Pixel x of a YUV row: the luma tables where they are close enough, else converted */
+static inline unsigned yuv_lum_of(const uint8_t *luma, const uint8_t *chroma, uint32_t x,
+                                  unsigned depth)
+{
+    unsigned y = fb_yuv_sample(luma, x, depth);
+    unsigned cb = fb_yuv_sample(chroma, x & ~1u, depth), cr = fb_yuv_sample(chroma, x | 1, depth);
+
+    return fb_yuv_exact(y, cb, cr) ? lum_of(fb_yuv_xrgb(y, cb, cr), 16, 0) : fb_yuv_lum[y];
+}
+
+/* harmful_transition: |dI| >= 0.1, or both > 0.8 with Michelson >= 1/17. */
+static inline int harmful_transition(unsigned i1, unsigned i2)
+{
+    unsigned d = i2 > i1 ? i2 - i1 : i1 - i2;
+
+    if (d * 10 >= FB_SCREEN_LUM_ONE)
+        return 1;
+    return 5 * i1 > 4 * FB_SCREEN_LUM_ONE && 5 * i2 > 4 * FB_SCREEN_LUM_ONE &&
+           17 * d >= i1 + i2;
+}
+
+static inline uint32_t blocks_of(uint32_t pixels)
+{
+    return (pixels + FB_SCREEN_BLOCK - 1) / FB_SCREEN_BLOCK;
+}
+
+size_t fb_screen_mem_size(uint32_t width, uint32_t height)
+{
+    size_t blocks = (size_t)blocks_of(width) * blocks_of(height);
+
+    return blocks * (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(int8_t));
+}
+
+void fb_screen_init(struct fb_screen *s, uint32_t width, uint32_t height, void *mem)
+{
+    size_t blocks;
+
+    memset(s, 0, sizeof(*s));
+    s->width = width;
+    s->height = height;
+    s->cols = blocks_of(width);
+    s->rows = blocks_of(height);
+    blocks = (size_t)s->cols * s->rows;
+    s->sum = mem;
+    s->lum = (uint16_t *)(s->sum + blocks);
+    s->dir = (int8_t *)(s->lum + blocks);
+
+    /* A power of two up to the block size, so every block has samples */
+    s->step = 1;
+    while (s->step < FB_SCREEN_BLOCK &&
+           (uint64_t)(width / s->step) * (height / s->step) > FB_SCREEN_MAX_SAMPLES)
+        s->step *= 2;
+}
+
+void fb_screen_begin(struct fb_screen *s)
+{
+    memset(s->sum, 0, (size_t)s->cols * s->rows * sizeof(*s->sum));
+    s->next = 0;
+    s->done_rows = 0;
+    s->broken = 0;
+    s->transitions = 0;
+    s->flashed = 0;
+}
+
+/* Compare block row by of this frame with the previous one, and keep its means. */
+static void finish_row(struct fb_screen *s, uint32_t by)
+{
+    const uint32_t y0 = by * FB_SCREEN_BLOCK;
+    const uint32_t bh = s->height - y0 < FB_SCREEN_BLOCK ? s->height - y0 : FB_SCREEN_BLOCK;
+    const uint32_t ny = (bh + s->step - 1) / s->step;
+    uint32_t *sum = s->sum + (size_t)by * s->cols;
+    uint16_t *lum = s->lum + (size_t)by * s->cols;
+    int8_t *dir = s->dir + (size_t)by * s->cols;
+    uint32_t bx;
+
+    for (bx = 0; bx < s->cols; bx++) {
+        const uint32_t x0 = bx * FB_SCREEN_BLOCK;
+        const uint32_t bw = s->width - x0 < FB_SCREEN_BLOCK ? s->width - x0 : FB_SCREEN_BLOCK;
+        const uint32_t samples = ((bw + s->step - 1) / s->step) * ny;
+        const unsigned cur = (sum[bx] + samples / 2) / samples;
+        const unsigned prev = lum[bx];
+        int8_t d = 0;
+
+        /* fa_step() on the block means */
+        if (s->has_prev && harmful_transition(prev, cur)) {
+            d = cur > prev ? 1 : -1;
+            s->transitions += bw * bh;
+            if (dir[bx] == -d)
+                s->flashed += bw * bh;
+        }
+        lum[bx] = cur;
+        dir[bx] = d;
+    }
+    s->done_rows++;
+}
+
+/* 32-bit RGB frame, or luma and chroma planes of depth-byte samples */
+static inline void add_pixels(struct fb_screen *s, const uint32_t *frame, const uint8_t *luma,
+                              const uint8_t *chroma, unsigned depth, size_t first, size_t n,
+                              int bgr)
+{
+    const unsigned rs = bgr ? 0 : 16, bs = bgr ? 16 : 0;
+    const size_t end = first + n;
+    size_t i = first;
+
+    if (first != s->next)
+        s->broken = 1;
+    s->next = end;
+
+    /* One row segment at a time */
+    while (i < end) {
+        uint32_t y = i / s->width, x = i % s->width;
+        size_t row_end = (size_t)(y + 1) * s->width;
+        uint32_t x1 = (end < row_end ? end : row_end) - (size_t)y * s->width;
+
+        if (y % s->step == 0) {
+            const uint32_t *row = depth ? NULL : frame + (size_t)y * s->width;
+            const uint8_t *lrow = depth ? luma + (size_t)y * s->width * depth : NULL;
+            const uint8_t *crow = depth ? chroma + (size_t)(y / 2) * s->width * depth : NULL;
+            uint32_t *sum = s->sum + (size_t)(y / FB_SCREEN_BLOCK) * s->cols;
+
+            /* Block by block, so the sum stays in a register */
+            x = (x + s->step - 1) / s->step * s->step;
+            while (x < x1) {
+                uint32_t bend = (x / FB_SCREEN_BLOCK + 1) * FB_SCREEN_BLOCK;
+                uint32_t acc = 0, xe = bend < x1 ? bend : x1;
+
+                if (depth)
+                    for (; x < xe; x += s->step)
+                        acc += yuv_lum_of(lrow, crow, x, depth);
+                else
+                    for (; x < xe; x += s->step)
+                        acc += lum_of(row[x], rs, bs);
+                sum[(x - 1) / FB_SCREEN_BLOCK] += acc;
+            }
+        }
+        i = (size_t)y * s->width + x1;
+        if (i == row_end && ((y + 1) % FB_SCREEN_BLOCK == 0 || y + 1 == s->height) &&
+            !s->broken)
+            finish_row(s, y / FB_SCREEN_BLOCK);
+    }
+}
+
+void fb_screen_add(struct fb_screen *s, const uint32_t *frame, size_t first, size_t n, int bgr)
+{
+    add_pixels(s, frame, NULL, NULL, 0, first, n, bgr);
+}
+
+void fb_screen_add_yuv(struct fb_screen *s, const uint8_t *luma, const uint8_t *chroma,
+                       size_t first, size_t n, unsigned depth)
+{
+    add_pixels(s, NULL, luma, chroma, depth, first, n, 0);
+}
+
+int fb_screen_finish(struct fb_screen *s, int ok)
+{
+    int compared = s->has_prev;
+
+    if (!ok || s->broken || s->done_rows != s->rows) {
+        /* Means of part of a frame are no reference for the next one */
+        memset(s->dir, 0, (size_t)s->cols * s->rows);
+        s->has_prev = 0;
+        return 0;
+    }
+    s->has_prev = 1;
+    s->frames++;
+    return compared;
+}
+
+/*
+ * (d * 10 deg) * (d * 7.5 deg) * ppi^2 / 4 with ppi^2 = (w^2 + h^2) / S^2;
+ * the angles and the quarter come to 0.0057115766 in units of 1e-7.
+ */
+uint32_t fb_screen_area_threshold(uint32_t width, uint32_t height,
+                                  uint32_t diag_in, uint32_t dist_in)
+{
+    uint64_t num = ((uint64_t)width * width + (uint64_t)height * height) *
+                   dist_in * dist_in;
+
+    if (!diag_in)
+        return 0;
+    num = fb_div64(num * 57116, (uint64_t)diag_in * diag_in);
+    return (uint32_t)fb_div64(num, 10000000);
+}
+
+unsigned fb_screen_window_add(struct fb_screen_window *w, uint64_t ts_ns, int flash)
+{
+    if (flash) {
+        w->ts[w->head] = ts_ns;
+        w->head = (w->head + 1) % FB_SCREEN_HARMFUL;
+        if (w->count < FB_SCREEN_HARMFUL)
+            w->count++;
+    }
+    /* Four flashes within a second include the last four: older ones need not be kept */
+    while (w->count) {
+        unsigned oldest = (w->head + FB_SCREEN_HARMFUL - w->count) % FB_SCREEN_HARMFUL;
+
+        if (ts_ns - w->ts[oldest] < NS_PER_SEC)
+            break;
+        w->count--;
+    }
+    return w->count;
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: MIT
+/* fb_screen.h – flash screening on block averages, in fixed point
+ *
+ * One implementation for the kernel module (kbuild, __KERNEL__) and the
+ * userspace tools (libfb_detile.a), like fb_stats.h. The module feeds it
+ * the bands of a capture as they are written and raises an alarm as soon
+ * as a frame is known to flash, often before the whole frame is copied.
+ *
+ * The rules are those of spec.v B.1, B.3 and B.4, applied to the mean
+ * relative luminance of FB_SCREEN_BLOCK x FB_SCREEN_BLOCK blocks instead
+ * of single pixels: harmful_transition between a block's means on two
+ * frames, a flash when it opposes the block's harmful transition of the
+ * frame before (opposing_changes), the flashed area is the area of the
+ * flashing blocks, and FB_SCREEN_HARMFUL flashes within one second are
+ * harmful. A block is far smaller than any flash area threshold (a
+ * 166 x 166 px square for a 24" 1080p screen at 24"), so only the blocks
+ * on the edge of a flashing area mix it with the background. Red flashes
+ * (B.2) are left to the userspace analyzer.
+ *
+ * Luminance uses the userspace analyzer's tables (flash_analyzer.c), so
+ * block means are exact averages of its per-pixel values. YUV frames are
+ * read from the luma plane, converting only strongly coloured pixels
+ * (fb_yuv.h). At most
+ * FB_SCREEN_MAX_SAMPLES pixels are read per frame: larger frames are
+ * sampled every step-th pixel of every step-th row, which bounds the cost.
+ * flash_screen checks the result against flash_analyzer on recordings.
+ */
+#ifndef FB_SCREEN_H
+#define FB_SCREEN_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define FB_SCREEN_BLOCK         16              /* pixels */
+#define FB_SCREEN_LUM_SHIFT     14              /* FA_LUM_SHIFT */
+#define FB_SCREEN_LUM_ONE       (1u << FB_SCREEN_LUM_SHIFT)
+#define FB_SCREEN_MAX_SAMPLES   (1u << 19)      /* pixels read per frame */
+#define FB_SCREEN_HARMFUL       4               /* flashes in one second */
+
+struct fb_screen {
+    uint32_t width, height;     /* frame, pixels */
+    uint32_t cols, rows;        /* blocks */
+    uint32_t step;              /* every step-th pixel of every step-th row is read */
+    uint32_t *sum;              /* this frame's luminance sums, per block */
+    uint16_t *lum;              /* previous frame's block means */
+    int8_t *dir;                /* +1/-1: the block's last transition was harmful up/down */
+    int has_prev;               /* lum and dir hold a whole previous frame */
+    uint64_t frames;
+
+    /* The frame being added */
+    size_t next;                /* pixel expected next */
+    uint32_t done_rows;         /* block rows complete */
+    int broken;                 /* pixels came out of order */
+    uint32_t transitions;       /* pixels in blocks with a harmful transition */
+    uint32_t flashed;           /* pixels in flashing blocks, so far */
+};
+
+/* Flashes of the last second, for B.4. */
+struct fb_screen_window {
+    uint64_t ts[FB_SCREEN_HARMFUL];
+    unsigned head, count;
+};
+
+/* Bytes of zeroed memory fb_screen_init() needs for a width x height frame. */
+size_t fb_screen_mem_size(uint32_t width, uint32_t height);
+void fb_screen_init(struct fb_screen *s, uint32_t width, uint32_t height, void *mem);
+
+void fb_screen_begin(struct fb_screen *s);
+
+/*
+ * Add pixels [first, first + n) of a frame of 32-bit RGB, given as the
+ * whole frame. Pixels must come in order. Every block row completed by
+ * them is compared with the previous frame at once, so s->flashed only
+ * grows during the frame. bgr: red is in the low byte.
+ */
+void fb_screen_add(struct fb_screen *s, const uint32_t *frame, size_t first, size_t n, int bgr);
+
+/*
+ * The same for a frame of NV12 (depth 1) or P010 (depth 2), given as its
+ * luma plane and the chroma plane after it, both packed (fb_yuv.h). The
+ * width must be even, and the chroma rows of the pixels must be there.
+ */
+void fb_screen_add_yuv(struct fb_screen *s, const uint8_t *luma, const uint8_t *chroma,
+                       size_t first, size_t n, unsigned depth);
+
+/*
+ * End the frame. Returns 1 when it was complete and compared with the
+ * previous one, so transitions and flashed are valid. A frame that failed
+ * (ok == 0) or came incomplete makes the next one start over.
+ */
+int fb_screen_finish(struct fb_screen *s, int ok);
+
+/* flash_area_threshold(d) of spec.v B.3 in pixels, for a width x height screen. */
+uint32_t fb_screen_area_threshold(uint32_t width, uint32_t height,
+                                  uint32_t diag_in, uint32_t dist_in);
+
+/* Add a frame at ts_ns; returns the flashes in the second up to it, at most FB_SCREEN_HARMFUL. */
+unsigned fb_screen_window_add(struct fb_screen_window *w, uint64_t ts_ns, int flash);
+
+/*
+ * /proc/drm_fb_flash: one record per screened display, 104 bytes,
+ * little-endian. The file polls readable (POLLIN | POLLPRI) when a
+ * display turns harmful or clears; writing "eventfd <fd>" has the eventfd
+ * signalled on the same changes for as long as the file stays open.
+ */
+#define FB_FLASH_MAGIC      0x48534c46u     /* 'FLSH' */
+#define FB_FLASH_VERSION    1
+
+#define FB_FLASH_HARMFUL    0x1             /* FB_SCREEN_HARMFUL flashes within the last second */
+#define FB_FLASH_FLASHED    0x2             /* the last capture flashed */
+
+struct fb_flash_status {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;                 /* FB_FLASH_* */
+    uint32_t dev_minor;
+    uint32_t width, height;         /* framebuffer */
+    uint32_t area_threshold;        /* framebuffer pixels */
+    uint32_t window_flashes;        /* up to the last capture, at most FB_SCREEN_HARMFUL */
+    uint32_t last_flashed;          /* flashed area of the last capture */
+    uint32_t max_flashed;
+    uint32_t step;                  /* sampling step of the last capture */
+    uint64_t frames, flashes;       /* captures screened, and those that flashed */
+    uint64_t alarms;                /* turns into the harmful state */
+    uint64_t last_ns;               /* CLOCK_MONOTONIC, last capture screened */
+    uint64_t alarm_ns;              /* last alarm */
+    uint64_t alarm_latency_ns;      /* from drm_framebuffer_init() returning to that alarm */
+    uint64_t busy_ns;               /* screening time, all captures */
+    uint64_t max_ns;                /* ... the longest capture */
+};
+
+#endif /* FB_SCREEN_H */
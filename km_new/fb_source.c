@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: MIT
+/* fb_source.c – one frame-consumer interface for live, recorded and synthetic frames
+ *
+ * Build :  gcc -O2 -c fb_source.c
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "fb_source.h"
+#include "fb_plan.h"
+#include "fb_yuv.h"
+#include "fb_export.h"
+
+#define NS_PER_SEC 1000000000ull
+#define PROC_INFO  "/proc/drm_fb_pixels"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+unsigned fb_modifier_tile_height(uint64_t modifier)
+{
+    if (modifier == FB_MOD_INTEL(1))
+        return 8;
+    if (modifier == FB_MOD_INTEL(2) || modifier == FB_MOD_INTEL(3) ||
+        modifier == FB_MOD_INTEL(9))
+        return 32;
+    return 1;
+}
+
+int fb_capture_node(void)
+{
+    FILE *f = fopen(PROC_INFO, "r");
+    char line[256];
+    int node = -1;
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "NUMA: %*[^,], latest capture on node %d", &node) == 1)
+            break;
+    }
+    fclose(f);
+    return node;
+}
+
+int fb_source_pin(const struct fb_source *src)
+{
+    char path[64], list[4096], *p;
+    cpu_set_t set;
+    FILE *f;
+    int ret;
+
+    if (src->node < 0)
+        return 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", src->node);
+    f = fopen(path, "r");
+    if (!f)
+        return -errno;
+    p = fgets(list, sizeof(list), f);
+    fclose(f);
+    if (!p)
+        return -EIO;
+
+    ret = fb_cpulist_parse(p, &set);
+    if (ret)
+        return ret;
+    if (!CPU_COUNT(&set))
+        return -EINVAL;
+    if (sched_setaffinity(0, sizeof(set), &set))
+        return -errno;
+    return 0;
+}
+
+int fb_source_open_raw(struct fb_source *src, const char *path, unsigned width,
+                       unsigned height, unsigned pitch, uint64_t modifier, double fps)
+{
+    return fb_source_open_raw_format(src, path, width, height, pitch, modifier,
+                                     FB_FOURCC_XRGB8888, fps);
+}
+
+int fb_source_open_raw_format(struct fb_source *src, const char *path, unsigned width,
+                              unsigned height, unsigned pitch, uint64_t modifier,
+                              uint32_t format, double fps)
+{
+    unsigned tile_h = fb_modifier_tile_height(modifier);
+    unsigned depth = fb_yuv_depth(format);
+    int live;
+
+    if (!width || !height || pitch < width * (depth ? depth : 4) || fps <= 0)
+        return -EINVAL;
+    if (!depth && format != FB_FOURCC_XRGB8888)
+        return -EINVAL;
+
+    memset(src, 0, sizeof(*src));
+    src->width = width;
+    src->height = height;
+    src->pitch = pitch;
+    src->modifier = modifier;
+    src->format = format;
+    src->fps = fps;
+    src->frame_size = depth ? fb_yuv_frame_size(pitch, height, tile_h)
+                            : (size_t)pitch * ((height + tile_h - 1) / tile_h * tile_h);
+
+    src->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (src->fd < 0)
+        return -errno;
+    live = fb_fd_is_live(src->fd);
+    if (live < 0) {
+        close(src->fd);
+        return live;
+    }
+    src->kind = live ? FB_SOURCE_LIVE : FB_SOURCE_RAW;
+    src->node = src->kind == FB_SOURCE_LIVE ? fb_capture_node() : -1;
+
+    src->buf = malloc(src->frame_size);
+    if (!src->buf) {
+        close(src->fd);
+        return -ENOMEM;
+    }
+    src->next_tick_ns = now_ns();
+    return 0;
+}
+
+int fb_source_open_fbrec(struct fb_source *src, const char *path)
+{
+    struct fbrec_frame first;
+    int ret;
+
+    memset(src, 0, sizeof(*src));
+    src->kind = FB_SOURCE_FBREC;
+    src->node = -1;
+    ret = fbrec_open(&src->rec, path);
+    if (ret)
+        return ret;
+    ret = fbrec_frame(&src->rec, 0, &first);
+    if (ret) {
+        fbrec_close(&src->rec);
+        return ret;
+    }
+    src->width = first.hdr->width;
+    src->height = first.hdr->height;
+    src->pitch = first.hdr->pitch;
+    src->modifier = first.hdr->modifier;
+    src->format = first.hdr->format;
+    return 0;
+}
+
+static void synth_fill(uint8_t *px, unsigned w, unsigned h, unsigned frame)
+{
+    for (unsigned y = 0; y < h; y++) {
+        for (unsigned x = 0; x < w; x++) {
+            uint8_t *p = px + ((size_t)y * w + x) * 4;
+            int flash = (x >= w / 4 && x < w / 2 && y >= h / 4 && y < h / 2);
+            uint8_t v = flash ? ((frame & 1) ? 0xff : 0x10) : (uint8_t)(x + y + frame);
+
+            p[0] = v;
+            p[1] = v;
+            p[2] = flash ? v : (uint8_t)(x >> 4);
+            p[3] = 0;
+        }
+    }
+}
+
+int fb_source_open_synth(struct fb_source *src, unsigned width, unsigned height,
+                         uint64_t frames, double fps)
+{
+    if (!width || !height || fps <= 0)
+        return -EINVAL;
+
+    memset(src, 0, sizeof(*src));
+    src->kind = FB_SOURCE_SYNTH;
+    src->node = -1;
+    src->format = FB_FOURCC_XRGB8888;
+    src->width = width;
+    src->height = height;
+    src->pitch = width * 4;
+    src->fps = fps;
+    src->limit = frames;
+    src->frame_size = (size_t)src->pitch * height;
+
+    for (unsigned i = 0; i < FB_SYNTH_FRAMES; i++) {
+        src->synth[i] = malloc(src->frame_size);
+        if (!src->synth[i]) {
+            fb_source_close(src);
+            return -ENOMEM;
+        }
+        synth_fill(src->synth[i], width, height, i);
+    }
+    return 0;
+}
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t size, int live)
+{
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t n = live ? pread(fd, buf + got, size - got, got)
+                         : read(fd, buf + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+static void live_unmap(struct fb_source *src)
+{
+    if (src->map)
+        munmap(src->map, src->map_size);
+    src->map = NULL;
+    src->map_size = 0;
+}
+
+/*
+ * Map the newest capture's dma-buf in place of the previous one, which
+ * unpins that one's slot. The mapping keeps the dma-buf alive after the fd
+ * is closed.
+ */
+static int live_map(struct fb_source *src)
+{
+    struct fb_export e = { .age = 0 };
+    void *map;
+
+    if (ioctl(src->fd, FB_IOC_EXPORT, &e)) {
+        /* Not the module, or one without exports: read() from now on. */
+        if (errno == ENOTTY)
+            src->no_export = 1;
+        return -errno;
+    }
+    /* A capture of another mode, quality level or format than asked for:
+     * read() would return the same capture, so the caller skips it. */
+    if (e.width != src->width || e.height != src->height || e.pitch != src->pitch ||
+        e.format != src->format) {
+        close(e.fd);
+        return -EMEDIUMTYPE;
+    }
+    if (e.size < src->frame_size) {
+        close(e.fd);
+        return -ENODATA;
+    }
+    map = mmap(NULL, e.size, PROT_READ, MAP_SHARED, e.fd, 0);
+    close(e.fd);
+    if (map == MAP_FAILED)
+        return -errno;
+    live_unmap(src);
+    src->map = map;
+    src->map_size = e.size;
+    return 0;
+}
+
+static void fill_common(struct fb_source *src, struct fb_frame *f, const uint8_t *data,
+                        uint64_t ts)
+{
+    f->data = data;
+    f->size = src->frame_size;
+    f->width = src->width;
+    f->height = src->height;
+    f->pitch = src->pitch;
+    f->format = src->format;
+    f->modifier = src->modifier;
+    f->timestamp_ns = ts;
+    f->sequence = src->next++;
+}
+
+int fb_source_next(struct fb_source *src, struct fb_frame *f)
+{
+    ssize_t n;
+
+    switch (src->kind) {
+    case FB_SOURCE_LIVE: {
+        uint64_t period = (uint64_t)(NS_PER_SEC / src->fps);
+        int ret;
+
+        for (;;) {
+            struct timespec next = {
+                .tv_sec = src->next_tick_ns / NS_PER_SEC,
+                .tv_nsec = src->next_tick_ns % NS_PER_SEC,
+            };
+
+            if (now_ns() >= src->next_tick_ns + period)
+                src->late++;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            src->next_tick_ns += period;
+            /* Zero-copy when the module hands the capture out; otherwise, or
+             * with every slot pinned by other importers, copy it. */
+            ret = src->no_export ? -ENOTTY : live_map(src);
+            if (ret == 0) {
+                fill_common(src, f, src->map, now_ns());
+                return 1;
+            }
+            if (ret != -EMEDIUMTYPE) {
+                n = read_full(src->fd, src->buf, src->frame_size, 1);
+                if (n < 0)
+                    return n;
+                if ((size_t)n == src->frame_size) {
+                    fill_common(src, f, src->buf, now_ns());
+                    return 1;
+                }
+            }
+            /* Not this source's geometry (a region or downscaled capture,
+             * another mode): poll again on the next tick. */
+            src->skipped++;
+        }
+    }
+
+    case FB_SOURCE_RAW:
+        n = read_full(src->fd, src->buf, src->frame_size, 0);
+        if (n < 0)
+            return n;
+        if ((size_t)n < src->frame_size)
+            return 0;
+        fill_common(src, f, src->buf, (uint64_t)(src->next * 1e9 / src->fps));
+        return 1;
+
+    case FB_SOURCE_FBREC:
+        while (src->next < src->rec.count) {
+            struct fbrec_frame rf;
+
+            if (fbrec_frame(&src->rec, src->next++, &rf))
+                continue;
+            /* Consumers are set up for the first frame's geometry and format. */
+            if (rf.hdr->width != src->width || rf.hdr->height != src->height ||
+                rf.hdr->format != src->format || (rf.hdr->flags & FBREC_FRAME_TRUNCATED))
+                continue;
+            f->data = rf.data;
+            f->size = rf.hdr->data_size;
+            f->width = rf.hdr->width;
+            f->height = rf.hdr->height;
+            f->pitch = rf.hdr->pitch;
+            f->format = rf.hdr->format;
+            f->modifier = rf.hdr->modifier;
+            f->timestamp_ns = rf.hdr->timestamp_ns;
+            f->sequence = rf.hdr->sequence;
+            return 1;
+        }
+        return 0;
+
+    case FB_SOURCE_SYNTH:
+        if (src->limit && src->next >= src->limit)
+            return 0;
+        fill_common(src, f, src->synth[src->next % FB_SYNTH_FRAMES],
+                    (uint64_t)(src->next * 1e9 / src->fps));
+        return 1;
+    }
+    return -EINVAL;
+}
+
+int fb_source_rewind(struct fb_source *src)
+{
+    switch (src->kind) {
+    case FB_SOURCE_LIVE:
+        return -ESPIPE;
+    case FB_SOURCE_RAW:
+        if (lseek(src->fd, 0, SEEK_SET) < 0)
+            return -errno;
+        break;
+    case FB_SOURCE_FBREC:
+    case FB_SOURCE_SYNTH:
+        break;
+    }
+    src->next = 0;
+    return 0;
+}
+
+void fb_source_close(struct fb_source *src)
+{
+    switch (src->kind) {
+    case FB_SOURCE_LIVE:
+    case FB_SOURCE_RAW:
+        live_unmap(src);
+        close(src->fd);
+        free(src->buf);
+        break;
+    case FB_SOURCE_FBREC:
+        fbrec_close(&src->rec);
+        break;
+    case FB_SOURCE_SYNTH:
+        for (unsigned i = 0; i < FB_SYNTH_FRAMES; i++)
+            free(src->synth[i]);
+        break;
+    }
+    memset(src, 0, sizeof(*src));
+}
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: MIT
+/* fb_source.h – one frame-consumer interface for live, recorded and synthetic frames
+ *
+ * Analyzers pull frames through fb_source_next() regardless of where they
+ * come from: the module's /proc/drm_fb_raw (polled at a fixed rate, each
+ * capture mapped from the dma-buf the module exports, see fb_export.h), a raw
+ * dump of back-to-back frames, a .fbrec recording (zero-copy from the
+ * mapping) or a synthetic flashing pattern generated up front. Frames are
+ * XRGB8888 unless a raw source was opened with a YUV format or a recording
+ * holds one (fb_yuv.h); every frame of a source has the same format.
+ */
+#ifndef FB_SOURCE_H
+#define FB_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "fbrec.h"
+
+#define FB_FOURCC_XRGB8888  0x34325258u     /* 'XR24' */
+#define FB_MOD_INTEL(n)     ((1ull << 56) | (n))
+#define FB_SYNTH_FRAMES     4               /* distinct synthetic frames, cycled */
+
+enum fb_source_kind {
+    FB_SOURCE_LIVE,
+    FB_SOURCE_RAW,
+    FB_SOURCE_FBREC,
+    FB_SOURCE_SYNTH
+};
+
+struct fb_frame {
+    const uint8_t *data;
+    size_t size;
+    unsigned width, height, pitch;
+    uint32_t format;
+    uint64_t modifier;
+    uint64_t timestamp_ns;
+    uint64_t sequence;
+};
+
+struct fb_source {
+    enum fb_source_kind kind;
+    unsigned width, height, pitch;
+    uint64_t modifier;
+    uint32_t format;
+    double fps;
+    uint64_t next;
+    uint64_t limit;             /* synthetic: frames to produce, 0 = endless */
+
+    /* live / raw */
+    int fd;
+    uint8_t *buf;
+    size_t frame_size;
+    uint64_t next_tick_ns;
+    uint64_t late;              /* live: polls that came a frame period or more after their tick */
+    uint64_t skipped;           /* live: polls whose capture had another geometry or format */
+    int node;                   /* live: NUMA node of the capture; 0 on one node, -1 if unknown */
+    int no_export;              /* live: no dma-buf exports, read() every frame */
+    void *map;                  /* live: the latest capture's dma-buf, mapped */
+    size_t map_size;
+
+    /* recording */
+    struct fbrec rec;
+
+    /* synthetic */
+    uint8_t *synth[FB_SYNTH_FRAMES];
+};
+
+/*
+ * Raw frames of the given geometry. A regular file is read as back-to-back
+ * frames stamped n / fps; anything live (fb_fd_is_live(), e.g.
+ * /proc/drm_fb_raw) is polled at fps and stamped with CLOCK_MONOTONIC.
+ */
+int  fb_source_open_raw(struct fb_source *src, const char *path, unsigned width,
+                        unsigned height, unsigned pitch, uint64_t modifier, double fps);
+/*
+ * The same for FB_FOURCC_XRGB8888, FB_YUV_NV12 or FB_YUV_P010 frames; a
+ * YUV frame is its luma plane followed by its chroma plane, each padded to
+ * whole tile rows (fb_yuv_frame_size()).
+ */
+int  fb_source_open_raw_format(struct fb_source *src, const char *path, unsigned width,
+                               unsigned height, unsigned pitch, uint64_t modifier,
+                               uint32_t format, double fps);
+int  fb_source_open_fbrec(struct fb_source *src, const char *path);
+/* Linear XRGB8888 frames with a flashing block; frames == 0 never ends. */
+int  fb_source_open_synth(struct fb_source *src, unsigned width, unsigned height,
+                          uint64_t frames, double fps);
+
+/*
+ * 1 and *f filled, 0 at the end, negative errno on failure. A live source
+ * passes over captures of another geometry or format than it was opened
+ * with (counted in skipped) and waits for the next one that fits.
+ */
+int  fb_source_next(struct fb_source *src, struct fb_frame *f);
+/* Start over from the first frame (not available for live sources). */
+int  fb_source_rewind(struct fb_source *src);
+void fb_source_close(struct fb_source *src);
+
+/*
+ * NUMA node the module put its latest capture on, from /proc/drm_fb_pixels:
+ * 0 on a single-node machine, -1 when the module is not loaded or has not
+ * captured anything yet.
+ */
+int  fb_capture_node(void);
+/*
+ * Restrict the calling thread to the CPUs of the source's node, so the
+ * frames are read where the module stored them. Returns 0 without doing
+ * anything when the node is unknown.
+ */
+int  fb_source_pin(const struct fb_source *src);
+
+/*
+ * Whether fd is polled for its latest frame rather than read through:
+ * anything but a regular file, and procfs files like /proc/drm_fb_raw,
+ * which stat as empty regular files. Negative errno on failure.
+ */
+static inline int fb_fd_is_live(int fd)
+{
+    struct statfs sfs;
+    struct stat st;
+
+    if (fstat(fd, &st))
+        return -errno;
+    if (!S_ISREG(st.st_mode))
+        return 1;
+    if (fstatfs(fd, &sfs))
+        return -errno;
+    return sfs.f_type == PROC_SUPER_MAGIC;
+}
+
+/* Tile height implied by a modifier, for sizing raw frames. */
+unsigned fb_modifier_tile_height(uint64_t modifier);
+
+#endif /* FB_SOURCE_H */
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: MIT
+/* fb_source_test.c – checks of how fb_source opens its inputs
+ *
+ * Build :  gcc -O2 fb_source_test.c fb_source.c fbrec.c fb_plan.c fb_detile.c -lpthread -o fb_source_test
+ * Usage :  fb_source_test        (exit status 0 when every check passes)
+ *
+ * A raw path is either a dump, read through once, or something to poll for
+ * its latest frame. procfs files stat as empty regular files, so a dump
+ * check on the file type alone takes /proc/drm_fb_raw for an empty dump.
+ * /proc/version stands in for it: it is on procfs and rereads from the
+ * start, like the module's file. When the module is loaded with inject_hz
+ * set, /proc/drm_fb_raw itself is polled too: its frames must come from
+ * exported dma-bufs, and captures of another height must be skipped.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fb_source.h"
+
+static int failed;
+
+#define CHECK(cond, ...)                                    \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                   \
+            fputc('\n', stderr);                            \
+            failed++;                                       \
+        }                                                   \
+    } while (0)
+
+/* Open path as a 4x1 XRGB8888 source and pull two frames from it. */
+static void check_source(const char *path, enum fb_source_kind kind)
+{
+    struct fb_source src;
+    struct fb_frame f;
+    int ret = fb_source_open_raw(&src, path, 4, 1, 16, 0, 1000.0);
+
+    CHECK(ret == 0, "%s: open: %s", path, strerror(-ret));
+    if (ret)
+        return;
+    CHECK(src.kind == kind, "%s: opened as kind %d, expected %d", path, src.kind, kind);
+    for (int i = 0; i < 2; i++) {
+        ret = fb_source_next(&src, &f);
+        CHECK(ret == 1, "%s: frame %d: %d", path, i, ret);
+    }
+    fb_source_close(&src);
+}
+
+static void check_regular_file(void)
+{
+    char path[] = "/tmp/fb_source_test.XXXXXX";
+    uint8_t frames[32] = { 0 };
+    struct fb_source src;
+    struct fb_frame f;
+    int fd = mkstemp(path), ret;
+
+    CHECK(fd >= 0, "mkstemp: %s", strerror(errno));
+    if (fd < 0)
+        return;
+    CHECK(write(fd, frames, sizeof(frames)) == sizeof(frames), "write: %s", strerror(errno));
+    close(fd);
+
+    ret = fb_source_open_raw(&src, path, 4, 1, 16, 0, 1000.0);
+    CHECK(ret == 0, "%s: open: %s", path, strerror(-ret));
+    if (!ret) {
+        CHECK(src.kind == FB_SOURCE_RAW, "regular file opened as kind %d", src.kind);
+        CHECK(fb_source_next(&src, &f) == 1, "dump frame 0");
+        CHECK(fb_source_next(&src, &f) == 1, "dump frame 1");
+        CHECK(fb_source_next(&src, &f) == 0, "dump has no frame 2");
+        fb_source_close(&src);
+    }
+    unlink(path);
+}
+
+#define MODULE_PARAMS "/sys/module/drm_fb_pixel_extractor/parameters/"
+
+static unsigned read_param(const char *name)
+{
+    char path[256];
+    unsigned v = 0;
+    FILE *p;
+
+    snprintf(path, sizeof(path), MODULE_PARAMS "%s", name);
+    p = fopen(path, "r");
+    if (p) {
+        if (fscanf(p, "%u", &v) != 1)
+            v = 0;
+        fclose(p);
+    }
+    return v;
+}
+
+static int write_param(const char *name, unsigned v)
+{
+    char path[256];
+    FILE *p;
+    int ret;
+
+    snprintf(path, sizeof(path), MODULE_PARAMS "%s", name);
+    p = fopen(path, "w");
+    if (!p)
+        return -errno;
+    ret = fprintf(p, "%u\n", v) < 0 ? -EIO : 0;
+    if (fclose(p) && !ret)
+        ret = -errno;
+    return ret;
+}
+
+static unsigned inject_height;
+
+/* Put the injected height back after a while, so the source finds a frame it takes. */
+static void *restore_height(void *arg)
+{
+    (void)arg;
+    usleep(200000);
+    write_param("inject_height", inject_height);
+    return NULL;
+}
+
+/* The module's own file, when it is loaded and injecting captures. */
+static void check_module(void)
+{
+    unsigned w = read_param("inject_width"), h = read_param("inject_height");
+    unsigned hz = read_param("inject_hz");
+    struct fb_source src;
+    struct fb_frame f;
+    pthread_t thread;
+    int ret;
+
+    if (!hz || !w || h < 2) {
+        printf("skip /proc/drm_fb_raw: module not loaded with inject_hz\n");
+        return;
+    }
+
+    ret = fb_source_open_raw(&src, "/proc/drm_fb_raw", w, h, w * 4, 0, hz);
+    CHECK(ret == 0, "/proc/drm_fb_raw: open: %s", strerror(-ret));
+    if (ret)
+        return;
+    CHECK(src.kind == FB_SOURCE_LIVE, "/proc/drm_fb_raw opened as kind %d", src.kind);
+    for (int i = 0; i < 3; i++) {
+        ret = fb_source_next(&src, &f);
+        CHECK(ret == 1, "/proc/drm_fb_raw: frame %d: %d", i, ret);
+        CHECK(ret != 1 || (src.map && f.data == src.map),
+              "/proc/drm_fb_raw: frame %d was copied, not mapped", i);
+    }
+
+    /* Captures one row short are skipped, not handed out as w x h */
+    inject_height = h;
+    ret = write_param("inject_height", h - 1);
+    if (ret) {
+        printf("skip /proc/drm_fb_raw geometry change: %s\n", strerror(-ret));
+        fb_source_close(&src);
+        return;
+    }
+    usleep(3 * 1000000 / hz + 10000);
+    src.skipped = 0;
+    CHECK(!pthread_create(&thread, NULL, restore_height, NULL), "pthread_create");
+    ret = fb_source_next(&src, &f);
+    pthread_join(thread, NULL);
+    CHECK(ret == 1, "/proc/drm_fb_raw after %ux%u captures: %d", w, h - 1, ret);
+    CHECK(src.skipped > 0, "/proc/drm_fb_raw: %ux%u captures were not skipped", w, h - 1);
+    CHECK(ret != 1 || (src.map && f.data == src.map),
+          "/proc/drm_fb_raw: frame after the skips was copied, not mapped");
+    fb_source_close(&src);
+}
+
+int main(void)
+{
+    check_source("/proc/version", FB_SOURCE_LIVE);
+    check_source("/dev/zero", FB_SOURCE_LIVE);
+    check_regular_file();
+    check_module();
+
+    if (failed) {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return EXIT_FAILURE;
+    }
+    printf("fb_source: all checks passed\n");
+    return EXIT_SUCCESS;
+}
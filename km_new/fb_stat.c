@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: MIT
+/* fb_stat.c – follow the module's per-frame statistics, or compute them
+ *
+ * Build :  gcc -O2 fb_stat.c fb_stats.c fbrec.c fb_detile.c -o fb_stat
+ * Usage :  fb_stat [-f] [-i interval_ms] [-H]
+ *          fb_stat [-H] <recording.fbrec>
+ *
+ * Without a file, reads the fixed-size records of /proc/drm_fb_stats and
+ * prints one line per capture: APL (mean luminance), luminance range and
+ * the share of pixels that changed since the previous capture of the same
+ * region. The pixels themselves are never read. -f keeps polling every -i
+ * milliseconds (default 16) and prints captures as they appear.
+ *
+ * With a recording, computes the same records from its frames with the
+ * module's code: frames are detiled 32 rows at a time and each band is
+ * summarised as it is produced. Useful to check the module's numbers, or
+ * to get them for captures taken without it.
+ *
+ * -H adds the luminance and per-channel histograms, drawn as one
+ * character per bin scaled to the fullest bin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fb_detile.h"
+#include "fb_stats.h"
+#include "fbrec.h"
+
+#define PROC_STATS      "/proc/drm_fb_stats"
+#define MAX_RECORDS     16              /* more than the module's ring holds */
+#define BAND_ROWS       32
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+/* One character per bin, " .:-=+*#%@" from empty to the fullest bin. */
+static void print_hist(const char *name, const uint32_t *bins, unsigned n)
+{
+    static const char ramp[] = " .:-=+*#%@";
+    uint32_t top = 0;
+
+    for (unsigned i = 0; i < n; i++)
+        top = bins[i] > top ? bins[i] : top;
+    printf("  %-5s |", name);
+    for (unsigned i = 0; i < n; i++)
+        putchar(top ? ramp[(uint64_t)bins[i] * (sizeof(ramp) - 2) / top] : ' ');
+    printf("|\n");
+}
+
+static void print_stats(const struct fb_stats *st, int hist)
+{
+    printf("#%-6llu %14.6f s  %ux%u  APL %6.2f  luma %3u-%3u  R %3u-%3u G %3u-%3u B %3u-%3u",
+           (unsigned long long)st->sequence, st->timestamp_ns / 1e9, st->width, st->height,
+           st->luma_mean / 256.0, st->luma_min, st->luma_max,
+           st->min[0], st->max[0], st->min[1], st->max[1], st->min[2], st->max[2]);
+    if ((st->flags & FB_STATS_COMPARED) && st->pixels)
+        printf("  changed %5.1f%%\n", 100.0 * st->changed / st->pixels);
+    else
+        printf("  changed     -\n");
+    if (hist) {
+        print_hist("luma", st->luma_hist, FB_STATS_LUMA_BINS);
+        print_hist("red", st->colour_hist[0], FB_STATS_COLOUR_BINS);
+        print_hist("green", st->colour_hist[1], FB_STATS_COLOUR_BINS);
+        print_hist("blue", st->colour_hist[2], FB_STATS_COLOUR_BINS);
+    }
+}
+
+/* Records currently in /proc/drm_fb_stats, oldest first. */
+static int read_records(struct fb_stats *recs, unsigned *n)
+{
+    size_t got = 0;
+    ssize_t r;
+    int fd = open(PROC_STATS, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -errno;
+    while ((r = read(fd, (char *)recs + got, MAX_RECORDS * sizeof(*recs) - got)) > 0)
+        got += r;
+    close(fd);
+    if (r < 0)
+        return -errno;
+    *n = got / sizeof(*recs);
+    for (unsigned i = 0; i < *n; i++)
+        if (recs[i].magic != FB_STATS_MAGIC || recs[i].version != FB_STATS_VERSION)
+            return -EPROTO;
+    return 0;
+}
+
+static int follow(int keep_going, unsigned interval_ms, int hist)
+{
+    struct fb_stats recs[MAX_RECORDS];
+    uint64_t last = 0;
+    int seen = 0;
+
+    do {
+        unsigned n = 0;
+        int ret = read_records(recs, &n);
+
+        if (ret) {
+            fprintf(stderr, "%s: %s\n", PROC_STATS, strerror(-ret));
+            return EXIT_FAILURE;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            if (seen && recs[i].sequence <= last)
+                continue;
+            print_stats(&recs[i], hist);
+            last = recs[i].sequence;
+            seen = 1;
+        }
+        fflush(stdout);
+        if (keep_going)
+            sleep_ms(interval_ms);
+    } while (keep_going && !stop);
+    return EXIT_SUCCESS;
+}
+
+static int stats_format(uint32_t format, int *bgr)
+{
+    switch (format) {
+    case 0x34325258u:   /* XR24 */
+    case 0x34325241u:   /* AR24 */
+        *bgr = 0;
+        return 1;
+    case 0x34324258u:   /* XB24 */
+    case 0x34324241u:   /* AB24 */
+        *bgr = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int from_recording(const char *path, int hist)
+{
+    struct fbrec rec;
+    uint32_t *cur = NULL, *prev = NULL;
+    unsigned pw = 0, ph = 0;
+    uint32_t pformat = 0;
+    uint64_t skipped = 0;
+    int ret;
+
+    ret = fbrec_open(&rec, path);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < rec.count && !stop; i++) {
+        const struct fbrec_frame_header *h;
+        struct fbrec_frame f;
+        struct fb_stats_acc frame, band;
+        struct fb_stats st;
+        enum fb_tiling tiling;
+        int bgr, compared;
+
+        ret = fbrec_frame(&rec, i, &f);
+        if (ret)
+            break;
+        h = f.hdr;
+        if (!stats_format(h->format, &bgr) || !h->width || !h->height) {
+            skipped++;
+            continue;
+        }
+        if (h->width != pw || h->height != ph) {
+            uint32_t *a = realloc(cur, (size_t)h->width * h->height * 4);
+            uint32_t *b = a ? realloc(prev, (size_t)h->width * h->height * 4) : NULL;
+
+            if (a)
+                cur = a;
+            if (b)
+                prev = b;
+            if (!a || !b) {
+                ret = -ENOMEM;
+                break;
+            }
+            pw = 0;
+        }
+        compared = pw == h->width && ph == h->height && pformat == h->format;
+        tiling = fb_tiling_from_modifier(h->modifier);
+
+        fb_stats_begin(&frame);
+        for (unsigned y = 0; y < h->height; y += BAND_ROWS) {
+            unsigned rows = h->height - y < BAND_ROWS ? h->height - y : BAND_ROWS;
+            size_t first = (size_t)y * h->width;
+
+            ret = fb_detile_rect((uint8_t *)(cur + first), f.data, h->data_size, h->pitch,
+                                 tiling, 0, y, h->width, rows);
+            if (ret)
+                break;
+            fb_stats_begin(&band);
+            fb_stats_add(&band, cur + first, compared ? prev + first : NULL,
+                         (size_t)rows * h->width, bgr);
+            fb_stats_merge(&frame, &band);
+        }
+        if (ret)
+            break;
+        fb_stats_finish(&frame, compared, &st);
+        st.sequence = h->sequence;
+        st.timestamp_ns = h->timestamp_ns;
+        st.width = h->width;
+        st.height = h->height;
+        print_stats(&st, hist);
+
+        uint32_t *t = prev;
+        prev = cur;
+        cur = t;
+        pw = h->width;
+        ph = h->height;
+        pformat = h->format;
+    }
+    if (skipped)
+        fprintf(stderr, "%llu frames skipped: not 32-bit RGB\n", (unsigned long long)skipped);
+    if (ret)
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+    free(cur);
+    free(prev);
+    fbrec_close(&rec);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-f] [-i interval_ms] [-H]\n"
+        "       %s [-H] <recording.fbrec>\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned interval_ms = 16;
+    int keep_going = 0, hist = 0, opt;
+
+    while ((opt = getopt(argc, argv, "fi:H")) != -1) {
+        switch (opt) {
+        case 'f': keep_going = 1; break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'H': hist = 1; break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind > 1 || (argc - optind == 1 && keep_going)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (argc - optind == 1)
+        return from_recording(argv[optind], hist);
+    return follow(keep_going, interval_ms, hist);
+}
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: MIT
+/* fb_stats.c – per-frame summary statistics, computed band by band
+ *
+ * Build :  kbuild (part of drm_fb_pixel_extractor.ko), or
+ *          gcc -O2 -c fb_stats.c && ar rcs libfb_detile.a fb_stats.o
+ */
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#include <linux/string.h>
+#define fb_div64(n, d)  div64_u64(n, d)
+#else
+#include <string.h>
+#define fb_div64(n, d)  ((n) / (d))
+#endif
+
+#include "fb_stats.h"
+#include "fb_yuv.h"
+
+#define FB_RGB_MASK     0x00ffffffu
+
+void fb_stats_begin(struct fb_stats_acc *acc)
+{
+    memset(acc, 0, sizeof(*acc));
+    acc->luma_min = 0xff;
+    acc->min[0] = acc->min[1] = acc->min[2] = 0xff;
+}
+
+void fb_stats_add(struct fb_stats_acc *acc, const uint32_t *px, const uint32_t *prev,
+                  size_t n, int bgr)
+{
+    const unsigned rs = bgr ? 0 : 16, bs = bgr ? 16 : 0;
+    unsigned lmin = acc->luma_min, lmax = acc->luma_max;
+    unsigned rmin = acc->min[0], gmin = acc->min[1], bmin = acc->min[2];
+    unsigned rmax = acc->max[0], gmax = acc->max[1], bmax = acc->max[2];
+    uint64_t sum = 0;
+    uint32_t changed = 0;
+    size_t i;
+
+    /* Min/max live in locals so the loop keeps them in registers */
+    for (i = 0; i < n; i++) {
+        uint32_t p = px[i];
+        unsigned r = (p >> rs) & 0xff, g = (p >> 8) & 0xff, b = (p >> bs) & 0xff;
+        unsigned y = (54 * r + 183 * g + 19 * b + 128) >> 8;
+
+        sum += y;
+        acc->luma_hist[y >> 2]++;
+        acc->colour_hist[0][r >> 4]++;
+        acc->colour_hist[1][g >> 4]++;
+        acc->colour_hist[2][b >> 4]++;
+        lmin = y < lmin ? y : lmin;
+        lmax = y > lmax ? y : lmax;
+        rmin = r < rmin ? r : rmin;
+        rmax = r > rmax ? r : rmax;
+        gmin = g < gmin ? g : gmin;
+        gmax = g > gmax ? g : gmax;
+        bmin = b < bmin ? b : bmin;
+        bmax = b > bmax ? b : bmax;
+    }
+    if (prev)
+        for (i = 0; i < n; i++)
+            changed += ((px[i] ^ prev[i]) & FB_RGB_MASK) != 0;
+
+    acc->luma_sum += sum;
+    acc->pixels += n;
+    acc->changed += changed;
+    acc->luma_min = lmin;
+    acc->luma_max = lmax;
+    acc->min[0] = rmin;
+    acc->min[1] = gmin;
+    acc->min[2] = bmin;
+    acc->max[0] = rmax;
+    acc->max[1] = gmax;
+    acc->max[2] = bmax;
+}
+
+void fb_stats_add_luma(struct fb_stats_acc *acc, const uint8_t *luma, const uint8_t *prev,
+                       size_t n, unsigned depth)
+{
+    unsigned lmin = acc->luma_min, lmax = acc->luma_max;
+    uint64_t sum = 0;
+    uint32_t changed = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        /* Limited to full range, 255/876 in 16.16 */
+        unsigned y = fb_yuv_clamp8((((int)fb_yuv_sample(luma, i, depth) - 64) * 19077 +
+                                    (1 << 15)) >> 16);
+
+        sum += y;
+        acc->luma_hist[y >> 2]++;
+        lmin = y < lmin ? y : lmin;
+        lmax = y > lmax ? y : lmax;
+    }
+    if (prev)
+        for (i = 0; i < n * depth; i += depth)
+            changed += memcmp(luma + i, prev + i, depth) != 0;
+
+    acc->luma_sum += sum;
+    acc->pixels += n;
+    acc->changed += changed;
+    acc->luma_only = 1;
+    acc->luma_min = lmin;
+    acc->luma_max = lmax;
+}
+
+void fb_stats_add_frame(struct fb_stats_acc *acc, const uint32_t *frame,
+                        const uint32_t *prev_frame, size_t first, size_t n,
+                        unsigned width, int bgr, uint8_t *dirty, unsigned block)
+{
+    const unsigned cols = (width + block - 1) / block;
+    const size_t end = first + n;
+    size_t i = first, j;
+
+    fb_stats_add(acc, frame + first, dirty ? NULL : prev_frame, n, bgr);
+    if (!dirty || !prev_frame)
+        return;
+
+    /* Changes counted one row segment within a block at a time */
+    while (i < end) {
+        unsigned x = i % width, y = i / width;
+        size_t seg = block - x % block;
+        uint32_t changed = 0;
+
+        if (seg > width - x)
+            seg = width - x;
+        if (seg > end - i)
+            seg = end - i;
+        for (j = i; j < i + seg; j++)
+            changed += ((frame[j] ^ prev_frame[j]) & FB_RGB_MASK) != 0;
+        if (changed) {
+            acc->changed += changed;
+            dirty[(size_t)(y / block) * cols + x / block] = 1;
+        }
+        i += seg;
+    }
+}
+
+void fb_stats_merge(struct fb_stats_acc *into, const struct fb_stats_acc *band)
+{
+    int c, i;
+
+    if (!band->pixels)
+        return;
+    into->luma_sum += band->luma_sum;
+    into->pixels += band->pixels;
+    into->changed += band->changed;
+    into->luma_only |= band->luma_only;
+    if (band->luma_min < into->luma_min)
+        into->luma_min = band->luma_min;
+    if (band->luma_max > into->luma_max)
+        into->luma_max = band->luma_max;
+    for (c = 0; c < 3; c++) {
+        if (band->min[c] < into->min[c])
+            into->min[c] = band->min[c];
+        if (band->max[c] > into->max[c])
+            into->max[c] = band->max[c];
+        for (i = 0; i < FB_STATS_COLOUR_BINS; i++)
+            into->colour_hist[c][i] += band->colour_hist[c][i];
+    }
+    for (i = 0; i < FB_STATS_LUMA_BINS; i++)
+        into->luma_hist[i] += band->luma_hist[i];
+}
+
+void fb_stats_finish(const struct fb_stats_acc *acc, int compared, struct fb_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->magic = FB_STATS_MAGIC;
+    out->version = FB_STATS_VERSION;
+    out->flags = (compared ? FB_STATS_COMPARED : 0) | (acc->luma_only ? FB_STATS_LUMA_ONLY : 0);
+    out->pixels = acc->pixels;
+    out->changed = compared ? acc->changed : 0;
+    if (!acc->pixels)
+        return;
+    out->luma_mean = fb_div64(acc->luma_sum * 256 + acc->pixels / 2, acc->pixels);
+    out->luma_min = acc->luma_min;
+    out->luma_max = acc->luma_max;
+    memcpy(out->luma_hist, acc->luma_hist, sizeof(out->luma_hist));
+    if (acc->luma_only)
+        return;
+    memcpy(out->min, acc->min, sizeof(out->min));
+    memcpy(out->max, acc->max, sizeof(out->max));
+    memcpy(out->colour_hist, acc->colour_hist, sizeof(out->colour_hist));
+}
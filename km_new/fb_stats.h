@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: MIT
+/* fb_stats.h – per-frame summary statistics, computed band by band
+ *
+ * One implementation for the kernel module (kbuild, __KERNEL__) and the
+ * userspace tools (libfb_detile.a). The module summarises every band of
+ * linear XRGB/XBGR pixels right after copying or detiling it, merges the
+ * bands and publishes the result as a fixed-size struct fb_stats per
+ * capture in /proc/drm_fb_stats; fb_stat computes the same record from
+ * recordings.
+ *
+ * Integer arithmetic only. Luminance is the BT.709 weighting in 8-bit
+ * fixed point, which sums to 256:
+ *
+ *   Y = (54 * R + 183 * G + 19 * B + 128) >> 8
+ *
+ * "Changed" compares the colour bits (alpha and X are ignored) against
+ * the same pixels of the previous capture of the same region.
+ *
+ * NV12/P010 captures are summarised from their luma plane alone. Y' is
+ * the same BT.709 weighting, so luma is exact once stretched from limited
+ * to full range; the colour fields stay zero and "changed" compares luma.
+ */
+#ifndef FB_STATS_H
+#define FB_STATS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define FB_STATS_MAGIC          0x54535246u     /* 'FRST' */
+#define FB_STATS_VERSION        1
+#define FB_STATS_LUMA_BINS      64              /* 4 luma levels per bin */
+#define FB_STATS_COLOUR_BINS    16              /* 16 levels per bin, per channel */
+
+#define FB_STATS_COMPARED       0x1             /* changed is valid */
+#define FB_STATS_LUMA_ONLY      0x2             /* from a luma plane, no colour fields */
+
+/* The published record: 504 bytes, little-endian, no pointers. */
+struct fb_stats {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;                 /* FB_STATS_* */
+    uint64_t sequence;              /* capture number, counting skipped ones out */
+    uint64_t timestamp_ns;          /* CLOCK_MONOTONIC, copy started */
+    uint32_t width, height;         /* region covered, after downscaling */
+    uint32_t pixels;                /* pixels summarised */
+    uint32_t changed;               /* of them, different from the previous capture */
+    uint16_t luma_mean;             /* APL, 8.8 fixed point */
+    uint8_t luma_min, luma_max;
+    uint8_t min[3], max[3];         /* R, G, B */
+    uint16_t reserved;
+    uint32_t luma_hist[FB_STATS_LUMA_BINS];
+    uint32_t colour_hist[3][FB_STATS_COLOUR_BINS];
+    uint32_t spare;
+};
+
+/* Running totals of one band, or of the bands merged so far. */
+struct fb_stats_acc {
+    uint64_t luma_sum;
+    uint32_t pixels, changed;
+    int luma_only;
+    uint8_t luma_min, luma_max;
+    uint8_t min[3], max[3];
+    uint32_t luma_hist[FB_STATS_LUMA_BINS];
+    uint32_t colour_hist[3][FB_STATS_COLOUR_BINS];
+};
+
+void fb_stats_begin(struct fb_stats_acc *acc);
+
+/*
+ * Add n pixels. prev, when not NULL, holds the same pixels of the previous
+ * frame. bgr: red is in the low byte (XBGR/ABGR) rather than bits 16-23.
+ */
+void fb_stats_add(struct fb_stats_acc *acc, const uint32_t *px, const uint32_t *prev,
+                  size_t n, int bgr);
+
+/*
+ * The same for pixels [first, first + n) of a frame width pixels wide,
+ * given as the whole frame. When dirty is not NULL, also sets
+ * dirty[(y / block) * cols + x / block] for every block x block square
+ * holding a changed pixel, with cols = (width + block - 1) / block.
+ */
+void fb_stats_add_frame(struct fb_stats_acc *acc, const uint32_t *frame,
+                        const uint32_t *prev_frame, size_t first, size_t n,
+                        unsigned width, int bgr, uint8_t *dirty, unsigned block);
+
+/*
+ * Add n pixels of a luma plane of depth-byte samples (1: NV12, 2: P010),
+ * packed; prev as for fb_stats_add().
+ */
+void fb_stats_add_luma(struct fb_stats_acc *acc, const uint8_t *luma, const uint8_t *prev,
+                       size_t n, unsigned depth);
+
+void fb_stats_merge(struct fb_stats_acc *into, const struct fb_stats_acc *band);
+
+/* Fill everything but sequence, timestamp_ns, width and height. */
+void fb_stats_finish(const struct fb_stats_acc *acc, int compared, struct fb_stats *out);
+
+#endif /* FB_STATS_H */
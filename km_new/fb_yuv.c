@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: MIT
+/* fb_yuv.c – calibrated luma tables for NV12/P010 luminance
+ *
+ * Build :  kbuild (part of drm_fb_pixel_extractor.ko), or
+ *          gcc -O2 -c fb_yuv.c && ar rcs libfb_detile.a fb_yuv.o
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#include "fb_yuv.h"
+
+/*
+ * Luminance (FB_SCREEN_LUM_ONE == 1.0) of the neutral pixel of each 10-bit
+ * luma code: fb_yuv_xrgb(y, 512, 512) weighted with the fb_screen.c
+ * tables, so grey is exactly what the XRGB8888 paths see.
+ */
+const uint16_t fb_yuv_lum[1024] = {
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,     0,     0,     0,     5,     5,     5,     5,    10,    10,
+       10,    15,    15,    15,    15,    19,    19,    19,    25,    25,    25,    29,
+       29,    29,    29,    35,    35,    35,    39,    39,    39,    39,    45,    45,
+       45,    51,    51,    51,    51,    55,    55,    55,    60,    60,    60,    66,
+       66,    66,    66,    71,    71,    71,    79,    79,    79,    79,    85,    85,
+       85,    93,    93,    93,    93,    99,    99,    99,   107,   107,   107,   114,
+      114,   114,   114,   123,   123,   123,   131,   131,   131,   131,   140,   140,
+      140,   150,   150,   150,   150,   159,   159,   159,   169,   169,   169,   169,
+      179,   179,   179,   190,   190,   190,   202,   202,   202,   202,   212,   212,
+      212,   225,   225,   225,   225,   236,   236,   236,   249,   249,   249,   249,
+      262,   262,   262,   276,   276,   276,   289,   289,   289,   289,   303,   303,
+      303,   318,   318,   318,   318,   333,   333,   333,   348,   348,   348,   348,
+      363,   363,   363,   379,   379,   379,   379,   396,   396,   396,   413,   413,
+      413,   429,   429,   429,   429,   447,   447,   447,   466,   466,   466,   466,
+      484,   484,   484,   503,   503,   503,   503,   523,   523,   523,   542,   542,
+      542,   563,   563,   563,   563,   583,   583,   583,   604,   604,   604,   604,
+      626,   626,   626,   648,   648,   648,   648,   670,   670,   670,   693,   693,
+      693,   716,   716,   716,   716,   739,   739,   739,   765,   765,   765,   765,
+      789,   789,   789,   814,   814,   814,   814,   841,   841,   841,   866,   866,
+      866,   866,   892,   892,   892,   920,   920,   920,   946,   946,   946,   946,
+      974,   974,   974,  1003,  1003,  1003,  1003,  1032,  1032,  1032,  1062,  1062,
+     1062,  1062,  1092,  1092,  1092,  1122,  1122,  1122,  1152,  1152,  1152,  1152,
+     1184,  1184,  1184,  1217,  1217,  1217,  1217,  1248,  1248,  1248,  1280,  1280,
+     1280,  1280,  1314,  1314,  1314,  1348,  1348,  1348,  1383,  1383,  1383,  1383,
+     1417,  1417,  1417,  1453,  1453,  1453,  1453,  1487,  1487,  1487,  1524,  1524,
+     1524,  1524,  1562,  1562,  1562,  1599,  1599,  1599,  1599,  1637,  1637,  1637,
+     1675,  1675,  1675,  1714,  1714,  1714,  1714,  1754,  1754,  1754,  1793,  1793,
+     1793,  1793,  1834,  1834,  1834,  1875,  1875,  1875,  1875,  1916,  1916,  1916,
+     1958,  1958,  1958,  2000,  2000,  2000,  2000,  2045,  2045,  2045,  2088,  2088,
+     2088,  2088,  2132,  2132,  2132,  2177,  2177,  2177,  2177,  2221,  2221,  2221,
+     2268,  2268,  2268,  2314,  2314,  2314,  2314,  2361,  2361,  2361,  2409,  2409,
+     2409,  2409,  2456,  2456,  2456,  2506,  2506,  2506,  2506,  2554,  2554,  2554,
+     2605,  2605,  2605,  2605,  2655,  2655,  2655,  2705,  2705,  2705,  2757,  2757,
+     2757,  2757,  2809,  2809,  2809,  2861,  2861,  2861,  2861,  2914,  2914,  2914,
+     2968,  2968,  2968,  2968,  3023,  3023,  3023,  3077,  3077,  3077,  3132,  3132,
+     3132,  3132,  3188,  3188,  3188,  3245,  3245,  3245,  3245,  3302,  3302,  3302,
+     3360,  3360,  3360,  3360,  3419,  3419,  3419,  3477,  3477,  3477,  3477,  3536,
+     3536,  3536,  3597,  3597,  3597,  3658,  3658,  3658,  3658,  3719,  3719,  3719,
+     3781,  3781,  3781,  3781,  3842,  3842,  3842,  3906,  3906,  3906,  3906,  3970,
+     3970,  3970,  4034,  4034,  4034,  4098,  4098,  4098,  4098,  4164,  4164,  4164,
+     4229,  4229,  4229,  4229,  4296,  4296,  4296,  4364,  4364,  4364,  4364,  4432,
+     4432,  4432,  4501,  4501,  4501,  4569,  4569,  4569,  4569,  4639,  4639,  4639,
+     4709,  4709,  4709,  4709,  4780,  4780,  4780,  4852,  4852,  4852,  4852,  4925,
+     4925,  4925,  4997,  4997,  4997,  4997,  5070,  5070,  5070,  5144,  5144,  5144,
+     5220,  5220,  5220,  5220,  5295,  5295,  5295,  5371,  5371,  5371,  5371,  5447,
+     5447,  5447,  5524,  5524,  5524,  5524,  5601,  5601,  5601,  5681,  5681,  5681,
+     5759,  5759,  5759,  5759,  5839,  5839,  5839,  5920,  5920,  5920,  5920,  6001,
+     6001,  6001,  6082,  6082,  6082,  6082,  6165,  6165,  6165,  6247,  6247,  6247,
+     6331,  6331,  6331,  6331,  6415,  6415,  6415,  6500,  6500,  6500,  6500,  6586,
+     6586,  6586,  6673,  6673,  6673,  6673,  6759,  6759,  6759,  6847,  6847,  6847,
+     6847,  6935,  6935,  6935,  7023,  7023,  7023,  7113,  7113,  7113,  7113,  7203,
+     7203,  7203,  7295,  7295,  7295,  7295,  7385,  7385,  7385,  7478,  7478,  7478,
+     7478,  7572,  7572,  7572,  7663,  7663,  7663,  7758,  7758,  7758,  7758,  7854,
+     7854,  7854,  7949,  7949,  7949,  7949,  8045,  8045,  8045,  8142,  8142,  8142,
+     8142,  8240,  8240,  8240,  8338,  8338,  8338,  8437,  8437,  8437,  8437,  8536,
+     8536,  8536,  8637,  8637,  8637,  8637,  8738,  8738,  8738,  8839,  8839,  8839,
+     8839,  8942,  8942,  8942,  9044,  9044,  9044,  9044,  9148,  9148,  9148,  9252,
+     9252,  9252,  9357,  9357,  9357,  9357,  9463,  9463,  9463,  9569,  9569,  9569,
+     9569,  9677,  9677,  9677,  9784,  9784,  9784,  9784,  9893,  9893,  9893, 10003,
+    10003, 10003, 10112, 10112, 10112, 10112, 10222, 10222, 10222, 10334, 10334, 10334,
+    10334, 10446, 10446, 10446, 10559, 10559, 10559, 10559, 10673, 10673, 10673, 10787,
+    10787, 10787, 10787, 10902, 10902, 10902, 11017, 11017, 11017, 11134, 11134, 11134,
+    11134, 11250, 11250, 11250, 11369, 11369, 11369, 11369, 11486, 11486, 11486, 11606,
+    11606, 11606, 11606, 11726, 11726, 11726, 11847, 11847, 11847, 11967, 11967, 11967,
+    11967, 12090, 12090, 12090, 12213, 12213, 12213, 12213, 12337, 12337, 12337, 12461,
+    12461, 12461, 12461, 12586, 12586, 12586, 12711, 12711, 12711, 12837, 12837, 12837,
+    12837, 12964, 12964, 12964, 13092, 13092, 13092, 13092, 13222, 13222, 13222, 13350,
+    13350, 13350, 13350, 13480, 13480, 13480, 13612, 13612, 13612, 13612, 13743, 13743,
+    13743, 13876, 13876, 13876, 14008, 14008, 14008, 14008, 14142, 14142, 14142, 14277,
+    14277, 14277, 14277, 14412, 14412, 14412, 14548, 14548, 14548, 14548, 14684, 14684,
+    14684, 14822, 14822, 14822, 14961, 14961, 14961, 14961, 15099, 15099, 15099, 15239,
+    15239, 15239, 15239, 15379, 15379, 15379, 15521, 15521, 15521, 15521, 15663, 15663,
+    15663, 15805, 15805, 15805, 15950, 15950, 15950, 15950, 16093, 16093, 16093, 16238,
+    16238, 16238, 16238, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+    16384, 16384, 16384, 16384,
+};
+
+/*
+ * Chroma radius in 10-bit steps, per four luma codes, within which
+ * fb_yuv_lum[] is within FB_YUV_LUM_ERROR of the converted pixel: the
+ * widest for which that held for every Cb/Cr, and each of the four codes,
+ * when checked against fb_yuv_xrgb().
+ */
+const uint8_t fb_yuv_near[256] = {
+    150, 147, 144, 142, 139, 137, 134, 132, 130, 128, 126, 123, 121, 118, 115, 113,
+    112, 110, 110, 109, 109, 108, 108, 107, 107, 106, 105, 105, 105, 105, 104, 104,
+    104, 102, 100, 100,  99,  98,  96,  98,  97,  96,  96,  94,  93,  94,  94,  93,
+     94,  93,  91,  91,  90,  89,  92,  89,  89,  89,  89,  89,  87,  87,  85,  87,
+     84,  87,  87,  87,  84,  85,  84,  85,  84,  83,  82,  83,  82,  82,  80,  82,
+     80,  83,  80,  79,  79,  79,  79,  78,  78,  78,  78,  78,  75,  78,  78,  78,
+     75,  78,  73,  78,  74,  78,  73,  76,  73,  76,  73,  76,  73,  74,  73,  73,
+     73,  74,  73,  74,  70,  69,  70,  72,  70,  72,  69,  69,  69,  69,  69,  71,
+     68,  68,  68,  64,  68,  69,  68,  64,  65,  64,  65,  67,  64,  64,  65,  64,
+     65,  61,  62,  62,  62,  59,  62,  59,  62,  59,  62,  59,  62,  58,  62,  61,
+     64,  58,  61,  58,  61,  58,  63,  58,  62,  58,  60,  53,  60,  57,  60,  55,
+     60,  54,  60,  53,  58,  53,  58,  53,  48,  53,  60,  53,  57,  49,  48,  53,
+     55,  53,  54,  50,  47,  53,  47,  50,  51,  49,  47,  51,  42,  49,  51,  49,
+     46,  51,  42,  49,  54,  43,  42,  49,  42,  49,  37,  43,  43,  41,  38,  36,
+     33,  31,  26,  21,  22,  18,  17,  14,  10,   5,   6,   7,  10,  12,  15,  18,
+     20,  23,  25,  28,  31,  33,  36,  38,  40,  43,  45,  47,  49,  52,  54,  57,
+};
+
+/* Lowest 8-bit Cr of a red-dominant pixel, per four luma codes; 255: none. */
+const uint8_t fb_yuv_red_cr[256] = {
+    138, 137, 137, 136, 135, 135, 134, 133, 133, 132, 131, 131, 130, 129, 129, 128,
+    128, 129, 130, 131, 131, 133, 133, 134, 135, 135, 136, 136, 137, 137, 138, 138,
+    138, 139, 139, 140, 140, 140, 141, 141, 141, 142, 142, 143, 143, 143, 144, 144,
+    144, 145, 145, 146, 146, 146, 147, 147, 148, 148, 149, 149, 150, 150, 150, 151,
+    151, 152, 152, 152, 153, 153, 153, 154, 154, 155, 155, 156, 156, 156, 157, 157,
+    158, 158, 159, 159, 159, 160, 160, 161, 161, 161, 162, 162, 163, 163, 163, 164,
+    164, 165, 165, 165, 166, 166, 166, 167, 167, 168, 168, 169, 169, 170, 170, 170,
+    171, 171, 171, 172, 172, 173, 173, 173, 174, 174, 175, 175, 175, 176, 176, 177,
+    177, 177, 178, 178, 179, 179, 180, 180, 180, 181, 181, 181, 182, 182, 183, 183,
+    184, 184, 184, 185, 187, 189, 192, 194, 196, 199, 201, 204, 206, 208, 211, 213,
+    216, 218, 221, 223, 225, 228, 230, 233, 235, 237, 240, 242, 245, 247, 249, 252,
+    254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+/* fb_yuv.h – relative luminance straight from the luma plane of NV12/P010
+ *
+ * One implementation for the kernel module (kbuild, __KERNEL__) and the
+ * userspace tools (libfb_detile.a), like fb_screen.h. Video planes carry
+ * BT.709 limited-range Y'CbCr 4:2:0: a plane of luma samples, then a plane
+ * of interleaved Cb/Cr pairs, each covering 2 x 2 pixels. NV12 samples
+ * are bytes, P010 samples 16-bit little-endian words holding 10 bits at
+ * the top. Everything below works on 10-bit codes (NV12 shifted up by 2).
+ *
+ * Y' is the BT.709 weighting of the gamma-encoded R'G'B', so for a neutral
+ * pixel the gamma expansion of Y' is its relative luminance (spec.v, the
+ * same value flash_analyzer.c and fb_screen.c compute from XRGB8888). For
+ * a coloured pixel the chroma terms cancel to first order and only the
+ * curvature of the expansion is left, which grows with the chroma:
+ *
+ *   within near(Y') = fb_yuv_near[Y' >> 2] of neutral chroma, i.e.
+ *   max(|Cb - 512|, |Cr - 512|) <= near(Y'), fb_yuv_lum[Y'] is within
+ *   FB_YUV_LUM_ERROR of the luminance of the pixel converted to XRGB8888;
+ *   beyond it, convert the pixel with fb_yuv_xrgb() and take the
+ *   luminance of that.
+ *
+ * fb_yuv_lum[] is exact for neutral pixels. near() was calibrated offline
+ * against fb_yuv_xrgb() over every 10-bit Y'CbCr triple, clipped ones
+ * included: about +-18 8-bit chroma steps at mid grey, narrowing towards
+ * white where converted pixels clip. Most video content stays within it
+ * and never leaves the luma plane.
+ *
+ * Red flashes (spec.v B.2) need chroma anyway, but only for red-dominant
+ * pixels: fb_yuv_red_cr[Y' >> 2] is the lowest 8-bit Cr any red-dominant
+ * pixel of that luma has (255: none), so pixels below it can be skipped
+ * without conversion.
+ */
+#ifndef FB_YUV_H
+#define FB_YUV_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define FB_YUV_NV12         0x3231564eu     /* 'NV12' */
+#define FB_YUV_P010         0x30313050u     /* 'P010' */
+#define FB_YUV_LUM_ERROR    164             /* 0.01 in FB_SCREEN_LUM_ONE / FA_LUM_ONE units */
+
+extern const uint16_t fb_yuv_lum[1024];
+extern const uint8_t fb_yuv_near[256];
+extern const uint8_t fb_yuv_red_cr[256];
+
+/* Bytes per luma sample of a YUV format: 1 (NV12), 2 (P010) or 0 for anything else. */
+static inline unsigned fb_yuv_depth(uint32_t format)
+{
+    return format == FB_YUV_NV12 ? 1 : format == FB_YUV_P010 ? 2 : 0;
+}
+
+/*
+ * Offset of the chroma plane in a frame of height rows, pitch bytes apart:
+ * it starts on the first whole tile row after the luma plane and has the
+ * same pitch. The frame ends (height + 1) / 2 rows, rounded up to whole
+ * tile rows, after it.
+ */
+static inline size_t fb_yuv_uv_offset(unsigned pitch, unsigned height, unsigned tile_h)
+{
+    return (size_t)pitch * ((height + tile_h - 1) / tile_h * tile_h);
+}
+
+static inline size_t fb_yuv_frame_size(unsigned pitch, unsigned height, unsigned tile_h)
+{
+    return fb_yuv_uv_offset(pitch, height, tile_h) +
+           (size_t)pitch * (((height + 1) / 2 + tile_h - 1) / tile_h * tile_h);
+}
+
+/* Sample i of a row, as a 10-bit code. */
+static inline unsigned fb_yuv_sample(const uint8_t *row, size_t i, unsigned depth)
+{
+    return depth == 2 ? (row[2 * i] | row[2 * i + 1] << 8) >> 6 : row[i] << 2;
+}
+
+/* Whether fb_yuv_lum[y] is not good enough for this chroma. */
+static inline int fb_yuv_exact(unsigned y, unsigned cb, unsigned cr)
+{
+    unsigned du = cb > 512 ? cb - 512 : 512 - cb;
+    unsigned dv = cr > 512 ? cr - 512 : 512 - cr;
+
+    return (du > dv ? du : dv) > fb_yuv_near[y >> 2];
+}
+
+/* Whether the pixel may be red-dominant (red_ratio >= 0.8 in linear light). */
+static inline int fb_yuv_reddish(unsigned y, unsigned cr)
+{
+    return cr >= 4u * fb_yuv_red_cr[y >> 2];
+}
+
+static inline unsigned fb_yuv_clamp8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/*
+ * BT.709 limited range to XRGB8888 in 16.16 fixed point:
+ * R' = 255/876 (Y' - 64) + 255 * 1.5748/896 (Cr - 512), and so on.
+ */
+static inline uint32_t fb_yuv_xrgb(unsigned y, unsigned cb, unsigned cr)
+{
+    const int l = ((int)y - 64) * 19077 + (1 << 15);
+    const int u = (int)cb - 512, v = (int)cr - 512;
+
+    return fb_yuv_clamp8((l + 29372 * v) >> 16) << 16 |
+           fb_yuv_clamp8((l - 3493 * u - 8731 * v) >> 16) << 8 |
+           fb_yuv_clamp8((l + 34610 * u) >> 16);
+}
+
+#endif /* FB_YUV_H */
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: MIT
+/* fbrec.c – seekable framebuffer recording container
+ *
+ * Build :  gcc -O2 -c fbrec.c
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fbrec.h"
+
+#define PAGE_ALIGN(x) (((x) + FBREC_PAGE - 1) & ~(uint64_t)(FBREC_PAGE - 1))
+
+static uint64_t slot_offset(uint64_t slot_size, uint64_t i)
+{
+    return FBREC_PAGE + i * slot_size;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_file_header(struct fbrec_writer *w, uint64_t count, uint64_t index_offset)
+{
+    struct fbrec_file_header hdr;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FBREC_MAGIC, sizeof(hdr.magic));
+    hdr.version = FBREC_VERSION;
+    hdr.header_size = FBREC_PAGE;
+    hdr.slot_size = w->slot_size;
+    hdr.frame_count = count;
+    hdr.index_offset = index_offset;
+    hdr.created_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    /* Keep the original creation time when finalising. */
+    if (index_offset) {
+        struct fbrec_file_header old;
+        if (pread(w->fd, &old, sizeof(old), 0) == sizeof(old))
+            hdr.created_ns = old.created_ns;
+    }
+    return pwrite_all(w->fd, &hdr, sizeof(hdr), 0);
+}
+
+int fbrec_create(struct fbrec_writer *w, const char *path, size_t max_frame_size)
+{
+    int ret;
+
+    memset(w, 0, sizeof(*w));
+    w->slot_size = FBREC_PAGE + PAGE_ALIGN(max_frame_size);
+    w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0)
+        return -errno;
+
+    ret = write_file_header(w, 0, 0);
+    if (ret) {
+        close(w->fd);
+        w->fd = -1;
+    }
+    return ret;
+}
+
+int fbrec_append(struct fbrec_writer *w, struct fbrec_frame_header *hdr, const void *data)
+{
+    uint64_t off = slot_offset(w->slot_size, w->count);
+    int ret;
+
+    if (FBREC_PAGE + hdr->data_size > w->slot_size)
+        return -E2BIG;
+    if (w->count && hdr->timestamp_ns < w->last_ts)
+        return -EINVAL;
+
+    if (w->count == w->index_cap) {
+        size_t cap = w->index_cap ? w->index_cap * 2 : 1024;
+        void *p = realloc(w->index, cap * sizeof(*w->index));
+        if (!p)
+            return -ENOMEM;
+        w->index = p;
+        w->index_cap = cap;
+    }
+
+    hdr->magic = FBREC_FRAME_MAGIC;
+    ret = pwrite_all(w->fd, hdr, sizeof(*hdr), off);
+    if (!ret)
+        ret = pwrite_all(w->fd, data, hdr->data_size, off + FBREC_PAGE);
+    if (ret)
+        return ret;
+
+    w->index[w->count].timestamp_ns = hdr->timestamp_ns;
+    w->index[w->count].sequence = hdr->sequence;
+    w->index[w->count].offset = off;
+    w->last_ts = hdr->timestamp_ns;
+    w->count++;
+    return 0;
+}
+
+int fbrec_finish(struct fbrec_writer *w)
+{
+    struct fbrec_index_header ih;
+    uint64_t off = slot_offset(w->slot_size, w->count);
+    int ret;
+
+    memcpy(ih.magic, FBREC_INDEX_MAGIC, sizeof(ih.magic));
+    ih.count = w->count;
+
+    ret = pwrite_all(w->fd, &ih, sizeof(ih), off);
+    if (!ret && w->count)
+        ret = pwrite_all(w->fd, w->index, w->count * sizeof(*w->index), off + sizeof(ih));
+    if (!ret)
+        ret = write_file_header(w, w->count, off);
+    if (!ret && fsync(w->fd))
+        ret = -errno;
+
+    close(w->fd);
+    free(w->index);
+    w->fd = -1;
+    w->index = NULL;
+    return ret;
+}
+
+/* Unfinished recording: walk the fixed-size slots until one doesn't parse. */
+static int rebuild_index(struct fbrec *rec)
+{
+    uint64_t slot = rec->hdr->slot_size;
+    uint64_t n = (rec->map_size - FBREC_PAGE) / slot + !!((rec->map_size - FBREC_PAGE) % slot);
+    uint64_t i;
+
+    rec->rebuilt = calloc(n ? n : 1, sizeof(*rec->rebuilt));
+    if (!rec->rebuilt)
+        return -ENOMEM;
+
+    for (i = 0; i < n; i++) {
+        uint64_t off = slot_offset(slot, i);
+        const struct fbrec_frame_header *fh = (const void *)(rec->map + off);
+
+        /* The last slot is not padded, so only its data has to be present. */
+        if (FBREC_PAGE > rec->map_size - off || fh->magic != FBREC_FRAME_MAGIC ||
+            fh->data_size > slot - FBREC_PAGE ||
+            fh->data_size > rec->map_size - off - FBREC_PAGE ||
+            (i && fh->timestamp_ns < rec->rebuilt[i - 1].timestamp_ns))
+            break;
+        rec->rebuilt[i].timestamp_ns = fh->timestamp_ns;
+        rec->rebuilt[i].sequence = fh->sequence;
+        rec->rebuilt[i].offset = off;
+    }
+    rec->index = rec->rebuilt;
+    rec->count = i;
+    return 0;
+}
+
+int fbrec_open(struct fbrec *rec, const char *path)
+{
+    struct stat st;
+    int ret;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (rec->fd < 0)
+        return -errno;
+
+    if (fstat(rec->fd, &st)) {
+        ret = -errno;
+        goto err_close;
+    }
+    if ((size_t)st.st_size < FBREC_PAGE) {
+        ret = -EINVAL;
+        goto err_close;
+    }
+
+    rec->map_size = st.st_size;
+    rec->map = mmap(NULL, rec->map_size, PROT_READ, MAP_SHARED, rec->fd, 0);
+    if (rec->map == MAP_FAILED) {
+        ret = -errno;
+        goto err_close;
+    }
+    rec->hdr = (const void *)rec->map;
+
+    if (memcmp(rec->hdr->magic, FBREC_MAGIC, sizeof(rec->hdr->magic)) ||
+        rec->hdr->version != FBREC_VERSION || rec->hdr->header_size != FBREC_PAGE ||
+        rec->hdr->slot_size <= FBREC_PAGE || rec->hdr->slot_size % FBREC_PAGE) {
+        ret = -EINVAL;
+        goto err_unmap;
+    }
+
+    if (rec->hdr->index_offset) {
+        const struct fbrec_index_header *ih;
+        uint64_t off = rec->hdr->index_offset;
+
+        if (off > rec->map_size || sizeof(*ih) > rec->map_size - off) {
+            ret = -EINVAL;
+            goto err_unmap;
+        }
+        ih = (const void *)(rec->map + off);
+        if (memcmp(ih->magic, FBREC_INDEX_MAGIC, sizeof(ih->magic)) ||
+            ih->count > (rec->map_size - off - sizeof(*ih)) / sizeof(*rec->index)) {
+            ret = -EINVAL;
+            goto err_unmap;
+        }
+        rec->index = (const void *)(ih + 1);
+        rec->count = ih->count;
+    } else {
+        ret = rebuild_index(rec);
+        if (ret)
+            goto err_unmap;
+    }
+
+    madvise((void *)rec->map, rec->map_size, MADV_SEQUENTIAL);
+    return 0;
+
+err_unmap:
+    munmap((void *)rec->map, rec->map_size);
+err_close:
+    close(rec->fd);
+    memset(rec, 0, sizeof(*rec));
+    return ret;
+}
+
+void fbrec_close(struct fbrec *rec)
+{
+    if (rec->map) {
+        munmap((void *)rec->map, rec->map_size);
+        close(rec->fd);
+    }
+    free(rec->rebuilt);
+    memset(rec, 0, sizeof(*rec));
+}
+
+int fbrec_frame(const struct fbrec *rec, uint64_t i, struct fbrec_frame *f)
+{
+    uint64_t off;
+
+    if (i >= rec->count)
+        return -ERANGE;
+
+    /* Offsets and sizes come from the file: compare by subtraction, which cannot wrap */
+    off = rec->index[i].offset;
+    if (off % FBREC_PAGE || off > rec->map_size || FBREC_PAGE > rec->map_size - off)
+        return -EINVAL;
+
+    f->hdr = (const void *)(rec->map + off);
+    if (f->hdr->magic != FBREC_FRAME_MAGIC ||
+        f->hdr->data_size > rec->hdr->slot_size - FBREC_PAGE ||
+        f->hdr->data_size > rec->map_size - off - FBREC_PAGE)
+        return -EINVAL;
+    f->data = rec->map + off + FBREC_PAGE;
+    return 0;
+}
+
+int64_t fbrec_seek(const struct fbrec *rec, uint64_t ts_ns)
+{
+    uint64_t lo = 0, hi = rec->count;
+
+    /* First entry with timestamp > ts_ns, minus one. */
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (rec->index[mid].timestamp_ns <= ts_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (int64_t)lo - 1;
+}
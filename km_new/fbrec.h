@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: MIT
+/* fbrec.h – seekable framebuffer recording container
+ *
+ * Layout (all offsets page aligned):
+ *
+ *   [file header page]
+ *   [slot 0: frame header page | pixel data ...]
+ *   [slot 1: ...]
+ *   ...
+ *   [index header | index entries]        (written by fbrec_finish)
+ *
+ * Slots have a fixed size chosen at creation, so frame i lives at
+ * FBREC_PAGE + i * slot_size and its pixel data starts on a page boundary.
+ * Readers mmap the file and hand frames to analyzers straight from the
+ * mapping; the trailing index is sorted by timestamp for O(log n) seeks.
+ * A recording that was never finished has no index; readers rebuild it by
+ * walking the slots.
+ */
+#ifndef FBREC_H
+#define FBREC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FBREC_PAGE          4096
+#define FBREC_VERSION       1
+#define FBREC_MAGIC         "FBREC\0\0\1"
+#define FBREC_INDEX_MAGIC   "FBRECIDX"
+#define FBREC_FRAME_MAGIC   0x4d415246u     /* "FRAM" */
+
+/* Frame flags */
+#define FBREC_FRAME_GAP       (1u << 0)     /* frames were dropped before this one */
+#define FBREC_FRAME_TRUNCATED (1u << 1)     /* data_size < pitch * height */
+
+struct fbrec_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;       /* bytes before slot 0 */
+    uint64_t slot_size;
+    uint64_t frame_count;       /* 0 until finished */
+    uint64_t index_offset;      /* 0 until finished */
+    uint64_t created_ns;        /* CLOCK_REALTIME */
+    uint32_t flags;
+    uint32_t reserved[5];
+};
+
+struct fbrec_frame_header {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    uint32_t width, height;
+    uint32_t pitch;
+    uint32_t format;            /* DRM fourcc */
+    uint64_t modifier;          /* DRM format modifier of the stored data */
+    uint64_t data_size;
+};
+
+struct fbrec_index_header {
+    char     magic[8];
+    uint64_t count;
+};
+
+struct fbrec_index_entry {
+    uint64_t timestamp_ns;
+    uint64_t sequence;
+    uint64_t offset;            /* file offset of the slot */
+};
+
+/* Writer */
+
+struct fbrec_writer {
+    int fd;
+    uint64_t slot_size;
+    uint64_t count;
+    uint64_t last_ts;
+    struct fbrec_index_entry *index;
+    size_t index_cap;
+};
+
+int fbrec_create(struct fbrec_writer *w, const char *path, size_t max_frame_size);
+/* hdr->magic is filled in; timestamps must not go backwards. */
+int fbrec_append(struct fbrec_writer *w, struct fbrec_frame_header *hdr, const void *data);
+/* Write the index, finalise the header and close. */
+int fbrec_finish(struct fbrec_writer *w);
+
+/* Reader */
+
+struct fbrec {
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    const struct fbrec_file_header *hdr;
+    const struct fbrec_index_entry *index;
+    struct fbrec_index_entry *rebuilt;  /* owned when the file had no index */
+    uint64_t count;
+};
+
+struct fbrec_frame {
+    const struct fbrec_frame_header *hdr;
+    const uint8_t *data;                /* points into the mapping */
+};
+
+int  fbrec_open(struct fbrec *rec, const char *path);
+void fbrec_close(struct fbrec *rec);
+
+/* Zero-copy access to frame i. */
+int  fbrec_frame(const struct fbrec *rec, uint64_t i, struct fbrec_frame *f);
+
+/* Index of the last frame with timestamp <= ts_ns, or -1 if none. */
+int64_t fbrec_seek(const struct fbrec *rec, uint64_t ts_ns);
+
+#endif /* FBREC_H */
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+/* fbrec_check.c – validate a .fbrec recording
+ *
+ * Build :  gcc -O2 fbrec_check.c fbrec.c -o fbrec_check
+ * Usage :  fbrec_check [-v] <recording.fbrec>
+ *
+ * Checks the file header, every frame header against the index (magic,
+ * offsets, slot bounds, monotonic sequence and timestamps) and that
+ * timestamp seeks land on the right frames. Exits non-zero on any error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fbrec.h"
+
+/* seek(ts) must land on the last frame at or before ts. */
+static int seek_ok(const struct fbrec *rec, uint64_t ts)
+{
+    int64_t i = fbrec_seek(rec, ts);
+
+    if (i >= 0 && rec->index[i].timestamp_ns > ts)
+        return 0;
+    return (uint64_t)(i + 1) == rec->count || rec->index[i + 1].timestamp_ns > ts;
+}
+
+int main(int argc, char **argv)
+{
+    struct fbrec rec;
+    int verbose = 0, opt, ret;
+    unsigned errors = 0, gaps = 0, truncated = 0;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt != 'v')
+            goto usage;
+        verbose = 1;
+    }
+    if (argc - optind != 1) {
+usage:
+        fprintf(stderr, "usage: %s [-v] <recording.fbrec>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ret = fbrec_open(&rec, argv[optind]);
+    if (ret) {
+        fprintf(stderr, "%s: not a valid recording: %s\n", argv[optind], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: version %u, slot size %llu, %llu frames%s\n", argv[optind],
+           rec.hdr->version, (unsigned long long)rec.hdr->slot_size,
+           (unsigned long long)rec.count,
+           rec.rebuilt ? " (unfinished, index rebuilt from slots)" : "");
+
+    if (!rec.rebuilt && rec.hdr->frame_count != rec.count) {
+        printf("error: header says %llu frames, index has %llu\n",
+               (unsigned long long)rec.hdr->frame_count, (unsigned long long)rec.count);
+        errors++;
+    }
+
+    for (uint64_t i = 0; i < rec.count; i++) {
+        const struct fbrec_index_entry *e = &rec.index[i];
+        struct fbrec_frame f;
+
+        if (fbrec_frame(&rec, i, &f)) {
+            printf("error: frame %llu: bad slot at offset %llu\n",
+                   (unsigned long long)i, (unsigned long long)e->offset);
+            errors++;
+            continue;
+        }
+        if (e->offset != rec.hdr->header_size + i * rec.hdr->slot_size) {
+            printf("error: frame %llu: offset %llu is not slot %llu\n", (unsigned long long)i,
+                   (unsigned long long)e->offset, (unsigned long long)i);
+            errors++;
+        }
+        if (f.hdr->timestamp_ns != e->timestamp_ns || f.hdr->sequence != e->sequence) {
+            printf("error: frame %llu: header disagrees with index\n", (unsigned long long)i);
+            errors++;
+        }
+        if (i && (e->timestamp_ns < e[-1].timestamp_ns || e->sequence <= e[-1].sequence)) {
+            printf("error: frame %llu: timestamp or sequence goes backwards\n",
+                   (unsigned long long)i);
+            errors++;
+        }
+        if (rec.hdr->header_size + f.hdr->data_size > rec.hdr->slot_size ||
+            (!(f.hdr->flags & FBREC_FRAME_TRUNCATED) &&
+             f.hdr->data_size < (uint64_t)f.hdr->pitch * f.hdr->height)) {
+            printf("error: frame %llu: data size %llu does not fit %ux%u pitch %u\n",
+                   (unsigned long long)i, (unsigned long long)f.hdr->data_size,
+                   f.hdr->width, f.hdr->height, f.hdr->pitch);
+            errors++;
+        }
+        gaps += !!(f.hdr->flags & FBREC_FRAME_GAP);
+        truncated += !!(f.hdr->flags & FBREC_FRAME_TRUNCATED);
+
+        if (verbose)
+            printf("  %8llu  seq %-8llu t=%.6fs  %ux%u pitch %u fourcc 0x%08x mod 0x%llx  %llu bytes%s%s\n",
+                   (unsigned long long)i, (unsigned long long)f.hdr->sequence,
+                   f.hdr->timestamp_ns / 1e9, f.hdr->width, f.hdr->height, f.hdr->pitch,
+                   f.hdr->format, (unsigned long long)f.hdr->modifier,
+                   (unsigned long long)f.hdr->data_size,
+                   (f.hdr->flags & FBREC_FRAME_GAP) ? " gap" : "",
+                   (f.hdr->flags & FBREC_FRAME_TRUNCATED) ? " truncated" : "");
+    }
+
+    /* Seeks at and around every stored timestamp. */
+    if (rec.count) {
+        for (uint64_t i = 0; i < rec.count; i++) {
+            uint64_t ts = rec.index[i].timestamp_ns;
+            uint64_t probes[3] = { ts, ts + 1, ts ? ts - 1 : 0 };
+
+            for (int p = 0; p < 3; p++) {
+                if (!seek_ok(&rec, probes[p])) {
+                    printf("error: seek to %llu ns lands on the wrong frame\n",
+                           (unsigned long long)probes[p]);
+                    errors++;
+                }
+            }
+        }
+    }
+
+    if (rec.count) {
+        printf("duration %.3fs, %u gaps, %u truncated frames\n",
+               (rec.index[rec.count - 1].timestamp_ns - rec.index[0].timestamp_ns) / 1e9,
+               gaps, truncated);
+    }
+    printf("%s\n", errors ? "INVALID" : "OK");
+
+    fbrec_close(&rec);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
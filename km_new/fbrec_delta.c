@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: MIT
+/* fbrec_delta.c – delta-compress a recording, and expand it again
+ *
+ * Build :  gcc -O2 fbrec_delta.c fb_delta.c fbrec.c fb_detile.c -o fbrec_delta
+ * Usage :  fbrec_delta [-k keyint] [-M] <in.fbrec> <out.fbd>
+ *          fbrec_delta -x <in.fbd> <out.fbrec>
+ *
+ * Encodes every frame of the recording's first geometry into the
+ * fb_delta.h format, detiling as needed, then decodes the result and
+ * checks it against the source frame by frame. Prints the compression
+ * ratio, how the blocks were coded, and encode and decode throughput in
+ * frame megabytes per second. -M turns off motion search, giving plain
+ * per-block deltas to compare against. -k sets the keyframe interval.
+ *
+ * -x expands a .fbd file into a linear XRGB8888 recording.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fb_delta.h"
+#include "fb_detile.h"
+#include "fbrec.h"
+
+#define NS_PER_SEC      1000000000ull
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void print_blocks(const struct fbd_stats *st)
+{
+    const uint64_t total = st->blocks_same + st->blocks_moved + st->blocks_residual +
+                           st->blocks_intra;
+    const double pct = total ? 100.0 / total : 0;
+
+    printf("blocks: %.1f%% unchanged, %.1f%% moved, %.1f%% corrected, %.1f%% intra\n",
+           st->blocks_same * pct, st->blocks_moved * pct, st->blocks_residual * pct,
+           st->blocks_intra * pct);
+}
+
+static int expand(const char *in, const char *out)
+{
+    struct fbd_reader r;
+    struct fbrec_writer wr;
+    int ret;
+
+    ret = fbd_open(&r, in);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", in, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    const unsigned w = r.hdr->width, h = r.hdr->height;
+
+    ret = fbrec_create(&wr, out, (size_t)w * h * 4);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+        fbd_close(&r);
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < r.count && !ret; i++) {
+        const struct fbd_frame_header *fh;
+        const uint8_t *px;
+
+        ret = fbd_frame(&r, i, &px, &fh);
+        if (!ret) {
+            struct fbrec_frame_header hdr = {
+                .sequence = fh->sequence,
+                .timestamp_ns = fh->timestamp_ns,
+                .width = w,
+                .height = h,
+                .pitch = w * 4,
+                .format = r.hdr->format,
+                .data_size = (uint64_t)w * h * 4,
+            };
+            ret = fbrec_append(&wr, &hdr, px);
+        }
+        if (ret)
+            fprintf(stderr, "frame %llu: %s\n", (unsigned long long)i, strerror(-ret));
+    }
+    if (fbrec_finish(&wr) && !ret)
+        ret = -EIO;
+    printf("%llu frames, %ux%u\n", (unsigned long long)r.count, w, h);
+    fbd_close(&r);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned keyint = 0;
+    int motion = 1, extract = 0;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "k:Mx")) != -1) {
+        switch (opt) {
+        case 'k': keyint = atoi(optarg); break;
+        case 'M': motion = 0; break;
+        case 'x': extract = 1; break;
+        default:  goto usage;
+        }
+    }
+    if (argc - optind != 2) {
+usage:
+        fprintf(stderr,
+            "usage: %s [-k keyint] [-M] <in.fbrec> <out.fbd>\n"
+            "   or: %s -x <in.fbd> <out.fbrec>\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (extract)
+        return expand(argv[optind], argv[optind + 1]);
+
+    const char *in = argv[optind], *out = argv[optind + 1];
+    struct fbrec rec;
+    struct fbrec_frame first;
+
+    ret = fbrec_open(&rec, in);
+    if (!ret)
+        ret = fbrec_frame(&rec, 0, &first);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", in, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    const unsigned w = first.hdr->width, h = first.hdr->height;
+    const size_t frame_size = (size_t)w * h * 4;
+    uint8_t *lin = malloc(frame_size);
+    uint64_t *src_frame = calloc(rec.count, sizeof(*src_frame));
+    uint64_t n = 0, skipped = 0, enc_ns = 0, dec_ns = 0, t0;
+    struct fbd_writer wr;
+    struct fbd_reader rd;
+
+    if (!lin || !src_frame) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    ret = fbd_create(&wr, out, w, h, keyint, motion);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    for (uint64_t i = 0; i < rec.count && !ret; i++) {
+        struct fbrec_frame fr;
+
+        if (fbrec_frame(&rec, i, &fr) || fr.hdr->width != w || fr.hdr->height != h ||
+            (fr.hdr->flags & FBREC_FRAME_TRUNCATED) ||
+            fb_detile_rect(lin, fr.data, fr.hdr->data_size, fr.hdr->pitch,
+                           fb_tiling_from_modifier(fr.hdr->modifier), 0, 0, w, h)) {
+            skipped++;
+            continue;
+        }
+        t0 = now_ns();
+        ret = fbd_append(&wr, lin, fr.hdr->timestamp_ns, fr.hdr->sequence);
+        enc_ns += now_ns() - t0;
+        src_frame[n++] = i;
+    }
+    const struct fbd_stats st = wr.stats;
+
+    if (fbd_finish(&wr) && !ret)
+        ret = -EIO;
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    /* Decode it all back and compare. */
+    ret = fbd_open(&rd, out);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < rd.count; i++) {
+        struct fbrec_frame fr;
+        const uint8_t *px;
+
+        t0 = now_ns();
+        ret = fbd_frame(&rd, i, &px, NULL);
+        dec_ns += now_ns() - t0;
+        if (!ret)
+            ret = fbrec_frame(&rec, src_frame[i], &fr);
+        if (!ret)
+            ret = fb_detile_rect(lin, fr.data, fr.hdr->data_size, fr.hdr->pitch,
+                                 fb_tiling_from_modifier(fr.hdr->modifier), 0, 0, w, h);
+        if (!ret && memcmp(px, lin, frame_size))
+            ret = -EILSEQ;
+        if (ret) {
+            fprintf(stderr, "%s: frame %llu does not decode: %s\n", out,
+                    (unsigned long long)i, strerror(-ret));
+            break;
+        }
+    }
+    fbd_close(&rd);
+
+    const double raw_mb = (double)n * frame_size / 1e6;
+
+    printf("%llu frames (%llu keyframes, %llu skipped), %ux%u, motion search %s\n",
+           (unsigned long long)n, (unsigned long long)st.keyframes,
+           (unsigned long long)skipped, w, h, motion ? "on" : "off");
+    printf("%.1f MB -> %.2f MB (%.1fx)\n", raw_mb, st.bytes / 1e6,
+           st.bytes ? raw_mb * 1e6 / st.bytes : 0.0);
+    print_blocks(&st);
+    printf("encode %.0f MB/s, decode %.0f MB/s%s\n", enc_ns ? raw_mb * 1e9 / enc_ns : 0.0,
+           dec_ns ? raw_mb * 1e9 / dec_ns : 0.0, ret ? "" : ", round trip exact");
+
+    free(lin);
+    free(src_frame);
+    fbrec_close(&rec);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: MIT
+/* fbrec_record.c – record raw frames into a seekable .fbrec container
+ *
+ * Build :  gcc -O2 fbrec_record.c fbrec.c frame_sig.c fb_plan.c fb_detile.c -o fbrec_record
+ * Usage :  fbrec_record [-n frames] [-f fps] [-S] <width> <height> <pitch> <X|Y|Yf|4|L> <in> <out.fbrec>
+ *
+ * A regular input file is treated as back-to-back frames at -f fps. Any
+ * live input (fb_fd_is_live(), e.g. /proc/drm_fb_raw) is polled at -f fps
+ * and stamped with CLOCK_MONOTONIC until -n frames or SIGINT.
+ *
+ * Each frame's content signature is computed as it is recorded and written
+ * to <out.fbrec>.fsig for frame_search; -S skips that.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fbrec.h"
+#include "fb_source.h"
+#include "frame_sig.h"
+#include "fb_plan.h"
+
+#define FOURCC_XRGB8888 0x34325258u     /* 'XR24' */
+#define INTEL_MOD(n)    ((1ull << 56) | (n))
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static ssize_t read_frame(int fd, uint8_t *buf, size_t size, int live)
+{
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t n = live ? pread(fd, buf + got, size - got, got)
+                         : read(fd, buf + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t max_frames = UINT64_MAX;
+    double fps = 60.0;
+    int signatures = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:S")) != -1) {
+        switch (opt) {
+        case 'n': max_frames = strtoull(optarg, NULL, 0); break;
+        case 'f': fps = atof(optarg); break;
+        case 'S': signatures = 0; break;
+        default:  goto usage;
+        }
+    }
+    if (argc - optind != 6 || fps <= 0) {
+usage:
+        fprintf(stderr,
+            "usage: %s [-n frames] [-f fps] [-S] <width> <height> <pitch> <X|Y|Yf|4|L> <in> <out.fbrec>\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+    fb_plan_stage_setup();
+
+    unsigned w     = atoi(argv[optind]);
+    unsigned h     = atoi(argv[optind + 1]);
+    unsigned pitch = atoi(argv[optind + 2]);
+    const char *layout = argv[optind + 3];
+    uint64_t modifier = !strcmp(layout, "X") ? INTEL_MOD(1) :
+                        !strcmp(layout, "Y") ? INTEL_MOD(2) :
+                        !strcmp(layout, "Yf") ? INTEL_MOD(3) :
+                        !strcmp(layout, "4") ? INTEL_MOD(9) : 0;
+    unsigned tile_h = !strcmp(layout, "X") ? 8 : modifier ? 32 : 1;
+    size_t frame_size = (size_t)pitch * ((h + tile_h - 1) / tile_h * tile_h);
+
+    struct fbrec_writer wr;
+    struct fsig_writer sigs;
+    uint8_t *buf = malloc(frame_size);
+    int fd = open(argv[optind + 4], O_RDONLY | O_CLOEXEC);
+    int ret, live;
+
+    if (!buf || fd < 0) {
+        perror(argv[optind + 4]);
+        return EXIT_FAILURE;
+    }
+    live = fb_fd_is_live(fd);
+    if (live < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 4], strerror(-live));
+        return EXIT_FAILURE;
+    }
+
+    ret = fbrec_create(&wr, argv[optind + 5], frame_size);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 5], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    fsig_writer_init(&sigs);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    uint64_t period_ns = (uint64_t)(1e9 / fps);
+    struct timespec next;
+    uint64_t seq = 0;
+    uint32_t pending_flags = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!stop && wr.count < max_frames) {
+        struct fbrec_frame_header hdr = { 0 };
+        struct timespec now;
+        ssize_t n;
+
+        if (live) {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+        }
+
+        n = read_frame(fd, buf, frame_size, live);
+        seq++;
+        if (n <= 0) {
+            if (!live)
+                break;
+            /* No capture available yet (ENODATA) or a read error: record a gap. */
+            pending_flags |= FBREC_FRAME_GAP;
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        hdr.flags = pending_flags | ((size_t)n < frame_size ? FBREC_FRAME_TRUNCATED : 0);
+        hdr.sequence = seq - 1;
+        hdr.timestamp_ns = live ? (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec
+                                : (uint64_t)(hdr.sequence * 1e9 / fps);
+        hdr.width = w;
+        hdr.height = h;
+        hdr.pitch = pitch;
+        hdr.format = FOURCC_XRGB8888;
+        hdr.modifier = modifier;
+        hdr.data_size = n;
+        pending_flags = 0;
+
+        ret = fbrec_append(&wr, &hdr, buf);
+        if (ret) {
+            fprintf(stderr, "append failed: %s\n", strerror(-ret));
+            break;
+        }
+        if (signatures) {
+            struct fsig sig;
+
+            ret = fsig_compute(&sig, buf, n, w, h, pitch, modifier);
+            if (!ret)
+                ret = fsig_add(&sigs, &sig, hdr.timestamp_ns, hdr.sequence, wr.count - 1);
+            if (ret) {
+                fprintf(stderr, "signature: %s\n", strerror(-ret));
+                signatures = 0;
+            }
+        }
+        if (!live && (size_t)n < frame_size)
+            break;
+    }
+
+    uint64_t count = wr.count;
+    ret = fbrec_finish(&wr);
+    if (ret) {
+        fprintf(stderr, "finishing %s: %s\n", argv[optind + 5], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    printf("recorded %llu frames to %s\n", (unsigned long long)count, argv[optind + 5]);
+
+    ret = 0;
+    if (signatures) {
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s.fsig", argv[optind + 5]);
+        ret = fsig_write(&sigs, path);
+        if (ret)
+            fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+    }
+    fsig_writer_free(&sigs);
+
+    close(fd);
+    free(buf);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: MIT
+/* flash_analyze.c – run per-monitor flash analysis over raw frames
+ *
+ * Build :  gcc -O2 flash_analyze.c flash_regions.c flash_analyzer.c flash_index.c fb_source.c fbrec.c \
+ *                 flash_mitigate.c flash_counters.c fb_plan.c -lm -lpthread -o flash_analyze
+ * Usage :  flash_analyze [-r regions.conf | -c /dev/dri/cardN [-M dim]] [-S diag_in] [-d dist_in]
+ *                        [-g] [-I] [-o index | -N] [-m counters] [-f fps] [-P] [-F nv12|p010]
+ *                        <width> <height> <pitch> <X|Y|Yf|4|L> <frames.raw>
+ *          flash_analyze [-r ... | -c ...] [-S diag_in] [-d dist_in] [-g] [-I] [-o index | -N]
+ *                        [-m counters] <recording.fbrec>
+ *
+ * frames.raw is a sequence of back-to-back frames as dumped from
+ * /proc/drm_fb_raw, or /proc/drm_fb_raw itself to analyse live at -f fps;
+ * a .fbrec recording carries its own geometry and
+ * timestamps and is analysed straight from the mapping. Without -r/-c the
+ * whole framebuffer is one monitor of diagonal -S. Prints every harmful
+ * window per monitor and a summary, and writes a per-second flash index to
+ * <input>.fidx (or -o) unless -N is given. -g skips red flash analysis.
+ *
+ * With -c, -M dims each monitor's CRTC to the given output scale while its
+ * region is harmful (see flash_mitigate.h) and reports how long detection
+ * took to reach the screen.
+ *
+ * -I analyses incrementally: each frame's 32x32 tiles are hashed and only
+ * those that differ from the previous frame are detiled and analysed (see
+ * fa_process_incremental()). Results are the same; the summary shows the
+ * share of tiles that had to be analysed.
+ *
+ * -F reads raw NV12 or P010 frames instead of XRGB8888: the luma plane,
+ * then the chroma plane (see fb_source_open_raw_format()); recordings carry
+ * their format. Luminance is read off the luma plane and chroma only looked
+ * at where it matters (see fa_process_yuv_rect()). Regions must start on
+ * even coordinates, and -I is not available.
+ *
+ * -P pins the analyzer to the CPUs of the NUMA node the module keeps its
+ * capture buffers on, when reading /proc/drm_fb_raw live.
+ *
+ * -m keeps the running counters (frames, flashes and alarms per region,
+ * late polls, a histogram of the time each frame took) in a small mapped
+ * file for fb_exporter, updated after every frame (see flash_counters.h).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash_regions.h"
+#include "flash_index.h"
+#include "fb_source.h"
+#include "flash_mitigate.h"
+#include "flash_counters.h"
+#include "fb_plan.h"
+#include "fb_yuv.h"
+
+#define DEFAULT_DIAG_IN      24.0
+#define DEFAULT_VIEW_DIST_IN 24.0
+
+static uint64_t parse_modifier(const char *s)
+{
+    if (!strcmp(s, "X"))  return FB_MOD_INTEL(1);
+    if (!strcmp(s, "Y"))  return FB_MOD_INTEL(2);
+    if (!strcmp(s, "Yf")) return FB_MOD_INTEL(3);
+    if (!strcmp(s, "4"))  return FB_MOD_INTEL(9);
+    return 0;
+}
+
+static uint32_t parse_format(const char *s)
+{
+    if (!strcmp(s, "nv12")) return FB_YUV_NV12;
+    if (!strcmp(s, "p010")) return FB_YUV_P010;
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "usage: %s [-r regions.conf | -c /dev/dri/cardN [-M dim]] [-S diag_in] [-d dist_in] [-g] [-I]\n"
+        "       [-o index | -N] [-m counters] [-f fps] [-P] [-F nv12|p010]\n"
+        "       <width> <height> <pitch> <X|Y|Yf|4|L> <frames.raw>\n"
+        "   or: %s [-r regions.conf | -c /dev/dri/cardN [-M dim]] [-S diag_in] [-d dist_in] [-g] [-I]\n"
+        "       [-o index | -N] [-m counters] <recording.fbrec>\n",
+        argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    static struct fa_region_set set;
+    static struct fidx_writer index;
+    const char *regions = NULL, *card = NULL, *index_path = NULL, *counters_path = NULL;
+    static struct fm_agent agents[FA_MAX_REGIONS];
+    struct fa_counters_writer counters = { 0 };
+    double diag = DEFAULT_DIAG_IN, dist = DEFAULT_VIEW_DIST_IN, fps = 60.0, dim = -1;
+    uint32_t format = FB_FOURCC_XRGB8888;
+    int red = 1, no_index = 0, pin = 0, drm_fd = -1;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "r:c:S:d:f:go:Nm:M:PIF:")) != -1) {
+        switch (opt) {
+        case 'r': regions = optarg; break;
+        case 'g': red = 0; break;
+        case 'o': index_path = optarg; break;
+        case 'N': no_index = 1; break;
+        case 'm': counters_path = optarg; break;
+        case 'c': card = optarg; break;
+        case 'S': diag = atof(optarg); break;
+        case 'd': dist = atof(optarg); break;
+        case 'f': fps = atof(optarg); break;
+        case 'M': dim = atof(optarg); break;
+        case 'P': pin = 1; break;
+        case 'I': set.incremental = 1; break;
+        case 'F':
+            format = parse_format(optarg);
+            if (!format) {
+                fprintf(stderr, "unknown frame format %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (dim >= 0 && !card) {
+        fprintf(stderr, "-M needs the monitor layout from -c\n");
+        return EXIT_FAILURE;
+    }
+    fb_plan_stage_setup();
+
+    struct fb_source in;
+
+    if (argc - optind == 1) {
+        ret = fb_source_open_fbrec(&in, argv[optind]);
+    } else if (argc - optind == 5) {
+        ret = fb_source_open_raw_format(&in, argv[optind + 4], atoi(argv[optind]),
+                                        atoi(argv[optind + 1]), atoi(argv[optind + 2]),
+                                        parse_modifier(argv[optind + 3]), format, fps);
+    } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", argv[argc - 1], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if (pin && in.kind == FB_SOURCE_LIVE) {
+        /* Before any worker threads, which inherit the mask. */
+        ret = fb_source_pin(&in);
+        if (ret)
+            fprintf(stderr, "cannot pin to node %d: %s\n", in.node, strerror(-ret));
+        else if (in.node >= 0)
+            printf("pinned to NUMA node %d\n", in.node);
+    }
+
+    unsigned w = in.width, h = in.height;
+    char default_index[4096];
+
+    if (!index_path) {
+        snprintf(default_index, sizeof(default_index), "%s.fidx", argv[argc - 1]);
+        index_path = default_index;
+    }
+
+    if (regions)
+        ret = fa_regions_load(&set, regions, dist);
+    else if (card)
+        ret = fa_regions_from_drm(&set, card, dist);
+    else
+        ret = fa_regions_add(&set, "fb", 0, 0, w, h, diag, dist);
+    if (ret) {
+        fprintf(stderr, "failed to set up monitor regions: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned i = 0; i < set.count; i++) {
+        struct fa_region *r = &set.regions[i];
+
+        if (r->x > w || r->width > w - r->x || r->y > h || r->height > h - r->y) {
+            fprintf(stderr, "region %s (%ux%u+%u+%u) exceeds the %ux%u framebuffer\n",
+                    r->name, r->width, r->height, r->x, r->y, w, h);
+            return EXIT_FAILURE;
+        }
+        printf("region %-10s %ux%u+%u+%u  %.1f\"  flash area threshold %u px\n",
+               r->name, r->width, r->height, r->x, r->y, r->diag_in, r->area_threshold);
+    }
+
+    if (dim >= 0) {
+        /* One fd for every CRTC: DRM master is held per open file */
+        drm_fd = fm_card_open(card);
+        if (drm_fd < 0) {
+            fprintf(stderr, "%s: %s\n", card, strerror(-drm_fd));
+            return EXIT_FAILURE;
+        }
+    }
+    for (unsigned i = 0; dim >= 0 && i < set.count; i++) {
+        struct fa_region *r = &set.regions[i];
+
+        ret = fm_agent_open(&agents[i], drm_fd, r->crtc_id, dim);
+        if (!ret)
+            ret = fm_agent_start(&agents[i]);
+        if (ret) {
+            fprintf(stderr, "crtc %u: cannot set up mitigation: %s\n", r->crtc_id,
+                    strerror(-ret));
+            return EXIT_FAILURE;
+        }
+        printf("region %-10s mitigation through %s, dim to %.2f\n", r->name,
+               agents[i].prop_name, dim);
+    }
+
+    set.format = in.format;
+    set.fb_height = h;
+    ret = fa_regions_start(&set, red);
+    if (ret) {
+        fprintf(stderr, "failed to start analysis: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    fidx_writer_init(&index, &set);
+    if (counters_path) {
+        ret = fa_counters_create(&counters, counters_path, &set, in.kind == FB_SOURCE_LIVE);
+        if (ret) {
+            fprintf(stderr, "%s: %s\n", counters_path, strerror(-ret));
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct fb_frame f;
+    uint64_t n = 0;
+
+    while ((ret = fb_source_next(&in, &f)) > 0) {
+        uint64_t alarms[FA_MAX_REGIONS];
+        int harmful[FA_MAX_REGIONS];
+        struct timespec t0, t1;
+
+        for (unsigned i = 0; i < set.count; i++) {
+            alarms[i] = set.regions[i].stats.alarms;
+            harmful[i] = set.regions[i].stats.harmful;
+        }
+
+        if (counters.c)
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+        fa_regions_process(&set, f.data, f.pitch, fa_tiling_from_modifier(f.modifier),
+                           f.timestamp_ns);
+        if (!no_index && fidx_add_frame(&index, &set, f.timestamp_ns))
+            no_index = 1;
+
+        for (unsigned i = 0; i < set.count; i++) {
+            struct fa_region *r = &set.regions[i];
+
+            if (dim >= 0 && r->stats.harmful != harmful[i]) {
+                struct timespec now;
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                fm_agent_request(&agents[i], r->stats.harmful,
+                                 (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec);
+            }
+            if (r->stats.alarms != alarms[i])
+                printf("t=%9.3fs %-10s harmful: %u flashes, %u red flashes within one second\n",
+                       f.timestamp_ns / 1e9, r->name, r->stats.window_flashes, r->stats.window_red_flashes);
+        }
+        n++;
+        if (counters.c) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            fa_counters_update(&counters, &set, n, in.late,
+                               (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ull +
+                               t1.tv_nsec - t0.tv_nsec);
+        }
+    }
+
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", argv[argc - 1], strerror(-ret));
+    printf("%llu frames analysed\n", (unsigned long long)n);
+    if (in.skipped)
+        printf("%llu captures skipped: not %ux%u in the format asked for\n",
+               (unsigned long long)in.skipped, w, h);
+    for (unsigned i = 0; i < set.count; i++) {
+        struct fa_region_stats *st = &set.regions[i].stats;
+        printf("region %-10s flashes %llu  red flashes %llu  harmful windows %llu  "
+               "max flashed area %u px\n", set.regions[i].name,
+               (unsigned long long)st->flashes, (unsigned long long)st->red_flashes,
+               (unsigned long long)st->alarms, st->max_flashed);
+        if (st->tiles)
+            printf("region %-10s %.1f%% of tiles analysed incrementally\n", set.regions[i].name,
+                   100.0 * st->dirty_tiles / st->tiles);
+    }
+
+    if (!no_index) {
+        ret = fidx_write(&index, index_path);
+        if (ret)
+            fprintf(stderr, "%s: %s\n", index_path, strerror(-ret));
+        else
+            printf("flash index written to %s\n", index_path);
+    }
+    fidx_writer_free(&index);
+
+    for (unsigned i = 0; dim >= 0 && i < set.count; i++) {
+        struct fm_agent *a = &agents[i];
+        int err;
+
+        fm_agent_close(a);
+        err = atomic_load(&a->error);
+        printf("region %-10s dimmed %llu times, released %llu times", set.regions[i].name,
+               (unsigned long long)a->engaged, (unsigned long long)a->released);
+        if (a->total.count)
+            printf(", detection to commit avg %.2f ms max %.2f ms "
+                   "(wakeup avg %.3f ms, commit avg %.2f ms)",
+                   a->total.sum_ns / 1e6 / a->total.count, a->total.max_ns / 1e6,
+                   a->wake.sum_ns / 1e6 / a->wake.count,
+                   a->commit.sum_ns / 1e6 / a->commit.count);
+        if (err)
+            printf(", last commit failed: %s", strerror(-err));
+        printf("\n");
+    }
+    if (drm_fd >= 0)
+        close(drm_fd);
+
+    fa_counters_close(&counters);
+    fa_regions_stop(&set);
+    fb_source_close(&in);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,714 @@
+// SPDX-License-Identifier: MIT
+/* flash_analyzer.c – per-pixel flash analysis following spec.v (B.1)
+ *
+ * Build :  gcc -O2 -c flash_analyzer.c   (link with libfb_detile.a)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "flash_analyzer.h"
+#include "fb_yuv.h"
+
+#define FA_MASK_TRANSITION 0x1
+#define FA_MASK_FLASH      0x2
+
+/* Per-channel weighted gamma expansion, so I = lut_r[r] + lut_g[g] + lut_b[b]. */
+static uint16_t lut_r[256], lut_g[256], lut_b[256];
+/* Unweighted gamma expansion, as Q16 for the red gate and float for (u', v'). */
+static uint32_t lut_lin[256];
+static float lut_linf[256];
+static int lut_ready;
+
+static double gamma_expand(double c)
+{
+    return (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static void fa_build_lut(void)
+{
+    if (lut_ready)
+        return;
+
+    for (unsigned i = 0; i < 256; i++) {
+        double lin = gamma_expand(i / 255.0);
+        lut_r[i] = (uint16_t)lround(0.2126 * lin * FA_LUM_ONE);
+        lut_g[i] = (uint16_t)lround(0.7152 * lin * FA_LUM_ONE);
+        lut_b[i] = (uint16_t)lround(0.0722 * lin * FA_LUM_ONE);
+        lut_lin[i] = (uint32_t)lround(lin * 65535);
+        lut_linf[i] = (float)lin;
+    }
+    lut_ready = 1;
+}
+
+static inline uint16_t lum_of(const uint8_t *px)
+{
+    /* XRGB8888 little-endian: B, G, R, X */
+    return lut_b[px[0]] + lut_g[px[1]] + lut_r[px[2]];
+}
+
+static inline uint16_t lum_of_xrgb(uint32_t xrgb)
+{
+    return lut_b[xrgb & 0xff] + lut_g[(xrgb >> 8) & 0xff] + lut_r[(xrgb >> 16) & 0xff];
+}
+
+uint16_t fa_luminance(uint32_t xrgb)
+{
+    fa_build_lut();
+    return lum_of_xrgb(xrgb);
+}
+
+/*
+ * YUV pixels travel as 10-bit codes packed into one word, Y' | Cb << 10 |
+ * Cr << 20; luminance comes off the luma tables unless the chroma is too
+ * strong for them (fb_yuv.h).
+ */
+static inline uint32_t yuv_pack(unsigned y, unsigned cb, unsigned cr)
+{
+    return y | cb << 10 | cr << 20;
+}
+
+static inline uint32_t yuv_xrgb(uint32_t p)
+{
+    return fb_yuv_xrgb(p & 0x3ff, (p >> 10) & 0x3ff, p >> 20);
+}
+
+static inline uint16_t lum_of_yuv(uint32_t p)
+{
+    unsigned y = p & 0x3ff;
+
+    return fb_yuv_exact(y, (p >> 10) & 0x3ff, p >> 20) ? lum_of_xrgb(yuv_xrgb(p))
+                                                       : fb_yuv_lum[y];
+}
+
+/* harmful_transition: |dI| >= 0.1, or both > 0.8 with Michelson >= 1/17. */
+static inline int harmful_transition(unsigned i1, unsigned i2)
+{
+    unsigned d = (i2 > i1) ? i2 - i1 : i1 - i2;
+
+    if (d * 10 >= FA_LUM_ONE)
+        return 1;
+    return 5 * i1 > 4 * FA_LUM_ONE && 5 * i2 > 4 * FA_LUM_ONE &&
+           17 * d >= i1 + i2;
+}
+
+/*
+ * Advance one pixel's state by one frame. Returns FA_MASK_* bits.
+ * dir holds the sign of the previous transition if it was harmful, so a
+ * flash is a harmful transition opposing a harmful one on the frame before.
+ */
+static inline unsigned fa_step(uint16_t *lum, int8_t *dir, uint16_t cur)
+{
+    unsigned prev = *lum;
+    unsigned bits = 0;
+    int8_t d = 0;
+
+    if (harmful_transition(prev, cur)) {
+        d = (cur > prev) ? 1 : -1;
+        bits = FA_MASK_TRANSITION;
+        if (*dir == -d)
+            bits |= FA_MASK_FLASH;
+    }
+    *lum = cur;
+    *dir = d;
+    return bits;
+}
+
+/* red_ratio >= 0.8, i.e. r >= 4 * (g + b) in linear light. */
+static inline int red_dominant(uint32_t px)
+{
+    uint32_t r = lut_lin[(px >> 16) & 0xff];
+    uint32_t gb = lut_lin[(px >> 8) & 0xff] + lut_lin[px & 0xff];
+
+    return r && r >= 4 * gb;
+}
+
+static inline void red_chroma(uint32_t px, float *ratio, float *u, float *v)
+{
+    float r = lut_linf[(px >> 16) & 0xff];
+    float g = lut_linf[(px >> 8) & 0xff];
+    float b = lut_linf[px & 0xff];
+    float X = 0.4124f * r + 0.3576f * g + 0.1805f * b;
+    float Y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    float Z = 0.0193f * r + 0.1192f * g + 0.9505f * b;
+    float d = X + 15 * Y + 3 * Z;
+    float s = r + g + b;
+
+    *ratio = (s > 0) ? r / s : 0;
+    *u = (d > 0) ? 4 * X / d : 0;
+    *v = (d > 0) ? 9 * Y / d : 0;
+}
+
+/*
+ * harmful_red_transition between two pixels, one of them red-dominant: a
+ * (u', v') difference above 0.2. *d is the sign of the red ratio change.
+ */
+static inline int red_transition(uint32_t prev, uint32_t cur, int8_t *d)
+{
+    float r1, u1, v1, r2, u2, v2;
+
+    red_chroma(prev, &r1, &u1, &v1);
+    red_chroma(cur, &r2, &u2, &v2);
+    if ((u1 - u2) * (u1 - u2) + (v1 - v2) * (v1 - v2) <= 0.2f * 0.2f)
+        return 0;
+    *d = (r2 > r1) ? 1 : (r2 < r1) ? -1 : 0;
+    return 1;
+}
+
+/*
+ * Red counterpart of fa_step(): harmful_red_transition needs a red-dominant
+ * pixel in either frame and a (u', v') difference above 0.2; a red flash is
+ * two such transitions with opposing red ratio changes.
+ */
+static inline unsigned fa_red_step(uint32_t *px_prev, int8_t *red_dir, uint32_t cur)
+{
+    uint32_t prev = *px_prev;
+    unsigned bits = 0;
+    int8_t d = 0;
+
+    if (prev != cur && (red_dominant(prev) || red_dominant(cur)) &&
+        red_transition(prev, cur, &d)) {
+        bits = FA_MASK_TRANSITION;
+        if (d && *red_dir == -d)
+            bits |= FA_MASK_FLASH;
+    }
+    *px_prev = cur;
+    *red_dir = d;
+    return bits;
+}
+
+/* The same on packed YUV, converting only pixels that may be red-dominant. */
+static inline unsigned fa_red_step_yuv(uint32_t *px_prev, int8_t *red_dir, uint32_t cur)
+{
+    uint32_t prev = *px_prev;
+    unsigned bits = 0;
+    int8_t d = 0;
+
+    if (prev != cur && (fb_yuv_reddish(prev & 0x3ff, prev >> 20) ||
+                        fb_yuv_reddish(cur & 0x3ff, cur >> 20))) {
+        uint32_t p = yuv_xrgb(prev), c = yuv_xrgb(cur);
+
+        if ((red_dominant(p) || red_dominant(c)) && red_transition(p, c, &d)) {
+            bits = FA_MASK_TRANSITION;
+            if (d && *red_dir == -d)
+                bits |= FA_MASK_FLASH;
+        }
+    }
+    *px_prev = cur;
+    *red_dir = d;
+    return bits;
+}
+
+enum fa_tiling fa_tiling_from_modifier(uint64_t modifier)
+{
+    return (enum fa_tiling)fb_tiling_from_modifier(modifier);
+}
+
+int fa_init(struct flash_analyzer *fa, unsigned width, unsigned height)
+{
+    size_t pixels = (size_t)width * height;
+
+    memset(fa, 0, sizeof(*fa));
+    fa_build_lut();
+
+    fa->width = width;
+    fa->height = height;
+    fa->lum = calloc(pixels, sizeof(*fa->lum));
+    fa->dir = calloc(pixels, sizeof(*fa->dir));
+    if (!fa->lum || !fa->dir) {
+        fa_free(fa);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+int fa_enable_red(struct flash_analyzer *fa)
+{
+    size_t pixels = (size_t)fa->width * fa->height;
+
+    if (fa->px_prev)
+        return 0;
+    fa->px_prev = calloc(pixels, sizeof(*fa->px_prev));
+    fa->red_dir = calloc(pixels, sizeof(*fa->red_dir));
+    if (!fa->px_prev || !fa->red_dir) {
+        free(fa->px_prev);
+        free(fa->red_dir);
+        fa->px_prev = NULL;
+        fa->red_dir = NULL;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void fa_free(struct flash_analyzer *fa)
+{
+    free(fa->lum);
+    free(fa->dir);
+    free(fa->px_prev);
+    free(fa->red_dir);
+    free(fa->linear);
+    free(fa->lum_cur);
+    free(fa->mask);
+    free(fa->band);
+    free(fa->armed);
+    memset(fa, 0, sizeof(*fa));
+}
+
+void fa_reset(struct flash_analyzer *fa)
+{
+    size_t pixels = (size_t)fa->width * fa->height;
+
+    memset(fa->lum, 0, pixels * sizeof(*fa->lum));
+    memset(fa->dir, 0, pixels * sizeof(*fa->dir));
+    if (fa->px_prev) {
+        memset(fa->px_prev, 0, pixels * sizeof(*fa->px_prev));
+        memset(fa->red_dir, 0, pixels * sizeof(*fa->red_dir));
+    }
+    fa->frames = 0;
+    fa->armed_valid = 0;
+}
+
+int fa_process_unfused(struct flash_analyzer *fa, const uint8_t *src,
+                       unsigned pitch, enum fa_tiling tiling,
+                       struct fa_frame_result *res)
+{
+    const size_t pixels = (size_t)fa->width * fa->height;
+    const unsigned row_bytes = fa->width * 4;
+    unsigned tile_w, tile_h;
+    size_t i;
+
+    if (fb_tile_dims((enum fb_tiling)tiling, &tile_w, &tile_h))
+        return -EINVAL;
+
+    if (!fa->linear) {
+        fa->linear = malloc(pixels * 4);
+        fa->lum_cur = malloc(pixels * sizeof(*fa->lum_cur));
+        fa->mask = malloc(pixels);
+        if (!fa->linear || !fa->lum_cur || !fa->mask)
+            return -ENOMEM;
+    }
+
+    /* Pass 1: detile */
+    fb_detile_rows(fa->linear, row_bytes, src, SIZE_MAX, pitch, (enum fb_tiling)tiling,
+                   0, row_bytes, 0, fa->height);
+
+    /* Pass 2: luminance */
+    for (i = 0; i < pixels; i++)
+        fa->lum_cur[i] = lum_of(fa->linear + i * 4);
+
+    /* Pass 3: compare with the previous frame */
+    if (fa->frames == 0) {
+        memcpy(fa->lum, fa->lum_cur, pixels * sizeof(*fa->lum));
+        memset(fa->mask, 0, pixels);
+    } else {
+        for (i = 0; i < pixels; i++)
+            fa->mask[i] = fa_step(&fa->lum[i], &fa->dir[i], fa->lum_cur[i]);
+    }
+
+    /* Pass 4: area reduction */
+    memset(res, 0, sizeof(*res));
+    for (i = 0; i < pixels; i++) {
+        res->transitions += fa->mask[i] & FA_MASK_TRANSITION;
+        res->flashed += (fa->mask[i] & FA_MASK_FLASH) >> 1;
+    }
+
+    fa->frames++;
+    return 0;
+}
+
+int fa_process_fused(struct flash_analyzer *fa, const uint8_t *src,
+                     unsigned pitch, enum fa_tiling tiling,
+                     uint8_t *linear_out, struct fa_frame_result *res)
+{
+    return fa_process_fused_rect(fa, src, pitch, tiling, 0, 0, linear_out, res);
+}
+
+int fa_process_fused_rect(struct flash_analyzer *fa, const uint8_t *src,
+                          unsigned pitch, enum fa_tiling tiling,
+                          unsigned x0, unsigned y0, uint8_t *linear_out,
+                          struct fa_frame_result *res)
+{
+    const unsigned row_bytes = fa->width * 4;
+    const int first = (fa->frames == 0);
+    uint32_t transitions = 0, flashed = 0;
+    uint32_t red_transitions = 0, red_flashed = 0;
+    unsigned tile_w, tile_h;
+
+    if (fb_tile_dims((enum fb_tiling)tiling, &tile_w, &tile_h))
+        return -EINVAL;
+
+    /* Linear frames have no tile rows; stream them in 8-row bands. */
+    if (!tile_w)
+        tile_h = 8;
+
+    if (!linear_out && fa->band_size < (size_t)row_bytes * tile_h) {
+        free(fa->band);
+        fa->band_size = (size_t)row_bytes * tile_h;
+        fa->band = malloc(fa->band_size);
+        if (!fa->band) {
+            fa->band_size = 0;
+            return -ENOMEM;
+        }
+    }
+
+    /* Bands follow the frame's tile rows, so the first one may be partial. */
+    for (unsigned yb = y0; yb < y0 + fa->height; ) {
+        unsigned y1 = (yb / tile_h + 1) * tile_h;
+        uint8_t *band;
+
+        if (y1 > y0 + fa->height)
+            y1 = y0 + fa->height;
+        band = linear_out ? linear_out + (size_t)(yb - y0) * row_bytes : fa->band;
+
+        fb_detile_rows(band, row_bytes, src, SIZE_MAX, pitch, (enum fb_tiling)tiling,
+                       x0 * 4, row_bytes, yb, y1);
+
+        for (unsigned y = yb; y < y1; y++) {
+            const uint8_t *px = band + (size_t)(y - yb) * row_bytes;
+            size_t base = (size_t)(y - y0) * fa->width;
+            uint16_t *lum = fa->lum + base;
+            int8_t *dir = fa->dir + base;
+
+            if (first) {
+                for (unsigned x = 0; x < fa->width; x++)
+                    lum[x] = lum_of(px + x * 4);
+                if (fa->px_prev)
+                    memcpy(fa->px_prev + base, px, row_bytes);
+                continue;
+            }
+            for (unsigned x = 0; x < fa->width; x++) {
+                unsigned bits = fa_step(&lum[x], &dir[x], lum_of(px + x * 4));
+                transitions += bits & FA_MASK_TRANSITION;
+                flashed += (bits & FA_MASK_FLASH) >> 1;
+            }
+            if (fa->px_prev) {
+                const uint32_t *cur = (const uint32_t *)px;
+                uint32_t *prev = fa->px_prev + base;
+                int8_t *rdir = fa->red_dir + base;
+
+                for (unsigned x = 0; x < fa->width; x++) {
+                    unsigned bits = fa_red_step(&prev[x], &rdir[x], cur[x]);
+                    red_transitions += bits & FA_MASK_TRANSITION;
+                    red_flashed += (bits & FA_MASK_FLASH) >> 1;
+                }
+            }
+        }
+        yb = y1;
+    }
+
+    res->transitions = transitions;
+    res->flashed = flashed;
+    res->red_transitions = red_transitions;
+    res->red_flashed = red_flashed;
+    fa->frames++;
+    fa->armed_valid = 0;
+    return 0;
+}
+
+int fa_process_yuv_rect(struct flash_analyzer *fa, const uint8_t *src,
+                        unsigned pitch, enum fa_tiling tiling, uint32_t format,
+                        size_t uv_offset, unsigned x0, unsigned y0,
+                        struct fa_frame_result *res)
+{
+    const unsigned depth = fb_yuv_depth(format);
+    const unsigned row_bytes = fa->width * depth;
+    const unsigned chroma_bytes = (fa->width + 1) / 2 * 2 * depth;
+    const int first = (fa->frames == 0);
+    uint32_t transitions = 0, flashed = 0;
+    uint32_t red_transitions = 0, red_flashed = 0;
+    unsigned tile_w, tile_h;
+    size_t size;
+    uint8_t *chroma;
+
+    if (!depth || (x0 | y0) & 1 || fb_tile_dims((enum fb_tiling)tiling, &tile_w, &tile_h))
+        return -EINVAL;
+
+    /* Linear frames have no tile rows; stream them in 8-row bands. */
+    if (!tile_w)
+        tile_h = 8;
+
+    /* A band of luma rows, then the chroma rows they use */
+    size = (size_t)row_bytes * tile_h + (size_t)chroma_bytes * (tile_h / 2 + 1);
+    if (fa->band_size < size) {
+        free(fa->band);
+        fa->band_size = size;
+        fa->band = malloc(fa->band_size);
+        if (!fa->band) {
+            fa->band_size = 0;
+            return -ENOMEM;
+        }
+    }
+    chroma = fa->band + (size_t)row_bytes * tile_h;
+
+    for (unsigned yb = y0; yb < y0 + fa->height; ) {
+        unsigned y1 = (yb / tile_h + 1) * tile_h;
+
+        if (y1 > y0 + fa->height)
+            y1 = y0 + fa->height;
+
+        fb_detile_rows(fa->band, row_bytes, src, SIZE_MAX, pitch, (enum fb_tiling)tiling,
+                       x0 * depth, row_bytes, yb, y1);
+        fb_detile_rows(chroma, chroma_bytes, src + uv_offset, SIZE_MAX, pitch,
+                       (enum fb_tiling)tiling, x0 * depth, chroma_bytes, yb / 2, (y1 + 1) / 2);
+
+        for (unsigned y = yb; y < y1; y++) {
+            const uint8_t *luma = fa->band + (size_t)(y - yb) * row_bytes;
+            const uint8_t *uv = chroma + (size_t)(y / 2 - yb / 2) * chroma_bytes;
+            size_t base = (size_t)(y - y0) * fa->width;
+            uint16_t *lum = fa->lum + base;
+            int8_t *dir = fa->dir + base;
+            uint32_t *prev = fa->px_prev ? fa->px_prev + base : NULL;
+            int8_t *rdir = fa->px_prev ? fa->red_dir + base : NULL;
+
+            for (unsigned x = 0; x < fa->width; x++) {
+                uint32_t p = yuv_pack(fb_yuv_sample(luma, x, depth),
+                                      fb_yuv_sample(uv, x & ~1u, depth),
+                                      fb_yuv_sample(uv, x | 1, depth));
+
+                if (first) {
+                    lum[x] = lum_of_yuv(p);
+                    if (prev)
+                        prev[x] = p;
+                    continue;
+                }
+                unsigned bits = fa_step(&lum[x], &dir[x], lum_of_yuv(p));
+                transitions += bits & FA_MASK_TRANSITION;
+                flashed += (bits & FA_MASK_FLASH) >> 1;
+                if (prev) {
+                    bits = fa_red_step_yuv(&prev[x], &rdir[x], p);
+                    red_transitions += bits & FA_MASK_TRANSITION;
+                    red_flashed += (bits & FA_MASK_FLASH) >> 1;
+                }
+            }
+        }
+        yb = y1;
+    }
+
+    res->transitions = transitions;
+    res->flashed = flashed;
+    res->red_transitions = red_transitions;
+    res->red_flashed = red_flashed;
+    fa->frames++;
+    fa->armed_valid = 0;
+    return 0;
+}
+
+int fa_process_incremental(struct flash_analyzer *fa, const uint8_t *src,
+                           unsigned pitch, enum fa_tiling tiling,
+                           unsigned x0, unsigned y0, const struct fa_dirty *dirty,
+                           struct fa_frame_result *res)
+{
+    const unsigned cols = (fa->width + FA_TILE - 1) / FA_TILE;
+    const unsigned rows = (fa->height + FA_TILE - 1) / FA_TILE;
+    uint32_t transitions = 0, flashed = 0;
+    uint32_t red_transitions = 0, red_flashed = 0;
+    unsigned tile_w, tile_h;
+    int ret;
+
+    if (fb_tile_dims((enum fb_tiling)tiling, &tile_w, &tile_h))
+        return -EINVAL;
+    if (dirty && (dirty->cols != cols || dirty->rows != rows))
+        return -EINVAL;
+
+    if (!fa->armed) {
+        fa->armed = malloc((size_t)cols * rows);
+        if (!fa->armed)
+            return -ENOMEM;
+        fa->armed_valid = 0;
+    }
+    if (fa->frames == 0 || !dirty) {
+        ret = fa_process_fused_rect(fa, src, pitch, tiling, x0, y0, NULL, res);
+        if (ret)
+            return ret;
+        /* Every pixel may have transitioned */
+        memset(fa->armed, 1, (size_t)cols * rows);
+        fa->armed_valid = 1;
+        return 0;
+    }
+    /* After fused frames, any tile may hold transition state */
+    if (!fa->armed_valid)
+        memset(fa->armed, 1, (size_t)cols * rows);
+    if (fa->band_size < FA_TILE * FA_TILE * 4) {
+        free(fa->band);
+        fa->band_size = FA_TILE * FA_TILE * 4;
+        fa->band = malloc(fa->band_size);
+        if (!fa->band) {
+            fa->band_size = 0;
+            return -ENOMEM;
+        }
+    }
+
+    for (unsigned ty = 0; ty < rows; ty++) {
+        const unsigned ya = ty * FA_TILE;
+        const unsigned th = fa->height - ya < FA_TILE ? fa->height - ya : FA_TILE;
+
+        for (unsigned tx = 0; tx < cols; tx++) {
+            const unsigned xa = tx * FA_TILE;
+            const unsigned tw = fa->width - xa < FA_TILE ? fa->width - xa : FA_TILE;
+            uint8_t *armed = &fa->armed[(size_t)ty * cols + tx];
+            unsigned live = 0;
+
+            if (!fa_dirty_test(dirty, tx, ty)) {
+                /* Clean: transitions age out, nothing else to do */
+                if (!*armed)
+                    continue;
+                for (unsigned y = ya; y < ya + th; y++) {
+                    size_t base = (size_t)y * fa->width + xa;
+
+                    memset(fa->dir + base, 0, tw);
+                    if (fa->px_prev)
+                        memset(fa->red_dir + base, 0, tw);
+                }
+                *armed = 0;
+                continue;
+            }
+
+            fb_detile_rows(fa->band, (size_t)tw * 4, src, SIZE_MAX, pitch, (enum fb_tiling)tiling,
+                           (x0 + xa) * 4, tw * 4, y0 + ya, y0 + ya + th);
+            for (unsigned y = 0; y < th; y++) {
+                const uint8_t *px = fa->band + (size_t)y * tw * 4;
+                size_t base = (size_t)(ya + y) * fa->width + xa;
+                uint16_t *lum = fa->lum + base;
+                int8_t *dir = fa->dir + base;
+
+                for (unsigned x = 0; x < tw; x++) {
+                    unsigned bits = fa_step(&lum[x], &dir[x], lum_of(px + x * 4));
+                    transitions += bits & FA_MASK_TRANSITION;
+                    flashed += (bits & FA_MASK_FLASH) >> 1;
+                    live |= bits;
+                }
+                if (fa->px_prev) {
+                    const uint32_t *cur = (const uint32_t *)px;
+                    uint32_t *prev = fa->px_prev + base;
+                    int8_t *rdir = fa->red_dir + base;
+
+                    for (unsigned x = 0; x < tw; x++) {
+                        unsigned bits = fa_red_step(&prev[x], &rdir[x], cur[x]);
+                        red_transitions += bits & FA_MASK_TRANSITION;
+                        red_flashed += (bits & FA_MASK_FLASH) >> 1;
+                        live |= bits;
+                    }
+                }
+            }
+            /* Any transition leaves a non-zero dir or red_dir behind */
+            *armed = live != 0;
+        }
+    }
+
+    res->transitions = transitions;
+    res->flashed = flashed;
+    res->red_transitions = red_transitions;
+    res->red_flashed = red_flashed;
+    fa->frames++;
+    fa->armed_valid = 1;
+    return 0;
+}
+
+int fa_dirty_init(struct fa_dirty *d, unsigned width, unsigned height)
+{
+    memset(d, 0, sizeof(*d));
+    d->width = width;
+    d->height = height;
+    d->cols = (width + FA_TILE - 1) / FA_TILE;
+    d->rows = (height + FA_TILE - 1) / FA_TILE;
+    d->bits = calloc(((size_t)d->cols * d->rows + 63) / 64, sizeof(*d->bits));
+    d->hash = calloc((size_t)d->cols * d->rows, sizeof(*d->hash));
+    d->tile = malloc(FA_TILE * FA_TILE * 4);
+    if (!d->bits || !d->hash || !d->tile) {
+        fa_dirty_free(d);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void fa_dirty_free(struct fa_dirty *d)
+{
+    free(d->bits);
+    free(d->hash);
+    free(d->tile);
+    memset(d, 0, sizeof(*d));
+}
+
+void fa_dirty_clear(struct fa_dirty *d)
+{
+    memset(d->bits, 0, ((size_t)d->cols * d->rows + 63) / 64 * sizeof(*d->bits));
+}
+
+void fa_dirty_all(struct fa_dirty *d)
+{
+    memset(d->bits, 0xff, ((size_t)d->cols * d->rows + 63) / 64 * sizeof(*d->bits));
+}
+
+static inline void fa_dirty_set(struct fa_dirty *d, unsigned tx, unsigned ty)
+{
+    size_t i = (size_t)ty * d->cols + tx;
+
+    d->bits[i / 64] |= 1ull << (i % 64);
+}
+
+void fa_dirty_add_rect(struct fa_dirty *d, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+    if (!w || !h || x >= d->width || y >= d->height)
+        return;
+    unsigned tx1 = (x + w - 1) / FA_TILE, ty1 = (y + h - 1) / FA_TILE;
+
+    if (tx1 >= d->cols)
+        tx1 = d->cols - 1;
+    if (ty1 >= d->rows)
+        ty1 = d->rows - 1;
+    for (unsigned ty = y / FA_TILE; ty <= ty1; ty++)
+        for (unsigned tx = x / FA_TILE; tx <= tx1; tx++)
+            fa_dirty_set(d, tx, ty);
+}
+
+/* Four independent multiply-xorshift lanes over the tile's words, folded at
+ * the end; not cryptographic. */
+static uint64_t tile_hash(const uint8_t *p, size_t len)
+{
+    uint64_t h[4] = { 0x9e3779b97f4a7c15ull ^ len, 1, 2, 3 };
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        for (unsigned l = 0; l < 4; l++) {
+            uint64_t v;
+
+            memcpy(&v, p + i + l * 8, 8);
+            h[l] = (h[l] ^ v) * 0xbf58476d1ce4e5b9ull;
+            h[l] ^= h[l] >> 31;
+        }
+    }
+    for (; i < len; i++)
+        h[0] = (h[0] ^ p[i]) * 0x94d049bb133111ebull;
+    return (h[0] ^ (h[1] * 0x94d049bb133111ebull)) + (h[2] ^ (h[3] >> 17)) * 0xbf58476d1ce4e5b9ull;
+}
+
+unsigned fa_dirty_hash(struct fa_dirty *d, const uint8_t *src, unsigned pitch,
+                       enum fa_tiling tiling, unsigned x0, unsigned y0)
+{
+    unsigned marked = 0;
+
+    for (unsigned ty = 0; ty < d->rows; ty++) {
+        const unsigned ya = ty * FA_TILE;
+        const unsigned th = d->height - ya < FA_TILE ? d->height - ya : FA_TILE;
+
+        for (unsigned tx = 0; tx < d->cols; tx++) {
+            const unsigned xa = tx * FA_TILE;
+            const unsigned tw = d->width - xa < FA_TILE ? d->width - xa : FA_TILE;
+            uint64_t *hash = &d->hash[(size_t)ty * d->cols + tx];
+            uint64_t h;
+
+            fb_detile_rows(d->tile, (size_t)tw * 4, src, SIZE_MAX, pitch, (enum fb_tiling)tiling,
+                           (x0 + xa) * 4, tw * 4, y0 + ya, y0 + ya + th);
+            h = tile_hash(d->tile, (size_t)tw * th * 4);
+            if (!d->hashed || h != *hash) {
+                fa_dirty_set(d, tx, ty);
+                marked++;
+            }
+            *hash = h;
+        }
+    }
+    d->hashed = 1;
+    return marked;
+}
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: MIT
+/* flash_analyzer.h – per-pixel flash analysis following spec.v (B.1, B.2)
+ *
+ * Luminance is kept in fixed point (FA_LUM_ONE == relative luminance 1.0)
+ * so the harmful_transition / opposing_changes rules reduce to integer
+ * compares. Red flashes (B.2) are optional; the (u', v') colour difference
+ * is only evaluated for pixels that are red-dominant in one of the frames.
+ * Frames are XRGB8888 (bgr0 in memory), either linear or tiled
+ * the same way the kernel module detiles them, or NV12/P010 planes
+ * (fa_process_yuv_rect()).
+ */
+#ifndef FLASH_ANALYZER_H
+#define FLASH_ANALYZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fb_detile.h"
+
+#define FA_LUM_SHIFT 14
+#define FA_LUM_ONE   (1u << FA_LUM_SHIFT)
+#define FA_TILE      32     /* dirty-tracking tile edge in pixels, one Y/Tile4 tile */
+
+enum fa_tiling {
+    FA_TILING_NONE = FB_TILING_NONE,
+    FA_TILING_X = FB_TILING_X,
+    FA_TILING_Y = FB_TILING_Y,
+    FA_TILING_YF = FB_TILING_YF,
+    FA_TILING_4 = FB_TILING_4
+};
+
+/* Map a DRM format modifier (I915_FORMAT_MOD_*_TILED) to a tiling. */
+enum fa_tiling fa_tiling_from_modifier(uint64_t modifier);
+
+struct fa_frame_result {
+    uint32_t transitions;   /* pixels with a harmful transition prev -> cur */
+    uint32_t flashed;       /* pixels where is_flash holds (prev2, prev, cur) */
+    uint32_t red_transitions;
+    uint32_t red_flashed;   /* pixels where is_red_flash holds */
+};
+
+struct flash_analyzer {
+    unsigned width, height;
+    uint16_t *lum;          /* luminance of the previous frame */
+    int8_t   *dir;          /* +1/-1: previous transition was harmful up/down */
+    uint64_t  frames;
+
+    /* Red flash state, only allocated by fa_enable_red(). */
+    uint32_t *px_prev;      /* previous XRGB8888 pixel */
+    int8_t   *red_dir;      /* sign of the red ratio change if it was harmful */
+
+    /* Scratch for the unfused reference path (full-frame intermediates). */
+    uint8_t  *linear;
+    uint16_t *lum_cur;
+    uint8_t  *mask;
+
+    /* Scratch for the fused path: one tile-row band. */
+    uint8_t  *band;
+    size_t    band_size;
+
+    /* Incremental path: per FA_TILE tile, some dir or red_dir is non-zero. */
+    uint8_t  *armed;
+    int       armed_valid;  /* armed is up to date; the fused path invalidates it */
+};
+
+/*
+ * Which FA_TILE x FA_TILE tiles of the analysed area may have changed since
+ * the previous frame. Filled from damage clips with fa_dirty_add_rect(), or
+ * by fa_dirty_hash() comparing tile hashes with the previous frame's.
+ */
+struct fa_dirty {
+    unsigned width, height; /* analysed area, pixels */
+    unsigned cols, rows;
+    uint64_t *bits;         /* bit ty * cols + tx */
+    uint64_t *hash;         /* per tile, for fa_dirty_hash() */
+    int       hashed;       /* hash holds a previous frame */
+    uint8_t  *tile;         /* scratch, one detiled tile */
+};
+
+int  fa_init(struct flash_analyzer *fa, unsigned width, unsigned height);
+void fa_free(struct flash_analyzer *fa);
+void fa_reset(struct flash_analyzer *fa);
+
+/* Also track red flashes (spec.v B.2) in the fused path. */
+int  fa_enable_red(struct flash_analyzer *fa);
+
+/* Relative luminance of one XRGB8888 pixel, FA_LUM_ONE == 1.0. */
+uint16_t fa_luminance(uint32_t xrgb);
+
+/*
+ * Reference pipeline: detile the whole frame, convert to luminance,
+ * compare against the previous frame, then reduce the flash mask.
+ * Four full-frame passes; kept as the baseline the fused kernel is
+ * checked and benchmarked against. Luminance flashes only.
+ */
+int fa_process_unfused(struct flash_analyzer *fa, const uint8_t *src,
+                       unsigned pitch, enum fa_tiling tiling,
+                       struct fa_frame_result *res);
+
+/*
+ * Fused pipeline: walks the frame one tile-row band at a time, detiles the
+ * band into a cache-resident scratch (or straight into linear_out when the
+ * caller also wants the linear frame), and updates luminance, transition
+ * state and area counters before moving on, so the frame is streamed
+ * through memory once.
+ */
+int fa_process_fused(struct flash_analyzer *fa, const uint8_t *src,
+                     unsigned pitch, enum fa_tiling tiling,
+                     uint8_t *linear_out, struct fa_frame_result *res);
+
+/*
+ * Fused pipeline over the fa->width x fa->height rectangle at (x0, y0) of a
+ * larger framebuffer, e.g. one monitor of a combined desktop. linear_out,
+ * when given, receives the rectangle's rows only.
+ */
+int fa_process_fused_rect(struct flash_analyzer *fa, const uint8_t *src,
+                          unsigned pitch, enum fa_tiling tiling,
+                          unsigned x0, unsigned y0, uint8_t *linear_out,
+                          struct fa_frame_result *res);
+
+/*
+ * Fused pipeline for NV12/P010 frames (fb_yuv.h): luminance comes from the
+ * luma plane, and chroma is only converted for pixels too colourful for
+ * the luma tables or, with red flashes on, possibly red-dominant. The
+ * chroma plane starts uv_offset bytes into src, with the same pitch and
+ * tiling; x0 and y0 must be even. Results are within FB_YUV_LUM_ERROR per
+ * pixel of analysing the frame converted to XRGB8888. px_prev keeps the
+ * pixels as packed 10-bit Y'CbCr, so an analyzer takes one kind of frame.
+ */
+int fa_process_yuv_rect(struct flash_analyzer *fa, const uint8_t *src,
+                        unsigned pitch, enum fa_tiling tiling, uint32_t format,
+                        size_t uv_offset, unsigned x0, unsigned y0,
+                        struct fa_frame_result *res);
+
+/*
+ * Incremental pipeline: like fa_process_fused_rect(), but only the tiles
+ * marked in dirty are detiled and analysed. A clean tile is identical to
+ * the previous frame, so its pixels cannot transition; all that changes is
+ * that their last transition is now one frame old, which clears dir and
+ * red_dir. Tiles with no transition state left are not touched at all, so
+ * the cost follows the changed area rather than the resolution. Results
+ * equal the fused path's as long as every changed tile is marked. The
+ * first frame, or dirty == NULL, runs the whole area.
+ */
+int fa_process_incremental(struct flash_analyzer *fa, const uint8_t *src,
+                           unsigned pitch, enum fa_tiling tiling,
+                           unsigned x0, unsigned y0, const struct fa_dirty *dirty,
+                           struct fa_frame_result *res);
+
+int  fa_dirty_init(struct fa_dirty *d, unsigned width, unsigned height);
+void fa_dirty_free(struct fa_dirty *d);
+void fa_dirty_clear(struct fa_dirty *d);
+void fa_dirty_all(struct fa_dirty *d);
+/* Mark the tiles a damage rectangle (relative to the analysed area) touches. */
+void fa_dirty_add_rect(struct fa_dirty *d, unsigned x, unsigned y, unsigned w, unsigned h);
+/*
+ * Mark the tiles of the area at (x0, y0) whose 64-bit content hash differs
+ * from the previous call's (all of them on the first call). Reads the
+ * whole area but does no colour arithmetic. Returns the tiles marked.
+ */
+unsigned fa_dirty_hash(struct fa_dirty *d, const uint8_t *src, unsigned pitch,
+                       enum fa_tiling tiling, unsigned x0, unsigned y0);
+
+static inline int fa_dirty_test(const struct fa_dirty *d, unsigned tx, unsigned ty)
+{
+    size_t i = (size_t)ty * d->cols + tx;
+
+    return (d->bits[i / 64] >> (i % 64)) & 1;
+}
+
+#endif /* FLASH_ANALYZER_H */
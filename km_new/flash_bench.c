@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: MIT
+/* flash_bench.c – fused vs. unfused flash analysis throughput
+ *
+ * Build :  gcc -O2 flash_bench.c flash_analyzer.c fb_detile.c -lm -o flash_bench
+ * Usage :  flash_bench [frames] [X|Y|4|L] [width height]
+ *
+ * Defaults to 120 X-tiled 3840x2160 frames. A small set of synthetic frames
+ * (gradient plus a flashing block) is tiled once up front and cycled, so the
+ * timings cover analysis only. Per-frame results of both paths are compared.
+ *
+ * The incremental path is timed on a second set whose gradient stands
+ * still, so only the flashing block changes: once with the dirty tiles
+ * found by hashing, once with the block given as a damage rectangle. Its
+ * results are checked against the fused path on the same frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "flash_analyzer.h"
+
+#define NUM_SOURCES 4
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void fill_pattern(uint8_t *px, unsigned w, unsigned h, unsigned frame, int still)
+{
+    for (unsigned y = 0; y < h; y++) {
+        for (unsigned x = 0; x < w; x++) {
+            uint8_t *p = px + ((size_t)y * w + x) * 4;
+            int flash = (x >= w / 4 && x < w / 2 && y >= h / 4 && y < h / 2);
+            uint8_t v = flash ? ((frame & 1) ? 0xff : 0x10) : (uint8_t)(x + y + (still ? 0 : frame));
+
+            p[0] = v;
+            p[1] = v;
+            p[2] = flash ? v : (uint8_t)(x >> 4);
+            p[3] = 0;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned frames = (argc > 1) ? atoi(argv[1]) : 120;
+    char layout     = (argc > 2) ? argv[2][0] : 'X';
+    unsigned w      = (argc > 4) ? atoi(argv[3]) : 3840;
+    unsigned h      = (argc > 4) ? atoi(argv[4]) : 2160;
+
+    enum fa_tiling tiling = (layout == 'X') ? FA_TILING_X :
+                            (layout == 'Y') ? FA_TILING_Y :
+                            (layout == '4') ? FA_TILING_4 : FA_TILING_NONE;
+    unsigned tile_w = (layout == 'X') ? 512 : (layout == 'Y' || layout == '4') ? 128 : 0;
+    unsigned tile_h = (layout == 'X') ? 8 : (layout == 'Y' || layout == '4') ? 32 : 1;
+    unsigned pitch  = w * 4;
+
+    if (tile_w)
+        pitch = (pitch + tile_w - 1) / tile_w * tile_w;
+    unsigned h_alloc = (h + tile_h - 1) / tile_h * tile_h;
+
+    size_t src_size = (size_t)pitch * h_alloc;
+    uint8_t *linear = malloc((size_t)w * h * 4);
+    uint8_t *out = malloc((size_t)w * h * 4);
+    uint8_t *src[NUM_SOURCES], *still[NUM_SOURCES];
+    struct fa_frame_result *ref = calloc(frames, sizeof(*ref));
+    struct flash_analyzer fa;
+
+    if (!linear || !out || !ref || fa_init(&fa, w, h)) {
+        perror("alloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < NUM_SOURCES; i++) {
+        src[i] = calloc(1, src_size);
+        still[i] = calloc(1, src_size);
+        if (!src[i] || !still[i]) { perror("alloc"); return EXIT_FAILURE; }
+        fill_pattern(linear, w, h, i, 0);
+        fb_tile_rect(src[i], src_size, pitch, (enum fb_tiling)tiling, linear, 0, 0, w, h);
+        fill_pattern(linear, w, h, i, 1);
+        fb_tile_rect(still[i], src_size, pitch, (enum fb_tiling)tiling, linear, 0, 0, w, h);
+    }
+
+    printf("%u frames %ux%u, layout %c, pitch %u\n", frames, w, h, layout, pitch);
+
+    double t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++)
+        fa_process_unfused(&fa, src[f % NUM_SOURCES], pitch, tiling, &ref[f]);
+    double unfused = (now_ms() - t0) / frames;
+
+    int mismatch = 0;
+    fa_reset(&fa);
+    t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++) {
+        struct fa_frame_result r;
+        fa_process_fused(&fa, src[f % NUM_SOURCES], pitch, tiling, NULL, &r);
+        mismatch |= memcmp(&r, &ref[f], sizeof(r)) != 0;
+    }
+    double fused = (now_ms() - t0) / frames;
+
+    fa_reset(&fa);
+    t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++) {
+        struct fa_frame_result r;
+        fa_process_fused(&fa, src[f % NUM_SOURCES], pitch, tiling, out, &r);
+        mismatch |= memcmp(&r, &ref[f], sizeof(r)) != 0;
+    }
+    double fused_out = (now_ms() - t0) / frames;
+
+    /* Incremental, on frames where only the flashing block changes */
+    struct fa_dirty dirty;
+    uint64_t dirty_tiles = 0;
+
+    if (fa_dirty_init(&dirty, w, h)) {
+        perror("alloc");
+        return EXIT_FAILURE;
+    }
+    fa_reset(&fa);
+    t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++)
+        fa_process_fused(&fa, still[f % NUM_SOURCES], pitch, tiling, NULL, &ref[f]);
+    double still_fused = (now_ms() - t0) / frames;
+
+    fa_reset(&fa);
+    t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++) {
+        struct fa_frame_result r;
+        fa_dirty_clear(&dirty);
+        dirty_tiles += fa_dirty_hash(&dirty, still[f % NUM_SOURCES], pitch, tiling, 0, 0);
+        fa_process_incremental(&fa, still[f % NUM_SOURCES], pitch, tiling, 0, 0, &dirty, &r);
+        mismatch |= memcmp(&r, &ref[f], sizeof(r)) != 0;
+    }
+    double incr_hash = (now_ms() - t0) / frames;
+
+    fa_reset(&fa);
+    t0 = now_ms();
+    for (unsigned f = 0; f < frames; f++) {
+        struct fa_frame_result r;
+        fa_dirty_clear(&dirty);
+        fa_dirty_add_rect(&dirty, w / 4, h / 4, w / 2 - w / 4, h / 2 - h / 4);
+        fa_process_incremental(&fa, still[f % NUM_SOURCES], pitch, tiling, 0, 0, &dirty, &r);
+        mismatch |= memcmp(&r, &ref[f], sizeof(r)) != 0;
+    }
+    double incr_damage = (now_ms() - t0) / frames;
+
+    double mb = src_size / 1e6;
+    printf("unfused           : %7.2f ms/frame  %6.2f GB/s\n", unfused, mb / unfused);
+    printf("fused             : %7.2f ms/frame  %6.2f GB/s  (%.2fx)\n",
+           fused, mb / fused, unfused / fused);
+    printf("fused + linear out: %7.2f ms/frame  %6.2f GB/s  (%.2fx)\n",
+           fused_out, mb / fused_out, unfused / fused_out);
+    printf("still background, %.1f%% of tiles dirty:\n",
+           100.0 * dirty_tiles / ((double)frames * dirty.cols * dirty.rows));
+    printf("  fused           : %7.2f ms/frame\n", still_fused);
+    printf("  incremental hash: %7.2f ms/frame  (%.2fx)\n", incr_hash, still_fused / incr_hash);
+    printf("  incremental clip: %7.2f ms/frame  (%.2fx)\n", incr_damage, still_fused / incr_damage);
+    printf("last frame: %u transitions, %u flashed pixels\n",
+           ref[frames - 1].transitions, ref[frames - 1].flashed);
+
+    if (mismatch) {
+        fprintf(stderr, "fused or incremental results differ from the reference\n");
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned i = 0; i < NUM_SOURCES; i++) {
+        free(src[i]);
+        free(still[i]);
+    }
+    fa_dirty_free(&dirty);
+    free(linear);
+    free(out);
+    free(ref);
+    fa_free(&fa);
+    return EXIT_SUCCESS;
+}
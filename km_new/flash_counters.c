@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+/* flash_counters.c – publish and read flash_analyze's running counters
+ *
+ * Build :  gcc -O2 -c flash_counters.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flash_counters.h"
+
+#define NS_PER_SEC  1000000000ull
+#define READ_TRIES  64
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+int fa_counters_create(struct fa_counters_writer *w, const char *path,
+                       const struct fa_region_set *set, int live)
+{
+    struct fa_counters *c;
+    int fd, ret = 0;
+
+    /* A fresh inode, so readers of a previous run keep their old mapping. */
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -errno;
+    if (ftruncate(fd, sizeof(*c)))
+        ret = -errno;
+    c = ret ? MAP_FAILED : mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (!ret && c == MAP_FAILED)
+        ret = -errno;
+    close(fd);
+    if (ret) {
+        unlink(path);
+        return ret;
+    }
+
+    c->magic = FA_COUNTERS_MAGIC;
+    c->version = FA_COUNTERS_VERSION;
+    c->regions = set->count;
+    c->pid = getpid();
+    c->started_ns = c->updated_ns = now_ns();
+    c->live = !!live;
+    for (unsigned i = 0; i < set->count; i++) {
+        snprintf(c->region[i].name, sizeof(c->region[i].name), "%s", set->regions[i].name);
+        c->region[i].area_threshold = set->regions[i].area_threshold;
+    }
+    w->c = c;
+    return 0;
+}
+
+void fa_counters_update(struct fa_counters_writer *w, const struct fa_region_set *set,
+                        uint64_t frames, uint64_t late, uint64_t frame_ns)
+{
+    struct fa_counters *c = w->c;
+    unsigned seq = atomic_load_explicit(&c->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&c->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    c->updated_ns = now_ns();
+    c->frames = frames;
+    c->late = late;
+    fb_hist_add(&c->frame, frame_ns);
+    for (unsigned i = 0; i < c->regions; i++) {
+        const struct fa_region_stats *st = &set->regions[i].stats;
+        struct fa_counters_region *r = &c->region[i];
+
+        r->frames = st->frames;
+        r->flashes = st->flashes;
+        r->red_flashes = st->red_flashes;
+        r->alarms = st->alarms;
+        r->max_flashed = st->max_flashed;
+        r->tiles = st->tiles;
+        r->dirty_tiles = st->dirty_tiles;
+        r->harmful = st->harmful;
+        r->harmful_red = st->harmful_red;
+    }
+
+    atomic_store_explicit(&c->seq, seq + 2, memory_order_release);
+}
+
+void fa_counters_close(struct fa_counters_writer *w)
+{
+    if (w->c)
+        munmap(w->c, sizeof(*w->c));
+    w->c = NULL;
+}
+
+int fa_counters_map(const char *path, const struct fa_counters **c)
+{
+    struct stat st;
+    void *p;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -errno;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(**c)) {
+        close(fd);
+        return -EPROTO;
+    }
+    p = mmap(NULL, sizeof(**c), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -errno;
+    *c = p;
+    if ((*c)->magic != FA_COUNTERS_MAGIC || (*c)->version != FA_COUNTERS_VERSION) {
+        fa_counters_unmap(*c);
+        return -EPROTO;
+    }
+    return 0;
+}
+
+void fa_counters_unmap(const struct fa_counters *c)
+{
+    munmap((void *)c, sizeof(*c));
+}
+
+int fa_counters_read(const struct fa_counters *c, struct fa_counters *out)
+{
+    for (int i = 0; i < READ_TRIES; i++) {
+        unsigned seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(out, c, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&c->seq, memory_order_relaxed) == seq)
+            return 0;
+    }
+    return -EAGAIN;
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+/* flash_counters.h – flash_analyze's running counters, shared through a file
+ *
+ * flash_analyze -m <file> keeps one struct fa_counters mapped from <file>
+ * and brings it up to date after every frame; fb_exporter maps the file
+ * read-only and publishes it. The writer never waits for readers: each
+ * update is bracketed by a sequence count that is odd while it is under
+ * way, and a reader retries its copy when the count was odd or moved.
+ * The file stays behind with the final values when the analyzer exits;
+ * pid tells whether it is still running.
+ */
+#ifndef FLASH_COUNTERS_H
+#define FLASH_COUNTERS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "fb_counters.h"
+#include "flash_regions.h"
+
+#define FA_COUNTERS_MAGIC       0x4e434146u     /* 'FACN' */
+#define FA_COUNTERS_VERSION     1
+
+struct fa_counters_region {
+    char name[32];
+    uint32_t area_threshold;    /* pixels */
+    uint32_t max_flashed;
+    uint64_t frames, flashes, red_flashes;
+    uint64_t alarms;            /* turns into the harmful state */
+    uint64_t tiles, dirty_tiles;    /* incremental analysis only */
+    uint32_t harmful, harmful_red;
+};
+
+struct fa_counters {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t regions;
+    atomic_uint seq;            /* odd while an update is under way */
+    uint32_t pid;
+    uint64_t started_ns;        /* CLOCK_MONOTONIC */
+    uint64_t updated_ns;
+    uint64_t frames;            /* frames analysed */
+    uint64_t late;              /* live: polls that came over a frame period late */
+    uint32_t live, reserved;
+    struct fb_hist frame;       /* time to analyse one frame, all regions */
+    struct fa_counters_region region[FA_MAX_REGIONS];
+};
+
+struct fa_counters_writer {
+    struct fa_counters *c;
+};
+
+/* Create (or replace) path and map a zeroed record for the set's regions. */
+int  fa_counters_create(struct fa_counters_writer *w, const char *path,
+                        const struct fa_region_set *set, int live);
+void fa_counters_update(struct fa_counters_writer *w, const struct fa_region_set *set,
+                        uint64_t frames, uint64_t late, uint64_t frame_ns);
+void fa_counters_close(struct fa_counters_writer *w);
+
+/* Map path read-only; fa_counters_unmap() when done. */
+int  fa_counters_map(const char *path, const struct fa_counters **c);
+void fa_counters_unmap(const struct fa_counters *c);
+/* Consistent copy of a mapped record, or -EAGAIN if every try met an update. */
+int  fa_counters_read(const struct fa_counters *c, struct fa_counters *out);
+
+#endif /* FLASH_COUNTERS_H */
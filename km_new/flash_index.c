@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+/* flash_index.c – compact per-second flash index for long recordings
+ *
+ * Build :  gcc -O2 -c flash_index.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flash_index.h"
+
+#define NS_PER_SEC 1000000000ull
+
+static void sat_inc16(uint16_t *v)
+{
+    if (*v != UINT16_MAX)
+        (*v)++;
+}
+
+int fidx_writer_init(struct fidx_writer *w, const struct fa_region_set *set)
+{
+    memset(w, 0, sizeof(*w));
+    w->region_count = set->count;
+    for (unsigned i = 0; i < set->count; i++) {
+        const struct fa_region *r = &set->regions[i];
+        struct fidx_region *d = &w->regions[i];
+
+        snprintf(d->name, sizeof(d->name), "%s", r->name);
+        d->x = r->x;
+        d->y = r->y;
+        d->width = r->width;
+        d->height = r->height;
+        d->area_threshold = r->area_threshold;
+    }
+    return 0;
+}
+
+int fidx_add_frame(struct fidx_writer *w, const struct fa_region_set *set, uint64_t ts_ns)
+{
+    uint64_t sec;
+
+    if (!w->started) {
+        w->start_ns = ts_ns;
+        w->started = 1;
+    }
+    if (ts_ns < w->start_ns)
+        return -EINVAL;
+    sec = (ts_ns - w->start_ns) / NS_PER_SEC;
+
+    if (sec >= w->cap) {
+        uint64_t cap = w->cap ? w->cap : 3600;
+        void *p;
+
+        while (cap <= sec)
+            cap *= 2;
+        p = realloc(w->seconds, cap * w->region_count * sizeof(*w->seconds));
+        if (!p)
+            return -ENOMEM;
+        w->seconds = p;
+        memset(w->seconds + w->cap * w->region_count, 0,
+               (cap - w->cap) * w->region_count * sizeof(*w->seconds));
+        w->cap = cap;
+    }
+    if (sec >= w->nseconds)
+        w->nseconds = sec + 1;
+
+    for (unsigned i = 0; i < w->region_count; i++) {
+        const struct fa_region_stats *st = &set->regions[i].stats;
+        struct fidx_second *s = &w->seconds[sec * w->region_count + i];
+        uint32_t area = st->last.flashed > st->last.red_flashed ?
+                        st->last.flashed : st->last.red_flashed;
+
+        sat_inc16(&s->frames);
+        if (st->flash)
+            sat_inc16(&s->flashes);
+        if (st->red_flash)
+            sat_inc16(&s->red_flashes);
+        if (area > s->max_flashed)
+            s->max_flashed = area;
+        if (st->harmful)
+            s->flags |= FIDX_HARMFUL;
+        if (st->harmful_red)
+            s->flags |= FIDX_HARMFUL_RED;
+    }
+    return 0;
+}
+
+int fidx_write(struct fidx_writer *w, const char *path)
+{
+    const unsigned rc = w->region_count;
+    uint64_t nblocks = (w->nseconds + FIDX_BLOCK_SECONDS - 1) / FIDX_BLOCK_SECONDS;
+    struct fidx_block *blocks = calloc(nblocks ? nblocks * rc : 1, sizeof(*blocks));
+    struct fidx_header hdr;
+    FILE *f;
+    int ret = 0;
+
+    if (!blocks)
+        return -ENOMEM;
+
+    for (uint64_t s = 0; s < w->nseconds; s++) {
+        for (unsigned i = 0; i < rc; i++) {
+            const struct fidx_second *sec = &w->seconds[s * rc + i];
+            struct fidx_block *b = &blocks[(s / FIDX_BLOCK_SECONDS) * rc + i];
+
+            b->frames += sec->frames;
+            b->flashes += sec->flashes;
+            b->red_flashes += sec->red_flashes;
+            b->harmful_seconds += !!(sec->flags & (FIDX_HARMFUL | FIDX_HARMFUL_RED));
+            if (sec->max_flashed > b->max_flashed)
+                b->max_flashed = sec->max_flashed;
+            b->flags |= sec->flags;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FIDX_MAGIC, sizeof(hdr.magic));
+    hdr.version = FIDX_VERSION;
+    hdr.region_count = rc;
+    hdr.start_ns = w->start_ns;
+    hdr.seconds = w->nseconds;
+    hdr.blocks = nblocks;
+    hdr.block_seconds = FIDX_BLOCK_SECONDS;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        free(blocks);
+        return -errno;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(w->regions, sizeof(w->regions[0]), rc, f) != rc ||
+        fwrite(w->seconds, sizeof(*w->seconds) * rc, w->nseconds, f) != w->nseconds ||
+        fwrite(blocks, sizeof(*blocks) * rc, nblocks, f) != nblocks)
+        ret = -EIO;
+    if (fclose(f) && !ret)
+        ret = -errno;
+
+    free(blocks);
+    return ret;
+}
+
+void fidx_writer_free(struct fidx_writer *w)
+{
+    free(w->seconds);
+    memset(w, 0, sizeof(*w));
+}
+
+int fidx_open(struct fidx *idx, const char *path)
+{
+    struct stat st;
+    size_t need;
+    int ret = -EINVAL;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (idx->fd < 0)
+        return -errno;
+    if (fstat(idx->fd, &st)) {
+        ret = -errno;
+        goto err_close;
+    }
+    if ((size_t)st.st_size < sizeof(struct fidx_header))
+        goto err_close;
+
+    idx->map_size = st.st_size;
+    idx->map = mmap(NULL, idx->map_size, PROT_READ, MAP_SHARED, idx->fd, 0);
+    if (idx->map == MAP_FAILED) {
+        ret = -errno;
+        goto err_close;
+    }
+    idx->hdr = (const void *)idx->map;
+
+    if (memcmp(idx->hdr->magic, FIDX_MAGIC, sizeof(idx->hdr->magic)) ||
+        idx->hdr->version != FIDX_VERSION || !idx->hdr->region_count ||
+        idx->hdr->region_count > FA_MAX_REGIONS ||
+        idx->hdr->block_seconds != FIDX_BLOCK_SECONDS ||
+        idx->hdr->blocks != (idx->hdr->seconds + FIDX_BLOCK_SECONDS - 1) / FIDX_BLOCK_SECONDS)
+        goto err_unmap;
+
+    need = sizeof(struct fidx_header) +
+           idx->hdr->region_count * (sizeof(struct fidx_region) +
+                                     idx->hdr->seconds * sizeof(struct fidx_second) +
+                                     idx->hdr->blocks * sizeof(struct fidx_block));
+    if (need != idx->map_size)
+        goto err_unmap;
+
+    idx->regions = (const void *)(idx->hdr + 1);
+    idx->seconds = (const void *)(idx->regions + idx->hdr->region_count);
+    idx->blocks = (const void *)(idx->seconds + idx->hdr->seconds * idx->hdr->region_count);
+    return 0;
+
+err_unmap:
+    munmap((void *)idx->map, idx->map_size);
+err_close:
+    close(idx->fd);
+    memset(idx, 0, sizeof(*idx));
+    return ret;
+}
+
+void fidx_close(struct fidx *idx)
+{
+    if (idx->map) {
+        munmap((void *)idx->map, idx->map_size);
+        close(idx->fd);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+static void add_second(struct fidx_summary *sum, const struct fidx_second *s)
+{
+    sum->frames += s->frames;
+    sum->flashes += s->flashes;
+    sum->red_flashes += s->red_flashes;
+    sum->harmful_seconds += !!(s->flags & (FIDX_HARMFUL | FIDX_HARMFUL_RED));
+    if (s->max_flashed > sum->max_flashed)
+        sum->max_flashed = s->max_flashed;
+    sum->flags |= s->flags;
+}
+
+void fidx_summarize(const struct fidx *idx, unsigned region, uint64_t s0, uint64_t s1,
+                    struct fidx_summary *sum)
+{
+    const unsigned rc = idx->hdr->region_count;
+    uint64_t s = s0;
+
+    memset(sum, 0, sizeof(*sum));
+    if (s1 > idx->hdr->seconds)
+        s1 = idx->hdr->seconds;
+
+    while (s < s1) {
+        if (s % FIDX_BLOCK_SECONDS == 0 && s + FIDX_BLOCK_SECONDS <= s1) {
+            const struct fidx_block *b = &idx->blocks[(s / FIDX_BLOCK_SECONDS) * rc + region];
+
+            sum->frames += b->frames;
+            sum->flashes += b->flashes;
+            sum->red_flashes += b->red_flashes;
+            sum->harmful_seconds += b->harmful_seconds;
+            if (b->max_flashed > sum->max_flashed)
+                sum->max_flashed = b->max_flashed;
+            sum->flags |= b->flags;
+            s += FIDX_BLOCK_SECONDS;
+            continue;
+        }
+        add_second(sum, fidx_at(idx, s, region));
+        s++;
+    }
+}
+
+uint64_t fidx_next_harmful(const struct fidx *idx, unsigned region, uint64_t s0, uint64_t s1)
+{
+    const unsigned rc = idx->hdr->region_count;
+    uint64_t s = s0;
+
+    if (s1 > idx->hdr->seconds)
+        s1 = idx->hdr->seconds;
+
+    while (s < s1) {
+        if (s % FIDX_BLOCK_SECONDS == 0 &&
+            !idx->blocks[(s / FIDX_BLOCK_SECONDS) * rc + region].harmful_seconds) {
+            s += FIDX_BLOCK_SECONDS;
+            continue;
+        }
+        if (fidx_at(idx, s, region)->flags & (FIDX_HARMFUL | FIDX_HARMFUL_RED))
+            return s;
+        s++;
+    }
+    return s1;
+}
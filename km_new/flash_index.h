@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MIT
+/* flash_index.h – compact per-second flash index for long recordings
+ *
+ * Written by flash_analyze next to the analysed input (<input>.fidx) so
+ * "where were the harmful seconds?" can be answered without re-running the
+ * analysis. Layout:
+ *
+ *   fidx_header
+ *   fidx_region  [region_count]
+ *   fidx_second  [seconds][region_count]
+ *   fidx_block   [blocks][region_count]      one per FIDX_BLOCK_SECONDS
+ *
+ * Blocks summarise their seconds so range queries skip quiet stretches
+ * without touching the per-second records.
+ */
+#ifndef FLASH_INDEX_H
+#define FLASH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash_regions.h"
+
+#define FIDX_MAGIC          "FLASHIDX"
+#define FIDX_VERSION        1
+#define FIDX_BLOCK_SECONDS  64
+
+/* fidx_second.flags / fidx_block.flags */
+#define FIDX_HARMFUL        (1u << 0)   /* >= 4 flashes within one second ended here */
+#define FIDX_HARMFUL_RED    (1u << 1)   /* ... counting red flashes */
+
+struct fidx_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t region_count;
+    uint64_t start_ns;          /* timestamp of second 0 */
+    uint64_t seconds;
+    uint64_t blocks;
+    uint32_t block_seconds;
+    uint32_t reserved;
+};
+
+struct fidx_region {
+    char     name[32];
+    uint32_t x, y, width, height;
+    uint32_t area_threshold;
+    uint32_t reserved;
+};
+
+struct fidx_second {
+    uint16_t frames;            /* 0: no frames recorded in this second */
+    uint16_t flashes;
+    uint16_t red_flashes;
+    uint8_t  flags;
+    uint8_t  reserved;
+    uint32_t max_flashed;       /* largest flashed area of any frame, pixels */
+};
+
+struct fidx_block {
+    uint32_t frames;
+    uint32_t flashes;
+    uint32_t red_flashes;
+    uint32_t harmful_seconds;
+    uint32_t max_flashed;
+    uint32_t flags;
+};
+
+/* Writer, fed once per analysed frame */
+
+struct fidx_writer {
+    unsigned region_count;
+    struct fidx_region regions[FA_MAX_REGIONS];
+    uint64_t start_ns;
+    int started;
+    struct fidx_second *seconds;
+    uint64_t nseconds, cap;
+};
+
+int  fidx_writer_init(struct fidx_writer *w, const struct fa_region_set *set);
+int  fidx_add_frame(struct fidx_writer *w, const struct fa_region_set *set, uint64_t ts_ns);
+int  fidx_write(struct fidx_writer *w, const char *path);
+void fidx_writer_free(struct fidx_writer *w);
+
+/* Reader (mmap) */
+
+struct fidx {
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    const struct fidx_header *hdr;
+    const struct fidx_region *regions;
+    const struct fidx_second *seconds;
+    const struct fidx_block *blocks;
+};
+
+struct fidx_summary {
+    uint64_t frames;
+    uint64_t flashes;
+    uint64_t red_flashes;
+    uint64_t harmful_seconds;
+    uint32_t max_flashed;
+    uint32_t flags;
+};
+
+int  fidx_open(struct fidx *idx, const char *path);
+void fidx_close(struct fidx *idx);
+
+static inline const struct fidx_second *fidx_at(const struct fidx *idx, uint64_t sec,
+                                                unsigned region)
+{
+    return &idx->seconds[sec * idx->hdr->region_count + region];
+}
+
+/* Aggregate seconds [s0, s1) of one region, using block summaries where possible. */
+void fidx_summarize(const struct fidx *idx, unsigned region, uint64_t s0, uint64_t s1,
+                    struct fidx_summary *sum);
+
+/* Next harmful second >= s0 and < s1 of a region, or s1 if there is none. */
+uint64_t fidx_next_harmful(const struct fidx *idx, unsigned region, uint64_t s0, uint64_t s1);
+
+#endif /* FLASH_INDEX_H */
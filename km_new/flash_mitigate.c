@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: MIT
+/* flash_mitigate.c – dim a CRTC through its colour pipeline while a flash alarm is up
+ *
+ * Build :  gcc -O2 -c flash_mitigate.c   (needs the kernel's DRM uapi headers)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+
+#include "flash_mitigate.h"
+
+#define NS_PER_SEC 1000000000ull
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void latency_add(struct fm_latency *l, uint64_t ns)
+{
+    l->count++;
+    l->sum_ns += ns;
+    if (ns > l->max_ns)
+        l->max_ns = ns;
+}
+
+/* Look up the CRTC properties we care about and their current values. */
+static int find_props(struct fm_agent *a, uint32_t *gamma, uint64_t *gamma_val,
+                      uint32_t *ctm, uint64_t *ctm_val, uint64_t *lut_size)
+{
+    struct drm_mode_obj_get_properties op = {
+        .obj_id = a->crtc_id,
+        .obj_type = DRM_MODE_OBJECT_CRTC,
+    };
+    uint32_t *ids = NULL;
+    uint64_t *vals = NULL;
+    int ret = 0;
+
+    if (ioctl(a->drm_fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &op))
+        return -errno;
+    ids = calloc(op.count_props, sizeof(*ids));
+    vals = calloc(op.count_props, sizeof(*vals));
+    if (!ids || !vals) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    op.props_ptr = (uintptr_t)ids;
+    op.prop_values_ptr = (uintptr_t)vals;
+    if (ioctl(a->drm_fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &op)) {
+        ret = -errno;
+        goto out;
+    }
+
+    for (unsigned i = 0; i < op.count_props; i++) {
+        struct drm_mode_get_property p = { .prop_id = ids[i] };
+
+        if (ioctl(a->drm_fd, DRM_IOCTL_MODE_GETPROPERTY, &p))
+            continue;
+        if (!strcmp(p.name, "GAMMA_LUT")) {
+            *gamma = ids[i];
+            *gamma_val = vals[i];
+        } else if (!strcmp(p.name, "CTM")) {
+            *ctm = ids[i];
+            *ctm_val = vals[i];
+        } else if (!strcmp(p.name, "GAMMA_LUT_SIZE")) {
+            *lut_size = vals[i];
+        }
+    }
+
+out:
+    free(ids);
+    free(vals);
+    return ret;
+}
+
+static int create_blob(int fd, const void *data, uint32_t len, uint32_t *id)
+{
+    struct drm_mode_create_blob blob = { .data = (uintptr_t)data, .length = len };
+
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &blob))
+        return -errno;
+    *id = blob.blob_id;
+    return 0;
+}
+
+/* A linear ramp scaled by dim. */
+static int build_gamma(struct fm_agent *a, uint64_t size)
+{
+    struct drm_color_lut *lut;
+    int ret;
+
+    if (size < 2)
+        return -EINVAL;
+    lut = calloc(size, sizeof(*lut));
+    if (!lut)
+        return -ENOMEM;
+    for (uint64_t i = 0; i < size; i++) {
+        uint16_t v = (uint16_t)(i * 0xffff / (size - 1) * a->dim);
+        lut[i].red = lut[i].green = lut[i].blue = v;
+    }
+    ret = create_blob(a->drm_fd, lut, size * sizeof(*lut), &a->dim_blob);
+    free(lut);
+    return ret;
+}
+
+/* Diagonal matrix of dim, S31.32 sign-magnitude. */
+static int build_ctm(struct fm_agent *a)
+{
+    struct drm_color_ctm ctm;
+
+    memset(&ctm, 0, sizeof(ctm));
+    ctm.matrix[0] = ctm.matrix[4] = ctm.matrix[8] = (uint64_t)(a->dim * 4294967296.0);
+    return create_blob(a->drm_fd, &ctm, sizeof(ctm), &a->dim_blob);
+}
+
+int fm_card_open(const char *card)
+{
+    struct drm_set_client_cap cap = { .capability = DRM_CLIENT_CAP_ATOMIC, .value = 1 };
+    int fd = open(card, O_RDWR | O_CLOEXEC), ret;
+
+    if (fd < 0)
+        return -errno;
+    if (ioctl(fd, DRM_IOCTL_SET_CLIENT_CAP, &cap)) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+int fm_agent_open(struct fm_agent *a, int drm_fd, uint32_t crtc_id, double dim)
+{
+    uint32_t gamma = 0, ctm = 0;
+    uint64_t gamma_val = 0, ctm_val = 0, lut_size = 0;
+    int ret;
+
+    if (drm_fd < 0 || !crtc_id || dim < 0 || dim > 1)
+        return -EINVAL;
+
+    memset(a, 0, sizeof(*a));
+    a->drm_fd = drm_fd;
+    a->crtc_id = crtc_id;
+    a->dim = dim;
+    a->efd = -1;
+
+    ret = find_props(a, &gamma, &gamma_val, &ctm, &ctm_val, &lut_size);
+    if (ret)
+        goto err;
+
+    if (gamma && lut_size) {
+        a->prop = gamma;
+        a->prop_name = "GAMMA_LUT";
+        a->orig_blob = gamma_val;
+        ret = build_gamma(a, lut_size);
+    } else if (ctm) {
+        a->prop = ctm;
+        a->prop_name = "CTM";
+        a->orig_blob = ctm_val;
+        ret = build_ctm(a);
+    } else {
+        ret = -EOPNOTSUPP;
+    }
+    if (ret)
+        goto err;
+
+    a->efd = eventfd(0, EFD_CLOEXEC);
+    if (a->efd < 0) {
+        ret = -errno;
+        goto err_blob;
+    }
+    return 0;
+
+err_blob: {
+        struct drm_mode_destroy_blob d = { .blob_id = a->dim_blob };
+        ioctl(a->drm_fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &d);
+    }
+err:
+    a->drm_fd = -1;
+    return ret;
+}
+
+static int commit(struct fm_agent *a, uint64_t value)
+{
+    uint32_t objs[1] = { a->crtc_id }, count[1] = { 1 }, props[1] = { a->prop };
+    uint64_t values[1] = { value };
+    struct drm_mode_atomic req = {
+        .count_objs = 1,
+        .objs_ptr = (uintptr_t)objs,
+        .count_props_ptr = (uintptr_t)count,
+        .props_ptr = (uintptr_t)props,
+        .prop_values_ptr = (uintptr_t)values,
+    };
+
+    /* Blocking: returns once the new colour state has been latched. */
+    if (ioctl(a->drm_fd, DRM_IOCTL_MODE_ATOMIC, &req))
+        return -errno;
+    return 0;
+}
+
+static void *agent_thread(void *arg)
+{
+    struct fm_agent *a = arg;
+    uint64_t n;
+
+    while (read(a->efd, &n, sizeof(n)) == sizeof(n) || errno == EINTR) {
+        uint64_t woke = now_ns(), detect, done;
+        int want, ret;
+
+        if (atomic_load(&a->stop))
+            break;
+        want = atomic_load(&a->want);
+        detect = atomic_load(&a->request_ns);
+        if (want == a->applied)
+            continue;
+
+        ret = commit(a, want ? a->dim_blob : a->orig_blob);
+        if (ret) {
+            atomic_store(&a->error, ret);
+            continue;
+        }
+        done = now_ns();
+        a->applied = want;
+        if (want)
+            a->engaged++;
+        else
+            a->released++;
+        latency_add(&a->wake, woke - detect);
+        latency_add(&a->commit, done - woke);
+        latency_add(&a->total, done - detect);
+    }
+    return NULL;
+}
+
+int fm_agent_start(struct fm_agent *a)
+{
+    int ret = pthread_create(&a->thread, NULL, agent_thread, a);
+
+    if (ret)
+        return -ret;
+    a->started = 1;
+    return 0;
+}
+
+void fm_agent_request(struct fm_agent *a, int dim, uint64_t detect_ns)
+{
+    uint64_t one = 1;
+
+    atomic_store(&a->request_ns, detect_ns);
+    atomic_store(&a->want, dim);
+    if (write(a->efd, &one, sizeof(one)) != sizeof(one))
+        atomic_store(&a->error, -errno);
+}
+
+void fm_agent_close(struct fm_agent *a)
+{
+    struct drm_mode_destroy_blob d = { .blob_id = a->dim_blob };
+    uint64_t one = 1;
+
+    if (a->started) {
+        atomic_store(&a->stop, 1);
+        if (write(a->efd, &one, sizeof(one)) == sizeof(one))
+            pthread_join(a->thread, NULL);
+        a->started = 0;
+    }
+    if (a->applied)
+        commit(a, a->orig_blob);
+    if (a->drm_fd >= 0)
+        ioctl(a->drm_fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &d);
+    if (a->efd >= 0)
+        close(a->efd);
+    a->drm_fd = a->efd = -1;
+}
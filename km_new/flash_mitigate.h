@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+/* flash_mitigate.h – dim a CRTC through its colour pipeline while a flash alarm is up
+ *
+ * One agent per CRTC. The analysis thread calls fm_agent_request() when a
+ * region's harmful state changes; that signals an eventfd, and the agent's
+ * own thread applies (or releases) a pre-built dimming GAMMA_LUT blob, or a
+ * CTM blob where the CRTC has no gamma LUT, in a single atomic commit. The
+ * blobs are created up front so the reaction is one ioctl.
+ *
+ * Atomic commits need DRM master: run it where no compositor holds the
+ * device, e.g. on a VT or against vkms. Master belongs to one open file, so
+ * the card is opened once (fm_card_open()) and every agent commits through
+ * that fd.
+ */
+#ifndef FLASH_MITIGATE_H
+#define FLASH_MITIGATE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define FM_DEFAULT_DIM  0.25        /* output scale while mitigating */
+
+struct fm_latency {
+    uint64_t count;
+    uint64_t sum_ns, max_ns;
+};
+
+struct fm_agent {
+    int drm_fd;                     /* the caller's, from fm_card_open() */
+    int efd;                        /* eventfd the analysis side signals */
+    uint32_t crtc_id;
+    double dim;
+
+    uint32_t prop;                  /* GAMMA_LUT, or CTM as a fallback */
+    const char *prop_name;
+    uint64_t orig_blob;             /* value to restore on release */
+    uint32_t dim_blob;
+
+    pthread_t thread;
+    atomic_int want;                /* requested state: 1 = dimmed */
+    atomic_uint_fast64_t request_ns;
+    atomic_int stop;
+    int applied;
+    int started;
+    atomic_int error;               /* last commit or wakeup failure, negative errno */
+
+    /* detection -> agent wakeup, wakeup -> commit done, detection -> commit done */
+    struct fm_latency wake, commit, total;
+    uint64_t engaged, released;
+};
+
+/* Open card for atomic commits: an fd, or negative errno. Close it after the agents. */
+int  fm_card_open(const char *card);
+/* Find the CRTC's colour properties and build the dimming blob. */
+int  fm_agent_open(struct fm_agent *a, int drm_fd, uint32_t crtc_id, double dim);
+int  fm_agent_start(struct fm_agent *a);
+/* Ask for the dimmed (1) or normal (0) state; detect_ns is CLOCK_MONOTONIC. */
+void fm_agent_request(struct fm_agent *a, int dim, uint64_t detect_ns);
+/* Stop the thread, restore the original colour state and free the blob; drm_fd stays open. */
+void fm_agent_close(struct fm_agent *a);
+
+#endif /* FLASH_MITIGATE_H */
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: MIT
+/* flash_query.c – range queries over a flash index (.fidx)
+ *
+ * Build :  gcc -O2 flash_query.c flash_index.c -o flash_query
+ * Usage :  flash_query [-r region] [-s from_s] [-e to_s] [-v] <index.fidx>
+ *
+ * Lists the harmful intervals of each region within [from, to) seconds and
+ * totals for the range. -v also lists every second that had a flash.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash_index.h"
+
+static void fmt_time(char *buf, size_t len, uint64_t s)
+{
+    snprintf(buf, len, "%02llu:%02llu:%02llu", (unsigned long long)(s / 3600),
+             (unsigned long long)(s / 60 % 60), (unsigned long long)(s % 60));
+}
+
+static void query_region(const struct fidx *idx, unsigned r, uint64_t s0, uint64_t s1,
+                         int verbose)
+{
+    struct fidx_summary sum;
+    char a[32], b[32];
+    uint64_t s = s0;
+
+    printf("region %s (%ux%u+%u+%u, threshold %u px)\n", idx->regions[r].name,
+           idx->regions[r].width, idx->regions[r].height, idx->regions[r].x,
+           idx->regions[r].y, idx->regions[r].area_threshold);
+
+    /* Coalesce consecutive harmful seconds into intervals. */
+    while ((s = fidx_next_harmful(idx, r, s, s1)) < s1) {
+        uint64_t end = s;
+        unsigned peak = 0, peak_red = 0;
+        uint8_t flags = 0;
+
+        while (end < s1) {
+            const struct fidx_second *sec = fidx_at(idx, end, r);
+            if (!(sec->flags & (FIDX_HARMFUL | FIDX_HARMFUL_RED)))
+                break;
+            if (sec->flashes > peak)
+                peak = sec->flashes;
+            if (sec->red_flashes > peak_red)
+                peak_red = sec->red_flashes;
+            flags |= sec->flags;
+            end++;
+        }
+        fmt_time(a, sizeof(a), s);
+        fmt_time(b, sizeof(b), end);
+        printf("  harmful %s - %s  peak %u flashes/s, %u red/s%s\n", a, b, peak, peak_red,
+               (flags & FIDX_HARMFUL_RED) ? "  [red]" : "");
+        s = end;
+    }
+
+    if (verbose) {
+        for (s = s0; s < s1 && s < idx->hdr->seconds; s++) {
+            const struct fidx_second *sec = fidx_at(idx, s, r);
+            if (!sec->flashes && !sec->red_flashes)
+                continue;
+            fmt_time(a, sizeof(a), s);
+            printf("    %s  %u frames  %u flashes  %u red  max area %u px%s\n", a,
+                   sec->frames, sec->flashes, sec->red_flashes, sec->max_flashed,
+                   (sec->flags & (FIDX_HARMFUL | FIDX_HARMFUL_RED)) ? "  harmful" : "");
+        }
+    }
+
+    fidx_summarize(idx, r, s0, s1, &sum);
+    printf("  total: %llu frames, %llu flashes, %llu red flashes, %llu harmful seconds, "
+           "max area %u px\n", (unsigned long long)sum.frames,
+           (unsigned long long)sum.flashes, (unsigned long long)sum.red_flashes,
+           (unsigned long long)sum.harmful_seconds, sum.max_flashed);
+}
+
+int main(int argc, char **argv)
+{
+    const char *region = NULL;
+    uint64_t s0 = 0, s1 = UINT64_MAX;
+    int verbose = 0, opt, ret, found = 0;
+    struct fidx idx;
+    struct timespec t0, t1;
+
+    while ((opt = getopt(argc, argv, "r:s:e:v")) != -1) {
+        switch (opt) {
+        case 'r': region = optarg; break;
+        case 's': s0 = strtoull(optarg, NULL, 0); break;
+        case 'e': s1 = strtoull(optarg, NULL, 0); break;
+        case 'v': verbose = 1; break;
+        default:  goto usage;
+        }
+    }
+    if (argc - optind != 1) {
+usage:
+        fprintf(stderr, "usage: %s [-r region] [-s from_s] [-e to_s] [-v] <index.fidx>\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = fidx_open(&idx, argv[optind]);
+    if (ret) {
+        fprintf(stderr, "%s: not a valid flash index: %s\n", argv[optind], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if (s1 > idx.hdr->seconds)
+        s1 = idx.hdr->seconds;
+
+    for (unsigned r = 0; r < idx.hdr->region_count; r++) {
+        if (region && strcmp(region, idx.regions[r].name))
+            continue;
+        found = 1;
+        if (s0 < s1)
+            query_region(&idx, r, s0, s1, verbose);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (!found) {
+        fprintf(stderr, "no region named %s\n", region);
+        fidx_close(&idx);
+        return EXIT_FAILURE;
+    }
+    printf("%llu seconds indexed, query took %.3f ms\n",
+           (unsigned long long)idx.hdr->seconds,
+           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    fidx_close(&idx);
+    return EXIT_SUCCESS;
+}
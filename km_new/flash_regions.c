@@ -0,0 +1,385 @@
+// SPDX-License-Identifier: MIT
+/* flash_regions.c – per-monitor flash area/frequency accounting
+ *
+ * Build :  gcc -O2 -c flash_regions.c   (needs the kernel's DRM uapi headers)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+
+#include "flash_regions.h"
+#include "fb_plan.h"
+#include "fb_detile.h"
+#include "fb_yuv.h"
+
+#define NS_PER_SEC 1000000000ull
+#define DEFAULT_DIAG_IN 24.0
+
+double fa_area_threshold(unsigned w, unsigned h, double diag_in, double view_dist_in)
+{
+    const double theta_h = 10.0 * M_PI / 180.0;
+    const double theta_v = 7.5 * M_PI / 180.0;
+    double ppi = sqrt((double)w * w + (double)h * h) / diag_in;
+    double area_inch = (view_dist_in * theta_h) * (view_dist_in * theta_v);
+
+    return area_inch * ppi * ppi * 0.25;
+}
+
+int fa_regions_add(struct fa_region_set *set, const char *name,
+                   unsigned x, unsigned y, unsigned w, unsigned h,
+                   double diag_in, double view_dist_in)
+{
+    struct fa_region *r;
+
+    if (set->count >= FA_MAX_REGIONS || set->running)
+        return -ENOSPC;
+    if (!w || !h || diag_in <= 0 || view_dist_in < 0)
+        return -EINVAL;
+
+    r = &set->regions[set->count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->x = x;
+    r->y = y;
+    r->width = w;
+    r->height = h;
+    r->diag_in = diag_in;
+    r->view_dist_in = view_dist_in;
+    r->area_threshold = (uint32_t)fa_area_threshold(w, h, diag_in, view_dist_in);
+    r->set = set;
+    return 0;
+}
+
+int fa_regions_load(struct fa_region_set *set, const char *path, double view_dist_in)
+{
+    char line[256];
+    unsigned lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -errno;
+
+    while (fgets(line, sizeof(line), f)) {
+        char name[32];
+        unsigned x, y, w, h;
+        double diag, dist = view_dist_in;
+        char *hash = strchr(line, '#');
+        int n, ret;
+
+        lineno++;
+        if (hash)
+            *hash = '\0';
+        n = sscanf(line, "%31s %u %u %u %u %lf %lf", name, &x, &y, &w, &h, &diag, &dist);
+        if (n <= 0)
+            continue;
+        if (n < 6) {
+            fprintf(stderr, "%s:%u: expected <name> <x> <y> <w> <h> <diag_in> [dist_in]\n",
+                    path, lineno);
+            fclose(f);
+            return -EINVAL;
+        }
+        ret = fa_regions_add(set, name, x, y, w, h, diag, dist);
+        if (ret) {
+            fprintf(stderr, "%s:%u: invalid region\n", path, lineno);
+            fclose(f);
+            return ret;
+        }
+    }
+    fclose(f);
+    return set->count ? 0 : -ENOENT;
+}
+
+int fa_regions_from_drm(struct fa_region_set *set, const char *card, double view_dist_in)
+{
+    struct drm_mode_card_res res = { 0 };
+    uint32_t *connectors = NULL;
+    int fd, ret = 0;
+
+    fd = open(card, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res)) {
+        ret = -errno;
+        goto out;
+    }
+    connectors = calloc(res.count_connectors, sizeof(*connectors));
+    if (!connectors) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    res.connector_id_ptr = (uintptr_t)connectors;
+    res.count_fbs = res.count_crtcs = res.count_encoders = 0;
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res)) {
+        ret = -errno;
+        goto out;
+    }
+
+    for (unsigned i = 0; i < res.count_connectors; i++) {
+        struct drm_mode_modeinfo mode;
+        struct drm_mode_get_connector conn = { 0 };
+        struct drm_mode_get_encoder enc = { 0 };
+        struct drm_mode_crtc crtc = { 0 };
+        char name[32];
+        double diag;
+
+        /* One mode slot keeps the kernel from forcing a connector probe. */
+        conn.connector_id = connectors[i];
+        conn.count_modes = 1;
+        conn.modes_ptr = (uintptr_t)&mode;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) || conn.connection != 1 ||
+            !conn.encoder_id)
+            continue;
+
+        enc.encoder_id = conn.encoder_id;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc) || !enc.crtc_id)
+            continue;
+
+        crtc.crtc_id = enc.crtc_id;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCRTC, &crtc) || !crtc.mode_valid)
+            continue;
+
+        if (conn.mm_width && conn.mm_height) {
+            diag = hypot(conn.mm_width, conn.mm_height) / 25.4;
+        } else {
+            diag = DEFAULT_DIAG_IN;
+            fprintf(stderr, "connector %u reports no physical size, assuming %.0f\"\n",
+                    conn.connector_id, diag);
+        }
+
+        snprintf(name, sizeof(name), "crtc%u", crtc.crtc_id);
+        ret = fa_regions_add(set, name, crtc.x, crtc.y, crtc.mode.hdisplay,
+                             crtc.mode.vdisplay, diag, view_dist_in);
+        if (ret)
+            goto out;
+        set->regions[set->count - 1].crtc_id = crtc.crtc_id;
+    }
+    ret = set->count ? 0 : -ENOENT;
+
+out:
+    free(connectors);
+    close(fd);
+    return ret;
+}
+
+/* Add a flash at ts_ns (if any) and drop those older than one second. */
+static unsigned window_update(struct fa_flash_window *w, int flash, uint64_t ts_ns)
+{
+    if (flash) {
+        w->ts[w->head] = ts_ns;
+        w->head = (w->head + 1) % FA_WINDOW_EVENTS;
+        if (w->count < FA_WINDOW_EVENTS)
+            w->count++;
+    }
+
+    while (w->count) {
+        unsigned oldest = (w->head + FA_WINDOW_EVENTS - w->count) % FA_WINDOW_EVENTS;
+        if (ts_ns - w->ts[oldest] < NS_PER_SEC)
+            break;
+        w->count--;
+    }
+    return w->count;
+}
+
+/* B.4: flag a region while >= 4 general or red flashes fall within one second. */
+static void region_account(struct fa_region *r, const struct fa_frame_result *res,
+                           uint64_t ts_ns)
+{
+    struct fa_region_stats *st = &r->stats;
+    int harmful;
+
+    st->frames++;
+    st->last = *res;
+    if (res->flashed > st->max_flashed)
+        st->max_flashed = res->flashed;
+    if (res->red_flashed > st->max_flashed)
+        st->max_flashed = res->red_flashed;
+
+    st->flash = res->flashed > r->area_threshold;
+    st->red_flash = res->red_flashed > r->area_threshold;
+    st->flashes += st->flash;
+    st->red_flashes += st->red_flash;
+
+    st->window_flashes = window_update(&r->gen_window, st->flash, ts_ns);
+    st->window_red_flashes = window_update(&r->red_window, st->red_flash, ts_ns);
+
+    st->harmful_red = st->window_red_flashes >= FA_HARMFUL_FLASHES;
+    harmful = st->window_flashes >= FA_HARMFUL_FLASHES || st->harmful_red;
+    if (harmful && !st->harmful)
+        st->alarms++;
+    st->harmful = harmful;
+}
+
+static void region_process(struct fa_region *r, const uint8_t *src, unsigned pitch,
+                           enum fa_tiling tiling, uint64_t ts_ns)
+{
+    struct fa_frame_result res;
+    int ret;
+
+    if (r->set->incremental) {
+        fa_dirty_clear(&r->dirty);
+        r->stats.dirty_tiles += fa_dirty_hash(&r->dirty, src, pitch, tiling, r->x, r->y);
+        r->stats.tiles += (uint64_t)r->dirty.cols * r->dirty.rows;
+        ret = fa_process_incremental(&r->fa, src, pitch, tiling, r->x, r->y, &r->dirty, &res);
+    } else if (fb_yuv_depth(r->set->format)) {
+        unsigned tile_w, tile_h;
+
+        if (fb_tile_dims((enum fb_tiling)tiling, &tile_w, &tile_h))
+            return;
+        ret = fa_process_yuv_rect(&r->fa, src, pitch, tiling, r->set->format,
+                                  fb_yuv_uv_offset(pitch, r->set->fb_height, tile_w ? tile_h : 1),
+                                  r->x, r->y, &res);
+    } else {
+        ret = fa_process_fused_rect(&r->fa, src, pitch, tiling, r->x, r->y, NULL, &res);
+    }
+    if (ret == 0)
+        region_account(r, &res, ts_ns);
+}
+
+static void region_free(struct fa_region *r)
+{
+    fa_free(&r->fa);
+    fa_dirty_free(&r->dirty);
+}
+
+static void *region_worker(void *arg)
+{
+    struct fa_region *r = arg;
+    struct fa_region_set *set = r->set;
+    uint64_t seen = 0;
+
+    fb_plan_pin_worker(r - set->regions);
+    pthread_mutex_lock(&set->lock);
+    for (;;) {
+        while (!set->stop && set->generation == seen)
+            pthread_cond_wait(&set->kick, &set->lock);
+        if (set->stop)
+            break;
+        seen = set->generation;
+        pthread_mutex_unlock(&set->lock);
+
+        region_process(r, set->src, set->pitch, set->tiling, set->ts_ns);
+
+        pthread_mutex_lock(&set->lock);
+        if (--set->pending == 0)
+            pthread_cond_signal(&set->done);
+    }
+    pthread_mutex_unlock(&set->lock);
+    return NULL;
+}
+
+int fa_regions_start(struct fa_region_set *set, int red)
+{
+    unsigned i;
+    int ret;
+
+    if (!set->count)
+        return -ENOENT;
+    if (fb_yuv_depth(set->format)) {
+        /* No tile hashes over two planes; chroma pairs need even origins. */
+        if (set->incremental || !set->fb_height)
+            return -EOPNOTSUPP;
+        for (i = 0; i < set->count; i++)
+            if ((set->regions[i].x | set->regions[i].y) & 1)
+                return -EINVAL;
+    }
+
+    for (i = 0; i < set->count; i++) {
+        struct fa_region *r = &set->regions[i];
+
+        ret = fa_init(&r->fa, r->width, r->height);
+        if (!ret && red)
+            ret = fa_enable_red(&r->fa);
+        if (!ret && set->incremental)
+            ret = fa_dirty_init(&r->dirty, r->width, r->height);
+        if (ret) {
+            region_free(r);
+            goto err_free;
+        }
+    }
+
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->kick, NULL);
+    pthread_cond_init(&set->done, NULL);
+    set->generation = 0;
+    set->pending = 0;
+    set->stop = 0;
+    set->running = 1;
+
+    /* A single region runs inline on the caller's thread. */
+    if (set->count == 1)
+        return 0;
+
+    for (i = 0; i < set->count; i++) {
+        ret = -pthread_create(&set->regions[i].thread, NULL, region_worker, &set->regions[i]);
+        if (ret) {
+            for (unsigned j = i; j < set->count; j++)
+                region_free(&set->regions[j]);
+            set->count = i;
+            fa_regions_stop(set);
+            return ret;
+        }
+    }
+    return 0;
+
+err_free:
+    while (i--)
+        region_free(&set->regions[i]);
+    return ret;
+}
+
+void fa_regions_stop(struct fa_region_set *set)
+{
+    if (!set->running)
+        return;
+
+    if (set->count > 1) {
+        pthread_mutex_lock(&set->lock);
+        set->stop = 1;
+        pthread_cond_broadcast(&set->kick);
+        pthread_mutex_unlock(&set->lock);
+        for (unsigned i = 0; i < set->count; i++)
+            pthread_join(set->regions[i].thread, NULL);
+    }
+    for (unsigned i = 0; i < set->count; i++)
+        region_free(&set->regions[i]);
+
+    pthread_cond_destroy(&set->kick);
+    pthread_cond_destroy(&set->done);
+    pthread_mutex_destroy(&set->lock);
+    set->running = 0;
+}
+
+int fa_regions_process(struct fa_region_set *set, const uint8_t *src,
+                       unsigned pitch, enum fa_tiling tiling, uint64_t ts_ns)
+{
+    if (!set->running)
+        return -EINVAL;
+
+    if (set->count == 1) {
+        region_process(&set->regions[0], src, pitch, tiling, ts_ns);
+        return 0;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    set->src = src;
+    set->pitch = pitch;
+    set->tiling = tiling;
+    set->ts_ns = ts_ns;
+    set->pending = set->count;
+    set->generation++;
+    pthread_cond_broadcast(&set->kick);
+    while (set->pending)
+        pthread_cond_wait(&set->done, &set->lock);
+    pthread_mutex_unlock(&set->lock);
+    return 0;
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MIT
+/* flash_regions.h – per-monitor flash area/frequency accounting
+ *
+ * A combined framebuffer (e.g. two 1920x1080 monitors in one 3840x1080 fb)
+ * is split into regions, one per monitor. Each region carries its own
+ * geometry so FlashAreaThreshold (spec.v B.3) is evaluated with that
+ * screen's resolution and diagonal, and its own one-second general and
+ * red flash windows (B.4). Regions are analysed concurrently, one worker
+ * thread each.
+ */
+#ifndef FLASH_REGIONS_H
+#define FLASH_REGIONS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "flash_analyzer.h"
+
+#define FA_MAX_REGIONS      16
+#define FA_WINDOW_EVENTS    256     /* flash events kept per one-second window */
+#define FA_HARMFUL_FLASHES  4       /* F_gen or F_red >= 4 in one second is harmful */
+
+/* Timestamps of the flashes in the last second. */
+struct fa_flash_window {
+    uint64_t ts[FA_WINDOW_EVENTS];
+    unsigned head, count;
+};
+
+struct fa_region_stats {
+    uint64_t frames;
+    uint64_t flashes;           /* frames whose flashed area exceeded the threshold */
+    uint64_t red_flashes;
+    uint64_t alarms;            /* transitions into the harmful state */
+    uint32_t window_flashes;    /* flashes in the last second */
+    uint32_t window_red_flashes;
+    uint32_t max_flashed;       /* largest flashed area seen, pixels */
+    uint64_t tiles, dirty_tiles;    /* incremental: tiles looked at, and analysed */
+    int      harmful;           /* either window currently holds >= 4 flashes */
+    int      harmful_red;       /* ... because of red flashes */
+    int      flash, red_flash;  /* the last frame counted as a flash */
+    struct fa_frame_result last;
+};
+
+struct fa_region {
+    char name[32];
+    unsigned x, y, width, height;
+    double diag_in;             /* S, screen diagonal in inches */
+    double view_dist_in;        /* d, viewing distance in inches */
+    uint32_t area_threshold;    /* flash_area_threshold(d), pixels */
+    uint32_t crtc_id;           /* CRTC scanning this region out, 0 if unknown */
+
+    struct flash_analyzer fa;
+    struct fa_dirty dirty;      /* incremental analysis only */
+    struct fa_region_stats stats;
+    struct fa_flash_window gen_window, red_window;
+
+    pthread_t thread;
+    struct fa_region_set *set;
+};
+
+struct fa_region_set {
+    struct fa_region regions[FA_MAX_REGIONS];
+    unsigned count;
+
+    /* Current frame handed to the workers. */
+    const uint8_t *src;
+    unsigned pitch;
+    enum fa_tiling tiling;
+    uint64_t ts_ns;
+
+    /* Set before fa_regions_start(): analyse only tiles whose hash changed. */
+    int incremental;
+
+    /*
+     * Set before fa_regions_start() for NV12/P010 frames (fb_yuv.h): the
+     * format and the frame height, which places the chroma plane. 0 or
+     * any other format means XRGB8888.
+     */
+    uint32_t format;
+    unsigned fb_height;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  kick, done;
+    uint64_t generation;
+    unsigned pending;
+    int running, stop;
+};
+
+/* flash_area_threshold(d) from spec.v B.3 for a w x h screen of diagonal S. */
+double fa_area_threshold(unsigned w, unsigned h, double diag_in, double view_dist_in);
+
+int  fa_regions_add(struct fa_region_set *set, const char *name,
+                    unsigned x, unsigned y, unsigned w, unsigned h,
+                    double diag_in, double view_dist_in);
+
+/*
+ * Config file, one monitor per line ('#' starts a comment):
+ *     <name> <x> <y> <width> <height> <diagonal_in> [viewing_distance_in]
+ */
+int  fa_regions_load(struct fa_region_set *set, const char *path, double view_dist_in);
+
+/*
+ * Build regions from the active CRTCs of a DRM device: each CRTC's scanout
+ * offset and mode give the rectangle, the connector's physical size the
+ * diagonal.
+ */
+int  fa_regions_from_drm(struct fa_region_set *set, const char *card, double view_dist_in);
+
+/* Allocate analyzers and start one worker per region. */
+int  fa_regions_start(struct fa_region_set *set, int red);
+void fa_regions_stop(struct fa_region_set *set);
+
+/* Analyse one frame in all regions concurrently; returns once all are done. */
+int  fa_regions_process(struct fa_region_set *set, const uint8_t *src,
+                        unsigned pitch, enum fa_tiling tiling, uint64_t ts_ns);
+
+#endif /* FLASH_REGIONS_H */
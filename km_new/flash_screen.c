@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: MIT
+/* flash_screen.c – follow the module's flash alarms, or check its screening
+ *
+ * Build :  gcc -O2 flash_screen.c flash_analyzer.c flash_regions.c fb_plan.c fbrec.c \
+ *              fb_screen.c fb_detile.c -lm -lpthread -o flash_screen
+ * Usage :  flash_screen [-e]
+ *          flash_screen [-S diag_in] [-d dist_in] [-v] <recording.fbrec>
+ *
+ * Without a file, waits on /proc/drm_fb_flash (module loaded with
+ * flash_screen=1) and prints a line whenever a display turns harmful or
+ * clears, with the time from drm_framebuffer_init() to the alarm. The
+ * wait is a poll() on the proc file, or with -e on an eventfd registered
+ * with the module.
+ *
+ * With a recording, runs the module's screening (fb_screen.c) and the
+ * per-pixel reference analyzer (flash_analyzer.c) side by side on every
+ * frame, as one screen of -S inches seen from -d inches (24 and 24), and
+ * reports where they disagree: frames counted as flashes, alarms raised,
+ * how far into a frame the screening knew it flashed, and the time each
+ * took. -v prints every frame on which the two disagree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fb_detile.h"
+#include "fb_screen.h"
+#include "fbrec.h"
+#include "flash_analyzer.h"
+#include "flash_regions.h"
+
+#define PROC_FLASH      "/proc/drm_fb_flash"
+#define MAX_DISPLAYS    16
+#define BAND_ROWS       32              /* the module's STATS_BAND_ROWS */
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void print_status(const struct fb_flash_status *st)
+{
+    printf("%14.6f s  minor %u %ux%u  %-7s  %u flash%s in the last second, %llu of %llu captures flashed",
+           st->last_ns / 1e9, st->dev_minor, st->width, st->height,
+           (st->flags & FB_FLASH_HARMFUL) ? "HARMFUL" : "clear", st->window_flashes,
+           st->window_flashes == 1 ? "" : "es", (unsigned long long)st->flashes,
+           (unsigned long long)st->frames);
+    if (st->alarms)
+        printf(", alarm %llu %.2f ms after the framebuffer was created",
+               (unsigned long long)st->alarms, st->alarm_latency_ns / 1e6);
+    printf(", screening %.0f us avg %.0f us max\n",
+           st->frames ? st->busy_ns / 1e3 / st->frames : 0.0, st->max_ns / 1e3);
+}
+
+/* Records currently in /proc/drm_fb_flash. */
+static int read_status(int fd, struct fb_flash_status *st, unsigned *n)
+{
+    ssize_t r = pread(fd, st, MAX_DISPLAYS * sizeof(*st), 0);
+
+    if (r < 0)
+        return -errno;
+    *n = r / sizeof(*st);
+    for (unsigned i = 0; i < *n; i++)
+        if (st[i].magic != FB_FLASH_MAGIC || st[i].version != FB_FLASH_VERSION)
+            return -EPROTO;
+    return 0;
+}
+
+static int follow(int use_eventfd)
+{
+    struct fb_flash_status st[MAX_DISPLAYS], seen[MAX_DISPLAYS];
+    unsigned n = 0, nseen = 0;
+    int fd, efd = -1, ret = 0;
+
+    fd = open(PROC_FLASH, (use_eventfd ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", PROC_FLASH, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (use_eventfd) {
+        char cmd[32];
+        int len;
+
+        efd = eventfd(0, EFD_CLOEXEC);
+        len = snprintf(cmd, sizeof(cmd), "eventfd %d", efd);
+        if (efd < 0 || write(fd, cmd, len) != len) {
+            fprintf(stderr, "%s: cannot register an eventfd: %s\n", PROC_FLASH, strerror(errno));
+            ret = -errno;
+            goto out;
+        }
+    }
+
+    /* Print every display once, then only its changes */
+    while (!stop) {
+        struct pollfd pfd = { .fd = use_eventfd ? efd : fd,
+                              .events = use_eventfd ? POLLIN : POLLPRI };
+        uint64_t events, woken;
+
+        ret = read_status(fd, st, &n);
+        if (ret)
+            break;
+        woken = now_ns();
+        for (unsigned i = 0; i < n; i++) {
+            unsigned j;
+
+            for (j = 0; j < nseen; j++)
+                if (seen[j].dev_minor == st[i].dev_minor && seen[j].width == st[i].width &&
+                    seen[j].height == st[i].height)
+                    break;
+            if (j < nseen && seen[j].alarms == st[i].alarms &&
+                (seen[j].flags & FB_FLASH_HARMFUL) == (st[i].flags & FB_FLASH_HARMFUL))
+                continue;
+            print_status(&st[i]);
+            if ((st[i].flags & FB_FLASH_HARMFUL) && st[i].alarm_ns && woken > st[i].alarm_ns)
+                printf("%14s    read %.2f ms after the alarm\n", "", (woken - st[i].alarm_ns) / 1e6);
+        }
+        memcpy(seen, st, n * sizeof(*st));
+        nseen = n;
+        fflush(stdout);
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno != EINTR)
+                ret = -errno;
+            continue;
+        }
+        if (use_eventfd && (pfd.revents & POLLIN) && read(efd, &events, sizeof(events)) < 0)
+            ret = -errno;
+    }
+out:
+    if (efd >= 0)
+        close(efd);
+    close(fd);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", PROC_FLASH, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+struct side {
+    struct fb_screen_window window;
+    uint64_t flashes, alarms, ns;
+    int harmful;
+};
+
+/* B.4 on one side's flash decision; returns 1 when it raises an alarm. */
+static int side_account(struct side *s, int flash, uint64_t ts_ns)
+{
+    int harmful = fb_screen_window_add(&s->window, ts_ns, flash) >= FB_SCREEN_HARMFUL;
+    int alarm = harmful && !s->harmful;
+
+    s->flashes += flash;
+    s->alarms += alarm;
+    s->harmful = harmful;
+    return alarm;
+}
+
+static int validate(const char *path, unsigned diag, unsigned dist, int verbose)
+{
+    struct fbrec rec;
+    struct flash_analyzer fa = { 0 };
+    struct fb_screen fs = { 0 };
+    struct side ref = { 0 }, scr = { 0 };
+    uint32_t *frame = NULL;
+    void *mem = NULL;
+    unsigned w = 0, h = 0;
+    uint32_t ref_thr = 0, scr_thr = 0;
+    uint64_t frames = 0, skipped = 0, both = 0, alarms_both = 0, early = 0;
+    double known = 0;
+    int ret;
+
+    ret = fbrec_open(&rec, path);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < rec.count && !stop; i++) {
+        const struct fbrec_frame_header *fh;
+        struct fbrec_frame f;
+        struct fa_frame_result res;
+        enum fb_tiling tiling;
+        int ref_flash, scr_flash, ref_alarm, scr_alarm;
+        unsigned flashed_at = 0;
+        uint64_t t0;
+
+        ret = fbrec_frame(&rec, i, &f);
+        if (ret)
+            break;
+        fh = f.hdr;
+        /* The reference reads XRGB byte order only */
+        if (!fh->width || !fh->height || (fh->format != 0x34325258u && fh->format != 0x34325241u)) {
+            skipped++;
+            continue;
+        }
+        if (fh->width != w || fh->height != h) {
+            fa_free(&fa);
+            free(mem);
+            free(frame);
+            w = fh->width;
+            h = fh->height;
+            frame = malloc((size_t)w * h * 4);
+            mem = calloc(1, fb_screen_mem_size(w, h));
+            ret = frame && mem ? fa_init(&fa, w, h) : -ENOMEM;
+            if (ret)
+                break;
+            fb_screen_init(&fs, w, h, mem);
+            ref_thr = (uint32_t)fa_area_threshold(w, h, diag, dist);
+            scr_thr = fb_screen_area_threshold(w, h, diag, dist);
+            printf("%ux%u: block %u px, sampling every %u px, area threshold %u px (reference %u px)\n",
+                   w, h, FB_SCREEN_BLOCK, fs.step, scr_thr, ref_thr);
+        }
+        tiling = fb_tiling_from_modifier(fh->modifier);
+
+        /* Screening as the module does it: band by band, as each is detiled */
+        fb_screen_begin(&fs);
+        for (unsigned y = 0; y < h; y += BAND_ROWS) {
+            unsigned rows = h - y < BAND_ROWS ? h - y : BAND_ROWS;
+
+            ret = fb_detile_rect((uint8_t *)(frame + (size_t)y * w), f.data, fh->data_size,
+                                 fh->pitch, tiling, 0, y, w, rows);
+            if (ret)
+                break;
+            t0 = now_ns();
+            fb_screen_add(&fs, frame, (size_t)y * w, (size_t)rows * w, 0);
+            scr.ns += now_ns() - t0;
+            if (!flashed_at && fs.flashed > scr_thr)
+                flashed_at = y + rows;
+        }
+        if (ret)
+            break;
+        scr_flash = fb_screen_finish(&fs, 1) && fs.flashed > scr_thr;
+
+        t0 = now_ns();
+        ret = fa_process_fused(&fa, (const uint8_t *)frame, w * 4, FA_TILING_NONE, NULL, &res);
+        ref.ns += now_ns() - t0;
+        if (ret)
+            break;
+        ref_flash = res.flashed > ref_thr;
+
+        ref_alarm = side_account(&ref, ref_flash, fh->timestamp_ns);
+        scr_alarm = side_account(&scr, scr_flash, fh->timestamp_ns);
+        frames++;
+        both += ref_flash && scr_flash;
+        alarms_both += ref_alarm && scr_alarm;
+        if (scr_flash) {
+            known += (double)flashed_at / h;
+            early += flashed_at < h;
+        }
+        if (ref_alarm || scr_alarm)
+            printf("t=%10.3fs frame %-6llu alarm: reference %s, screening %s\n",
+                   fh->timestamp_ns / 1e9, (unsigned long long)i, ref_alarm ? "yes" : "no",
+                   scr_alarm ? "yes" : "no");
+        if (verbose && ref_flash != scr_flash)
+            printf("t=%10.3fs frame %-6llu flash: reference %s (%u px), screening %s (%u px)\n",
+                   fh->timestamp_ns / 1e9, (unsigned long long)i, ref_flash ? "yes" : "no",
+                   res.flashed, scr_flash ? "yes" : "no", fs.flashed);
+    }
+
+    if (!ret) {
+        printf("%llu frames compared", (unsigned long long)frames);
+        if (skipped)
+            printf(", %llu skipped (not XRGB)", (unsigned long long)skipped);
+        printf("\nflashes: reference %llu, screening %llu, both %llu\n",
+               (unsigned long long)ref.flashes, (unsigned long long)scr.flashes,
+               (unsigned long long)both);
+        printf("alarms:  reference %llu, screening %llu, on the same frame %llu -> %s\n",
+               (unsigned long long)ref.alarms, (unsigned long long)scr.alarms,
+               (unsigned long long)alarms_both,
+               ref.alarms == scr.alarms && alarms_both == ref.alarms ? "agree" : "DIFFER");
+        if (scr.flashes)
+            printf("screening knew a frame flashed after %.0f%% of it on average, before its end in %llu of %llu\n",
+                   100 * known / scr.flashes, (unsigned long long)early,
+                   (unsigned long long)scr.flashes);
+        if (frames)
+            printf("time per frame: reference %.3f ms, screening %.3f ms\n",
+                   ref.ns / 1e6 / frames, scr.ns / 1e6 / frames);
+    } else {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+    }
+    fa_free(&fa);
+    free(mem);
+    free(frame);
+    fbrec_close(&rec);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-e]\n"
+        "       %s [-S diag_in] [-d dist_in] [-v] <recording.fbrec>\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned diag = 24, dist = 24;
+    int use_eventfd = 0, verbose = 0, opt;
+
+    while ((opt = getopt(argc, argv, "eS:d:v")) != -1) {
+        switch (opt) {
+        case 'e': use_eventfd = 1; break;
+        case 'S': diag = atoi(optarg); break;
+        case 'd': dist = atoi(optarg); break;
+        case 'v': verbose = 1; break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind > 1 || (argc - optind == 1 && use_eventfd) || !diag) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (argc - optind == 1)
+        return validate(argv[optind], diag, dist, verbose);
+    return follow(use_eventfd);
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: MIT
+/* frame_search.c – find the recorded frames that look like a query image
+ *
+ * Build :  gcc -O2 frame_search.c frame_sig.c fbrec.c fb_detile.c -o frame_search
+ * Usage :  frame_search [-k hits] [-d max_bits] [-s WxH] <query.ppm|query.raw> <rec.fbrec|index.fsig>...
+ *
+ * The query (a binary PPM, or a linear XRGB8888 dump with -s) is reduced to
+ * a frame_sig.h signature and compared against every frame of every index
+ * with one Hamming-distance scan over the packed hashes. Runs of
+ * consecutive frames within -d bits of the query are reported as one hit
+ * with its time span, best first; ties go to the closer colour histogram.
+ *
+ * A recording is searched through <rec.fbrec>.fsig, which fbrec_record
+ * writes; when it is missing it is built from the recording first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fbrec.h"
+#include "frame_sig.h"
+
+#define NS_PER_SEC      1000000000ull
+#define DEFAULT_HITS    10
+#define DEFAULT_BITS    24          /* of 256 */
+
+struct hit {
+    const char *file;
+    uint64_t first, last;           /* frame indices in the recording */
+    uint64_t first_ns, last_ns;     /* relative to the start of the recording */
+    unsigned bits, hist;            /* best frame of the run */
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && !strcmp(s + n - m, suffix);
+}
+
+static void fmt_time(char *buf, size_t len, uint64_t ns)
+{
+    uint64_t ms = ns / 1000000;
+
+    snprintf(buf, len, "%02llu:%02llu:%02llu.%03llu", (unsigned long long)(ms / 3600000),
+             (unsigned long long)(ms / 60000 % 60), (unsigned long long)(ms / 1000 % 60),
+             (unsigned long long)(ms % 1000));
+}
+
+/* P6 with maxval 255, or headerless XRGB8888 of the given size. */
+static int load_query(const char *path, unsigned w, unsigned h, struct fsig *sig)
+{
+    FILE *f = fopen(path, "rb");
+    unsigned maxval = 0;
+    uint8_t *px = NULL;
+    size_t n;
+    int ret = -EINVAL;
+
+    if (!f)
+        return -errno;
+
+    if (fscanf(f, "P6 %u %u %u", &w, &h, &maxval) == 3) {
+        uint8_t *rgb;
+
+        fgetc(f);
+        if (maxval != 255 || !w || !h)
+            goto out;
+        n = (size_t)w * h;
+        rgb = malloc(n * 3);
+        px = malloc(n * 4);
+        if (!rgb || !px) {
+            free(rgb);
+            ret = -ENOMEM;
+            goto out;
+        }
+        if (fread(rgb, 3, n, f) != n) {
+            free(rgb);
+            goto out;
+        }
+        for (size_t i = 0; i < n; i++) {
+            px[i * 4 + 0] = rgb[i * 3 + 2];
+            px[i * 4 + 1] = rgb[i * 3 + 1];
+            px[i * 4 + 2] = rgb[i * 3 + 0];
+            px[i * 4 + 3] = 0;
+        }
+        free(rgb);
+    } else {
+        if (!w || !h)
+            goto out;
+        rewind(f);
+        n = (size_t)w * h;
+        px = malloc(n * 4);
+        if (!px) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        if (fread(px, 4, n, f) != n)
+            goto out;
+    }
+    ret = fsig_compute(sig, px, (size_t)w * h * 4, w, h, w * 4, 0);
+
+out:
+    free(px);
+    fclose(f);
+    return ret;
+}
+
+/* Signatures for every frame of a recording, written to path. */
+static int build_index(const char *rec_path, const char *path)
+{
+    struct fsig_writer w;
+    struct fbrec rec;
+    int ret;
+
+    ret = fbrec_open(&rec, rec_path);
+    if (ret)
+        return ret;
+    fsig_writer_init(&w);
+    for (uint64_t i = 0; i < rec.count && !ret; i++) {
+        struct fbrec_frame fr;
+        struct fsig sig;
+
+        ret = fbrec_frame(&rec, i, &fr);
+        if (!ret)
+            ret = fsig_compute(&sig, fr.data, fr.hdr->data_size, fr.hdr->width,
+                               fr.hdr->height, fr.hdr->pitch, fr.hdr->modifier);
+        if (!ret)
+            ret = fsig_add(&w, &sig, fr.hdr->timestamp_ns, fr.hdr->sequence, i);
+    }
+    if (!ret)
+        ret = fsig_write(&w, path);
+    fsig_writer_free(&w);
+    fbrec_close(&rec);
+    return ret;
+}
+
+/* Keep hits sorted by (bits, hist); at most k. */
+static void add_hit(struct hit *hits, unsigned *count, unsigned k, const struct hit *h)
+{
+    unsigned i = *count < k ? (*count)++ : k;
+
+    if (i == k) {
+        const struct hit *worst = &hits[k - 1];
+
+        if (h->bits > worst->bits || (h->bits == worst->bits && h->hist >= worst->hist))
+            return;
+        i = k - 1;
+    }
+    while (i > 0 && (hits[i - 1].bits > h->bits ||
+                     (hits[i - 1].bits == h->bits && hits[i - 1].hist > h->hist))) {
+        hits[i] = hits[i - 1];
+        i--;
+    }
+    hits[i] = *h;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned k = DEFAULT_HITS, max_bits = DEFAULT_BITS, qw = 0, qh = 0;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "k:d:s:")) != -1) {
+        switch (opt) {
+        case 'k': k = atoi(optarg); break;
+        case 'd': max_bits = atoi(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &qw, &qh) != 2)
+                goto usage;
+            break;
+        default:  goto usage;
+        }
+    }
+    if (argc - optind < 2 || !k) {
+usage:
+        fprintf(stderr,
+            "usage: %s [-k hits] [-d max_bits] [-s WxH] <query.ppm|query.raw> "
+            "<rec.fbrec|index.fsig>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct fsig query;
+    struct hit *hits = calloc(k, sizeof(*hits));
+    unsigned nhits = 0;
+    uint64_t scanned = 0, scan_ns = 0;
+    unsigned nearest = FSIG_BITS + 1;
+    int failed = 0;                 /* a recording could not be indexed */
+
+    ret = load_query(argv[optind], qw, qh, &query);
+    if (ret || !hits) {
+        fprintf(stderr, "%s: %s\n", argv[optind],
+                ret == -EINVAL ? "not a P6 PPM (or give -s for a raw dump)" : strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    for (int a = optind + 1; a < argc; a++) {
+        char path[4096];
+        struct fsig_index idx;
+        uint16_t *dist;
+        uint64_t t0, start_ns;
+
+        if (has_suffix(argv[a], ".fbrec")) {
+            snprintf(path, sizeof(path), "%s.fsig", argv[a]);
+            if (access(path, R_OK)) {
+                fprintf(stderr, "%s: building signatures\n", argv[a]);
+                ret = build_index(argv[a], path);
+                if (ret) {
+                    fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+                    failed = 1;
+                    continue;
+                }
+            }
+        } else {
+            snprintf(path, sizeof(path), "%s", argv[a]);
+        }
+
+        ret = fsig_open(&idx, path);
+        if (ret) {
+            fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+            continue;
+        }
+        if (!idx.hdr->count) {
+            fsig_close(&idx);
+            continue;
+        }
+        dist = malloc(idx.hdr->count * sizeof(*dist));
+        if (!dist) {
+            fsig_close(&idx);
+            return EXIT_FAILURE;
+        }
+
+        t0 = now_ns();
+        fsig_scan(idx.hashes, idx.hdr->count, query.hash, dist);
+        scan_ns += now_ns() - t0;
+        scanned += idx.hdr->count;
+
+        /* Coalesce runs of matching frames; only those touch the entries. */
+        start_ns = idx.entries[0].timestamp_ns;
+        for (uint64_t i = 0; i < idx.hdr->count; i++) {
+            struct hit h = { .file = argv[a], .bits = FSIG_BITS + 1 };
+
+            if (dist[i] < nearest)
+                nearest = dist[i];
+            if (dist[i] > max_bits)
+                continue;
+            h.first = idx.entries[i].frame;
+            h.first_ns = idx.entries[i].timestamp_ns - start_ns;
+            for (; i < idx.hdr->count && dist[i] <= max_bits; i++) {
+                unsigned hd = fsig_hist_dist(idx.entries[i].hist, query.hist);
+
+                if (dist[i] < h.bits || (dist[i] == h.bits && hd < h.hist)) {
+                    h.bits = dist[i];
+                    h.hist = hd;
+                }
+                h.last = idx.entries[i].frame;
+                h.last_ns = idx.entries[i].timestamp_ns - start_ns;
+            }
+            add_hit(hits, &nhits, k, &h);
+        }
+
+        free(dist);
+        fsig_close(&idx);
+    }
+
+    printf("scanned %llu frames in %.3f ms (%.1f Mframes/s)\n", (unsigned long long)scanned,
+           scan_ns / 1e6, scan_ns ? scanned * 1e3 / scan_ns : 0.0);
+    if (!nhits) {
+        printf("no frame within %u bits; nearest is %u bits away\n", max_bits, nearest);
+        free(hits);
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < nhits; i++) {
+        char a[32], b[32];
+
+        fmt_time(a, sizeof(a), hits[i].first_ns);
+        fmt_time(b, sizeof(b), hits[i].last_ns);
+        printf("%3u bits  hist %3u  %s  %s - %s  frames %llu-%llu\n", hits[i].bits, hits[i].hist,
+               hits[i].file, a, b, (unsigned long long)hits[i].first,
+               (unsigned long long)hits[i].last);
+    }
+    free(hits);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: MIT
+/* frame_sig.c – per-frame content signatures for similarity search
+ *
+ * Build :  gcc -O2 -c frame_sig.c   (link with libfb_detile.a)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FSIG_HAVE_AVX2 1
+#endif
+
+#include "fb_detile.h"
+#include "frame_sig.h"
+
+#define FSIG_HASH_ALIGN 32
+#define SAMPLE          2           /* every 2nd pixel of every 2nd row */
+
+static void accumulate_row(const uint8_t *px, unsigned w, const uint8_t *cell_of_x,
+                           uint64_t *cells, uint32_t *hist)
+{
+    for (unsigned x = 0; x < w; x += SAMPLE, px += 4 * SAMPLE) {
+        unsigned b = px[0], g = px[1], r = px[2];
+
+        cells[cell_of_x[x]] += (77 * r + 150 * g + 29 * b) >> 8;
+        hist[(r >> 6) << 4 | (g >> 6) << 2 | b >> 6]++;
+    }
+}
+
+int fsig_compute(struct fsig *s, const uint8_t *src, size_t src_size, unsigned width,
+                 unsigned height, unsigned pitch, uint64_t modifier)
+{
+    const enum fb_tiling tiling = fb_tiling_from_modifier(modifier);
+    const size_t row_bytes = (size_t)width * 4;
+    uint64_t cells[FSIG_GRID_H][FSIG_GRID_W] = { { 0 } };
+    uint32_t col_px[FSIG_GRID_W] = { 0 }, row_px[FSIG_GRID_H] = { 0 };
+    uint32_t hist[FSIG_BINS] = { 0 };
+    uint8_t *cell_of_x, *row = NULL;
+    unsigned tile_w, tile_h;
+    uint64_t total = 0;
+    int in_place;
+
+    if (!width || !height || pitch < row_bytes || fb_tile_dims(tiling, &tile_w, &tile_h))
+        return -EINVAL;
+
+    /*
+     * Linear frames that are fully present are read where they lie; anything
+     * else is detiled one sampled row at a time.
+     */
+    in_place = !tile_w && src_size >= (size_t)pitch * (height - 1) + row_bytes;
+
+    cell_of_x = malloc(width);
+    if (!in_place)
+        row = malloc(row_bytes);
+    if (!cell_of_x || (!in_place && !row)) {
+        free(cell_of_x);
+        free(row);
+        return -ENOMEM;
+    }
+    for (unsigned x = 0; x < width; x++)
+        cell_of_x[x] = (uint64_t)x * FSIG_GRID_W / width;
+    for (unsigned x = 0; x < width; x += SAMPLE)
+        col_px[cell_of_x[x]]++;
+
+    for (unsigned y = 0; y < height; y += SAMPLE) {
+        const unsigned r = (uint64_t)y * FSIG_GRID_H / height;
+        const uint8_t *px = src + (size_t)y * pitch;
+
+        if (!in_place) {
+            fb_detile_rows(row, row_bytes, src, src_size, pitch, tiling, 0, row_bytes, y, y + 1);
+            px = row;
+        }
+        accumulate_row(px, width, cell_of_x, cells[r], hist);
+        row_px[r]++;
+    }
+
+    memset(s, 0, sizeof(*s));
+    for (unsigned r = 0; r < FSIG_GRID_H; r++) {
+        uint64_t mean[FSIG_GRID_W];
+
+        for (unsigned c = 0; c < FSIG_GRID_W; c++) {
+            uint64_t n = (uint64_t)col_px[c] * row_px[r];
+
+            mean[c] = n ? cells[r][c] * 256 / n : 0;
+        }
+        for (unsigned c = 0; c + 1 < FSIG_GRID_W; c++) {
+            unsigned bit = r * (FSIG_GRID_W - 1) + c;
+
+            if (mean[c] < mean[c + 1])
+                s->hash[bit / 64] |= 1ull << (bit % 64);
+        }
+    }
+
+    for (unsigned i = 0; i < FSIG_BINS; i++)
+        total += hist[i];
+    for (unsigned i = 0; i < FSIG_BINS; i++)
+        s->hist[i] = (uint8_t)((hist[i] * 255ull + total / 2) / total);
+
+    free(cell_of_x);
+    free(row);
+    return 0;
+}
+
+unsigned fsig_hamming(const uint64_t *a, const uint64_t *b)
+{
+    unsigned d = 0;
+
+    for (unsigned i = 0; i < FSIG_WORDS; i++)
+        d += __builtin_popcountll(a[i] ^ b[i]);
+    return d;
+}
+
+unsigned fsig_hist_dist(const uint8_t *a, const uint8_t *b)
+{
+    unsigned d = 0;
+
+    for (unsigned i = 0; i < FSIG_BINS; i++)
+        d += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    return d;
+}
+
+static void scan_scalar(const uint64_t (*hashes)[FSIG_WORDS], size_t n, const uint64_t *q,
+                        uint16_t *dist)
+{
+    for (size_t i = 0; i < n; i++)
+        dist[i] = fsig_hamming(hashes[i], q);
+}
+
+#ifdef FSIG_HAVE_AVX2
+/* One hash per ymm register: nibble-LUT popcount, then byte sums via SAD. */
+__attribute__((target("avx2")))
+static void scan_avx2(const uint64_t (*hashes)[FSIG_WORDS], size_t n, const uint64_t *q,
+                      uint16_t *dist)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i qv = _mm256_loadu_si256((const __m256i *)q);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    /* Two hashes per step; their SAD lanes are folded together before the extract. */
+    for (; i + 2 <= n; i += 2) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)hashes[i]), qv);
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)hashes[i + 1]), qv);
+        __m256i c0 = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x0, low)),
+                        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x0, 4), low)));
+        __m256i c1 = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x1, low)),
+                        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x1, 4), low)));
+        __m256i s0 = _mm256_sad_epu8(c0, zero);
+        __m256i s1 = _mm256_sad_epu8(c1, zero);
+        /* Each 128-bit half ends up holding one partial sum per hash. */
+        __m256i lo = _mm256_unpacklo_epi64(s0, s1);
+        __m256i hi = _mm256_unpackhi_epi64(s0, s1);
+        __m256i sum = _mm256_add_epi64(lo, hi);
+        __m128i t = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+
+        dist[i] = (uint16_t)_mm_cvtsi128_si64(t);
+        dist[i + 1] = (uint16_t)_mm_extract_epi64(t, 1);
+    }
+    for (; i < n; i++)
+        dist[i] = fsig_hamming(hashes[i], q);
+}
+#endif
+
+void fsig_scan(const uint64_t (*hashes)[FSIG_WORDS], size_t n, const uint64_t *q,
+               uint16_t *dist)
+{
+#ifdef FSIG_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        scan_avx2(hashes, n, q, dist);
+        return;
+    }
+#endif
+    scan_scalar(hashes, n, q, dist);
+}
+
+void fsig_writer_init(struct fsig_writer *w)
+{
+    memset(w, 0, sizeof(*w));
+}
+
+int fsig_add(struct fsig_writer *w, const struct fsig *s, uint64_t timestamp_ns,
+             uint64_t sequence, uint64_t frame)
+{
+    struct fsig_entry *e;
+
+    if (w->count == w->cap) {
+        uint64_t cap = w->cap ? w->cap * 2 : 4096;
+        void *h = realloc(w->hashes, cap * sizeof(*w->hashes));
+
+        if (!h)
+            return -ENOMEM;
+        w->hashes = h;
+        h = realloc(w->entries, cap * sizeof(*w->entries));
+        if (!h)
+            return -ENOMEM;
+        w->entries = h;
+        w->cap = cap;
+    }
+
+    memcpy(w->hashes[w->count], s->hash, sizeof(s->hash));
+    e = &w->entries[w->count++];
+    e->timestamp_ns = timestamp_ns;
+    e->sequence = sequence;
+    e->frame = frame;
+    memcpy(e->hist, s->hist, sizeof(e->hist));
+    return 0;
+}
+
+int fsig_write(struct fsig_writer *w, const char *path)
+{
+    static const uint8_t pad[FSIG_HASH_ALIGN];
+    struct fsig_header hdr;
+    size_t pad_len;
+    FILE *f;
+    int ret = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FSIG_MAGIC, sizeof(hdr.magic));
+    hdr.version = FSIG_VERSION;
+    hdr.hash_bits = FSIG_BITS;
+    hdr.hist_bins = FSIG_BINS;
+    hdr.count = w->count;
+    hdr.hash_offset = (sizeof(hdr) + FSIG_HASH_ALIGN - 1) / FSIG_HASH_ALIGN * FSIG_HASH_ALIGN;
+    hdr.entry_offset = hdr.hash_offset + w->count * sizeof(*w->hashes);
+    pad_len = hdr.hash_offset - sizeof(hdr);
+
+    f = fopen(path, "wb");
+    if (!f)
+        return -errno;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(pad, 1, pad_len, f) != pad_len ||
+        fwrite(w->hashes, sizeof(*w->hashes), w->count, f) != w->count ||
+        fwrite(w->entries, sizeof(*w->entries), w->count, f) != w->count)
+        ret = -EIO;
+    if (fclose(f) && !ret)
+        ret = -errno;
+    /* A short file would never open, nor be rebuilt by frame_search */
+    if (ret)
+        unlink(path);
+    return ret;
+}
+
+void fsig_writer_free(struct fsig_writer *w)
+{
+    free(w->hashes);
+    free(w->entries);
+    memset(w, 0, sizeof(*w));
+}
+
+int fsig_open(struct fsig_index *idx, const char *path)
+{
+    struct stat st;
+    int ret = -EINVAL;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (idx->fd < 0)
+        return -errno;
+    if (fstat(idx->fd, &st)) {
+        ret = -errno;
+        goto err_close;
+    }
+    if ((size_t)st.st_size < sizeof(struct fsig_header))
+        goto err_close;
+
+    idx->map_size = st.st_size;
+    idx->map = mmap(NULL, idx->map_size, PROT_READ, MAP_SHARED, idx->fd, 0);
+    if (idx->map == MAP_FAILED) {
+        ret = -errno;
+        goto err_close;
+    }
+    idx->hdr = (const void *)idx->map;
+
+    if (memcmp(idx->hdr->magic, FSIG_MAGIC, sizeof(idx->hdr->magic)) ||
+        idx->hdr->version != FSIG_VERSION || idx->hdr->hash_bits != FSIG_BITS ||
+        idx->hdr->hist_bins != FSIG_BINS || idx->hdr->hash_offset % FSIG_HASH_ALIGN ||
+        /* bounded first, so the products below cannot wrap */
+        idx->hdr->hash_offset > idx->map_size ||
+        idx->hdr->count > idx->map_size / sizeof(*idx->entries) ||
+        idx->hdr->entry_offset != idx->hdr->hash_offset + idx->hdr->count * sizeof(*idx->hashes) ||
+        idx->hdr->entry_offset + idx->hdr->count * sizeof(*idx->entries) != idx->map_size)
+        goto err_unmap;
+
+    idx->hashes = (const void *)(idx->map + idx->hdr->hash_offset);
+    idx->entries = (const void *)(idx->map + idx->hdr->entry_offset);
+    return 0;
+
+err_unmap:
+    munmap((void *)idx->map, idx->map_size);
+err_close:
+    close(idx->fd);
+    memset(idx, 0, sizeof(*idx));
+    return ret;
+}
+
+void fsig_close(struct fsig_index *idx)
+{
+    if (idx->map) {
+        munmap((void *)idx->map, idx->map_size);
+        close(idx->fd);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+/* frame_sig.h – per-frame content signatures for similarity search
+ *
+ * A signature is a 256-bit difference hash of a 17x16 luminance thumbnail
+ * (bit set where a cell is darker than its right-hand neighbour) plus a
+ * 4x4x4 RGB histogram scaled to 255. Near-identical screens differ in a few
+ * hash bits whatever their resolution; the histogram breaks ties between
+ * layouts that share structure but not colour. Both are taken from every
+ * second pixel of every second row, which is plenty for a 17x16 thumbnail
+ * and keeps the cost within a 60 Hz capture loop.
+ *
+ * fbrec_record writes <recording>.fsig in the capture pass. Layout:
+ *
+ *   fsig_header
+ *   hashes   [count][FSIG_WORDS]       32-byte aligned, scanned linearly
+ *   fsig_entry [count]
+ *
+ * Hashes are kept apart from the rest so a search streams 32 bytes per
+ * frame: an hour at 60 Hz is 6.9 MB.
+ */
+#ifndef FRAME_SIG_H
+#define FRAME_SIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FSIG_MAGIC      "FRAMESIG"
+#define FSIG_VERSION    1
+#define FSIG_GRID_W     17          /* thumbnail cells; 16 comparisons per row */
+#define FSIG_GRID_H     16
+#define FSIG_BITS       256
+#define FSIG_WORDS      (FSIG_BITS / 64)
+#define FSIG_BINS       64          /* 4 levels per channel */
+
+struct fsig {
+    uint64_t hash[FSIG_WORDS];
+    uint8_t  hist[FSIG_BINS];
+};
+
+struct fsig_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t hash_bits;
+    uint32_t hist_bins;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t hash_offset;
+    uint64_t entry_offset;
+};
+
+struct fsig_entry {
+    uint64_t timestamp_ns;
+    uint64_t sequence;
+    uint64_t frame;             /* index in the recording */
+    uint8_t  hist[FSIG_BINS];
+};
+
+/*
+ * Signature of one XRGB8888 frame in any layout fb_detile handles. Only
+ * the sampled rows of tiled frames are detiled; src_size bounds the reads.
+ */
+int fsig_compute(struct fsig *s, const uint8_t *src, size_t src_size, unsigned width,
+                 unsigned height, unsigned pitch, uint64_t modifier);
+
+/* Hamming distance over the hash, and L1 distance over the histogram. */
+unsigned fsig_hamming(const uint64_t *a, const uint64_t *b);
+unsigned fsig_hist_dist(const uint8_t *a, const uint8_t *b);
+
+/*
+ * dist[i] = Hamming distance between q and hashes[i] for i < n. Uses AVX2
+ * when the CPU has it.
+ */
+void fsig_scan(const uint64_t (*hashes)[FSIG_WORDS], size_t n, const uint64_t *q,
+               uint16_t *dist);
+
+/* Writer */
+
+struct fsig_writer {
+    uint64_t (*hashes)[FSIG_WORDS];
+    struct fsig_entry *entries;
+    uint64_t count, cap;
+};
+
+void fsig_writer_init(struct fsig_writer *w);
+int  fsig_add(struct fsig_writer *w, const struct fsig *s, uint64_t timestamp_ns,
+              uint64_t sequence, uint64_t frame);
+int  fsig_write(struct fsig_writer *w, const char *path);
+void fsig_writer_free(struct fsig_writer *w);
+
+/* Reader (mmap) */
+
+struct fsig_index {
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    const struct fsig_header *hdr;
+    const uint64_t (*hashes)[FSIG_WORDS];
+    const struct fsig_entry *entries;
+};
+
+int  fsig_open(struct fsig_index *idx, const char *path);
+void fsig_close(struct fsig_index *idx);
+
+#endif /* FRAME_SIG_H */
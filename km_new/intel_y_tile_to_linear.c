@@ -1,9 +1,9 @@
 // SPDX-License-Identifier: MIT
 /* intel_y_tile_to_linear.c – copyright Intel Corporation
- * Convert an Intel Y-tiled/X-tiled framebuffer to linear layout.
+ * Convert an Intel X/Y/Yf/Tile4 framebuffer to linear layout.
  *
- * Build :  gcc -O2 intel_y_tile_to_linear.c -o intel_y_tile_to_linear
- * Usage :  intel_y_tile_to_linear <width> <height> <pitch> <X|Y|Yf> <in.raw> <out.raw>
+ * Build :  gcc -O2 intel_y_tile_to_linear.c fb_detile.c -o intel_y_tile_to_linear
+ * Usage :  intel_y_tile_to_linear <width> <height> <pitch> <X|Y|Yf|4> <in.raw> <out.raw>
  */
 
 #include <stdio.h>
@@ -11,44 +11,13 @@
 #include <stdint.h>
 #include <string.h>
 
-static inline unsigned tile_offset_x(unsigned x, unsigned tile_width)
-{
-    return (x & (tile_width - 1));
-}
-
-static inline unsigned tile_offset_y(unsigned y, unsigned tile_height)
-{
-    return (y & (tile_height - 1));
-}
-
-static void convert(uint8_t *dst, const uint8_t *src,
-                    unsigned w, unsigned h, unsigned pitch,
-                    unsigned tile_w, unsigned tile_h)
-{
-    const unsigned tile_size = tile_w * tile_h;
-    const unsigned tiles_per_row = pitch / tile_w;
-
-    for (unsigned y = 0; y < h; y++) {
-        for (unsigned x = 0; x < w * 4; x++) {
-            unsigned tile_x = (x / tile_w);
-            unsigned tile_y = (y / tile_h);
-            unsigned tile_index = tile_y * tiles_per_row + tile_x;
-
-            unsigned in_tile_x = tile_offset_x(x, tile_w);
-            unsigned in_tile_y = tile_offset_y(y, tile_h);
-
-            unsigned offset = tile_index * tile_size +
-                              in_tile_y * tile_w + in_tile_x;
-            dst[y * w * 4 + x] = src[offset];
-        }
-    }
-}
+#include "fb_detile.h"
 
 int main(int argc, char **argv)
 {
     if (argc != 7) {
         fprintf(stderr,
-            "usage: %s <width> <height> <pitch> <X|Y|Yf> <in.raw> <out.raw>\n", argv[0]);
+            "usage: %s <width> <height> <pitch> <X|Y|Yf|4> <in.raw> <out.raw>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -57,10 +26,16 @@ int main(int argc, char **argv)
     unsigned pitch = atoi(argv[3]);
     char layout    = argv[4][0];
 
-    unsigned tile_w = (layout == 'X') ? 512 : 128;   /* bytes */
-    unsigned tile_h = (layout == 'X') ?  8  :  32;   /* rows  */
+    enum fb_tiling tiling = (layout == 'X') ? FB_TILING_X :
+                            (layout == '4') ? FB_TILING_4 :
+                            !strcmp(argv[4], "Yf") ? FB_TILING_YF : FB_TILING_Y;
+
+    unsigned tile_w, tile_h;
 
-    size_t src_size = (size_t)h * pitch;
+    fb_tile_dims(tiling, &tile_w, &tile_h);
+
+    /* The last tile row is stored whole even when h does not fill it. */
+    size_t src_size = (size_t)((h + tile_h - 1) / tile_h * tile_h) * pitch;
     size_t dst_size = (size_t)h * w * 4;
 
     uint8_t *src = malloc(src_size);
@@ -71,8 +46,11 @@ int main(int argc, char **argv)
     FILE *fo = fopen(argv[6], "wb");
     if (!fi || !fo) { perror("fopen"); return EXIT_FAILURE; }
 
-    fread(src, 1, src_size, fi);
-    convert(dst, src, w, h, pitch, tile_w, tile_h);
+    size_t got = fread(src, 1, src_size, fi);
+    if (fb_detile_rect(dst, src, got, pitch, tiling, 0, 0, w, h)) {
+        fprintf(stderr, "pitch %u is too small for width %u\n", pitch, w);
+        return EXIT_FAILURE;
+    }
     fwrite(dst, 1, dst_size, fo);
 
     return EXIT_SUCCESS;
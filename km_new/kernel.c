@@ -8,33 +8,75 @@
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
 #include <linux/kprobes.h>
+#include <linux/fprobe.h>
+#include <linux/workqueue.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
 #include <linux/version.h>
 #include <linux/io.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/file.h>
+#include <linux/dma-fence.h>
+#include <linux/dma-resv.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/error-injection.h>
 #include <drm/drm_framebuffer.h>
 #include <drm/drm_gem.h>
 #include <drm/drm_device.h>
 #include <drm/drm_fourcc.h>
 #include <drm/drm_gem_shmem_helper.h>
 
+// dma_buf_map was renamed iosys_map in 5.18, and the old names were removed
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+#include <linux/iosys-map.h>
+#else
+#include <linux/dma-buf-map.h>
+#define iosys_map               dma_buf_map
+#define iosys_map_set_vaddr     dma_buf_map_set_vaddr
+#define iosys_map_is_null       dma_buf_map_is_null
+#endif
+
+#include "fb_detile.h"
+#include "fb_stats.h"
+#include "fb_heatmap.h"
+#include "fb_screen.h"
+#include "fb_counters.h"
+#include "fb_yuv.h"
+#include "fb_export.h"
+
+#define CREATE_TRACE_POINTS
+#include "drm_fb_trace.h"
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("DRM FB Content Extractor");
 MODULE_DESCRIPTION("Extract actual DRM framebuffer pixel content with detiling");
-MODULE_VERSION("2.1");
+MODULE_VERSION("2.2");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS("DMA_BUF");
+#else
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
 
 #define PROC_NAME "drm_fb_pixels"
 #define PROC_RAW_NAME "drm_fb_raw"
+#define PROC_STATS_NAME "drm_fb_stats"
+#define PROC_HEATMAP_NAME "drm_fb_heatmap"
+#define PROC_FLASH_NAME "drm_fb_flash"
+#define PROC_COUNTERS_NAME "drm_fb_counters"
 #define MAX_FB_CAPTURE 5
 #define MAX_CAPTURE_SIZE (3840 * 1080 * 4) // Max 1080p RGBA
 
-// Intel tiling definitions
-#define INTEL_TILE_X_WIDTH  512
-#define INTEL_TILE_X_HEIGHT 8
-#define INTEL_TILE_Y_WIDTH  128
-#define INTEL_TILE_Y_HEIGHT 32
-
 // Intel format modifiers (in case they're not available in headers)
 #ifndef I915_FORMAT_MOD_X_TILED
 #define I915_FORMAT_MOD_X_TILED fourcc_mod_code(INTEL, 1)
@@ -46,13 +88,40 @@ MODULE_VERSION("2.1");
 #define I915_FORMAT_MOD_Yf_TILED fourcc_mod_code(INTEL, 3)
 #endif
 
-enum intel_tiling {
-    INTEL_TILING_NONE = 0,
-    INTEL_TILING_X,
-    INTEL_TILING_Y,
-    INTEL_TILING_YF
+// Capture policy hook. A BPF program attached to drm_fb_capture_policy()
+// with fmod_ret sees the framebuffer metadata and returns one of the
+// decisions below; without a program every framebuffer is captured whole.
+enum drm_fb_capture_decision {
+    DRM_FB_CAPTURE_FULL = 0,
+    DRM_FB_CAPTURE_SKIP = 1,
+    DRM_FB_CAPTURE_ROI = 2,     // region set with drm_fb_capture_set_roi()
 };
 
+struct drm_fb_capture_ctx {
+    u32 dev_minor;
+    u32 width, height;
+    u32 format;
+    u32 pitch;
+    u64 modifier;
+    u64 ns_since_last;          // since the previous capture, U64_MAX before the first
+    u64 captures;               // framebuffers captured so far
+    u64 skipped;                // framebuffers the policy skipped so far
+    u32 roi_x, roi_y, roi_w, roi_h;
+};
+
+#if IS_ENABLED(CONFIG_BPF_SYSCALL) && IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES) && \
+    LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define DRM_FB_BPF_KFUNCS 1
+#endif
+
+#ifndef __bpf_kfunc
+#define __bpf_kfunc __used noinline
+#endif
+
+int drm_fb_capture_policy(struct drm_fb_capture_ctx *ctx);
+__bpf_kfunc int drm_fb_capture_set_roi(struct drm_fb_capture_ctx *ctx,
+                                       u32 x, u32 y, u32 w, u32 h);
+
 struct fb_pixel_data {
     struct drm_framebuffer *fb;
     struct drm_device *dev;
@@ -61,203 +130,752 @@ struct fb_pixel_data {
     uint32_t width, height;
     uint32_t format;
     uint32_t pitch;
+    uint32_t roi_x, roi_y, roi_w, roi_h;   // captured region, the whole fb by default
     uint64_t timestamp;
+    int node;                   // NUMA node holding pixel_buffer
+    int quality;                // enum fb_quality the capture was taken at
+    uint32_t scale;             // region downscaled by this factor in each dimension
+    uint32_t depth;             // NV12/P010: bytes per sample of the planes kept, else 0
+    u64 capture_ns;             // copy and detile, as charged to the CPU budget
+    u64 detile_ns;
+    u64 hook_ns;                // drm_framebuffer_init() returned
+    u64 render_ns;              // last render fence signalled; hook_ns if none was pending
+    int fence_status;           // <0: a render fence signalled with this error
+    bool guard_metadata;        // pixels left out by the overhead guard
+    bool has_stats;
+    struct fb_stats stats;      // summary of the captured pixels, see "Frame statistics"
     bool valid;
     bool has_pixels;
+    bool consumed;              // read through /proc/drm_fb_raw
     bool is_detiled;
-    enum intel_tiling detected_tiling;
+    enum fb_tiling detected_tiling;
+};
+
+// When the framebuffer's contents were finished, as seen by the hook
+struct fb_render {
+    u64 hook_ns;
+    u64 render_ns;
+    int status;
 };
 
 static struct fb_pixel_data captured_fbs[MAX_FB_CAPTURE];
+static unsigned int slot_pins[MAX_FB_CAPTURE];         // exported dma-bufs per slot, under capture_mutex
 static int capture_count = 0;
 static int current_index = 0;
+static u64 total_captures;
+static u64 total_skipped;
+static u64 last_capture_ns;
 static DEFINE_MUTEX(capture_mutex);
 static struct proc_dir_entry *proc_entry;
 static struct proc_dir_entry *proc_raw_entry;
+static struct proc_dir_entry *proc_stats_entry;
+static struct proc_dir_entry *proc_heatmap_entry;
+static struct proc_dir_entry *proc_flash_entry;
+static struct proc_dir_entry *proc_counters_entry;
+static struct workqueue_struct *capture_wq;
+
+// Captures that waited for rendering, under capture_mutex
+static u64 render_waits;
+static u64 render_wait_ns;
+static u64 render_wait_max_ns;
+static u64 render_errors;
+
+// Totals kept only for /proc/drm_fb_counters, under capture_mutex. The read
+// fills in the rest from the counters above and below.
+static struct fb_counters counters;
+
+// Copy bandwidth per NUMA node of the capture buffer. A copy is remote when
+// the worker that made it ran on another node.
+struct node_bw {
+    u64 captures;
+    u64 remote;
+    u64 bytes;
+    u64 ns;
+};
+
+static struct node_bw node_stats[MAX_NUMNODES];
+static int reader_node = NUMA_NO_NODE;  // node of the last /proc/drm_fb_raw reader
+
+static char *hook = "auto";
+module_param(hook, charp, 0444);
+MODULE_PARM_DESC(hook, "Hook on drm_framebuffer_init: auto, fprobe or kretprobe");
+
+static unsigned int hook_bench;
+module_param(hook_bench, uint, 0444);
+MODULE_PARM_DESC(hook_bench, "Calls per mechanism for the hook overhead benchmark run at load (0 = off)");
+
+static unsigned int detile_bench;
+module_param(detile_bench, uint, 0444);
+MODULE_PARM_DESC(detile_bench, "Frames per tiling for the detile throughput benchmark run at load (0 = off)");
+
+static unsigned int cpu_budget_us;
+module_param(cpu_budget_us, uint, 0644);
+MODULE_PARM_DESC(cpu_budget_us, "CPU time per second the capture path may use before it lowers quality (0 = unlimited)");
+
+static bool wait_render = true;
+module_param(wait_render, bool, 0644);
+MODULE_PARM_DESC(wait_render, "Copy once the framebuffer's render fences have signalled (0 = copy as soon as the hook fires)");
+
+static unsigned int guard_hook_us = 100;
+module_param(guard_hook_us, uint, 0644);
+MODULE_PARM_DESC(guard_hook_us, "Longest the probe handler may take before the hook is silenced for a second (0 = no limit)");
+
+static unsigned int guard_call_us = 20000;
+module_param(guard_call_us, uint, 0644);
+MODULE_PARM_DESC(guard_call_us, "Longest one capture may take before its framebuffer shape goes metadata-only (0 = no limit)");
+
+static unsigned int guard_sec_us = 250000;
+module_param(guard_sec_us, uint, 0644);
+MODULE_PARM_DESC(guard_sec_us, "Hook and capture time per second before captures are skipped (0 = no limit)");
+
+static bool frame_stats = true;
+module_param(frame_stats, bool, 0644);
+MODULE_PARM_DESC(frame_stats, "Summarise every capture (APL, histograms, changed pixels) in /proc/drm_fb_stats");
+
+static unsigned int heatmap_window_ms = 10000;
+module_param(heatmap_window_ms, uint, 0644);
+MODULE_PARM_DESC(heatmap_window_ms, "Length of each activity heatmap window in /proc/drm_fb_heatmap (0 = no heatmap)");
 
-// Intel tiling utility functions
-static inline unsigned int tile_offset_x(unsigned int x, unsigned int tile_width)
+static bool flash_screen;
+module_param(flash_screen, bool, 0644);
+MODULE_PARM_DESC(flash_screen, "Screen every capture for harmful flashes and raise alarms on /proc/drm_fb_flash");
+
+static unsigned int flash_diag_in = 24;
+module_param(flash_diag_in, uint, 0644);
+MODULE_PARM_DESC(flash_diag_in, "Screen diagonal in inches, for the flash area threshold");
+
+static unsigned int flash_dist_in = 24;
+module_param(flash_dist_in, uint, 0644);
+MODULE_PARM_DESC(flash_dist_in, "Viewing distance in inches, for the flash area threshold");
+
+static char *numa = "auto";
+module_param(numa, charp, 0444);
+MODULE_PARM_DESC(numa, "Node for capture buffers and workers: auto (the GPU's, else the reader's), gpu, reader or a node number");
+
+enum fb_numa_policy {
+    FB_NUMA_AUTO = 0,
+    FB_NUMA_GPU,
+    FB_NUMA_READER,
+    FB_NUMA_FIXED,
+};
+
+static enum fb_numa_policy numa_policy;
+static int numa_fixed_node = NUMA_NO_NODE;
+
+static const char *numa_policy_name(enum fb_numa_policy p)
+{
+    switch (p) {
+    case FB_NUMA_GPU:    return "gpu";
+    case FB_NUMA_READER: return "reader";
+    case FB_NUMA_FIXED:  return "fixed";
+    default:             return "auto";
+    }
+}
+
+static int parse_numa_param(void)
 {
-    return (x & (tile_width - 1));
+    int node;
+
+    if (!strcmp(numa, "auto")) {
+        numa_policy = FB_NUMA_AUTO;
+    } else if (!strcmp(numa, "gpu")) {
+        numa_policy = FB_NUMA_GPU;
+    } else if (!strcmp(numa, "reader")) {
+        numa_policy = FB_NUMA_READER;
+    } else if (!kstrtoint(numa, 10, &node) && node >= 0 && node < nr_node_ids &&
+               node_online(node)) {
+        numa_policy = FB_NUMA_FIXED;
+        numa_fixed_node = node;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
 }
 
-static inline unsigned int tile_offset_y(unsigned int y, unsigned int tile_height)
+// Node to place a capture of dev's framebuffer on. Safe in probe context.
+// NUMA_NO_NODE leaves the choice to the allocator and the workqueue.
+static int capture_node(struct drm_device *dev)
 {
-    return (y & (tile_height - 1));
+    int node = NUMA_NO_NODE;
+
+    switch (numa_policy) {
+    case FB_NUMA_FIXED:
+        return numa_fixed_node;
+    case FB_NUMA_READER:
+        return READ_ONCE(reader_node);
+    case FB_NUMA_GPU:
+    case FB_NUMA_AUTO:
+        // The GPU's PCI device carries the node of its root port.
+        if (dev && dev->dev)
+            node = dev_to_node(dev->dev);
+        if (node == NUMA_NO_NODE && numa_policy == FB_NUMA_AUTO)
+            node = READ_ONCE(reader_node);
+        break;
+    }
+    return node;
 }
 
 // Detect Intel tiling based on framebuffer properties
-static enum intel_tiling detect_intel_tiling(struct drm_framebuffer *fb)
+static enum fb_tiling detect_intel_tiling(struct drm_framebuffer *fb)
 {
     uint64_t modifier;
     
     if (!fb || !fb->modifier)
-        return INTEL_TILING_NONE;
+        return FB_TILING_NONE;
     
     modifier = fb->modifier;
     
     // Check for Intel-specific modifiers
     switch (modifier) {
         case I915_FORMAT_MOD_X_TILED:
-            return INTEL_TILING_X;
+            return FB_TILING_X;
         case I915_FORMAT_MOD_Y_TILED:
-            return INTEL_TILING_Y;
+            return FB_TILING_Y;
         case I915_FORMAT_MOD_Yf_TILED:
-            return INTEL_TILING_YF;
+            return FB_TILING_YF;
+#ifdef I915_FORMAT_MOD_4_TILED
+        case I915_FORMAT_MOD_4_TILED:
+            return FB_TILING_4;
+#endif
         default:
             // Try to detect based on pitch alignment
-            if (fb->pitches[0] % INTEL_TILE_X_WIDTH == 0) {
+            if (fb->pitches[0] % FB_TILE_X_WIDTH == 0) {
                 pr_info("Detected potential X-tiling based on pitch alignment\n");
-                return INTEL_TILING_X;
+                return FB_TILING_X;
             }
-            return INTEL_TILING_NONE;
+            return FB_TILING_NONE;
     }
 }
 
-// Convert tiled framebuffer to linear format
-static int convert_tiled_to_linear(const uint8_t *src_buffer, uint8_t *dst_buffer,
-                                  uint32_t width, uint32_t height, uint32_t pitch,
-                                  enum intel_tiling tiling)
+// Flash screening
+//
+// With flash_screen set, captures of 32-bit RGB are screened for harmful
+// flashes (fb_screen.h) band by band, next to the statistics pass and
+// while each band is still in cache. The flashed area is checked after
+// every band: once it passes the display's area threshold the capture
+// counts as a flash, and the flash that makes FB_SCREEN_HARMFUL within a
+// second raises the alarm from the worker there and then, usually before
+// the rest of the frame has been copied. Pollers of /proc/drm_fb_flash and
+// the eventfds registered on it are woken whenever a display turns harmful
+// or clears. Block means are taken over capture pixels, so a downscaled
+// capture is screened at a coarser grain and its areas are scaled back to
+// framebuffer pixels; a change of region or scale starts the display over.
+#define SCREEN_DISPLAYS     4
+
+struct flash_screen {
+    u32 dev_minor, width, height;       // width 0: slot unused
+    u32 roi_x, roi_y, roi_w, roi_h, scale;  // geometry fs was set up for
+    struct fb_screen fs;
+    void *mem;                          // fs arrays
+    struct fb_screen_window window;
+    u32 area_threshold;                 // framebuffer pixels
+    u32 window_flashes, last_flashed, max_flashed;
+    u64 frames, flashes, alarms;
+    u64 last_ns, alarm_ns, alarm_latency_ns;
+    u64 busy_ns, max_ns;
+    u64 frame_ns;                       // time spent on the current capture
+    bool flash;                         // the current capture was counted as a flash
+    bool harmful;
+};
+
+// An open /proc/drm_fb_flash
+struct flash_reader {
+    struct list_head node;              // on flash_readers while efd is set
+    struct eventfd_ctx *efd;
+    s64 seen;                           // flash_events at the last read
+};
+
+static struct flash_screen screens[SCREEN_DISPLAYS];   // under capture_mutex
+static LIST_HEAD(flash_readers);                        // under capture_mutex
+static DECLARE_WAIT_QUEUE_HEAD(flash_wait);
+static atomic64_t flash_events;                         // changes of any harmful state
+
+static void screen_free(struct flash_screen *scr)
+{
+    vfree(scr->mem);
+    memset(scr, 0, sizeof(*scr));
+}
+
+static void screen_notify(void)
 {
-    uint32_t tile_w, tile_h;
-    uint32_t x, y;
-    uint32_t tile_x, tile_y, tile_index;
-    uint32_t in_tile_x, in_tile_y;
-    uint32_t src_offset, dst_offset;
-    uint32_t tile_size, tiles_per_row;
-    uint32_t bytes_per_pixel = 4; // Assuming 32-bit pixels (ARGB/XRGB)
-    
-    if (!src_buffer || !dst_buffer) {
-        return -EINVAL;
+    struct flash_reader *r;
+
+    atomic64_inc(&flash_events);
+    wake_up_interruptible(&flash_wait);
+    list_for_each_entry(r, &flash_readers, node)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+        eventfd_signal(r->efd);
+#else
+        eventfd_signal(r->efd, 1);
+#endif
+}
+
+// The display's state, set up for this capture's geometry, or NULL
+static struct flash_screen *screen_start(const struct fb_pixel_data *capture)
+{
+    u32 dev_minor = capture->dev && capture->dev->primary ? capture->dev->primary->index : 0;
+    u32 w = capture->roi_w / capture->scale, h = capture->roi_h / capture->scale;
+    struct flash_screen *scr = NULL, *lru = &screens[0];
+    int i;
+
+    for (i = 0; i < SCREEN_DISPLAYS && !scr; i++) {
+        if (screens[i].width == capture->width && screens[i].height == capture->height &&
+            screens[i].dev_minor == dev_minor)
+            scr = &screens[i];
+        else if (screens[i].last_ns < lru->last_ns)
+            lru = &screens[i];
     }
-    
-    // Set tile dimensions based on tiling type
-    switch (tiling) {
-        case INTEL_TILING_X:
-            tile_w = INTEL_TILE_X_WIDTH;
-            tile_h = INTEL_TILE_X_HEIGHT;
-            break;
-        case INTEL_TILING_Y:
-        case INTEL_TILING_YF:
-            tile_w = INTEL_TILE_Y_WIDTH;
-            tile_h = INTEL_TILE_Y_HEIGHT;
-            break;
-        default:
-            pr_warn("Unknown tiling type: %d\n", tiling);
-            return -EINVAL;
+    if (!scr) {
+        scr = lru;
+        screen_free(scr);
+        scr->dev_minor = dev_minor;
+        scr->width = capture->width;
+        scr->height = capture->height;
     }
-    
-    tile_size = tile_w * tile_h;
-    tiles_per_row = pitch / tile_w;
-    
-    pr_info("Converting %s-tiled buffer: %dx%d, pitch=%d, tile=%dx%d\n",
-            (tiling == INTEL_TILING_X) ? "X" : "Y", width, height, pitch, tile_w, tile_h);
-    
-    // Convert pixel by pixel
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            uint32_t byte_x = x * bytes_per_pixel;
-            uint32_t byte_offset;
-            
-            // Calculate tile coordinates
-            tile_x = byte_x / tile_w;
-            tile_y = y / tile_h;
-            tile_index = tile_y * tiles_per_row + tile_x;
-            
-            // Calculate position within tile
-            in_tile_x = tile_offset_x(byte_x, tile_w);
-            in_tile_y = tile_offset_y(y, tile_h);
-            
-            // Calculate source offset in tiled buffer
-            src_offset = tile_index * tile_size + in_tile_y * tile_w + in_tile_x;
-            
-            // Calculate destination offset in linear buffer
-            dst_offset = y * width * bytes_per_pixel + x * bytes_per_pixel;
-            
-            // Copy all bytes for this pixel
-            for (byte_offset = 0; byte_offset < bytes_per_pixel; byte_offset++) {
-                if (src_offset + byte_offset < height * pitch &&
-                    dst_offset + byte_offset < height * width * bytes_per_pixel) {
-                    dst_buffer[dst_offset + byte_offset] = src_buffer[src_offset + byte_offset];
-                }
-            }
+    if (!scr->mem || scr->roi_x != capture->roi_x || scr->roi_y != capture->roi_y ||
+        scr->roi_w != capture->roi_w || scr->roi_h != capture->roi_h ||
+        scr->scale != capture->scale) {
+        vfree(scr->mem);
+        scr->mem = vzalloc(fb_screen_mem_size(w, h));
+        if (!scr->mem) {
+            screen_free(scr);
+            return NULL;
         }
+        fb_screen_init(&scr->fs, w, h, scr->mem);
+        scr->roi_x = capture->roi_x;
+        scr->roi_y = capture->roi_y;
+        scr->roi_w = capture->roi_w;
+        scr->roi_h = capture->roi_h;
+        scr->scale = capture->scale;
     }
-    
-    return 0;
+    // Every capture, so changes to the parameters apply at once
+    scr->area_threshold = fb_screen_area_threshold(capture->width, capture->height,
+                                                   flash_diag_in, flash_dist_in);
+    scr->flash = false;
+    scr->frame_ns = 0;
+    scr->last_ns = capture->timestamp;
+    fb_screen_begin(&scr->fs);
+    return scr;
 }
 
-// Function to map and copy pixel data from GEM object with detiling support
-static int extract_gem_pixels(struct drm_gem_object *gem_obj, struct fb_pixel_data *capture)
+// Count the capture in the one-second window (B.4), flashing or not
+static void screen_account(struct flash_screen *scr, const struct fb_pixel_data *capture,
+                           bool flash)
 {
-    int ret = 0;
-    void *raw_buffer = NULL;
-    size_t raw_buffer_size;
-    bool needs_detiling = false;
-    
-    if (!gem_obj || !capture) {
-        return -EINVAL;
+    bool harmful;
+
+    scr->window_flashes = fb_screen_window_add(&scr->window, capture->timestamp, flash);
+    harmful = scr->window_flashes >= FB_SCREEN_HARMFUL;
+    if (flash) {
+        scr->flash = true;
+        scr->flashes++;
+        counters.screen_flashes++;
+    }
+    if (harmful == scr->harmful)
+        return;
+    scr->harmful = harmful;
+    if (harmful) {
+        scr->alarms++;
+        counters.screen_alarms++;
+        scr->alarm_ns = ktime_get_ns();
+        scr->alarm_latency_ns = scr->alarm_ns - capture->hook_ns;
     }
+    trace_drm_fb_flash(scr->dev_minor, scr->width, scr->height, harmful, scr->window_flashes,
+                       scr->fs.flashed * capture->scale * capture->scale,
+                       harmful ? scr->alarm_latency_ns : 0);
+    screen_notify();
+}
 
-    pr_info("Extracting pixels from GEM object: size=%zu\n", gem_obj->size);
+// The chroma plane of an NV12/P010 capture, right after its luma plane
+static const uint8_t *capture_chroma(const struct fb_pixel_data *capture)
+{
+    return (const uint8_t *)capture->pixel_buffer + (size_t)(capture->roi_w / capture->scale) *
+           (capture->roi_h / capture->scale) * capture->depth;
+}
 
-    // Check if we need detiling
-    if (capture->detected_tiling != INTEL_TILING_NONE) {
-        needs_detiling = true;
-        raw_buffer_size = capture->height * capture->pitch;
-        raw_buffer = vmalloc(raw_buffer_size);
-        if (!raw_buffer) {
-            pr_err("Failed to allocate raw buffer for detiling (%zu bytes)\n", raw_buffer_size);
-            return -ENOMEM;
+// Pixels [first, first + count) of the capture have just been written
+static void screen_band(struct flash_screen *scr, const struct fb_pixel_data *capture,
+                        const uint32_t *pixels, size_t first, size_t count, int bgr)
+{
+    u64 start = ktime_get_ns();
+
+    if (capture->depth)
+        fb_screen_add_yuv(&scr->fs, (const uint8_t *)pixels, capture_chroma(capture), first,
+                          count, capture->depth);
+    else
+        fb_screen_add(&scr->fs, pixels, first, count, bgr);
+    if (!scr->flash &&
+        (u64)scr->fs.flashed * capture->scale * capture->scale > scr->area_threshold)
+        screen_account(scr, capture, true);
+    scr->frame_ns += ktime_get_ns() - start;
+}
+
+static void screen_finish(struct flash_screen *scr, const struct fb_pixel_data *capture, bool ok)
+{
+    u64 start = ktime_get_ns();
+    bool compared = fb_screen_finish(&scr->fs, ok);
+
+    if (!scr->flash)
+        screen_account(scr, capture, false);
+    scr->last_flashed = compared ? scr->fs.flashed * capture->scale * capture->scale : 0;
+    scr->max_flashed = max(scr->max_flashed, scr->last_flashed);
+    scr->frames++;
+    counters.screen_frames++;
+    scr->frame_ns += ktime_get_ns() - start;
+    scr->busy_ns += scr->frame_ns;
+    scr->max_ns = max(scr->max_ns, scr->frame_ns);
+}
+
+// Frame statistics
+//
+// Each band of the capture is summarised right after it is copied or
+// detiled, while it is still in cache, and merged into the frame's totals;
+// the pixels are not read a second time. Bands are 32 rows of a staged
+// capture or one page / STATS_CHUNK of a straight copy. The previous slot
+// of the ring is the reference for changed pixels when it holds the same
+// region at the same scale. 32-bit RGB formats are summarised, NV12 and
+// P010 from their luma plane as its bands come with their chroma rows. The
+// pass also carries flash screening, which runs without frame_stats too.
+#define STATS_BAND_ROWS     32
+#define STATS_CHUNK         (64 * 1024)
+
+struct stats_pass {
+    struct fb_stats_acc frame, band;
+    const uint32_t *pixels;     // the capture's pixel_buffer
+    const uint32_t *prev;       // previous capture of the same region, or NULL
+    uint32_t width;             // of the capture, in pixels
+    uint8_t *dirty;             // FB_HEATMAP_BLOCK blocks of the capture that changed
+    int bgr;
+    unsigned int depth;         // NV12/P010 luma sample size, 0 for RGB
+    bool summarise;             // frame_stats: fill in capture->stats
+    struct flash_screen *screen;    // flash screening of this capture, or NULL
+    const struct fb_pixel_data *capture;
+};
+
+static struct stats_pass stats_pass;    // under capture_mutex
+
+static bool stats_format(uint32_t format, int *bgr)
+{
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+        *bgr = 0;
+        return true;
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+        *bgr = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The pass for this capture, or NULL when it is neither summarised nor screened
+static struct stats_pass *stats_start(struct fb_pixel_data *capture)
+{
+    const struct fb_pixel_data *prev;
+    struct stats_pass *sp = &stats_pass;
+
+    if ((!frame_stats && !flash_screen) ||
+        (!capture->depth && !stats_format(capture->format, &sp->bgr)))
+        return NULL;
+    fb_stats_begin(&sp->frame);
+    sp->depth = capture->depth;
+    sp->pixels = capture->pixel_buffer;
+    sp->prev = NULL;
+    sp->width = capture->roi_w / capture->scale;
+    sp->dirty = NULL;
+    sp->summarise = frame_stats;
+    sp->screen = flash_screen ? screen_start(capture) : NULL;
+    sp->capture = capture;
+    if (!capture_count || !sp->summarise)
+        return sp;
+
+    prev = &captured_fbs[(current_index + MAX_FB_CAPTURE - 1) % MAX_FB_CAPTURE];
+    if (prev->has_stats && prev->pixel_buffer && prev->format == capture->format &&
+        prev->width == capture->width && prev->height == capture->height &&
+        prev->roi_x == capture->roi_x && prev->roi_y == capture->roi_y &&
+        prev->roi_w == capture->roi_w && prev->roi_h == capture->roi_h &&
+        prev->scale == capture->scale && prev->buffer_size == capture->buffer_size)
+        sp->prev = prev->pixel_buffer;
+    // Without the map the heatmap misses this capture, nothing else does;
+    // luma planes have none
+    if (sp->prev && heatmap_window_ms && !sp->depth)
+        sp->dirty = kzalloc((size_t)DIV_ROUND_UP(sp->width, FB_HEATMAP_BLOCK) *
+                            DIV_ROUND_UP(capture->roi_h / capture->scale, FB_HEATMAP_BLOCK),
+                            GFP_KERNEL);
+    return sp;
+}
+
+// Pixels [first, first + count) of the capture have just been written
+static void stats_band(struct stats_pass *sp, size_t first, size_t count)
+{
+    if (!sp || !count)
+        return;
+    if (sp->summarise) {
+        fb_stats_begin(&sp->band);
+        if (sp->depth)
+            fb_stats_add_luma(&sp->band, (const uint8_t *)sp->pixels + first * sp->depth,
+                              sp->prev ? (const uint8_t *)sp->prev + first * sp->depth : NULL,
+                              count, sp->depth);
+        else
+            fb_stats_add_frame(&sp->band, sp->pixels, sp->prev, first, count, sp->width,
+                               sp->bgr, sp->dirty, FB_HEATMAP_BLOCK);
+        fb_stats_merge(&sp->frame, &sp->band);
+    }
+    if (sp->screen)
+        screen_band(sp->screen, sp->capture, sp->pixels, first, count, sp->bgr);
+}
+
+// Screen activity heatmap
+//
+// Which FB_HEATMAP_BLOCK blocks of each display change, and how often,
+// built from the dirty map of the statistics pass: a capture compared with
+// the previous one adds one to the count of every block it found changed,
+// both since load and in the current heatmap_window_ms window. Captures
+// that could not be compared leave the map alone. Layout in fb_heatmap.h.
+#define HEATMAP_DISPLAYS    4
+
+struct fb_heatmap {
+    u32 dev_minor, width, height;   // width 0: slot unused
+    u32 cols, rows;
+    u64 since_ns, last_ns;
+    u64 total_frames;
+    unsigned int cur;               // window being filled
+    u64 window_start_ns[FB_HEATMAP_WINDOWS];
+    u32 window_frames[FB_HEATMAP_WINDOWS];
+    u32 *total;                     // rows x cols, one allocation with the two below
+    u16 *window;                    // FB_HEATMAP_WINDOWS x rows x cols
+    u8 *mark;                       // blocks changed in this capture
+};
+
+static struct fb_heatmap heatmaps[HEATMAP_DISPLAYS];   // under capture_mutex
+
+static void heatmap_free(struct fb_heatmap *hm)
+{
+    vfree(hm->total);
+    memset(hm, 0, sizeof(*hm));
+}
+
+// The display's map, replacing the one updated longest ago if it is new
+static struct fb_heatmap *heatmap_get(u32 dev_minor, u32 width, u32 height, u64 now)
+{
+    struct fb_heatmap *hm = &heatmaps[0];
+    size_t blocks;
+    int i;
+
+    for (i = 0; i < HEATMAP_DISPLAYS; i++) {
+        if (heatmaps[i].width == width && heatmaps[i].height == height &&
+            heatmaps[i].dev_minor == dev_minor)
+            return &heatmaps[i];
+        if (heatmaps[i].last_ns < hm->last_ns)
+            hm = &heatmaps[i];
+    }
+
+    heatmap_free(hm);
+    hm->cols = DIV_ROUND_UP(width, FB_HEATMAP_BLOCK);
+    hm->rows = DIV_ROUND_UP(height, FB_HEATMAP_BLOCK);
+    blocks = (size_t)hm->cols * hm->rows;
+    hm->total = vzalloc(blocks * (sizeof(u32) + FB_HEATMAP_WINDOWS * sizeof(u16) + 1));
+    if (!hm->total) {
+        memset(hm, 0, sizeof(*hm));
+        return NULL;
+    }
+    hm->window = (u16 *)(hm->total + blocks);
+    hm->mark = (u8 *)(hm->window + FB_HEATMAP_WINDOWS * blocks);
+    hm->dev_minor = dev_minor;
+    hm->width = width;
+    hm->height = height;
+    hm->since_ns = now;
+    hm->window_start_ns[0] = now;
+    return hm;
+}
+
+// Count the blocks sp->dirty found changed. Dirty blocks are in capture
+// pixels; each covers FB_HEATMAP_BLOCK * scale framebuffer pixels from the
+// region's corner.
+static void heatmap_update(const struct fb_pixel_data *capture, const u8 *dirty, u64 now)
+{
+    const u32 span = FB_HEATMAP_BLOCK * capture->scale;
+    const u32 dcols = DIV_ROUND_UP(capture->roi_w / capture->scale, FB_HEATMAP_BLOCK);
+    const u32 drows = DIV_ROUND_UP(capture->roi_h / capture->scale, FB_HEATMAP_BLOCK);
+    struct fb_heatmap *hm;
+    size_t blocks, i;
+    u16 *window;
+    u32 bx, by;
+
+    hm = heatmap_get(capture->dev && capture->dev->primary ? capture->dev->primary->index : 0,
+                     capture->width, capture->height, now);
+    if (!hm)
+        return;
+    blocks = (size_t)hm->cols * hm->rows;
+
+    if (now - hm->window_start_ns[hm->cur] >= (u64)heatmap_window_ms * NSEC_PER_MSEC) {
+        hm->cur = (hm->cur + 1) % FB_HEATMAP_WINDOWS;
+        hm->window_start_ns[hm->cur] = now;
+        hm->window_frames[hm->cur] = 0;
+        memset(hm->window + hm->cur * blocks, 0, blocks * sizeof(u16));
+    }
+    window = hm->window + hm->cur * blocks;
+
+    memset(hm->mark, 0, blocks);
+    for (by = 0; by < drows; by++) {
+        u32 y0 = capture->roi_y + by * span;
+        u32 y1 = min(y0 + span, capture->roi_y + capture->roi_h) - 1;
+
+        for (bx = 0; bx < dcols; bx++) {
+            u32 x0 = capture->roi_x + bx * span;
+            u32 x1 = min(x0 + span, capture->roi_x + capture->roi_w) - 1;
+            u32 x, y;
+
+            if (!dirty[by * dcols + bx])
+                continue;
+            for (y = y0 / FB_HEATMAP_BLOCK; y <= y1 / FB_HEATMAP_BLOCK && y < hm->rows; y++)
+                for (x = x0 / FB_HEATMAP_BLOCK; x <= x1 / FB_HEATMAP_BLOCK && x < hm->cols; x++)
+                    hm->mark[y * hm->cols + x] = 1;
+        }
+    }
+    for (i = 0; i < blocks; i++) {
+        if (!hm->mark[i])
+            continue;
+        hm->total[i]++;
+        if (window[i] < U16_MAX)
+            window[i]++;
+    }
+    hm->total_frames++;
+    hm->window_frames[hm->cur]++;
+    hm->last_ns = now;
+}
+
+// Record the statistics of a capture that succeeded, and let go of the pass
+static void stats_finish(struct stats_pass *sp, struct fb_pixel_data *capture, bool ok)
+{
+    if (sp->screen)
+        screen_finish(sp->screen, capture, ok);
+    if (ok && sp->summarise) {
+        fb_stats_finish(&sp->frame, sp->prev != NULL, &capture->stats);
+        capture->stats.sequence = total_captures;
+        capture->stats.timestamp_ns = capture->timestamp;
+        capture->stats.width = capture->roi_w / capture->scale;
+        capture->stats.height = capture->roi_h / capture->scale;
+        capture->has_stats = true;
+        if (sp->dirty)
+            heatmap_update(capture, sp->dirty, ktime_get_ns());
+    }
+    kfree(sp->dirty);
+    sp->dirty = NULL;
+}
+
+// Downscaled capture: detile every scale-th row of the region and keep
+// every scale-th pixel of it.
+static int detile_downscaled(const uint8_t *raw_buffer, size_t raw_size,
+                             struct fb_pixel_data *capture, uint32_t band_y,
+                             struct stats_pass *sp)
+{
+    uint32_t out_w = capture->roi_w / capture->scale;
+    uint32_t out_h = capture->roi_h / capture->scale;
+    uint32_t *dst = capture->pixel_buffer;
+    uint32_t *row;
+    uint32_t ox, oy, band_start = 0;
+
+    if ((capture->roi_x + capture->roi_w) * 4 > capture->pitch)
+        return -EINVAL;
+    row = kmalloc_array(capture->roi_w, 4, GFP_KERNEL);
+    if (!row)
+        return -ENOMEM;
+
+    for (oy = 0; oy < out_h; oy++) {
+        uint32_t y = capture->roi_y - band_y + oy * capture->scale;
+
+        fb_detile_rows((uint8_t *)row, 0, raw_buffer, raw_size, capture->pitch,
+                       capture->detected_tiling, capture->roi_x * 4, capture->roi_w * 4,
+                       y, y + 1);
+        for (ox = 0; ox < out_w; ox++)
+            dst[ox] = row[ox * capture->scale];
+        dst += out_w;
+        if (oy + 1 - band_start == STATS_BAND_ROWS || oy + 1 == out_h) {
+            stats_band(sp, (size_t)band_start * out_w, (size_t)(oy + 1 - band_start) * out_w);
+            band_start = oy + 1;
         }
-        pr_info("Allocated raw buffer for detiling: %zu bytes\n", raw_buffer_size);
     }
+    kfree(row);
+    return 0;
+}
+
+// Turn the staged band into the linear capture. The band starts on a tile
+// row, so rows are addressed relative to it.
+static int finish_staged_capture(const uint8_t *raw_buffer, size_t raw_size,
+                                 struct fb_pixel_data *capture, uint32_t band_y,
+                                 struct stats_pass *sp)
+{
+    u64 start = ktime_get_ns();
+    uint32_t y, rows;
+    int ret = 0;
+
+    if (capture->scale > 1)
+        ret = detile_downscaled(raw_buffer, raw_size, capture, band_y, sp);
+    for (y = 0; capture->scale == 1 && y < capture->roi_h && !ret; y += rows) {
+        rows = min_t(uint32_t, STATS_BAND_ROWS, capture->roi_h - y);
+        ret = fb_detile_rect((uint8_t *)capture->pixel_buffer + (size_t)y * capture->roi_w * 4,
+                             raw_buffer, raw_size, capture->pitch, capture->detected_tiling,
+                             capture->roi_x, capture->roi_y - band_y + y, capture->roi_w, rows);
+        if (!ret)
+            stats_band(sp, (size_t)y * capture->roi_w, (size_t)rows * capture->roi_w);
+    }
+    capture->detile_ns = ktime_get_ns() - start;
+    if (capture->detected_tiling == FB_TILING_NONE)
+        return ret;
+
+    if (ret == 0) {
+        capture->is_detiled = true;
+        pr_info("Successfully detiled framebuffer\n");
+    } else {
+        pr_warn("Failed to detile framebuffer: %d\n", ret);
+    }
+    return ret;
+}
 
+// Copy size bytes at offset of the GEM object into dst. A straight copy
+// into the capture passes its stats_pass, so each piece is summarised while
+// in cache; staged copies pass NULL. Returns the bytes found, or -ENODATA.
+static ssize_t gem_copy(struct drm_gem_object *gem_obj, size_t offset, void *dst, size_t size,
+                        struct stats_pass *sp)
+{
     // Try different methods to access the GEM object data
     
     // Method 1: Try SHMEM-based GEM objects
     if (gem_obj->filp && gem_obj->filp->f_mapping) {
         struct address_space *mapping = gem_obj->filp->f_mapping;
-        size_t copied = 0;
-        pgoff_t index = 0;
+        size_t copied = 0, found = 0;
+        size_t pos = offset;
         pgoff_t num_pages;
-        void *target_buffer = needs_detiling ? raw_buffer : capture->pixel_buffer;
-        size_t target_size = needs_detiling ? raw_buffer_size : capture->buffer_size;
         
         pr_info("Trying SHMEM mapping method\n");
         
         num_pages = (gem_obj->size + PAGE_SIZE - 1) >> PAGE_SHIFT;
         
-        while (copied < target_size && index < num_pages) {
-            struct page *page = find_get_page(mapping, index);
+        while (copied < size && (pos >> PAGE_SHIFT) < num_pages) {
+            struct page *page = find_get_page(mapping, pos >> PAGE_SHIFT);
+            size_t in_page = offset_in_page(pos);
+            size_t to_copy = min_t(size_t, PAGE_SIZE - in_page, size - copied);
+
             if (page) {
                 void *kaddr = kmap_atomic(page);
                 if (kaddr) {
-                    size_t to_copy = min_t(size_t, PAGE_SIZE, target_size - copied);
-                    memcpy((char*)target_buffer + copied, kaddr, to_copy);
-                    copied += to_copy;
+                    memcpy((char*)dst + copied, (char*)kaddr + in_page, to_copy);
+                    found += to_copy;
                     kunmap_atomic(kaddr);
+                    stats_band(sp, copied / 4, to_copy / 4);
                 }
                 put_page(page);
             }
-            index++;
+            copied += to_copy;
+            pos += to_copy;
         }
         
-        if (copied > 0) {
-            pr_info("Copied %zu bytes via SHMEM method\n", copied);
-            if (needs_detiling) {
-                ret = convert_tiled_to_linear((uint8_t*)raw_buffer, (uint8_t*)capture->pixel_buffer,
-                                            capture->width, capture->height, capture->pitch,
-                                            capture->detected_tiling);
-                if (ret == 0) {
-                    capture->is_detiled = true;
-                    pr_info("Successfully detiled framebuffer\n");
-                } else {
-                    pr_warn("Failed to detile framebuffer: %d\n", ret);
-                }
-            }
-            if (raw_buffer) vfree(raw_buffer);
-            return ret;
+        if (found > 0) {
+            pr_info("Copied %zu bytes via SHMEM method\n", found);
+            return found;
         }
     }
     
@@ -268,110 +886,957 @@ static int extract_gem_pixels(struct drm_gem_object *gem_obj, struct fb_pixel_da
     #endif
     
     // Method 3: Try DMA-buf approach if it's an imported buffer
-    if (gem_obj->dma_buf && gem_obj->import_attach) {
-        struct dma_buf_map map;
-        void *target_buffer = needs_detiling ? raw_buffer : capture->pixel_buffer;
-        size_t target_size = needs_detiling ? raw_buffer_size : capture->buffer_size;
+    if (gem_obj->dma_buf && gem_obj->import_attach && offset < gem_obj->dma_buf->size) {
+        struct iosys_map map;
         
         pr_info("Trying DMA-buf method\n");
         
-        ret = dma_buf_vmap(gem_obj->dma_buf, &map);
-        if (ret == 0 && !dma_buf_map_is_null(&map)) {
-            size_t to_copy = min_t(size_t, gem_obj->dma_buf->size, target_size);
+        if (dma_buf_vmap(gem_obj->dma_buf, &map) == 0 && !iosys_map_is_null(&map)) {
+            size_t to_copy = min_t(size_t, gem_obj->dma_buf->size - offset, size);
+            size_t off, chunk;
             
-            if (map.is_iomem) {
-                memcpy_fromio(target_buffer, map.vaddr_iomem, to_copy);
-            } else {
-                memcpy(target_buffer, map.vaddr, to_copy);
+            // In chunks, so a straight copy is summarised while in cache
+            for (off = 0; off < to_copy; off += chunk) {
+                chunk = min_t(size_t, STATS_CHUNK, to_copy - off);
+                if (map.is_iomem) {
+                    memcpy_fromio((char *)dst + off, map.vaddr_iomem + offset + off, chunk);
+                } else {
+                    memcpy((char *)dst + off, (char*)map.vaddr + offset + off, chunk);
+                }
+                stats_band(sp, off / 4, chunk / 4);
             }
             
             dma_buf_vunmap(gem_obj->dma_buf, &map);
             pr_info("Copied %zu bytes via DMA-buf method\n", to_copy);
-            
-            if (needs_detiling) {
-                ret = convert_tiled_to_linear((uint8_t*)raw_buffer, (uint8_t*)capture->pixel_buffer,
-                                            capture->width, capture->height, capture->pitch,
-                                            capture->detected_tiling);
-                if (ret == 0) {
-                    capture->is_detiled = true;
-                    pr_info("Successfully detiled framebuffer\n");
-                } else {
-                    pr_warn("Failed to detile framebuffer: %d\n", ret);
-                }
-            }
-            if (raw_buffer) vfree(raw_buffer);
-            return ret;
+            return to_copy;
         }
     }
     
-    if (raw_buffer) vfree(raw_buffer);
     pr_warn("Could not access pixel data from GEM object\n");
     return -ENODATA;
 }
 
-// Function to capture framebuffer pixel content
-static int capture_fb_pixels(struct drm_framebuffer *fb, struct drm_device *dev)
+// Function to map and copy pixel data from GEM object with detiling support.
+// Only the tile rows covering the capture region are read from the object.
+static int extract_gem_pixels(struct drm_gem_object *gem_obj, struct fb_pixel_data *capture,
+                              struct stats_pass *sp)
 {
-    struct fb_pixel_data *capture;
-    int ret;
-    size_t expected_size;
+    int ret = 0;
+    void *raw_buffer = NULL;
+    size_t raw_buffer_size = 0;
+    size_t src_offset = 0;
+    uint32_t band_y = 0;
+    bool needs_staging;
+    ssize_t found;
     
-    if (!fb || !fb->obj[0]) {
-        pr_warn("Invalid framebuffer or missing GEM object\n");
+    if (!gem_obj || !capture) {
         return -EINVAL;
     }
-    
-    mutex_lock(&capture_mutex);
-    
-    // Use circular buffer for captures
-    capture = &captured_fbs[current_index];
-    
-    // Clean up previous capture
-    if (capture->pixel_buffer) {
-        vfree(capture->pixel_buffer);
-        capture->pixel_buffer = NULL;
+
+    pr_info("Extracting pixels from GEM object: size=%zu\n", gem_obj->size);
+
+    // Tiled buffers and partial regions go through a staging band; a
+    // whole linear framebuffer is copied straight into the capture.
+    needs_staging = capture->detected_tiling != FB_TILING_NONE || capture->scale > 1 ||
+                    capture->roi_w != capture->width || capture->roi_h != capture->height;
+    if (needs_staging) {
+        unsigned int tile_w, tile_h;
+        uint32_t band_end;
+
+        fb_tile_dims(capture->detected_tiling, &tile_w, &tile_h);
+        band_end = roundup(capture->roi_y + capture->roi_h, tile_h);
+
+        band_y = rounddown(capture->roi_y, tile_h);
+        src_offset = (size_t)band_y * capture->pitch;
+        raw_buffer_size = (size_t)(band_end - band_y) * capture->pitch;
+        if (src_offset >= gem_obj->size)
+            return -EINVAL;
+        raw_buffer_size = min_t(size_t, raw_buffer_size, gem_obj->size - src_offset);
+        raw_buffer = vmalloc_node(raw_buffer_size, capture->node);
+        if (!raw_buffer) {
+            pr_err("Failed to allocate raw buffer for detiling (%zu bytes)\n", raw_buffer_size);
+            return -ENOMEM;
+        }
+        pr_info("Allocated raw buffer for rows %u-%u: %zu bytes\n", band_y, band_end,
+                raw_buffer_size);
+        found = gem_copy(gem_obj, src_offset, raw_buffer, raw_buffer_size, NULL);
+    } else {
+        found = gem_copy(gem_obj, 0, capture->pixel_buffer, capture->buffer_size, sp);
     }
-    
-    // Initialize capture structure
-    memset(capture, 0, sizeof(*capture));
-    capture->fb = fb;
-    capture->dev = dev;
-    capture->width = fb->width;
-    capture->height = fb->height;
-    capture->format = fb->format->format;
-    capture->pitch = fb->pitches[0];
-    capture->timestamp = ktime_get_ns();
-    capture->is_detiled = false;
-    
-    // Detect Intel tiling
-    capture->detected_tiling = detect_intel_tiling(fb);
-    
-    // Calculate expected buffer size (always linear output size)
-    expected_size = capture->height * capture->width * 4; // 4 bytes per pixel for ARGB
-    if (expected_size > MAX_CAPTURE_SIZE) {
-        expected_size = MAX_CAPTURE_SIZE;
-        pr_warn("Framebuffer too large, limiting to %d bytes\n", MAX_CAPTURE_SIZE);
+
+    if (found < 0)
+        ret = found;
+    else if (needs_staging)
+        ret = finish_staged_capture(raw_buffer, raw_buffer_size, capture, band_y, sp);
+    if (raw_buffer) vfree(raw_buffer);
+    return ret;
+}
+
+// YUV planes
+//
+// NV12 and P010 framebuffers are captured in their own layout rather than
+// as 32-bit pixels: the region's luma plane, packed, then its chroma plane,
+// packed: three eighths (NV12) or three quarters (P010) of the bytes of
+// XRGB8888 for the same region. Statistics and flash screening read
+// luminance off the luma plane (fb_yuv.h), so nothing is converted to RGB.
+
+// Align the region to whole chroma samples at the capture's scale, within
+// the framebuffer, and return the bytes its planes take (0: none fits).
+static size_t yuv_capture_size(struct fb_pixel_data *capture)
+{
+    const u32 step = 2 * capture->scale;
+    u32 x1 = capture->roi_x + capture->roi_w, y1 = capture->roi_y + capture->roi_h;
+    size_t row;
+
+    capture->roi_x = rounddown(capture->roi_x, 2);
+    capture->roi_y = rounddown(capture->roi_y, 2);
+    capture->roi_w = roundup(x1 - capture->roi_x, step);
+    capture->roi_h = roundup(y1 - capture->roi_y, step);
+    if (capture->roi_x + capture->roi_w > capture->width)
+        capture->roi_w -= step;
+    if (capture->roi_y + capture->roi_h > capture->height)
+        capture->roi_h -= step;
+    if (!capture->roi_w || !capture->roi_h)
+        return 0;
+
+    row = (size_t)(capture->roi_w / capture->scale) * capture->depth;
+    if (row * (capture->roi_h / capture->scale) * 3 / 2 > MAX_CAPTURE_SIZE) {
+        capture->roi_h = rounddown(MAX_CAPTURE_SIZE * 2 / 3 / row * capture->scale, step);
+        pr_warn("Framebuffer too large, limiting to %u rows\n", capture->roi_h);
     }
-    
-    capture->buffer_size = expected_size;
-    
-    // Allocate buffer for pixel data (linear format)
-    capture->pixel_buffer = vmalloc(capture->buffer_size);
-    if (!capture->pixel_buffer) {
-        pr_err("Failed to allocate pixel buffer (%zu bytes)\n", capture->buffer_size);
-        mutex_unlock(&capture_mutex);
+    return row * (capture->roi_h / capture->scale) * 3 / 2;
+}
+
+// Capture the region's rows of one plane, packed, keeping every
+// scale-th sample of every scale-th row. cpp is the bytes per sample (a
+// Cb/Cr pair in the chroma plane), x, y the region's corner in samples and
+// w x h the samples kept. The chroma plane is the one given the stats pass:
+// it comes second, so its rows complete luma rows for the pass.
+static int extract_yuv_plane(struct drm_gem_object *gem_obj, struct fb_pixel_data *capture,
+                             size_t offset, u32 pitch, u32 cpp, u32 x, u32 y, u32 w, u32 h,
+                             uint8_t *dst, struct stats_pass *sp)
+{
+    const u32 step = capture->scale;
+    const u32 span = ((w - 1) * step + 1) * cpp;    // source bytes per row
+    const u32 chunk = STATS_BAND_ROWS / 2;
+    const size_t row_bytes = (size_t)w * cpp;
+    unsigned int tile_w, tile_h;
+    uint8_t *raw, *row = NULL;
+    size_t raw_size;
+    ssize_t found;
+    u32 band_y, oy, n, i, ox;
+    u64 start;
+
+    if (x * cpp + span > pitch)
+        return -EINVAL;
+    fb_tile_dims(capture->detected_tiling, &tile_w, &tile_h);
+    band_y = rounddown(y, tile_h);
+    offset += (size_t)band_y * pitch;
+    if (offset >= gem_obj->size)
+        return -EINVAL;
+    raw_size = (size_t)(roundup(y + (h - 1) * step + 1, tile_h) - band_y) * pitch;
+    raw_size = min_t(size_t, raw_size, gem_obj->size - offset);
+    raw = vmalloc_node(raw_size, capture->node);
+    if (step > 1)
+        row = kmalloc(span, GFP_KERNEL);
+    if (!raw || (step > 1 && !row)) {
+        vfree(raw);
+        return -ENOMEM;
+    }
+
+    found = gem_copy(gem_obj, offset, raw, raw_size, NULL);
+    start = ktime_get_ns();
+    for (oy = 0; oy < h && found >= 0; oy += n) {
+        n = min(chunk, h - oy);
+        if (step == 1) {
+            fb_detile_rows(dst + oy * row_bytes, row_bytes, raw, raw_size, pitch,
+                           capture->detected_tiling, x * cpp, row_bytes,
+                           y - band_y + oy, y - band_y + oy + n);
+        } else {
+            for (i = oy; i < oy + n; i++) {
+                u32 sy = y - band_y + i * step;
+
+                fb_detile_rows(row, 0, raw, raw_size, pitch, capture->detected_tiling,
+                               x * cpp, span, sy, sy + 1);
+                for (ox = 0; ox < w; ox++)
+                    memcpy(dst + i * row_bytes + ox * cpp, row + ox * step * cpp, cpp);
+            }
+        }
+        // Each chroma row completes two luma rows of twice its samples
+        stats_band(sp, (size_t)oy * 4 * w, (size_t)n * 4 * w);
+    }
+    capture->detile_ns += ktime_get_ns() - start;
+    kfree(row);
+    vfree(raw);
+    return found < 0 ? found : 0;
+}
+
+static int extract_yuv_planes(struct drm_framebuffer *fb, struct fb_pixel_data *capture,
+                              struct stats_pass *sp)
+{
+    const u32 out_w = capture->roi_w / capture->scale;
+    const u32 out_h = capture->roi_h / capture->scale;
+    const u32 depth = capture->depth;
+    int ret;
+
+    // Planes in separate objects would need a second mapping
+    if (!fb->obj[0] || fb->obj[1] != fb->obj[0])
+        return -EOPNOTSUPP;
+
+    ret = extract_yuv_plane(fb->obj[0], capture, fb->offsets[0], fb->pitches[0], depth,
+                            capture->roi_x, capture->roi_y, out_w, out_h,
+                            capture->pixel_buffer, NULL);
+    if (!ret)
+        ret = extract_yuv_plane(fb->obj[0], capture, fb->offsets[1], fb->pitches[1], 2 * depth,
+                                capture->roi_x / 2, capture->roi_y / 2, out_w / 2, out_h / 2,
+                                (uint8_t *)capture_chroma(capture), sp);
+    if (!ret && capture->detected_tiling != FB_TILING_NONE)
+        capture->is_detiled = true;
+    return ret;
+}
+
+// Default capture policy: capture everything. BPF programs replace the
+// return value through fmod_ret; __weak keeps the compiler from folding the
+// constant result into the caller.
+__weak noinline int drm_fb_capture_policy(struct drm_fb_capture_ctx *ctx)
+{
+    return DRM_FB_CAPTURE_FULL;
+}
+ALLOW_ERROR_INJECTION(drm_fb_capture_policy, ERRNO);
+
+// kfunc for policies: narrow the capture to a region of the framebuffer.
+__bpf_kfunc int drm_fb_capture_set_roi(struct drm_fb_capture_ctx *ctx,
+                                       u32 x, u32 y, u32 w, u32 h)
+{
+    if (!ctx || !w || !h || x >= ctx->width || y >= ctx->height ||
+        w > ctx->width - x || h > ctx->height - y)
+        return -EINVAL;
+
+    ctx->roi_x = x;
+    ctx->roi_y = y;
+    ctx->roi_w = w;
+    ctx->roi_h = h;
+    return 0;
+}
+
+#ifdef DRM_FB_BPF_KFUNCS
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+BTF_KFUNCS_START(drm_fb_capture_kfunc_ids)
+BTF_ID_FLAGS(func, drm_fb_capture_set_roi)
+BTF_KFUNCS_END(drm_fb_capture_kfunc_ids)
+#else
+BTF_SET8_START(drm_fb_capture_kfunc_ids)
+BTF_ID_FLAGS(func, drm_fb_capture_set_roi)
+BTF_SET8_END(drm_fb_capture_kfunc_ids)
+#endif
+
+static const struct btf_kfunc_id_set drm_fb_capture_kfunc_set = {
+    .owner = THIS_MODULE,
+    .set = &drm_fb_capture_kfunc_ids,
+};
+#endif
+
+// Ask the policy what to do with this framebuffer. Called with
+// capture_mutex held.
+static int run_capture_policy(struct drm_framebuffer *fb, struct drm_device *dev,
+                              struct drm_fb_capture_ctx *ctx)
+{
+    u64 now = ktime_get_ns();
+    int decision;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->dev_minor = dev->primary ? dev->primary->index : 0;
+    ctx->width = fb->width;
+    ctx->height = fb->height;
+    ctx->format = fb->format ? fb->format->format : 0;
+    ctx->pitch = fb->pitches[0];
+    ctx->modifier = fb->modifier;
+    ctx->ns_since_last = total_captures ? now - last_capture_ns : U64_MAX;
+    ctx->captures = total_captures;
+    ctx->skipped = total_skipped;
+    ctx->roi_w = fb->width;
+    ctx->roi_h = fb->height;
+
+    decision = drm_fb_capture_policy(ctx);
+    switch (decision) {
+    case DRM_FB_CAPTURE_SKIP:
+    case DRM_FB_CAPTURE_ROI:
+        return decision;
+    default:
+        // Unknown answers fall back to a full capture.
+        ctx->roi_x = ctx->roi_y = 0;
+        ctx->roi_w = fb->width;
+        ctx->roi_h = fb->height;
+        return DRM_FB_CAPTURE_FULL;
+    }
+}
+
+// Adaptive quality
+//
+// With cpu_budget_us set, the time spent copying and detiling is summed
+// over one-second windows. Going over budget steps one rung down the
+// ladder at once; QUALITY_HOLD_WINDOWS windows in a row under half the
+// budget step one rung back up. Each rung is cheaper than the one above:
+//
+//   full      the whole framebuffer, or the policy's region
+//   region    the centre quarter, unless the policy chose a region
+//   half      that region at half resolution in each dimension
+//   sampled   half resolution, one framebuffer in QUALITY_SAMPLE_EVERY
+//   skip      nothing
+//
+// Framebuffers are captured as they are created, so there are no damage
+// clips to narrow a capture to.
+enum fb_quality {
+    FB_QUALITY_FULL = 0,
+    FB_QUALITY_REGION,
+    FB_QUALITY_HALF,
+    FB_QUALITY_SAMPLED,
+    FB_QUALITY_SKIP,
+    FB_QUALITY_COUNT
+};
+
+#define QUALITY_WINDOW_NS       NSEC_PER_SEC
+#define QUALITY_HOLD_WINDOWS    3
+#define QUALITY_SAMPLE_EVERY    4
+#define QUALITY_LOG_SIZE        8
+
+static const char * const quality_names[FB_QUALITY_COUNT] = {
+    "full", "region", "half", "sampled", "skip",
+};
+
+struct quality_step {
+    u64 timestamp;
+    u64 used_us;                // in the window that caused the step
+    enum fb_quality from, to;
+};
+
+// All under capture_mutex
+static struct {
+    enum fb_quality level;
+    u64 window_start;
+    u64 window_ns;              // capture time in the current window
+    u64 last_used_us;           // in the last complete window
+    unsigned int calm_windows;  // consecutive windows under half the budget
+    unsigned int sample;
+    u64 steps_down, steps_up;
+    u64 frames[FB_QUALITY_COUNT];
+    u64 copy_ns, detile_ns, timed; // stage totals over timed captures
+    struct quality_step log[QUALITY_LOG_SIZE];
+    unsigned int log_next;
+} quality;
+
+static void quality_set(enum fb_quality to, u64 now, u64 used_us)
+{
+    struct quality_step *step = &quality.log[quality.log_next++ % QUALITY_LOG_SIZE];
+
+    step->timestamp = now;
+    step->used_us = used_us;
+    step->from = quality.level;
+    step->to = to;
+    if (to > quality.level)
+        quality.steps_down++;
+    else
+        quality.steps_up++;
+    pr_info("Capture quality %s -> %s (%llu us used, budget %u us/s)\n",
+            quality_names[quality.level], quality_names[to], used_us, cpu_budget_us);
+    quality.level = to;
+    quality.calm_windows = 0;
+}
+
+// Close finished windows and pick the level for the next capture.
+static enum fb_quality quality_level(u64 now)
+{
+    u64 budget_ns = (u64)READ_ONCE(cpu_budget_us) * NSEC_PER_USEC;
+
+    if (!budget_ns) {
+        if (quality.level != FB_QUALITY_FULL)
+            quality_set(FB_QUALITY_FULL, now, 0);
+        return FB_QUALITY_FULL;
+    }
+
+    if (now - quality.window_start >= QUALITY_WINDOW_NS) {
+        // Windows without any capture count as calm too.
+        u64 windows = div64_u64(now - quality.window_start, QUALITY_WINDOW_NS);
+
+        quality.last_used_us = div_u64(quality.window_ns, NSEC_PER_USEC);
+        if (quality.window_ns * 2 < budget_ns)
+            quality.calm_windows += min_t(u64, windows, QUALITY_HOLD_WINDOWS);
+        else
+            quality.calm_windows = 0;
+        quality.window_start = now;
+        quality.window_ns = 0;
+
+        if (quality.calm_windows >= QUALITY_HOLD_WINDOWS && quality.level > FB_QUALITY_FULL)
+            quality_set(quality.level - 1, now, quality.last_used_us);
+    }
+    return quality.level;
+}
+
+// Charge a capture to the window; over budget steps down straight away.
+static void quality_charge(const struct fb_pixel_data *capture, u64 now)
+{
+    u64 budget_ns = (u64)READ_ONCE(cpu_budget_us) * NSEC_PER_USEC;
+
+    quality.window_ns += capture->capture_ns;
+    quality.copy_ns += capture->capture_ns - capture->detile_ns;
+    quality.detile_ns += capture->detile_ns;
+    quality.timed++;
+
+    if (budget_ns && quality.window_ns > budget_ns && quality.level < FB_QUALITY_SKIP) {
+        quality_set(quality.level + 1, now, div_u64(quality.window_ns, NSEC_PER_USEC));
+        quality.window_start = now;
+        quality.window_ns = 0;
+    }
+}
+
+// Narrow the policy's answer to what the level allows. Returns false when
+// this framebuffer is not to be captured at all.
+static bool quality_apply(enum fb_quality level, int decision,
+                          struct drm_fb_capture_ctx *ctx, uint32_t *scale)
+{
+    *scale = 1;
+    switch (level) {
+    case FB_QUALITY_SKIP:
+        return false;
+    case FB_QUALITY_SAMPLED:
+        if (quality.sample++ % QUALITY_SAMPLE_EVERY)
+            return false;
+        fallthrough;
+    case FB_QUALITY_HALF:
+        *scale = 2;
+        fallthrough;
+    case FB_QUALITY_REGION:
+        if (decision != DRM_FB_CAPTURE_ROI) {
+            ctx->roi_x = ctx->width / 4;
+            ctx->roi_y = ctx->height / 4;
+            ctx->roi_w = max_t(u32, ctx->width / 2, 1);
+            ctx->roi_h = max_t(u32, ctx->height / 2, 1);
+        }
+        break;
+    default:
+        break;
+    }
+    if (ctx->roi_w < *scale || ctx->roi_h < *scale)
+        *scale = 1;
+    return true;
+}
+
+// Overhead guard
+//
+// Hard limits on what capturing may cost, on top of the gradual quality
+// steps above. The probe handler runs inside drm_framebuffer_init(), on the
+// compositor's path, so every call is timed; one over guard_hook_us
+// silences the hook for the rest of the second. Worker copies are timed
+// per framebuffer shape (size, format, modifier): a shape whose copy took
+// longer than guard_call_us is captured metadata-only for
+// GUARD_PENALTY_NS, then measured again. Hook and worker time together are
+// held to guard_sec_us per second, past which nothing is captured until the
+// second is over. Every intervention is counted and traced as
+// drm_fb:drm_fb_guard.
+
+#define GUARD_WINDOW_NS     NSEC_PER_SEC
+#define GUARD_PENALTY_NS    (10 * NSEC_PER_SEC)
+#define GUARD_SHAPES        8
+
+struct guard_shape {
+    u32 width, height, format;
+    u64 modifier;
+    u64 cost_ns;                // last copy
+    u64 until;                  // metadata-only until then
+};
+
+// Worker side, under capture_mutex
+static struct {
+    struct guard_shape shapes[GUARD_SHAPES];
+    unsigned int next_shape;
+    u64 window_start;
+    u64 window_ns;              // hook and worker time in this second
+    bool window_tripped;
+    u64 metadata_only, skipped, penalised;
+} guard;
+
+// Probe side, lockless
+static atomic64_t guard_hook_calls, guard_hook_ns, guard_hook_max_ns;
+static atomic64_t guard_hook_window_ns;     // not yet moved into guard.window_ns
+static atomic64_t guard_hook_over, guard_hook_silenced;
+static atomic64_t guard_quiet_until;        // hook does nothing before this
+
+static bool guard_hook_enter(u64 now)
+{
+    if (now < (u64)atomic64_read(&guard_quiet_until)) {
+        atomic64_inc(&guard_hook_silenced);
+        return false;
+    }
+    return true;
+}
+
+static void guard_hook_exit(struct drm_framebuffer *fb, u64 start)
+{
+    u64 budget_ns = (u64)READ_ONCE(guard_hook_us) * NSEC_PER_USEC;
+    u64 ns = ktime_get_ns() - start;
+    s64 max = atomic64_read(&guard_hook_max_ns);
+
+    atomic64_inc(&guard_hook_calls);
+    atomic64_add(ns, &guard_hook_ns);
+    atomic64_add(ns, &guard_hook_window_ns);
+    while ((s64)ns > max && !atomic64_try_cmpxchg(&guard_hook_max_ns, &max, ns))
+        ;
+    if (budget_ns && ns > budget_ns) {
+        atomic64_inc(&guard_hook_over);
+        atomic64_set(&guard_quiet_until, start + GUARD_WINDOW_NS);
+        trace_drm_fb_guard(FB_GUARD_HOOK, fb->width, fb->height,
+                           fb->format ? fb->format->format : 0, fb->modifier, ns, budget_ns);
+    }
+}
+
+static struct guard_shape *guard_shape(struct drm_framebuffer *fb, bool add)
+{
+    struct guard_shape *shape;
+    int i;
+
+    for (i = 0; i < GUARD_SHAPES; i++) {
+        shape = &guard.shapes[i];
+        if (shape->width == fb->width && shape->height == fb->height &&
+            shape->format == fb->format->format && shape->modifier == fb->modifier)
+            return shape;
+    }
+    if (!add)
+        return NULL;
+    shape = &guard.shapes[guard.next_shape++ % GUARD_SHAPES];
+    memset(shape, 0, sizeof(*shape));
+    shape->width = fb->width;
+    shape->height = fb->height;
+    shape->format = fb->format->format;
+    shape->modifier = fb->modifier;
+    return shape;
+}
+
+// What may be captured of fb now: 0 (all of it), FB_GUARD_METADATA or FB_GUARD_SKIP.
+static int guard_check(struct drm_framebuffer *fb, u64 now)
+{
+    u64 budget_ns = (u64)READ_ONCE(guard_sec_us) * NSEC_PER_USEC;
+    struct guard_shape *shape;
+
+    if (now - guard.window_start >= GUARD_WINDOW_NS) {
+        guard.window_start = now;
+        guard.window_ns = 0;
+        guard.window_tripped = false;
+    }
+    guard.window_ns += atomic64_xchg(&guard_hook_window_ns, 0);
+
+    if (budget_ns && guard.window_ns > budget_ns) {
+        if (!guard.window_tripped) {
+            // Stop queuing work as well until the second is over
+            atomic64_set(&guard_quiet_until, guard.window_start + GUARD_WINDOW_NS);
+            trace_drm_fb_guard(FB_GUARD_SKIP, fb->width, fb->height, fb->format->format,
+                               fb->modifier, guard.window_ns, budget_ns);
+            guard.window_tripped = true;
+        }
+        guard.skipped++;
+        return FB_GUARD_SKIP;
+    }
+
+    shape = guard_shape(fb, false);
+    if (shape && now < shape->until) {
+        guard.metadata_only++;
+        return FB_GUARD_METADATA;
+    }
+    return 0;
+}
+
+static void guard_charge(struct drm_framebuffer *fb, u64 ns, u64 now)
+{
+    u64 budget_ns = (u64)READ_ONCE(guard_call_us) * NSEC_PER_USEC;
+    struct guard_shape *shape = guard_shape(fb, true);
+
+    guard.window_ns += ns;
+    shape->cost_ns = ns;
+    if (budget_ns && ns > budget_ns) {
+        shape->until = now + GUARD_PENALTY_NS;
+        guard.penalised++;
+        trace_drm_fb_guard(FB_GUARD_METADATA, fb->width, fb->height, fb->format->format,
+                           fb->modifier, ns, budget_ns);
+        pr_info("Capture of %ux%u format=0x%08x took %llu us (guard %u us), metadata only for %llu s\n",
+                fb->width, fb->height, fb->format->format, div_u64(ns, NSEC_PER_USEC),
+                guard_call_us, div_u64(GUARD_PENALTY_NS, NSEC_PER_SEC));
+    }
+}
+
+// The ring
+//
+// One capture_mutex covers the writer and every reader. Its wait and hold
+// times on both sides go to /proc/drm_fb_counters, so changes to the ring
+// can be measured with ring_bench.
+
+// Take capture_mutex for a writer or reader; returns when it was taken
+static u64 ring_lock(enum fb_ring_side side)
+{
+    u64 start = ktime_get_ns(), locked;
+
+    mutex_lock(&capture_mutex);
+    locked = ktime_get_ns();
+    fb_hist_add(&counters.lock_wait[side], locked - start);
+    return locked;
+}
+
+static void ring_unlock(enum fb_ring_side side, u64 locked)
+{
+    fb_hist_add(&counters.lock_hold[side], ktime_get_ns() - locked);
+    mutex_unlock(&capture_mutex);
+}
+
+// The next slot of the ring that no dma-buf pins, emptied; under
+// capture_mutex. Exports always leave one slot unpinned. Until
+// ring_commit() the newest capture stays the one before current_index.
+static struct fb_pixel_data *ring_slot(void)
+{
+    struct fb_pixel_data *capture;
+    int slot = current_index;
+
+    while (slot_pins[slot])
+        slot = (slot + 1) % MAX_FB_CAPTURE;
+    capture = &captured_fbs[slot];
+    if (capture->valid && capture->has_pixels && !capture->consumed)
+        counters.unread++;
+    if (capture->pixel_buffer) {
+        vfree(capture->pixel_buffer);
+        capture->pixel_buffer = NULL;
+    }
+    memset(capture, 0, sizeof(*capture));
+    return capture;
+}
+
+// Make the slot from ring_slot() the newest capture
+static void ring_commit(struct fb_pixel_data *capture)
+{
+    total_captures++;
+    last_capture_ns = capture->timestamp;
+    current_index = (capture - captured_fbs + 1) % MAX_FB_CAPTURE;
+    if (capture_count < MAX_FB_CAPTURE) {
+        capture_count++;
+    }
+}
+
+// Ring slots as dma-bufs
+//
+// FB_IOC_EXPORT (fb_export.h) wraps a slot's pixel_buffer in a read-only
+// dma-buf. The buffer is vmalloc'ed, so importers get a scatterlist of its
+// pages and mappings insert the same pages: nothing is copied. Each
+// dma-buf holds a pin on its slot until its release, and ring_slot() passes
+// pinned slots over, so the slot, its pixel_buffer and buffer_size stay as
+// they were while anyone holds it. The ops read them without the lock.
+
+static unsigned int slots_pinned(void)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < MAX_FB_CAPTURE; i++)
+        n += slot_pins[i] != 0;
+    return n;
+}
+
+static struct page *slot_page(const struct fb_pixel_data *capture, unsigned long i)
+{
+    return vmalloc_to_page((const u8 *)capture->pixel_buffer + i * PAGE_SIZE);
+}
+
+static struct sg_table *slot_map_dma_buf(struct dma_buf_attachment *attach,
+                                         enum dma_data_direction dir)
+{
+    const struct fb_pixel_data *capture = attach->dmabuf->priv;
+    unsigned int pages = PAGE_ALIGN(capture->buffer_size) >> PAGE_SHIFT;
+    struct scatterlist *sg;
+    struct sg_table *sgt;
+    unsigned int i;
+    int ret;
+
+    sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+    if (!sgt)
+        return ERR_PTR(-ENOMEM);
+    ret = sg_alloc_table(sgt, pages, GFP_KERNEL);
+    if (ret)
+        goto err_free;
+    for_each_sgtable_sg(sgt, sg, i)
+        sg_set_page(sg, slot_page(capture, i), PAGE_SIZE, 0);
+    ret = dma_map_sgtable(attach->dev, sgt, dir, 0);
+    if (ret)
+        goto err_table;
+    return sgt;
+
+err_table:
+    sg_free_table(sgt);
+err_free:
+    kfree(sgt);
+    return ERR_PTR(ret);
+}
+
+static void slot_unmap_dma_buf(struct dma_buf_attachment *attach, struct sg_table *sgt,
+                               enum dma_data_direction dir)
+{
+    dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+    sg_free_table(sgt);
+    kfree(sgt);
+}
+
+static int slot_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+    const struct fb_pixel_data *capture = dmabuf->priv;
+    unsigned long i;
+    int ret;
+
+    // dma_buf_mmap_internal() has checked the range against dmabuf->size
+    for (i = 0; i < vma_pages(vma); i++) {
+        ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE,
+                             slot_page(capture, vma->vm_pgoff + i));
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+static int slot_vmap(struct dma_buf *dmabuf, struct iosys_map *map)
+{
+    const struct fb_pixel_data *capture = dmabuf->priv;
+
+    iosys_map_set_vaddr(map, capture->pixel_buffer);
+    return 0;
+}
+
+// The last reference is gone: give the slot back to the ring
+static void slot_release(struct dma_buf *dmabuf)
+{
+    const struct fb_pixel_data *capture = dmabuf->priv;
+    u64 locked = ring_lock(FB_RING_READER);
+
+    slot_pins[capture - captured_fbs]--;
+    ring_unlock(FB_RING_READER, locked);
+}
+
+static const struct dma_buf_ops slot_dmabuf_ops = {
+    .map_dma_buf = slot_map_dma_buf,
+    .unmap_dma_buf = slot_unmap_dma_buf,
+    .mmap = slot_mmap,
+    .vmap = slot_vmap,
+    .release = slot_release,
+};
+
+// The capture with pixels taken before all but age of the others, or
+// NULL. By time rather than slot, as pinned slots keep older captures
+// between newer ones.
+static struct fb_pixel_data *capture_by_age(unsigned int age)
+{
+    struct fb_pixel_data *capture = NULL;
+    u64 before = U64_MAX;
+    unsigned int n;
+    int i;
+
+    for (n = 0; n <= age; n++) {
+        capture = NULL;
+        for (i = 0; i < MAX_FB_CAPTURE; i++) {
+            struct fb_pixel_data *c = &captured_fbs[i];
+
+            if (c->has_pixels && c->pixel_buffer && c->timestamp < before &&
+                (!capture || c->timestamp > capture->timestamp))
+                capture = c;
+        }
+        if (!capture)
+            break;
+        before = capture->timestamp;
+    }
+    return capture;
+}
+
+// Export the capture e->age captures with pixels back from the newest and
+// fill in the rest of e. The fd is only installed once e has reached
+// userspace, in drm_fb_raw_ioctl().
+static struct dma_buf *slot_export(struct fb_export *e)
+{
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+    struct fb_pixel_data *capture;
+    struct dma_buf *dmabuf;
+    int slot;
+    u64 locked;
+
+    locked = ring_lock(FB_RING_READER);
+    capture = capture_by_age(e->age);
+    if (!capture) {
+        dmabuf = ERR_PTR(-ENODATA);
+        goto out;
+    }
+    slot = capture - captured_fbs;
+    if (!slot_pins[slot] && slots_pinned() >= MAX_FB_CAPTURE - 1) {
+        dmabuf = ERR_PTR(-EBUSY);
+        goto out;
+    }
+
+    exp_info.ops = &slot_dmabuf_ops;
+    exp_info.size = PAGE_ALIGN(capture->buffer_size);
+    exp_info.flags = O_RDONLY | O_CLOEXEC;
+    exp_info.priv = capture;
+    dmabuf = dma_buf_export(&exp_info);
+    if (IS_ERR(dmabuf))
+        goto out;
+
+    slot_pins[slot]++;
+    capture->consumed = true;
+    counters.exported++;
+    e->size = capture->buffer_size;
+    e->timestamp_ns = capture->timestamp;
+    e->width = capture->roi_w / capture->scale;
+    e->height = capture->roi_h / capture->scale;
+    e->pitch = e->width * (capture->depth ? capture->depth : 4);
+    e->format = capture->format;
+    e->slot = slot;
+    e->pinned = slots_pinned();
+out:
+    ring_unlock(FB_RING_READER, locked);
+    return dmabuf;
+}
+
+// Function to capture framebuffer pixel content
+static int capture_fb_pixels(struct drm_framebuffer *fb, struct drm_device *dev, int node,
+                             const struct fb_render *render)
+{
+    struct fb_pixel_data *capture;
+    struct drm_fb_capture_ctx ctx;
+    struct stats_pass *sp;
+    int ret;
+    size_t expected_size;
+    u64 copy_start;
+    enum fb_quality level;
+    uint32_t scale;
+    int decision, guarded;
+    u64 locked;
+    
+    if (!fb || !fb->obj[0]) {
+        pr_warn("Invalid framebuffer or missing GEM object\n");
+        return -EINVAL;
+    }
+    
+    locked = ring_lock(FB_RING_WRITER);
+
+    decision = run_capture_policy(fb, dev, &ctx);
+    level = quality_level(ktime_get_ns());
+    guarded = guard_check(fb, ktime_get_ns());
+    if (decision == DRM_FB_CAPTURE_SKIP || guarded == FB_GUARD_SKIP ||
+        !quality_apply(level, decision, &ctx, &scale)) {
+        total_skipped++;
+        ring_unlock(FB_RING_WRITER, locked);
+        return 0;
+    }
+    quality.frames[level]++;
+    
+    // Use circular buffer for captures, cleaning up the previous one
+    capture = ring_slot();
+    
+    // Initialize capture structure
+    capture->fb = fb;
+    capture->dev = dev;
+    capture->width = fb->width;
+    capture->height = fb->height;
+    capture->format = fb->format->format;
+    capture->pitch = fb->pitches[0];
+    capture->roi_x = ctx.roi_x;
+    capture->roi_y = ctx.roi_y;
+    capture->roi_w = ctx.roi_w;
+    capture->roi_h = ctx.roi_h;
+    capture->timestamp = ktime_get_ns();
+    capture->hook_ns = render->hook_ns;
+    capture->render_ns = render->render_ns;
+    capture->fence_status = render->status;
+    if (render->render_ns > render->hook_ns) {
+        u64 wait = render->render_ns - render->hook_ns;
+
+        render_waits++;
+        render_wait_ns += wait;
+        render_wait_max_ns = max(render_wait_max_ns, wait);
+    }
+    if (render->status < 0)
+        render_errors++;
+    fb_hist_add(&counters.stage[FB_STAGE_RENDER], render->render_ns - render->hook_ns);
+    fb_hist_add(&counters.stage[FB_STAGE_QUEUE], capture->timestamp - render->render_ns);
+    // Without a placement the buffer stays local to this worker
+    if (node == NUMA_NO_NODE)
+        node = numa_node_id();
+    capture->node = node;
+    capture->quality = level;
+    capture->scale = scale;
+    capture->is_detiled = false;
+    
+    // Detect Intel tiling
+    capture->detected_tiling = detect_intel_tiling(fb);
+
+    if (guarded == FB_GUARD_METADATA) {
+        capture->guard_metadata = true;
+        capture->valid = true;
+        goto record;
+    }
+    
+    // Calculate expected buffer size (always linear output size)
+    capture->depth = fb_yuv_depth(capture->format);
+    if (capture->depth) {
+        expected_size = yuv_capture_size(capture);
+        // Too small for a single chroma sample at this scale
+        if (!expected_size) {
+            capture->valid = true;
+            goto record;
+        }
+    } else
+        expected_size = (size_t)(capture->roi_h / scale) * (capture->roi_w / scale) * 4; // 4 bytes per pixel for ARGB
+    if (!capture->depth && expected_size > MAX_CAPTURE_SIZE) {
+        capture->roi_h = MAX_CAPTURE_SIZE / (capture->roi_w / scale * 4) * scale;
+        expected_size = (size_t)(capture->roi_h / scale) * (capture->roi_w / scale) * 4;
+        pr_warn("Framebuffer too large, limiting to %zu bytes\n", expected_size);
+    }
+    
+    capture->buffer_size = expected_size;
+    
+    // Allocate buffer for pixel data (linear format)
+    capture->pixel_buffer = vmalloc_node(capture->buffer_size, node);
+    if (!capture->pixel_buffer) {
+        pr_err("Failed to allocate pixel buffer (%zu bytes)\n", capture->buffer_size);
+        // ring_slot() has already emptied the slot: keep the metadata there
+        // as a failed capture rather than leave a hole in the ring
+        capture->buffer_size = 0;
+        capture->valid = true;
+        counters.failed++;
+        ring_commit(capture);
+        ring_unlock(FB_RING_WRITER, locked);
         return -ENOMEM;
     }
     
     pr_info("Framebuffer info: %dx%d, format=0x%08x, pitch=%d, tiling=%s\n",
             capture->width, capture->height, capture->format, capture->pitch,
-            (capture->detected_tiling == INTEL_TILING_X) ? "X-tiled" :
-            (capture->detected_tiling == INTEL_TILING_Y) ? "Y-tiled" :
-            (capture->detected_tiling == INTEL_TILING_YF) ? "Yf-tiled" : "linear");
+            (capture->detected_tiling == FB_TILING_X) ? "X-tiled" :
+            (capture->detected_tiling == FB_TILING_Y) ? "Y-tiled" :
+            (capture->detected_tiling == FB_TILING_YF) ? "Yf-tiled" :
+            (capture->detected_tiling == FB_TILING_4) ? "4-tiled" : "linear");
     
     // Extract pixel data from the primary GEM object
-    ret = extract_gem_pixels(fb->obj[0], capture);
+    copy_start = ktime_get_ns();
+    sp = stats_start(capture);
+    if (capture->depth)
+        ret = extract_yuv_planes(fb, capture, sp);
+    else
+        ret = extract_gem_pixels(fb->obj[0], capture, sp);
+    if (sp)
+        stats_finish(sp, capture, ret == 0);
+    capture->capture_ns = ktime_get_ns() - copy_start;
+    quality_charge(capture, copy_start + capture->capture_ns);
+    guard_charge(fb, capture->capture_ns, copy_start + capture->capture_ns);
+    fb_hist_add(&counters.stage[FB_STAGE_CAPTURE], capture->capture_ns);
+    if (capture->detile_ns)
+        fb_hist_add(&counters.stage[FB_STAGE_DETILE], capture->detile_ns);
     if (ret == 0) {
+        struct node_bw *bw = &node_stats[node];
+
+        bw->captures++;
+        bw->bytes += capture->buffer_size;
+        bw->ns += capture->capture_ns;
+        if (numa_node_id() != node)
+            bw->remote++;
+        counters.with_pixels++;
+        counters.bytes_copied += capture->buffer_size;
         capture->has_pixels = true;
         capture->valid = true;
         
@@ -382,60 +1847,671 @@ static int capture_fb_pixels(struct drm_framebuffer *fb, struct drm_device *dev)
             pr_info("Successfully captured framebuffer pixels: %dx%d, format=0x%08x, %zu bytes\n",
                     capture->width, capture->height, capture->format, capture->buffer_size);
         }
-    } else {
-        capture->has_pixels = false;
-        capture->valid = true; // Still valid for metadata
-        
-        pr_info("Captured framebuffer metadata only: %dx%d, format=0x%08x\n",
-                capture->width, capture->height, capture->format);
-    }
-    
-    // Update counters
-    current_index = (current_index + 1) % MAX_FB_CAPTURE;
-    if (capture_count < MAX_FB_CAPTURE) {
-        capture_count++;
+    } else {
+        capture->has_pixels = false;
+        capture->valid = true; // Still valid for metadata
+        counters.failed++;
+        
+        pr_info("Captured framebuffer metadata only: %dx%d, format=0x%08x\n",
+                capture->width, capture->height, capture->format);
+    }
+    
+record:
+    // Update counters
+    ring_commit(capture);
+    
+    ring_unlock(FB_RING_WRITER, locked);
+    return 0;
+}
+
+// Capture injection
+//
+// Setting inject_hz makes a worker record synthetic captures into the ring
+// at that rate, through the same lock and slot handling as real ones, so
+// ring_bench can load the ring without a display or a GPU. Every pixel of
+// an injected capture holds its sequence number (the count of captures
+// before it): a reader that sees two values in one frame read across a
+// replacement. Injected captures skip the policy, quality, statistics and
+// screening.
+static unsigned int inject_width = 1920, inject_height = 1080;
+module_param(inject_width, uint, 0644);
+MODULE_PARM_DESC(inject_width, "Width of injected captures");
+module_param(inject_height, uint, 0644);
+MODULE_PARM_DESC(inject_height, "Height of injected captures");
+
+static unsigned int inject_hz;
+static bool inject_stop;
+
+static void inject_work_fn(struct work_struct *work);
+static DECLARE_WORK(inject_work, inject_work_fn);
+
+static int inject_hz_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_uint(val, kp);
+
+    // Called under kernel_param_lock. Before load drm_fb_extractor_init()
+    // queues the work; once unloading has set inject_stop, nothing does.
+    if (!ret && inject_hz && capture_wq && !inject_stop)
+        queue_work(capture_wq, &inject_work);
+    return ret;
+}
+
+static const struct kernel_param_ops inject_hz_ops = {
+    .set = inject_hz_set,
+    .get = param_get_uint,
+};
+module_param_cb(inject_hz, &inject_hz_ops, &inject_hz, 0644);
+MODULE_PARM_DESC(inject_hz, "Synthetic captures per second recorded into the ring, for ring_bench (0 = off)");
+
+static void inject_capture(u32 width, u32 height)
+{
+    size_t size = (size_t)width * height * 4;
+    struct fb_pixel_data *capture;
+    int node = numa_node_id();
+    u64 locked, start;
+    void *buffer;
+
+    if (!width || !height || size > MAX_CAPTURE_SIZE)
+        return;
+
+    // Before a slot is taken, so a failure leaves the ring as it was
+    buffer = vmalloc_node(size, node);
+    if (!buffer)
+        return;
+
+    locked = ring_lock(FB_RING_WRITER);
+    capture = ring_slot();
+    capture->node = node;
+    capture->pixel_buffer = buffer;
+    start = ktime_get_ns();
+    memset32(capture->pixel_buffer, (u32)total_captures, size / 4);
+    capture->buffer_size = size;
+    capture->width = capture->roi_w = width;
+    capture->height = capture->roi_h = height;
+    capture->format = DRM_FORMAT_XRGB8888;
+    capture->pitch = width * 4;
+    capture->timestamp = capture->hook_ns = capture->render_ns = start;
+    capture->capture_ns = ktime_get_ns() - start;
+    capture->quality = FB_QUALITY_FULL;
+    capture->scale = 1;
+    capture->detected_tiling = FB_TILING_NONE;
+    capture->has_pixels = true;
+    capture->valid = true;
+    counters.injected++;
+    counters.with_pixels++;
+    counters.bytes_copied += size;
+    ring_commit(capture);
+    ring_unlock(FB_RING_WRITER, locked);
+}
+
+static void inject_work_fn(struct work_struct *work)
+{
+    u64 next = ktime_get_ns();
+    unsigned int hz;
+
+    while ((hz = READ_ONCE(inject_hz)) && !READ_ONCE(inject_stop)) {
+        u64 period = div_u64(NSEC_PER_SEC, hz), now;
+        ktime_t until;
+
+        inject_capture(READ_ONCE(inject_width), READ_ONCE(inject_height));
+        next += period;
+        now = ktime_get_ns();
+        if (next <= now) {
+            // Behind: carry on from now rather than catch up in a burst
+            next = now;
+            cond_resched();
+            continue;
+        }
+        until = ns_to_ktime(next);
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        schedule_hrtimeout_range(&until, 10 * NSEC_PER_USEC, HRTIMER_MODE_ABS);
+    }
+}
+
+// Hook layer
+//
+// Captures are triggered from the return path of drm_framebuffer_init(),
+// once it has succeeded: only then are the format, modifier and refcount
+// valid. The handler pins the framebuffer and queues the capture, which
+// sleeps, to a workqueue. Arguments are fetched with the architecture's
+// calling-convention helpers, so no per-arch register names are needed.
+
+// The handlers pass the arguments from entry to exit in entry_data, and the
+// entry handler returns int; both arrived in 6.3. Older kernels use kretprobe.
+#if IS_ENABLED(CONFIG_FPROBE) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+#define DRM_FB_HAVE_FPROBE 1
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+#define FB_FPROBE_REGS          struct ftrace_regs *regs
+#define fb_fprobe_arg(regs, n)  ftrace_regs_get_argument(regs, n)
+#define fb_fprobe_ret(regs)     ftrace_regs_get_return_value(regs)
+#else
+#define FB_FPROBE_REGS          struct pt_regs *regs
+#define fb_fprobe_arg(regs, n)  regs_get_kernel_argument(regs, n)
+#define fb_fprobe_ret(regs)     regs_return_value(regs)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define FB_FPROBE_IPS           unsigned long entry_ip, unsigned long ret_ip
+#else
+#define FB_FPROBE_IPS           unsigned long entry_ip
+#endif
+#endif
+
+enum fb_hook_kind {
+    FB_HOOK_NONE = 0,
+    FB_HOOK_KRETPROBE,
+    FB_HOOK_FPROBE,
+};
+
+static enum fb_hook_kind active_hook;
+
+// drm_framebuffer_init(dev, fb, funcs) arguments, saved on entry
+struct fb_hook_args {
+    struct drm_device *dev;
+    struct drm_framebuffer *fb;
+};
+
+// Render fences
+//
+// A client usually registers a framebuffer right after submitting the
+// rendering into it, so the GPU may still be writing when the hook fires.
+// Rather than copying a half-drawn frame, or blocking the caller, the hook
+// looks up the unsignalled write fences on the buffer's reservation object
+// and registers a callback on the first one. The callback, in fence
+// signalling context, records the time and queues the copy; the worker
+// then moves on to any further write fence before copying.
+
+#define RENDER_FENCE_TRIES  8       // lookups racing with signalling before giving up
+
+struct fb_capture_work {
+    struct work_struct work;
+    struct dma_fence_cb cb;
+    struct dma_fence *fence;        // render fence waited on, NULL when none
+    struct list_head pending;       // on render_pending while the callback is armed
+    struct drm_device *dev;
+    struct drm_framebuffer *fb;
+    int node;
+    struct fb_render render;
+};
+
+// Armed callbacks, so unload can take them back before the code goes away
+static LIST_HEAD(render_pending);
+static DEFINE_SPINLOCK(render_lock);
+static unsigned int render_waiting;
+static bool render_stopping;
+
+static void queue_capture_work(struct fb_capture_work *cw)
+{
+    // capture_wq is unbound, so the worker runs on a CPU of that node
+    if (cw->node != NUMA_NO_NODE)
+        queue_work_node(cw->node, capture_wq, &cw->work);
+    else
+        queue_work(capture_wq, &cw->work);
+}
+
+// First unsignalled fence writing the object, referenced, or NULL. Walks
+// the reservation object under RCU without its lock, so it is usable from
+// the probe handler.
+static struct dma_fence *render_fence(struct drm_gem_object *obj)
+{
+    struct dma_fence *fence, *found = NULL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+    struct dma_resv_iter cursor;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+    dma_resv_iter_begin(&cursor, obj->resv, DMA_RESV_USAGE_WRITE);
+#else
+    dma_resv_iter_begin(&cursor, obj->resv, false);   // exclusive fence only
+#endif
+    dma_resv_for_each_fence_unlocked(&cursor, fence) {
+        if (!dma_fence_is_signaled(fence)) {
+            found = dma_fence_get(fence);
+            break;
+        }
+    }
+    dma_resv_iter_end(&cursor);
+#else
+    fence = dma_resv_get_excl_unlocked(obj->resv);
+    if (fence && !dma_fence_is_signaled(fence))
+        found = fence;
+    else
+        dma_fence_put(fence);
+#endif
+    return found;
+}
+
+// Fence signalling context, possibly hard irq: note the time and queue.
+static void render_fence_done(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+    struct fb_capture_work *cw = container_of(cb, struct fb_capture_work, cb);
+
+    cw->render.render_ns = ktime_get_ns();
+    queue_capture_work(cw);
+}
+
+// Arm a callback on the next pending render fence. Returns false when there
+// is nothing to wait for, and the caller should queue the copy itself.
+static bool arm_render_wait(struct fb_capture_work *cw)
+{
+    struct drm_gem_object *obj = cw->fb->obj[0];
+    struct dma_fence *fence;
+    unsigned long flags;
+    int tries, ret;
+
+    if (!READ_ONCE(wait_render) || !obj || !obj->resv)
+        return false;
+
+    for (tries = 0; tries < RENDER_FENCE_TRIES; tries++) {
+        fence = render_fence(obj);
+        if (!fence)
+            return false;
+
+        // Under render_lock so unload sees either no callback or an armed one
+        spin_lock_irqsave(&render_lock, flags);
+        ret = render_stopping ? -ESHUTDOWN :
+              dma_fence_add_callback(fence, &cw->cb, render_fence_done);
+        if (!ret) {
+            cw->fence = fence;
+            list_add_tail(&cw->pending, &render_pending);
+            render_waiting++;
+        }
+        spin_unlock_irqrestore(&render_lock, flags);
+        if (!ret)
+            return true;
+
+        dma_fence_put(fence);
+        if (ret != -ENOENT)     // -ENOENT: signalled since the lookup, look again
+            return false;
+    }
+    return false;
+}
+
+static void capture_work_fn(struct work_struct *work)
+{
+    struct fb_capture_work *cw = container_of(work, struct fb_capture_work, work);
+
+    if (cw->fence) {
+        int status = dma_fence_get_status(cw->fence);
+
+        if (status < 0)
+            cw->render.status = status;
+        spin_lock_irq(&render_lock);
+        list_del(&cw->pending);
+        render_waiting--;
+        spin_unlock_irq(&render_lock);
+        dma_fence_put(cw->fence);
+        cw->fence = NULL;
+
+        // Several writers may share the buffer; the frame is done after the last
+        if (arm_render_wait(cw))
+            return;
+    }
+
+    capture_fb_pixels(cw->fb, cw->dev, cw->node, &cw->render);
+    drm_framebuffer_put(cw->fb);
+    kfree(cw);
+}
+
+// Runs in probe context: no sleeping, so only pin and queue, or arm a
+// render fence callback that queues later.
+static void queue_fb_capture(struct drm_device *dev, struct drm_framebuffer *fb)
+{
+    struct fb_capture_work *cw;
+    u64 start = ktime_get_ns();
+
+    if (!dev || !fb || !guard_hook_enter(start))
+        return;
+
+    cw = kzalloc(sizeof(*cw), GFP_ATOMIC);
+    if (!cw)
+        goto out;
+
+    INIT_WORK(&cw->work, capture_work_fn);
+    cw->dev = dev;
+    cw->fb = fb;
+    cw->node = capture_node(dev);
+    cw->render.hook_ns = ktime_get_ns();
+    cw->render.render_ns = cw->render.hook_ns;
+    drm_framebuffer_get(fb);
+    if (!arm_render_wait(cw))
+        queue_capture_work(cw);
+out:
+    guard_hook_exit(fb, start);
+}
+
+// Take back callbacks still armed at unload. Those that already fired have
+// queued their work, which drains with the workqueue.
+static void cancel_render_waits(void)
+{
+    struct fb_capture_work *cw, *tmp;
+    LIST_HEAD(detached);
+
+    spin_lock_irq(&render_lock);
+    render_stopping = true;
+    list_for_each_entry_safe(cw, tmp, &render_pending, pending) {
+        if (dma_fence_remove_callback(cw->fence, &cw->cb)) {
+            list_move(&cw->pending, &detached);
+            render_waiting--;
+        }
+    }
+    spin_unlock_irq(&render_lock);
+
+    list_for_each_entry_safe(cw, tmp, &detached, pending) {
+        dma_fence_put(cw->fence);
+        drm_framebuffer_put(cw->fb);
+        kfree(cw);
+    }
+}
+
+static int krp_fb_init_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct fb_hook_args *args = (struct fb_hook_args *)ri->data;
+
+    args->dev = (struct drm_device *)regs_get_kernel_argument(regs, 0);
+    args->fb = (struct drm_framebuffer *)regs_get_kernel_argument(regs, 1);
+    return 0;
+}
+
+static int krp_fb_init_return(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct fb_hook_args *args = (struct fb_hook_args *)ri->data;
+
+    if ((int)regs_return_value(regs) == 0)
+        queue_fb_capture(args->dev, args->fb);
+    return 0;
+}
+
+static struct kretprobe krp_drm_fb_init = {
+    .kp.symbol_name = "drm_framebuffer_init",
+    .entry_handler = krp_fb_init_entry,
+    .handler = krp_fb_init_return,
+    .data_size = sizeof(struct fb_hook_args),
+    .maxactive = 16,
+};
+
+#ifdef DRM_FB_HAVE_FPROBE
+static int fp_fb_init_entry(struct fprobe *fp, FB_FPROBE_IPS, FB_FPROBE_REGS, void *entry_data)
+{
+    struct fb_hook_args *args = entry_data;
+
+    args->dev = (struct drm_device *)fb_fprobe_arg(regs, 0);
+    args->fb = (struct drm_framebuffer *)fb_fprobe_arg(regs, 1);
+    return 0;
+}
+
+static void fp_fb_init_exit(struct fprobe *fp, FB_FPROBE_IPS, FB_FPROBE_REGS, void *entry_data)
+{
+    struct fb_hook_args *args = entry_data;
+
+    if ((int)fb_fprobe_ret(regs) == 0)
+        queue_fb_capture(args->dev, args->fb);
+}
+
+static struct fprobe fp_drm_fb_init = {
+    .entry_handler = fp_fb_init_entry,
+    .exit_handler = fp_fb_init_exit,
+    .entry_data_size = sizeof(struct fb_hook_args),
+};
+#endif
+
+static const char *hook_name(enum fb_hook_kind kind)
+{
+    switch (kind) {
+        case FB_HOOK_KRETPROBE: return "kretprobe";
+        case FB_HOOK_FPROBE: return "fprobe";
+        default: return "none";
+    }
+}
+
+static int register_fb_hook(void)
+{
+    int ret;
+
+#ifdef DRM_FB_HAVE_FPROBE
+    if (!strcmp(hook, "auto") || !strcmp(hook, "fprobe")) {
+        ret = register_fprobe(&fp_drm_fb_init, "drm_framebuffer_init", NULL);
+        if (ret == 0) {
+            active_hook = FB_HOOK_FPROBE;
+            return 0;
+        }
+        if (strcmp(hook, "auto"))
+            return ret;
+        pr_warn("fprobe unavailable (%d), falling back to kretprobe\n", ret);
+    }
+#else
+    if (!strcmp(hook, "fprobe")) {
+        pr_err("fprobe needs CONFIG_FPROBE and kernel 6.3 or later\n");
+        return -EOPNOTSUPP;
+    }
+#endif
+    if (strcmp(hook, "auto") && strcmp(hook, "kretprobe") && strcmp(hook, "fprobe"))
+        return -EINVAL;
+
+    ret = register_kretprobe(&krp_drm_fb_init);
+    if (ret == 0)
+        active_hook = FB_HOOK_KRETPROBE;
+    return ret;
+}
+
+static void unregister_fb_hook(void)
+{
+    switch (active_hook) {
+        case FB_HOOK_KRETPROBE:
+            unregister_kretprobe(&krp_drm_fb_init);
+            break;
+#ifdef DRM_FB_HAVE_FPROBE
+        case FB_HOOK_FPROBE:
+            unregister_fprobe(&fp_drm_fb_init);
+            break;
+#endif
+        default:
+            break;
+    }
+    active_hook = FB_HOOK_NONE;
+}
+
+// Hook overhead benchmark
+//
+// Each mechanism is attached to a local function with the same signature
+// as drm_framebuffer_init() and handlers that fetch the same arguments;
+// the cost per call is the probed loop time minus the unprobed one.
+
+enum fb_bench_mech {
+    FB_BENCH_KPROBE,
+    FB_BENCH_KRETPROBE,
+    FB_BENCH_FPROBE_ENTRY,
+    FB_BENCH_FPROBE_EXIT,
+    FB_BENCH_COUNT
+};
+
+static const char * const bench_names[FB_BENCH_COUNT] = {
+    "kprobe (entry)", "kretprobe (entry+return)", "fprobe (entry)", "fprobe (entry+exit)",
+};
+
+static s64 bench_ns_per_call[FB_BENCH_COUNT];   // ns x 1000, <0: mechanism unavailable
+static u64 bench_base_ns;                       // unprobed call, ns x 1000
+static void *volatile bench_sink;
+
+static noinline int drm_fb_hook_bench_target(struct drm_device *dev,
+                                             struct drm_framebuffer *fb, void *funcs)
+{
+    barrier();
+    return 0;
+}
+
+static int bench_kp_pre(struct kprobe *p, struct pt_regs *regs)
+{
+    bench_sink = (void *)regs_get_kernel_argument(regs, 1);
+    return 0;
+}
+
+static int bench_krp_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct fb_hook_args *args = (struct fb_hook_args *)ri->data;
+
+    args->fb = (struct drm_framebuffer *)regs_get_kernel_argument(regs, 1);
+    return 0;
+}
+
+static int bench_krp_return(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct fb_hook_args *args = (struct fb_hook_args *)ri->data;
+
+    if ((int)regs_return_value(regs) == 0)
+        bench_sink = args->fb;
+    return 0;
+}
+
+#ifdef DRM_FB_HAVE_FPROBE
+static int bench_fp_entry(struct fprobe *fp, FB_FPROBE_IPS, FB_FPROBE_REGS, void *entry_data)
+{
+    struct fb_hook_args *args = entry_data;
+
+    args->fb = (struct drm_framebuffer *)fb_fprobe_arg(regs, 1);
+    bench_sink = args->fb;
+    return 0;
+}
+
+static void bench_fp_exit(struct fprobe *fp, FB_FPROBE_IPS, FB_FPROBE_REGS, void *entry_data)
+{
+    struct fb_hook_args *args = entry_data;
+
+    if ((int)fb_fprobe_ret(regs) == 0)
+        bench_sink = args->fb;
+}
+#endif
+
+// Average ns per call of the bench target, x 1000 for sub-ns resolution.
+static u64 bench_loop(unsigned int calls)
+{
+    int (*volatile target)(struct drm_device *, struct drm_framebuffer *, void *) =
+        drm_fb_hook_bench_target;
+    unsigned int i;
+    u64 start;
+
+    start = ktime_get_ns();
+    for (i = 0; i < calls; i++)
+        target(NULL, NULL, NULL);
+    return (ktime_get_ns() - start) * 1000 / calls;
+}
+
+static void run_hook_bench(unsigned int calls)
+{
+    struct kprobe kp = {
+        .symbol_name = "drm_fb_hook_bench_target",
+        .pre_handler = bench_kp_pre,
+    };
+    struct kretprobe krp = {
+        .kp.symbol_name = "drm_fb_hook_bench_target",
+        .entry_handler = bench_krp_entry,
+        .handler = bench_krp_return,
+        .data_size = sizeof(struct fb_hook_args),
+        .maxactive = 4,
+    };
+    int m;
+
+    bench_base_ns = bench_loop(calls);
+
+    for (m = 0; m < FB_BENCH_COUNT; m++) {
+#ifdef DRM_FB_HAVE_FPROBE
+        struct fprobe fp = {
+            .entry_handler = bench_fp_entry,
+            .exit_handler = m == FB_BENCH_FPROBE_EXIT ? bench_fp_exit : NULL,
+            .entry_data_size = sizeof(struct fb_hook_args),
+        };
+#endif
+        int ret = -EOPNOTSUPP;
+        u64 probed;
+
+        switch (m) {
+            case FB_BENCH_KPROBE:
+                ret = register_kprobe(&kp);
+                break;
+            case FB_BENCH_KRETPROBE:
+                ret = register_kretprobe(&krp);
+                break;
+#ifdef DRM_FB_HAVE_FPROBE
+            case FB_BENCH_FPROBE_ENTRY:
+            case FB_BENCH_FPROBE_EXIT:
+                ret = register_fprobe(&fp, "drm_fb_hook_bench_target", NULL);
+                break;
+#endif
+        }
+        if (ret) {
+            bench_ns_per_call[m] = -1;
+            pr_info("hook bench: %s unavailable (%d)\n", bench_names[m], ret);
+            continue;
+        }
+
+        probed = bench_loop(calls);
+
+        switch (m) {
+            case FB_BENCH_KPROBE:
+                unregister_kprobe(&kp);
+                break;
+            case FB_BENCH_KRETPROBE:
+                unregister_kretprobe(&krp);
+                break;
+#ifdef DRM_FB_HAVE_FPROBE
+            case FB_BENCH_FPROBE_ENTRY:
+            case FB_BENCH_FPROBE_EXIT:
+                unregister_fprobe(&fp);
+                break;
+#endif
+        }
+
+        bench_ns_per_call[m] = probed > bench_base_ns ? probed - bench_base_ns : 0;
+        pr_info("hook bench: %-26s %lld.%03lld ns/call over %u calls\n", bench_names[m],
+                bench_ns_per_call[m] / 1000, bench_ns_per_call[m] % 1000, calls);
     }
-    
-    mutex_unlock(&capture_mutex);
-    return 0;
 }
 
-// Kprobe handler for drm_framebuffer_init
-static int handler_drm_framebuffer_init(struct kprobe *p, struct pt_regs *regs)
+// Detile throughput benchmark: whole 1920x1088 frames (a multiple of every
+// tile height) through the same fb_detile_rect() the capture path uses.
+
+#define DETILE_BENCH_WIDTH  1920
+#define DETILE_BENCH_HEIGHT 1088
+#define DETILE_BENCH_PITCH  (DETILE_BENCH_WIDTH * 4)
+
+static const char * const tiling_names[] = { "linear", "X-tiled", "Y-tiled", "Yf-tiled", "4-tiled" };
+static u64 detile_bench_mbps[ARRAY_SIZE(tiling_names)];
+
+static void run_detile_bench(unsigned int frames)
 {
-    struct drm_device *dev;
-    struct drm_framebuffer *fb;
-    
-    // Extract parameters based on architecture
-#ifdef CONFIG_X86_64
-    dev = (struct drm_device *)regs->di;
-    fb = (struct drm_framebuffer *)regs->si;
-#elif defined(CONFIG_ARM64)
-    dev = (struct drm_device *)regs->regs[0];
-    fb = (struct drm_framebuffer *)regs->regs[1];
-#else
-    return 0;
-#endif
+    size_t src_size = (size_t)DETILE_BENCH_PITCH * DETILE_BENCH_HEIGHT;
+    size_t frame_bytes = (size_t)DETILE_BENCH_WIDTH * DETILE_BENCH_HEIGHT * 4;
+    uint8_t *src, *dst;
+    unsigned int i, t;
 
-    if (!dev || !fb) {
-        return 0;
+    src = vmalloc(src_size);
+    dst = vmalloc(frame_bytes);
+    if (!src || !dst) {
+        pr_warn("detile bench: out of memory\n");
+        goto out;
     }
+    for (i = 0; i < src_size; i++)
+        src[i] = (uint8_t)(i * 7);
 
-    pr_info("Intercepted framebuffer init: %dx%d, format=0x%08x\n", 
-            fb->width, fb->height, fb->format ? fb->format->format : 0);
+    for (t = 0; t < ARRAY_SIZE(tiling_names); t++) {
+        u64 start = ktime_get_ns(), ns;
 
-    // Capture the framebuffer content
-    capture_fb_pixels(fb, dev);
-    
-    return 0;
+        for (i = 0; i < frames; i++) {
+            fb_detile_rect(dst, src, src_size, DETILE_BENCH_PITCH, t, 0, 0,
+                           DETILE_BENCH_WIDTH, DETILE_BENCH_HEIGHT);
+            cond_resched();
+        }
+        ns = ktime_get_ns() - start;
+        // bytes per ns x 1000 = MB/s
+        detile_bench_mbps[t] = ns ? div64_u64((u64)frame_bytes * frames * 1000, ns) : 0;
+        pr_info("detile bench: %-8s %llu MB/s over %u frames\n", tiling_names[t],
+                detile_bench_mbps[t], frames);
+    }
+out:
+    vfree(src);
+    vfree(dst);
 }
 
-// Kprobe structure
-static struct kprobe kp_drm_fb_init = {
-    .symbol_name = "drm_framebuffer_init",
-    .pre_handler = handler_drm_framebuffer_init,
-};
-
 // Convert pixel format to string
 static const char* format_to_string(uint32_t format)
 {
@@ -445,6 +2521,8 @@ static const char* format_to_string(uint32_t format)
         case DRM_FORMAT_RGB565: return "RGB565";
         case DRM_FORMAT_XBGR8888: return "XBGR8888";
         case DRM_FORMAT_ABGR8888: return "ABGR8888";
+        case DRM_FORMAT_NV12: return "NV12";
+        case DRM_FORMAT_P010: return "P010";
         default: return "UNKNOWN";
     }
 }
@@ -457,7 +2535,119 @@ static int drm_fb_proc_show(struct seq_file *m, void *v)
     mutex_lock(&capture_mutex);
     
     seq_printf(m, "DRM Framebuffer Pixel Extractor with Intel Detiling\n");
-    seq_printf(m, "Captured framebuffers: %d\n\n", capture_count);
+    seq_printf(m, "Captured framebuffers: %d\n", capture_count);
+    seq_printf(m, "Policy: %llu captured, %llu skipped\n", total_captures, total_skipped);
+    seq_printf(m, "  Pixels: %llu captures (%llu MB), %llu copies failed, %llu replaced unread\n",
+               counters.with_pixels, counters.bytes_copied >> 20, counters.failed,
+               counters.unread);
+    seq_printf(m, "  Exported: %llu dma-bufs, %u of %d slots pinned\n", counters.exported,
+               slots_pinned(), MAX_FB_CAPTURE);
+    seq_printf(m, "Hook: %s on drm_framebuffer_init\n", hook_name(active_hook));
+    seq_printf(m, "Guard: hook %llu calls (avg %llu ns, max %llu ns), %llu over %u us, %llu silenced\n",
+               (u64)atomic64_read(&guard_hook_calls),
+               atomic64_read(&guard_hook_calls) ?
+                   div64_u64(atomic64_read(&guard_hook_ns), atomic64_read(&guard_hook_calls)) : 0,
+               (u64)atomic64_read(&guard_hook_max_ns), (u64)atomic64_read(&guard_hook_over),
+               guard_hook_us, (u64)atomic64_read(&guard_hook_silenced));
+    seq_printf(m, "  Captures: %llu metadata-only (%llu shapes over %u us), %llu skipped over %u us/s\n",
+               guard.metadata_only, guard.penalised, guard_call_us, guard.skipped, guard_sec_us);
+    for (i = 0; i < GUARD_SHAPES; i++) {
+        const struct guard_shape *shape = &guard.shapes[i];
+        u64 now = ktime_get_ns();
+
+        if (!shape->width)
+            continue;
+        seq_printf(m, "  Shape %ux%u format=0x%08x modifier=0x%llx: last copy %llu us%s\n",
+                   shape->width, shape->height, shape->format, shape->modifier,
+                   div_u64(shape->cost_ns, NSEC_PER_USEC),
+                   now < shape->until ? ", metadata only" : "");
+    }
+    seq_printf(m, "Render wait: %s, %llu captures waited (avg %llu us, max %llu us), %llu fence errors, %u waiting\n",
+               wait_render ? "on" : "off", render_waits,
+               render_waits ? div64_u64(render_wait_ns, render_waits * NSEC_PER_USEC) : 0,
+               div_u64(render_wait_max_ns, NSEC_PER_USEC), render_errors,
+               READ_ONCE(render_waiting));
+    seq_printf(m, "Heatmap: %u x %u px blocks, windows of %u ms\n", FB_HEATMAP_BLOCK,
+               FB_HEATMAP_BLOCK, heatmap_window_ms);
+    for (i = 0; i < HEATMAP_DISPLAYS; i++) {
+        const struct fb_heatmap *hm = &heatmaps[i];
+        const size_t blocks = (size_t)hm->cols * hm->rows;
+        size_t b, active = 0;
+
+        if (!hm->width)
+            continue;
+        for (b = 0; b < blocks; b++)
+            active += hm->window[hm->cur * blocks + b] != 0;
+        seq_printf(m, "  Display minor %u %ux%u: %llu captures compared, %zu of %zu blocks changed in the current window\n",
+                   hm->dev_minor, hm->width, hm->height, hm->total_frames, active, blocks);
+    }
+    seq_printf(m, "Flash screening: %s, %u\" screen at %u\", %u x %u px blocks\n",
+               flash_screen ? "on" : "off", flash_diag_in, flash_dist_in, FB_SCREEN_BLOCK,
+               FB_SCREEN_BLOCK);
+    for (i = 0; i < SCREEN_DISPLAYS; i++) {
+        const struct flash_screen *scr = &screens[i];
+
+        if (!scr->width)
+            continue;
+        seq_printf(m, "  Display minor %u %ux%u: %s, %llu of %llu captures flashed (threshold %u px, max %u px), %llu alarms",
+                   scr->dev_minor, scr->width, scr->height, scr->harmful ? "HARMFUL" : "clear",
+                   scr->flashes, scr->frames, scr->area_threshold, scr->max_flashed, scr->alarms);
+        if (scr->alarms)
+            seq_printf(m, ", last %llu us after the hook", div_u64(scr->alarm_latency_ns, NSEC_PER_USEC));
+        seq_printf(m, ", screening avg %llu us max %llu us, 1/%u sampling\n",
+                   scr->frames ? div64_u64(scr->busy_ns, scr->frames * NSEC_PER_USEC) : 0,
+                   div_u64(scr->max_ns, NSEC_PER_USEC), scr->fs.step * scr->fs.step);
+    }
+    if (hook_bench) {
+        seq_printf(m, "Hook overhead (%u calls, unprobed call %llu.%03llu ns):\n", hook_bench,
+                   bench_base_ns / 1000, bench_base_ns % 1000);
+        for (i = 0; i < FB_BENCH_COUNT; i++) {
+            if (bench_ns_per_call[i] < 0)
+                seq_printf(m, "  %-26s unavailable\n", bench_names[i]);
+            else
+                seq_printf(m, "  %-26s %lld.%03lld ns/call\n", bench_names[i],
+                           bench_ns_per_call[i] / 1000, bench_ns_per_call[i] % 1000);
+        }
+    }
+    if (detile_bench) {
+        seq_printf(m, "Detile throughput (%ux%u, %u frames):", DETILE_BENCH_WIDTH,
+                   DETILE_BENCH_HEIGHT, detile_bench);
+        for (i = 0; i < ARRAY_SIZE(tiling_names); i++)
+            seq_printf(m, " %s %llu MB/s%s", tiling_names[i], detile_bench_mbps[i],
+                       i + 1 < ARRAY_SIZE(tiling_names) ? "," : "\n");
+    }
+    seq_printf(m, "Quality: %s (budget %u us/s, %llu us used last second), %llu steps down, %llu up\n",
+               quality_names[quality.level], cpu_budget_us, quality.last_used_us,
+               quality.steps_down, quality.steps_up);
+    if (quality.timed)
+        seq_printf(m, "  Per capture: copy %llu us, detile %llu us\n",
+                   div64_u64(quality.copy_ns, quality.timed * NSEC_PER_USEC),
+                   div64_u64(quality.detile_ns, quality.timed * NSEC_PER_USEC));
+    seq_printf(m, "  Captures per level:");
+    for (i = 0; i < FB_QUALITY_COUNT; i++)
+        seq_printf(m, " %s %llu", quality_names[i], quality.frames[i]);
+    seq_printf(m, "\n");
+    for (i = 0; i < QUALITY_LOG_SIZE && i < quality.log_next; i++) {
+        const struct quality_step *step =
+            &quality.log[(quality.log_next - 1 - i) % QUALITY_LOG_SIZE];
+
+        seq_printf(m, "  Step at %llu ns: %s -> %s (%llu us used)\n", step->timestamp,
+                   quality_names[step->from], quality_names[step->to], step->used_us);
+    }
+    seq_printf(m, "NUMA: %s, latest capture on node %d, reader on node %d\n",
+               numa_policy_name(numa_policy),
+               capture_count ? captured_fbs[(current_index + MAX_FB_CAPTURE - 1) %
+                                            MAX_FB_CAPTURE].node : NUMA_NO_NODE,
+               READ_ONCE(reader_node));
+    for (i = 0; i < nr_node_ids; i++) {
+        struct node_bw *bw = &node_stats[i];
+
+        if (!bw->captures)
+            continue;
+        seq_printf(m, "  Node %d: %llu captures (%llu remote), %llu MB/s\n", i, bw->captures,
+                   bw->remote, bw->ns ? div64_u64(bw->bytes * 1000, bw->ns) : 0);
+    }
+    seq_printf(m, "\n");
     
     for (i = 0; i < capture_count; i++) {
         struct fb_pixel_data *capture = &captured_fbs[i];
@@ -467,15 +2657,18 @@ static int drm_fb_proc_show(struct seq_file *m, void *v)
             continue;
         
         switch (capture->detected_tiling) {
-            case INTEL_TILING_X:
+            case FB_TILING_X:
                 tiling_str = "X-tiled";
                 break;
-            case INTEL_TILING_Y:
+            case FB_TILING_Y:
                 tiling_str = "Y-tiled";
                 break;
-            case INTEL_TILING_YF:
+            case FB_TILING_YF:
                 tiling_str = "Yf-tiled";
                 break;
+            case FB_TILING_4:
+                tiling_str = "4-tiled";
+                break;
             default:
                 tiling_str = "Linear";
                 break;
@@ -483,12 +2676,33 @@ static int drm_fb_proc_show(struct seq_file *m, void *v)
             
         seq_printf(m, "Capture %d:\n", i);
         seq_printf(m, "  Timestamp: %llu ns\n", capture->timestamp);
+        seq_printf(m, "  Node: %d\n", capture->node);
         seq_printf(m, "  Device: %p\n", capture->dev);
         seq_printf(m, "  Framebuffer: %p\n", capture->fb);
         seq_printf(m, "  Dimensions: %dx%d\n", capture->width, capture->height);
         seq_printf(m, "  Format: 0x%08x (%s)\n", capture->format, format_to_string(capture->format));
         seq_printf(m, "  Pitch: %d bytes/row\n", capture->pitch);
+        seq_printf(m, "  Region: %ux%u+%u+%u\n", capture->roi_w, capture->roi_h,
+                   capture->roi_x, capture->roi_y);
+        seq_printf(m, "  Quality: %s, scale 1/%u (%ux%u), %llu us\n",
+                   quality_names[capture->quality], capture->scale,
+                   capture->roi_w / capture->scale, capture->roi_h / capture->scale,
+                   div_u64(capture->capture_ns, NSEC_PER_USEC));
+        seq_printf(m, "  Render: complete at %llu ns, %llu us after the hook",
+                   capture->render_ns, div_u64(capture->render_ns - capture->hook_ns, NSEC_PER_USEC));
+        if (capture->fence_status < 0)
+            seq_printf(m, ", fence error %d", capture->fence_status);
+        seq_printf(m, "\n");
+        if (capture->guard_metadata)
+            seq_printf(m, "  Guard: metadata only, copies of this shape are over %u us\n",
+                       guard_call_us);
         seq_printf(m, "  Buffer size: %zu bytes\n", capture->buffer_size);
+        if (slot_pins[i])
+            seq_printf(m, "  Pinned: %u dma-bufs\n", slot_pins[i]);
+        if (capture->depth && capture->has_pixels)
+            seq_printf(m, "  Planes: luma %u bytes/row, chroma from byte %zu\n",
+                       capture->roi_w / capture->scale * capture->depth,
+                       (size_t)(capture_chroma(capture) - (uint8_t *)capture->pixel_buffer));
         seq_printf(m, "  Tiling: %s\n", tiling_str);
         seq_printf(m, "  Detiled: %s\n", capture->is_detiled ? "YES" : "NO");
         seq_printf(m, "  Pixel data: %s\n", capture->has_pixels ? "AVAILABLE (LINEAR)" : "NOT AVAILABLE");
@@ -504,12 +2718,26 @@ static int drm_fb_proc_show(struct seq_file *m, void *v)
             seq_printf(m, "\n");
             
             // Show some basic statistics
-            if (capture->buffer_size >= 4) {
+            if (capture->buffer_size >= 4 && !capture->depth) {
                 uint32_t *pixels = (uint32_t*)capture->pixel_buffer;
                 uint32_t first_pixel = pixels[0];
                 seq_printf(m, "  First pixel (ARGB): 0x%08x\n", first_pixel);
             }
         }
+        if (capture->has_stats) {
+            const struct fb_stats *st = &capture->stats;
+
+            seq_printf(m, "  Stats: APL %u.%02u, luma %u-%u, ",
+                       st->luma_mean >> 8, (st->luma_mean & 0xff) * 100 / 256,
+                       st->luma_min, st->luma_max);
+            if (!(st->flags & FB_STATS_LUMA_ONLY))
+                seq_printf(m, "R %u-%u, G %u-%u, B %u-%u, ", st->min[0], st->max[0],
+                           st->min[1], st->max[1], st->min[2], st->max[2]);
+            if (st->flags & FB_STATS_COMPARED)
+                seq_printf(m, "%u of %u pixels changed\n", st->changed, st->pixels);
+            else
+                seq_printf(m, "%u pixels, no previous capture to compare\n", st->pixels);
+        }
         seq_printf(m, "\n");
     }
     
@@ -525,30 +2753,28 @@ static int drm_fb_proc_show(struct seq_file *m, void *v)
 // Proc file for raw pixel data access
 static ssize_t drm_fb_raw_read(struct file *file, char __user *buffer, size_t count, loff_t *pos)
 {
-    struct fb_pixel_data *capture = NULL;
+    struct fb_pixel_data *capture;
     loff_t offset = *pos;
     size_t to_copy;
     int ret;
-    int i;
+    u64 locked;
     
-    mutex_lock(&capture_mutex);
+    WRITE_ONCE(reader_node, numa_node_id());
+
+    locked = ring_lock(FB_RING_READER);
     
-    // Find the most recent capture with pixel data
-    for (i = capture_count - 1; i >= 0; i--) {
-        if (captured_fbs[i].valid && captured_fbs[i].has_pixels) {
-            capture = &captured_fbs[i];
-            break;
-        }
-    }
+    // The newest capture with pixel data, picked by time as FB_IOC_EXPORT
+    // does: once the ring has wrapped, the highest slot is not the newest
+    capture = capture_by_age(0);
     
-    if (!capture || !capture->pixel_buffer) {
-        mutex_unlock(&capture_mutex);
+    if (!capture) {
+        ring_unlock(FB_RING_READER, locked);
         return -ENODATA;
     }
     
     // Check bounds
     if (offset >= capture->buffer_size) {
-        mutex_unlock(&capture_mutex);
+        ring_unlock(FB_RING_READER, locked);
         return 0; // EOF
     }
     
@@ -556,16 +2782,322 @@ static ssize_t drm_fb_raw_read(struct file *file, char __user *buffer, size_t co
     
     ret = copy_to_user(buffer, (char*)capture->pixel_buffer + offset, to_copy);
     if (ret) {
-        mutex_unlock(&capture_mutex);
+        ring_unlock(FB_RING_READER, locked);
         return -EFAULT;
     }
     
+    capture->consumed = true;
     *pos += to_copy;
-    mutex_unlock(&capture_mutex);
+    ring_unlock(FB_RING_READER, locked);
     
     return to_copy;
 }
 
+// FB_IOC_EXPORT on /proc/drm_fb_raw: a capture as a dma-buf, see fb_export.h
+static long drm_fb_raw_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fb_export __user *uarg = (struct fb_export __user *)arg;
+    struct dma_buf *dmabuf;
+    struct fb_export e;
+    int fd;
+
+    if (cmd != FB_IOC_EXPORT)
+        return -ENOTTY;
+    if (copy_from_user(&e, uarg, sizeof(e)))
+        return -EFAULT;
+
+    fd = get_unused_fd_flags(O_CLOEXEC);
+    if (fd < 0)
+        return fd;
+    dmabuf = slot_export(&e);
+    if (IS_ERR(dmabuf)) {
+        put_unused_fd(fd);
+        return PTR_ERR(dmabuf);
+    }
+    e.fd = fd;
+    if (copy_to_user(uarg, &e, sizeof(e))) {
+        // Unlocked here: the release takes capture_mutex
+        dma_buf_put(dmabuf);
+        put_unused_fd(fd);
+        return -EFAULT;
+    }
+    fd_install(fd, dmabuf->file);
+    return 0;
+}
+
+// Proc file for the statistics records, one struct fb_stats per capture
+// that has them, oldest first (by sequence: pinned slots keep older ones
+// in between)
+static ssize_t drm_fb_stats_read(struct file *file, char __user *buffer, size_t count, loff_t *pos)
+{
+    struct fb_stats *records;
+    size_t size = 0;
+    ssize_t ret;
+    int i;
+
+    records = kmalloc_array(MAX_FB_CAPTURE, sizeof(*records), GFP_KERNEL);
+    if (!records)
+        return -ENOMEM;
+
+    mutex_lock(&capture_mutex);
+    for (i = 0; i < capture_count; i++) {
+        int slot = (current_index - capture_count + i + MAX_FB_CAPTURE) % MAX_FB_CAPTURE;
+
+        if (captured_fbs[slot].valid && captured_fbs[slot].has_stats)
+            records[size++] = captured_fbs[slot].stats;
+    }
+    mutex_unlock(&capture_mutex);
+
+    for (i = 1; i < size; i++) {
+        struct fb_stats r = records[i];
+        int j;
+
+        for (j = i; j > 0 && records[j - 1].sequence > r.sequence; j--)
+            records[j] = records[j - 1];
+        records[j] = r;
+    }
+
+    ret = simple_read_from_buffer(buffer, count, pos, records, size * sizeof(*records));
+    kfree(records);
+    return ret;
+}
+
+// Proc file for the activity heatmaps. Each open takes a snapshot, so a
+// reader sees consistent maps however it splits its reads.
+struct heatmap_snapshot {
+    size_t size;
+    u8 data[];
+};
+
+static int drm_fb_heatmap_open(struct inode *inode, struct file *file)
+{
+    struct heatmap_snapshot *snap;
+    size_t size = 0;
+    u8 *p;
+    int i, k;
+
+    mutex_lock(&capture_mutex);
+    for (i = 0; i < HEATMAP_DISPLAYS; i++)
+        if (heatmaps[i].width)
+            size += fb_heatmap_size(heatmaps[i].cols, heatmaps[i].rows);
+    snap = vzalloc(sizeof(*snap) + size);
+    if (!snap) {
+        mutex_unlock(&capture_mutex);
+        return -ENOMEM;
+    }
+    snap->size = size;
+    p = snap->data;
+    for (i = 0; i < HEATMAP_DISPLAYS; i++) {
+        const struct fb_heatmap *hm = &heatmaps[i];
+        const size_t blocks = (size_t)hm->cols * hm->rows;
+        struct fb_heatmap_header *hdr = (struct fb_heatmap_header *)p;
+        u16 *window;
+
+        if (!hm->width)
+            continue;
+        hdr->magic = FB_HEATMAP_MAGIC;
+        hdr->version = FB_HEATMAP_VERSION;
+        hdr->block = FB_HEATMAP_BLOCK;
+        hdr->dev_minor = hm->dev_minor;
+        hdr->width = hm->width;
+        hdr->height = hm->height;
+        hdr->cols = hm->cols;
+        hdr->rows = hm->rows;
+        hdr->windows = FB_HEATMAP_WINDOWS;
+        hdr->window_ms = heatmap_window_ms;
+        hdr->since_ns = hm->since_ns;
+        hdr->total_frames = hm->total_frames;
+        memcpy(hdr + 1, hm->total, blocks * sizeof(u32));
+        window = (u16 *)((u8 *)(hdr + 1) + blocks * sizeof(u32));
+        // Oldest window first
+        for (k = 0; k < FB_HEATMAP_WINDOWS; k++) {
+            int w = (hm->cur + 1 + k) % FB_HEATMAP_WINDOWS;
+
+            hdr->window_start_ns[k] = hm->window_start_ns[w];
+            hdr->window_frames[k] = hm->window_frames[w];
+            memcpy(window + k * blocks, hm->window + w * blocks, blocks * sizeof(u16));
+        }
+        p += fb_heatmap_size(hm->cols, hm->rows);
+    }
+    mutex_unlock(&capture_mutex);
+
+    file->private_data = snap;
+    return 0;
+}
+
+static ssize_t drm_fb_heatmap_read(struct file *file, char __user *buffer, size_t count, loff_t *pos)
+{
+    const struct heatmap_snapshot *snap = file->private_data;
+
+    return simple_read_from_buffer(buffer, count, pos, snap->data, snap->size);
+}
+
+// Any write clears the maps
+static ssize_t drm_fb_heatmap_write(struct file *file, const char __user *buffer,
+                                    size_t count, loff_t *pos)
+{
+    int i;
+
+    mutex_lock(&capture_mutex);
+    for (i = 0; i < HEATMAP_DISPLAYS; i++)
+        heatmap_free(&heatmaps[i]);
+    mutex_unlock(&capture_mutex);
+    return count;
+}
+
+static int drm_fb_heatmap_release(struct inode *inode, struct file *file)
+{
+    vfree(file->private_data);
+    return 0;
+}
+
+// Proc file for flash alarms, one struct fb_flash_status per screened
+// display. Polls readable when a harmful state changed since this file was
+// last read; "eventfd <fd>" has that eventfd signalled on the same changes.
+static int drm_fb_flash_open(struct inode *inode, struct file *file)
+{
+    struct flash_reader *r = kzalloc(sizeof(*r), GFP_KERNEL);
+
+    if (!r)
+        return -ENOMEM;
+    INIT_LIST_HEAD(&r->node);
+    r->seen = atomic64_read(&flash_events);
+    file->private_data = r;
+    return 0;
+}
+
+static ssize_t drm_fb_flash_read(struct file *file, char __user *buffer, size_t count, loff_t *pos)
+{
+    struct flash_reader *r = file->private_data;
+    struct fb_flash_status *records;
+    size_t n = 0;
+    ssize_t ret;
+    int i;
+
+    records = kcalloc(SCREEN_DISPLAYS, sizeof(*records), GFP_KERNEL);
+    if (!records)
+        return -ENOMEM;
+
+    mutex_lock(&capture_mutex);
+    WRITE_ONCE(r->seen, atomic64_read(&flash_events));
+    for (i = 0; i < SCREEN_DISPLAYS; i++) {
+        const struct flash_screen *scr = &screens[i];
+        struct fb_flash_status *st = &records[n];
+
+        if (!scr->width)
+            continue;
+        st->magic = FB_FLASH_MAGIC;
+        st->version = FB_FLASH_VERSION;
+        st->flags = (scr->harmful ? FB_FLASH_HARMFUL : 0) | (scr->flash ? FB_FLASH_FLASHED : 0);
+        st->dev_minor = scr->dev_minor;
+        st->width = scr->width;
+        st->height = scr->height;
+        st->area_threshold = scr->area_threshold;
+        st->window_flashes = scr->window_flashes;
+        st->last_flashed = scr->last_flashed;
+        st->max_flashed = scr->max_flashed;
+        st->step = scr->fs.step;
+        st->frames = scr->frames;
+        st->flashes = scr->flashes;
+        st->alarms = scr->alarms;
+        st->last_ns = scr->last_ns;
+        st->alarm_ns = scr->alarm_ns;
+        st->alarm_latency_ns = scr->alarm_latency_ns;
+        st->busy_ns = scr->busy_ns;
+        st->max_ns = scr->max_ns;
+        n++;
+    }
+    mutex_unlock(&capture_mutex);
+
+    ret = simple_read_from_buffer(buffer, count, pos, records, n * sizeof(*records));
+    kfree(records);
+    return ret;
+}
+
+static __poll_t drm_fb_flash_poll(struct file *file, poll_table *wait)
+{
+    struct flash_reader *r = file->private_data;
+
+    poll_wait(file, &flash_wait, wait);
+    if (atomic64_read(&flash_events) != READ_ONCE(r->seen))
+        return EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+    return 0;
+}
+
+static ssize_t drm_fb_flash_write(struct file *file, const char __user *buffer,
+                                  size_t count, loff_t *pos)
+{
+    struct flash_reader *r = file->private_data;
+    struct eventfd_ctx *efd;
+    char cmd[32];
+    int fd;
+
+    if (count >= sizeof(cmd))
+        return -EINVAL;
+    if (copy_from_user(cmd, buffer, count))
+        return -EFAULT;
+    cmd[count] = '\0';
+    if (sscanf(cmd, "eventfd %d", &fd) != 1)
+        return -EINVAL;
+    efd = eventfd_ctx_fdget(fd);
+    if (IS_ERR(efd))
+        return PTR_ERR(efd);
+
+    mutex_lock(&capture_mutex);
+    if (r->efd)
+        eventfd_ctx_put(r->efd);
+    else
+        list_add_tail(&r->node, &flash_readers);
+    r->efd = efd;
+    mutex_unlock(&capture_mutex);
+    return count;
+}
+
+static int drm_fb_flash_release(struct inode *inode, struct file *file)
+{
+    struct flash_reader *r = file->private_data;
+
+    mutex_lock(&capture_mutex);
+    if (r->efd) {
+        list_del(&r->node);
+        eventfd_ctx_put(r->efd);
+    }
+    mutex_unlock(&capture_mutex);
+    kfree(r);
+    return 0;
+}
+
+// Proc file for the running totals, one struct fb_counters (fb_counters.h)
+static ssize_t drm_fb_counters_read(struct file *file, char __user *buffer, size_t count,
+                                    loff_t *pos)
+{
+    struct fb_counters *c;
+    ssize_t ret;
+
+    BUILD_BUG_ON(FB_QUALITY_COUNT != FB_COUNTERS_LEVELS);
+    c = kmalloc(sizeof(*c), GFP_KERNEL);
+    if (!c)
+        return -ENOMEM;
+
+    mutex_lock(&capture_mutex);
+    *c = counters;
+    c->captured = total_captures;
+    c->skipped = total_skipped;
+    c->metadata_only = guard.metadata_only;
+    c->render_waits = render_waits;
+    c->render_errors = render_errors;
+    memcpy(c->quality_captures, quality.frames, sizeof(c->quality_captures));
+    c->quality_steps_down = quality.steps_down;
+    c->quality_steps_up = quality.steps_up;
+    mutex_unlock(&capture_mutex);
+    c->hook_calls = atomic64_read(&guard_hook_calls);
+    c->hook_silenced = atomic64_read(&guard_hook_silenced);
+
+    ret = simple_read_from_buffer(buffer, count, pos, c, sizeof(*c));
+    kfree(c);
+    return ret;
+}
+
 static int drm_fb_proc_open(struct inode *inode, struct file *file)
 {
     return single_open(file, drm_fb_proc_show, NULL);
@@ -581,8 +3113,70 @@ static const struct proc_ops drm_fb_proc_ops = {
 static const struct proc_ops drm_fb_raw_ops = {
     .proc_read = drm_fb_raw_read,
     .proc_lseek = default_llseek,
+    .proc_ioctl = drm_fb_raw_ioctl,
+#ifdef CONFIG_COMPAT
+    .proc_compat_ioctl = drm_fb_raw_ioctl,
+#endif
+};
+
+static const struct proc_ops drm_fb_stats_ops = {
+    .proc_read = drm_fb_stats_read,
+    .proc_lseek = default_llseek,
+};
+
+static const struct proc_ops drm_fb_heatmap_ops = {
+    .proc_open = drm_fb_heatmap_open,
+    .proc_read = drm_fb_heatmap_read,
+    .proc_write = drm_fb_heatmap_write,
+    .proc_lseek = default_llseek,
+    .proc_release = drm_fb_heatmap_release,
+};
+
+static const struct proc_ops drm_fb_flash_ops = {
+    .proc_open = drm_fb_flash_open,
+    .proc_read = drm_fb_flash_read,
+    .proc_write = drm_fb_flash_write,
+    .proc_poll = drm_fb_flash_poll,
+    .proc_lseek = default_llseek,
+    .proc_release = drm_fb_flash_release,
 };
 
+static const struct proc_ops drm_fb_counters_ops = {
+    .proc_read = drm_fb_counters_read,
+    .proc_lseek = default_llseek,
+};
+
+// Unhook, stop injecting, take back render fence callbacks, let queued
+// captures finish, then free what they left in the ring. Shared by module
+// exit and the init failures that come after the hook is registered.
+static void capture_teardown(void)
+{
+    int i;
+
+    unregister_fb_hook();
+    kernel_param_lock(THIS_MODULE);
+    inject_stop = true;
+    kernel_param_unlock(THIS_MODULE);
+    cancel_work_sync(&inject_work);
+    cancel_render_waits();
+    destroy_workqueue(capture_wq);
+
+    // Free allocated buffers
+    mutex_lock(&capture_mutex);
+    for (i = 0; i < MAX_FB_CAPTURE; i++) {
+        if (captured_fbs[i].pixel_buffer) {
+            vfree(captured_fbs[i].pixel_buffer);
+            captured_fbs[i].pixel_buffer = NULL;
+        }
+    }
+    for (i = 0; i < HEATMAP_DISPLAYS; i++)
+        heatmap_free(&heatmaps[i]);
+    for (i = 0; i < SCREEN_DISPLAYS; i++)
+        screen_free(&screens[i]);
+    capture_count = 0;
+    mutex_unlock(&capture_mutex);
+}
+
 // Module initialization
 static int __init drm_fb_extractor_init(void)
 {
@@ -590,49 +3184,136 @@ static int __init drm_fb_extractor_init(void)
 
     pr_info("DRM Framebuffer Pixel Extractor loading\n");
 
+    counters.magic = FB_COUNTERS_MAGIC;
+    counters.version = FB_COUNTERS_VERSION;
+    counters.stages = FB_STAGE_COUNT;
+    counters.buckets = FB_COUNTERS_BUCKETS;
+    counters.levels = FB_COUNTERS_LEVELS;
+    counters.loaded_ns = ktime_get_ns();
+
     // Initialize capture array
     memset(captured_fbs, 0, sizeof(captured_fbs));
     capture_count = 0;
     current_index = 0;
 
-    // Register kprobe
-    ret = register_kprobe(&kp_drm_fb_init);
+    ret = parse_numa_param();
+    if (ret) {
+        pr_err("Invalid numa=%s\n", numa);
+        return ret;
+    }
+
+    // WQ_SYSFS exposes cpumask and nice under
+    // /sys/devices/virtual/workqueue/drm_fb_capture for fb_pipeline
+    capture_wq = alloc_workqueue("drm_fb_capture", WQ_UNBOUND | WQ_SYSFS, 0);
+    if (!capture_wq)
+        return -ENOMEM;
+
+    if (hook_bench)
+        run_hook_bench(hook_bench);
+    if (detile_bench)
+        run_detile_bench(detile_bench);
+
+    // Hook drm_framebuffer_init
+    ret = register_fb_hook();
     if (ret < 0) {
-        pr_err("Failed to register kprobe: %d\n", ret);
+        pr_err("Failed to hook drm_framebuffer_init (%s): %d\n", hook, ret);
+        destroy_workqueue(capture_wq);
         return ret;
     }
+    pr_info("Hooked drm_framebuffer_init with %s\n", hook_name(active_hook));
+
+#ifdef DRM_FB_BPF_KFUNCS
+    // Without the kfunc, policies can still skip but cannot pick a region.
+    ret = register_btf_kfunc_id_set(BPF_PROG_TYPE_TRACING, &drm_fb_capture_kfunc_set);
+    if (ret)
+        pr_warn("Capture policy kfuncs unavailable: %d\n", ret);
+#endif
+
+    // From here on the hook may already have captured into the ring
+    ret = -ENOMEM;
 
     // Create proc entries
     proc_entry = proc_create(PROC_NAME, 0644, NULL, &drm_fb_proc_ops);
     if (!proc_entry) {
         pr_err("Failed to create proc entry %s\n", PROC_NAME);
-        unregister_kprobe(&kp_drm_fb_init);
-        return -ENOMEM;
+        goto err_teardown;
     }
     
     proc_raw_entry = proc_create(PROC_RAW_NAME, 0644, NULL, &drm_fb_raw_ops);
     if (!proc_raw_entry) {
         pr_err("Failed to create proc entry %s\n", PROC_RAW_NAME);
-        proc_remove(proc_entry);
-        unregister_kprobe(&kp_drm_fb_init);
-        return -ENOMEM;
+        goto err_proc;
+    }
+
+    proc_stats_entry = proc_create(PROC_STATS_NAME, 0444, NULL, &drm_fb_stats_ops);
+    if (!proc_stats_entry) {
+        pr_err("Failed to create proc entry %s\n", PROC_STATS_NAME);
+        goto err_proc_raw;
+    }
+
+    proc_heatmap_entry = proc_create(PROC_HEATMAP_NAME, 0644, NULL, &drm_fb_heatmap_ops);
+    if (!proc_heatmap_entry) {
+        pr_err("Failed to create proc entry %s\n", PROC_HEATMAP_NAME);
+        goto err_proc_stats;
+    }
+
+    proc_flash_entry = proc_create(PROC_FLASH_NAME, 0644, NULL, &drm_fb_flash_ops);
+    if (!proc_flash_entry) {
+        pr_err("Failed to create proc entry %s\n", PROC_FLASH_NAME);
+        goto err_proc_heatmap;
+    }
+
+    proc_counters_entry = proc_create(PROC_COUNTERS_NAME, 0444, NULL, &drm_fb_counters_ops);
+    if (!proc_counters_entry) {
+        pr_err("Failed to create proc entry %s\n", PROC_COUNTERS_NAME);
+        goto err_proc_flash;
     }
 
+    if (inject_hz)
+        queue_work(capture_wq, &inject_work);
+
     pr_info("DRM Framebuffer Pixel Extractor with Intel Detiling loaded successfully\n");
     pr_info("Use 'cat /proc/%s' to view capture info\n", PROC_NAME);
     pr_info("Use 'cat /proc/%s' to access raw linear pixel data\n", PROC_RAW_NAME);
+    pr_info("Use 'fb_stat' to follow per-frame statistics in /proc/%s\n", PROC_STATS_NAME);
+    pr_info("Use 'flash_screen' to wait for flash alarms on /proc/%s\n", PROC_FLASH_NAME);
+    pr_info("Use 'fb_exporter' to publish the totals in /proc/%s\n", PROC_COUNTERS_NAME);
     
     return 0;
+
+err_proc_flash:
+    proc_remove(proc_flash_entry);
+err_proc_heatmap:
+    proc_remove(proc_heatmap_entry);
+err_proc_stats:
+    proc_remove(proc_stats_entry);
+err_proc_raw:
+    proc_remove(proc_raw_entry);
+err_proc:
+    proc_remove(proc_entry);
+err_teardown:
+    capture_teardown();
+    return ret;
 }
 
 // Module cleanup
 static void __exit drm_fb_extractor_exit(void)
 {
-    int i;
-
     pr_info("DRM Framebuffer Pixel Extractor with Intel Detiling unloading\n");
 
     // Remove proc entries
+    if (proc_counters_entry) {
+        proc_remove(proc_counters_entry);
+    }
+    if (proc_flash_entry) {
+        proc_remove(proc_flash_entry);
+    }
+    if (proc_heatmap_entry) {
+        proc_remove(proc_heatmap_entry);
+    }
+    if (proc_stats_entry) {
+        proc_remove(proc_stats_entry);
+    }
     if (proc_raw_entry) {
         proc_remove(proc_raw_entry);
     }
@@ -640,19 +3321,7 @@ static void __exit drm_fb_extractor_exit(void)
         proc_remove(proc_entry);
     }
 
-    // Unregister kprobe
-    unregister_kprobe(&kp_drm_fb_init);
-
-    // Free allocated buffers
-    mutex_lock(&capture_mutex);
-    for (i = 0; i < MAX_FB_CAPTURE; i++) {
-        if (captured_fbs[i].pixel_buffer) {
-            vfree(captured_fbs[i].pixel_buffer);
-            captured_fbs[i].pixel_buffer = NULL;
-        }
-    }
-    capture_count = 0;
-    mutex_unlock(&capture_mutex);
+    capture_teardown();
 
     pr_info("DRM Framebuffer Pixel Extractor with Intel Detiling unloaded\n");
 }
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: MIT
+/* ring_bench.c – load the module's capture ring and measure its contention
+ *
+ * Build :  gcc -O2 ring_bench.c -lpthread -o ring_bench
+ * Usage :  ring_bench [-r hz] [-s WxH] [-t seconds] [-n readers] [-c small,large]
+ *
+ * Has the module inject -r synthetic captures per second of -s pixels
+ * (default 240 Hz, 1920x1080; see inject_hz in kernel.c) while -n reader
+ * threads (default 6) read /proc/drm_fb_raw for -t seconds (default 10).
+ * Readers take turns at three patterns: whole frames in -c small and
+ * large chunks (default 4096 and 262144 bytes) and whole frames in a
+ * single read.
+ *
+ * Each injected capture holds its sequence number in every pixel, so a
+ * frame read in several calls is torn when its chunks disagree: the ring
+ * replaced the slot between two reads. Frames that come back short
+ * (another size was captured meanwhile) count as torn too.
+ *
+ * Reports, for the run:
+ *   - the writer's rate, and how long it waited for and held the ring lock;
+ *   - the same for the readers' read() calls, from /proc/drm_fb_counters;
+ *   - captures replaced in the ring before any reader got to them;
+ *   - per reader: frames, throughput, torn frames, repeats of the frame
+ *     read before, and read() latency as seen from userspace.
+ * Latencies are given as the power-of-two bucket holding the percentile.
+ *
+ * -r 0 injects nothing and measures whatever the display produces; torn
+ * frames cannot be told apart then. The injection rate is reset to 0 on
+ * exit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fb_counters.h"
+
+#define PROC_RAW        "/proc/drm_fb_raw"
+#define PROC_COUNTERS   "/proc/drm_fb_counters"
+#define PARAMS          "/sys/module/drm_fb_pixel_extractor/parameters/"
+#define NS_PER_SEC      1000000000ull
+#define MAX_READERS     64
+
+enum pattern { PAT_SMALL, PAT_LARGE, PAT_WHOLE, PAT_COUNT };
+
+static const char *const pattern_names[PAT_COUNT] = { "small", "large", "whole" };
+
+struct reader {
+    pthread_t thread;
+    enum pattern pattern;
+    size_t chunk;
+    size_t frame;
+    int check;                  /* frames hold sequence numbers */
+    uint64_t deadline_ns;
+
+    uint64_t frames, bytes, torn, repeats;
+    int error;
+    struct fb_hist call;        /* read() latency */
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int write_param(const char *name, unsigned value)
+{
+    char path[256], buf[32];
+    int fd, n, ret = 0;
+
+    snprintf(path, sizeof(path), PARAMS "%s", name);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    n = snprintf(buf, sizeof(buf), "%u\n", value);
+    if (write(fd, buf, n) != n)
+        ret = -errno;
+    close(fd);
+    return ret;
+}
+
+static int read_counters(struct fb_counters *c)
+{
+    size_t got = 0;
+    ssize_t r = 0;
+    int fd = open(PROC_COUNTERS, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -errno;
+    while (got < sizeof(*c) && (r = read(fd, (char *)c + got, sizeof(*c) - got)) > 0)
+        got += r;
+    close(fd);
+    if (r < 0)
+        return -errno;
+    if (got < sizeof(*c) || c->magic != FB_COUNTERS_MAGIC || c->version != FB_COUNTERS_VERSION)
+        return -EPROTO;
+    return 0;
+}
+
+static void hist_sub(struct fb_hist *d, const struct fb_hist *a, const struct fb_hist *b)
+{
+    d->count = a->count - b->count;
+    d->sum_ns = a->sum_ns - b->sum_ns;
+    for (unsigned i = 0; i < FB_COUNTERS_BUCKETS; i++)
+        d->bucket[i] = a->bucket[i] - b->bucket[i];
+}
+
+static void hist_merge(struct fb_hist *d, const struct fb_hist *a)
+{
+    d->count += a->count;
+    d->sum_ns += a->sum_ns;
+    for (unsigned i = 0; i < FB_COUNTERS_BUCKETS; i++)
+        d->bucket[i] += a->bucket[i];
+}
+
+/* "<N us" for the bucket holding the q-th quantile. */
+static const char *hist_pct(const struct fb_hist *h, double q, char *buf, size_t size)
+{
+    uint64_t want = (uint64_t)(q * h->count), seen = 0;
+    unsigned i;
+
+    if (!h->count)
+        return snprintf(buf, size, "-"), buf;
+    if (want >= h->count)
+        want = h->count - 1;
+    for (i = 0; i + 1 < FB_COUNTERS_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > want)
+            break;
+    }
+    if (i + 1 == FB_COUNTERS_BUCKETS)
+        snprintf(buf, size, ">%llu us", 1ull << (FB_COUNTERS_BUCKETS - 2));
+    else
+        snprintf(buf, size, "<%llu us", 1ull << i);
+    return buf;
+}
+
+static void print_hist(const char *what, const struct fb_hist *h)
+{
+    char p50[24], p99[24], max[24];
+
+    printf("  %-18s %9llu  avg %8.1f us  p50 %-10s p99 %-10s max %s\n", what,
+           (unsigned long long)h->count, h->count ? h->sum_ns / 1e3 / h->count : 0.0,
+           hist_pct(h, 0.5, p50, sizeof(p50)), hist_pct(h, 0.99, p99, sizeof(p99)),
+           hist_pct(h, 1.0, max, sizeof(max)));
+}
+
+static void *reader_fn(void *arg)
+{
+    struct reader *r = arg;
+    uint8_t *buf = malloc(r->pattern == PAT_WHOLE ? r->frame : r->chunk);
+    uint32_t last = 0;
+    int fd, have_last = 0;
+
+    if (!buf) {
+        r->error = -ENOMEM;
+        return NULL;
+    }
+    fd = open(PROC_RAW, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        r->error = -errno;
+        free(buf);
+        return NULL;
+    }
+
+    while (!stop && now_ns() < r->deadline_ns) {
+        size_t off = 0;
+        uint32_t seq = 0;
+        int torn = 0;
+
+        while (off < r->frame) {
+            size_t want = r->pattern == PAT_WHOLE ? r->frame : r->chunk;
+            uint64_t t0 = now_ns();
+            ssize_t n;
+
+            if (want > r->frame - off)
+                want = r->frame - off;
+            n = pread(fd, buf, want, off);
+            fb_hist_add(&r->call, now_ns() - t0);
+            if (n < 0) {
+                if (errno == ENODATA) {
+                    /* Nothing captured yet */
+                    usleep(1000);
+                    break;
+                }
+                r->error = -errno;
+                goto out;
+            }
+            if (n == 0 || n % 4) {
+                torn = 1;
+                break;
+            }
+            if (r->check) {
+                uint32_t first, tail;
+
+                memcpy(&first, buf, 4);
+                memcpy(&tail, buf + n - 4, 4);
+                if (!off)
+                    seq = first;
+                if (first != seq || tail != seq)
+                    torn = 1;
+            }
+            off += n;
+            r->bytes += n;
+        }
+        if (off < r->frame && !torn)
+            continue;
+
+        r->frames++;
+        r->torn += torn;
+        if (r->check && !torn) {
+            r->repeats += have_last && seq == last;
+            last = seq;
+            have_last = 1;
+        }
+    }
+out:
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-r hz] [-s WxH] [-t seconds] [-n readers] [-c small,large]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    static struct reader readers[MAX_READERS];
+    unsigned hz = 240, width = 1920, height = 1080, seconds = 10, nreaders = 6;
+    size_t small = 4096, large = 262144;
+    struct fb_counters before, after;
+    struct fb_hist total_call = { 0 };
+    uint64_t start, elapsed, frames = 0, bytes = 0, torn = 0;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "r:s:t:n:c:")) != -1) {
+        switch (opt) {
+        case 'r': hz = strtoul(optarg, NULL, 0); break;
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        case 'n': nreaders = strtoul(optarg, NULL, 0); break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (sscanf(optarg, "%zu,%zu", &small, &large) != 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:  usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || !width || !height || !seconds || nreaders > MAX_READERS ||
+        !small || !large || small % 4 || large % 4) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ret = read_counters(&before);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", PROC_COUNTERS, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (hz) {
+        ret = write_param("inject_width", width);
+        if (!ret)
+            ret = write_param("inject_height", height);
+        if (!ret)
+            ret = write_param("inject_hz", hz);
+        if (ret) {
+            fprintf(stderr, "cannot set up injection under %s: %s\n", PARAMS, strerror(-ret));
+            return EXIT_FAILURE;
+        }
+        printf("injecting %ux%u at %u Hz for %u s, %u readers\n", width, height, hz, seconds,
+               nreaders);
+        /* Let the first capture land before the clock starts */
+        usleep(100000);
+        read_counters(&before);
+    } else {
+        printf("measuring the display's captures (%ux%u) for %u s, %u readers\n", width,
+               height, seconds, nreaders);
+    }
+
+    start = now_ns();
+    for (unsigned i = 0; i < nreaders; i++) {
+        struct reader *r = &readers[i];
+
+        r->pattern = i % PAT_COUNT;
+        r->chunk = r->pattern == PAT_SMALL ? small : large;
+        r->frame = (size_t)width * height * 4;
+        r->check = hz != 0;
+        r->deadline_ns = start + (uint64_t)seconds * NS_PER_SEC;
+        ret = pthread_create(&r->thread, NULL, reader_fn, r);
+        if (ret) {
+            fprintf(stderr, "cannot start reader %u: %s\n", i, strerror(ret));
+            stop = 1;
+            nreaders = i;
+            break;
+        }
+    }
+    if (!nreaders) {
+        struct timespec ts = { seconds, 0 };
+
+        nanosleep(&ts, NULL);
+    }
+    for (unsigned i = 0; i < nreaders; i++)
+        pthread_join(readers[i].thread, NULL);
+    elapsed = now_ns() - start;
+
+    ret = read_counters(&after);
+    if (hz)
+        write_param("inject_hz", 0);
+    if (ret) {
+        fprintf(stderr, "%s: %s\n", PROC_COUNTERS, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    struct fb_hist d;
+    uint64_t captures = after.captured - before.captured;
+
+    printf("writer: %llu captures (%.1f/s, %llu injected), %llu replaced unread\n",
+           (unsigned long long)captures, captures * 1e9 / elapsed,
+           (unsigned long long)(after.injected - before.injected),
+           (unsigned long long)(after.unread - before.unread));
+    hist_sub(&d, &after.lock_wait[FB_RING_WRITER], &before.lock_wait[FB_RING_WRITER]);
+    print_hist("lock wait", &d);
+    hist_sub(&d, &after.lock_hold[FB_RING_WRITER], &before.lock_hold[FB_RING_WRITER]);
+    print_hist("lock hold", &d);
+    printf("readers (module side):\n");
+    hist_sub(&d, &after.lock_wait[FB_RING_READER], &before.lock_wait[FB_RING_READER]);
+    print_hist("lock wait", &d);
+    hist_sub(&d, &after.lock_hold[FB_RING_READER], &before.lock_hold[FB_RING_READER]);
+    print_hist("lock hold", &d);
+
+    for (unsigned i = 0; i < nreaders; i++) {
+        struct reader *r = &readers[i];
+
+        printf("reader %-2u %-5s %7zu B: %6llu frames %8.1f MB/s  %llu torn (%.1f%%)  "
+               "%llu repeats", i, pattern_names[r->pattern],
+               r->pattern == PAT_WHOLE ? r->frame : r->chunk, (unsigned long long)r->frames,
+               r->bytes / 1e6 / (elapsed / 1e9), (unsigned long long)r->torn,
+               r->frames ? 100.0 * r->torn / r->frames : 0.0, (unsigned long long)r->repeats);
+        if (r->error)
+            printf("  stopped: %s", strerror(-r->error));
+        printf("\n");
+        print_hist("read() calls", &r->call);
+        frames += r->frames;
+        bytes += r->bytes;
+        torn += r->torn;
+        hist_merge(&total_call, &r->call);
+    }
+    printf("total: %llu frames %.1f MB/s, %llu torn (%.2f%%)\n", (unsigned long long)frames,
+           bytes / 1e6 / (elapsed / 1e9), (unsigned long long)torn,
+           frames ? 100.0 * torn / frames : 0.0);
+    print_hist("read() calls", &total_call);
+    return EXIT_SUCCESS;
+}